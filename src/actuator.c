@@ -0,0 +1,356 @@
+#define _GNU_SOURCE     //ppoll
+
+#include "actuator.h"
+#include "rtmode.h"
+#include "util.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#define STDPRINT_NAME                       __FILE__ ":"
+
+#define ACTUATOR_PENDING_MAX                ( 2 * ACTUATOR_QUEUE_SIZE )
+
+typedef struct
+{
+    uint64_t                                seq;            //index + 1 once published
+    uint64_t                                batch;          //index of the submission's first slot + 1
+    uint64_t                                submit_nsec;
+    int                                     flags;
+    actuator_cmd_t                          cmd;
+} actuator_slot_t;
+
+typedef struct
+{
+    uint64_t                                due_nsec;       //deadline, never before submission
+    uint64_t                                submit_nsec;
+    uint64_t                                batch;
+    actuator_cmd_t                          cmd;
+} actuator_pending_t;
+
+struct actuator
+{
+    actuator_drive_fn                       drive;
+    void*                                   ctx;
+    pthread_t                               tid;
+    int                                     event_fd;
+    bool                                    running;
+    uint64_t                                head;           //next slot to claim
+    uint64_t                                tail;           //next slot to consume
+    uint64_t                                rejected;
+    uint64_t                                cancel_before;  //actuator only; batches below are superseded
+    int                                     pending_count;  //actuator only
+    actuator_pending_t                      pending[ ACTUATOR_PENDING_MAX ];
+    pthread_mutex_t                         mutex_stats;
+    actuator_stats_t                        stats;
+    actuator_slot_t                         ring[ ACTUATOR_QUEUE_SIZE ];
+};
+
+/*
+ * Internal function dropping pending commands of submissions before batch
+ * Note: actuator thread only
+ */
+static void actuator_supersede( actuator_t* pact, uint64_t batch )
+{
+    int kept = 0;
+    int i;
+
+    for ( i = 0; i < pact->pending_count; i++ )
+    {
+        if ( pact->pending[ i ].batch >= batch )
+        {
+            pact->pending[ kept++ ] = pact->pending[ i ];
+        }
+    }
+
+    pthread_mutex_lock( &pact->mutex_stats );
+    pact->stats.superseded += (uint64_t)( pact->pending_count - kept );
+    pthread_mutex_unlock( &pact->mutex_stats );
+
+    pact->pending_count = kept;
+    pact->cancel_before = batch;
+}
+
+/*
+ * Internal function moving published slots into the deadline ordered pending list
+ * Note: actuator thread only
+ */
+static void actuator_drain( actuator_t* pact )
+{
+    uint64_t tail = pact->tail;
+
+    //a full list leaves the rest in the ring; submitters see ENOBUFS until deadlines pass
+    while ( pact->pending_count < ACTUATOR_PENDING_MAX )
+    {
+        actuator_slot_t* pslot = &pact->ring[ tail & ( ACTUATOR_QUEUE_SIZE - 1 ) ];
+
+        if ( __atomic_load_n( &pslot->seq, __ATOMIC_ACQUIRE ) != ( tail + 1 ) )
+        {
+            break;
+        }
+
+        if ( ( pslot->flags & ACTUATOR_REPLACE ) && ( pslot->batch > pact->cancel_before ) )
+        {
+            actuator_supersede( pact, pslot->batch );
+        }
+
+        if ( pslot->batch < pact->cancel_before )
+        {
+            pthread_mutex_lock( &pact->mutex_stats );
+            pact->stats.superseded++;
+            pthread_mutex_unlock( &pact->mutex_stats );
+        }
+        else
+        {
+            actuator_pending_t entry;
+            int i;
+
+            entry.due_nsec = ( pslot->cmd.at_nsec > pslot->submit_nsec ) ? pslot->cmd.at_nsec : pslot->submit_nsec;
+            entry.submit_nsec = pslot->submit_nsec;
+            entry.batch = pslot->batch;
+            entry.cmd = pslot->cmd;
+
+            //equal deadlines keep submission order
+            for ( i = pact->pending_count; ( i > 0 ) && ( pact->pending[ i - 1 ].due_nsec > entry.due_nsec ); i-- )
+            {
+                pact->pending[ i ] = pact->pending[ i - 1 ];
+            }
+            pact->pending[ i ] = entry;
+            pact->pending_count++;
+        }
+
+        tail++;
+        __atomic_store_n( &pact->tail, tail, __ATOMIC_RELEASE );
+    }
+}
+
+/*
+ * Internal function executing every pending command due by now
+ * Note: actuator thread only
+ */
+static void actuator_execute_due( actuator_t* pact )
+{
+    int done = 0;
+
+    while ( ( done < pact->pending_count ) && ( pact->pending[ done ].due_nsec <= get_monotonic_nsec() ) )
+    {
+        const actuator_pending_t* pentry = &pact->pending[ done ];
+
+        pact->drive( pact->ctx, pentry->cmd.movement, pentry->cmd.speed_percent );
+
+        uint64_t now_nsec = get_monotonic_nsec();
+
+        pthread_mutex_lock( &pact->mutex_stats );
+        pact->stats.executed++;
+        latency_hist_record( &pact->stats.lateness, now_nsec - pentry->due_nsec );
+        latency_hist_record( &pact->stats.latency, now_nsec - pentry->submit_nsec );
+        pthread_mutex_unlock( &pact->mutex_stats );
+
+        done++;
+    }
+
+    if ( done > 0 )
+    {
+        pact->pending_count -= done;
+        memmove( &pact->pending[ 0 ], &pact->pending[ done ], (size_t)pact->pending_count * sizeof( actuator_pending_t ) );
+    }
+}
+
+static void* actuator_thread_entry( void* args )
+{
+    actuator_t* pact = (actuator_t*)args;
+    struct pollfd pfd;
+    uint64_t counter;
+
+    rtmode_enter( rt_role_edge );
+
+    pfd.fd = pact->event_fd;
+    pfd.events = POLLIN;
+
+    while ( __atomic_load_n( &pact->running, __ATOMIC_ACQUIRE ) )
+    {
+        actuator_drain( pact );
+        actuator_execute_due( pact );
+
+        //sleep until the next deadline or the next submission
+        if ( pact->pending_count > 0 )
+        {
+            uint64_t now_nsec = get_monotonic_nsec();
+            uint64_t wait_nsec = ( pact->pending[ 0 ].due_nsec > now_nsec ) ? pact->pending[ 0 ].due_nsec - now_nsec : 0;
+            struct timespec timeout;
+
+            timeout.tv_sec = (time_t)( wait_nsec / 1000000000ULL );
+            timeout.tv_nsec = (long)( wait_nsec % 1000000000ULL );
+            ppoll( &pfd, 1, &timeout, NULL );
+        }
+        else
+        {
+            ppoll( &pfd, 1, NULL, NULL );
+        }
+
+        if ( read( pact->event_fd, &counter, sizeof( counter ) ) < 0 )
+        {
+            //EAGAIN; woken by the deadline
+        }
+    }
+
+    //due commands still run; later ones would act on a box shutting down
+    actuator_drain( pact );
+    actuator_execute_due( pact );
+    actuator_supersede( pact, UINT64_MAX );
+
+    pact->drive( pact->ctx, am_idle, 0 );
+
+    return NULL;
+}
+
+int actuator_create( actuator_t** ppact, actuator_drive_fn drive, void* ctx )
+{
+    actuator_t* pact;
+    pthread_attr_t attr;
+    int ret;
+
+    return_if( drive == NULL, EINVAL );
+
+    pact = calloc( 1, sizeof( actuator_t ) );
+    return_if( pact == NULL, ENOMEM );
+
+    pact->event_fd = eventfd( 0, EFD_NONBLOCK | EFD_CLOEXEC );
+    if ( pact->event_fd < 0 )
+    {
+        ret = errno;
+        free( pact );
+        return ret;
+    }
+
+    pact->drive = drive;
+    pact->ctx = ctx;
+    pact->running = true;
+    latency_hist_init( &pact->stats.lateness );
+    latency_hist_init( &pact->stats.latency );
+    pthread_mutex_init( &pact->mutex_stats, NULL );
+
+    ret = rtmode_thread_attr_init( &attr, rt_role_edge );
+    if ( ret == EOK )
+    {
+        ret = pthread_create( &pact->tid, &attr, actuator_thread_entry, pact );
+        pthread_attr_destroy( &attr );
+    }
+
+    if ( ret != EOK )
+    {
+        pthread_mutex_destroy( &pact->mutex_stats );
+        close( pact->event_fd );
+        free( pact );
+        return ret;
+    }
+
+    *ppact = pact;
+
+    return EOK;
+}
+
+int actuator_destroy( actuator_t* pact )
+{
+    uint64_t one = 1;
+
+    return_if( pact == NULL, EOK );
+
+    __atomic_store_n( &pact->running, false, __ATOMIC_RELEASE );
+    if ( write( pact->event_fd, &one, sizeof( one ) ) < 0 )
+    {
+        print_stderr( STDPRINT_NAME "failed to wake actuator; err=%d\n", errno );
+    }
+
+    pthread_join( pact->tid, NULL );
+
+    pthread_mutex_destroy( &pact->mutex_stats );
+    close( pact->event_fd );
+    free( pact );
+
+    return EOK;
+}
+
+int actuator_submit( actuator_t* pact, const actuator_cmd_t* pcmds, int count, int flags )
+{
+    uint64_t now_nsec = get_monotonic_nsec();
+    uint64_t idx = __atomic_load_n( &pact->head, __ATOMIC_RELAXED );
+    uint64_t one = 1;
+    int i;
+
+    return_if( ( count <= 0 ) || ( count > ACTUATOR_QUEUE_SIZE ), EINVAL );
+
+    //claim the whole sequence unless that would lap the actuator
+    do
+    {
+        if ( ( idx + (uint64_t)count - __atomic_load_n( &pact->tail, __ATOMIC_ACQUIRE ) ) > ACTUATOR_QUEUE_SIZE )
+        {
+            __atomic_add_fetch( &pact->rejected, 1, __ATOMIC_RELAXED );
+            return ENOBUFS;
+        }
+    } while ( !__atomic_compare_exchange_n( &pact->head, &idx, idx + (uint64_t)count, true, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED ) );
+
+    for ( i = 0; i < count; i++ )
+    {
+        actuator_slot_t* pslot = &pact->ring[ ( idx + (uint64_t)i ) & ( ACTUATOR_QUEUE_SIZE - 1 ) ];
+
+        pslot->batch = idx + 1;
+        pslot->submit_nsec = now_nsec;
+        pslot->flags = flags;
+        pslot->cmd = pcmds[ i ];
+
+        __atomic_store_n( &pslot->seq, idx + (uint64_t)i + 1, __ATOMIC_RELEASE );
+    }
+
+    if ( write( pact->event_fd, &one, sizeof( one ) ) < 0 )
+    {
+        //EAGAIN only if the counter is saturated; the actuator is awake anyway
+    }
+
+    return EOK;
+}
+
+int actuator_submit_now( actuator_t* pact, arm_movement_state_t movement, int speed_percent )
+{
+    actuator_cmd_t cmd;
+
+    cmd.at_nsec = ACTUATOR_NOW;
+    cmd.movement = movement;
+    cmd.speed_percent = speed_percent;
+
+    return actuator_submit( pact, &cmd, 1, ACTUATOR_REPLACE );
+}
+
+void actuator_get_stats( actuator_t* pact, actuator_stats_t* pstats )
+{
+    pthread_mutex_lock( &pact->mutex_stats );
+    *pstats = pact->stats;
+    pthread_mutex_unlock( &pact->mutex_stats );
+
+    pstats->rejected = __atomic_load_n( &pact->rejected, __ATOMIC_RELAXED );
+}
+
+void actuator_report( actuator_t* pact, FILE* pout )
+{
+    actuator_stats_t stats;
+
+    actuator_get_stats( pact, &stats );
+
+    fprintf( pout, "actuator; executed=%llu superseded=%llu rejected=%llu lateness p50=%lluus p99=%lluus max=%lluus latency p50=%lluus p99=%lluus max=%lluus\n",
+        (unsigned long long)stats.executed,
+        (unsigned long long)stats.superseded,
+        (unsigned long long)stats.rejected,
+        (unsigned long long)( latency_hist_percentile( &stats.lateness, 50.0 ) / 1000 ),
+        (unsigned long long)( latency_hist_percentile( &stats.lateness, 99.0 ) / 1000 ),
+        (unsigned long long)( stats.lateness.max_nsec / 1000 ),
+        (unsigned long long)( latency_hist_percentile( &stats.latency, 50.0 ) / 1000 ),
+        (unsigned long long)( latency_hist_percentile( &stats.latency, 99.0 ) / 1000 ),
+        (unsigned long long)( stats.latency.max_nsec / 1000 ) );
+}
@@ -0,0 +1,99 @@
+#ifndef actuator_H_
+#define actuator_H_
+
+#include "behaviour.h"
+#include "latency.h"
+
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * Actuator command queue
+ *
+ * One thread owns the motor and is the only one driving it. Any thread,
+ * the edge handler included, submits timestamped commands through a lock
+ * free ring and an eventfd wakeup; the actuator executes them at their
+ * deadline, so deciding what to do and doing it are timed separately:
+ *  lateness    write time past the deadline (or past submission for immediate commands)
+ *  latency     write time past submission
+ *
+ * A submission is a sequence of commands (e.g. reverse now, stop in 350ms)
+ * claimed as one block. With ACTUATOR_REPLACE it supersedes whatever earlier
+ * submissions still have pending; the newest decision about the motor wins.
+ */
+
+#define ACTUATOR_QUEUE_SIZE                 64      //power of two
+#define ACTUATOR_NOW                        0       //deadline for immediate commands
+#define ACTUATOR_REPLACE                    0x01    //drop commands of earlier submissions not yet executed
+
+typedef struct
+{
+    uint64_t                at_nsec;        //monotonic deadline; ACTUATOR_NOW runs right away
+    arm_movement_state_t    movement;
+    int                     speed_percent;
+} actuator_cmd_t;
+
+/*
+ * Drives the motor; called on the actuator thread only
+ */
+typedef int (*actuator_drive_fn)( void* ctx, arm_movement_state_t movement, int speed_percent );
+
+typedef struct
+{
+    uint64_t        executed;
+    uint64_t        superseded;     //dropped by a later ACTUATOR_REPLACE
+    uint64_t        rejected;       //submissions refused to a full ring
+    latency_hist_t  lateness;
+    latency_hist_t  latency;
+} actuator_stats_t;
+
+typedef struct actuator actuator_t;
+
+/*
+ * Creates the actuator and starts its thread
+ *
+ * drive        called for every command executed
+ * ctx          passed back untouched to drive
+ *
+ * returns EOK on success; EErr type otherwise describing the failure
+ */
+int actuator_create( actuator_t** ppact, actuator_drive_fn drive, void* ctx );
+
+/*
+ * Executes what is due, drops the rest, stops the motor and the thread
+ *
+ * returns EOK always
+ */
+int actuator_destroy( actuator_t* pact );
+
+/*
+ * Queues a sequence of commands; lock free, never blocks
+ *
+ * thread-safe: yes
+ *
+ * pcmds        commands; deadlines need not be ordered
+ * count        1 to ACTUATOR_QUEUE_SIZE
+ * flags        ACTUATOR_ flags
+ *
+ * returns EOK on success; EINVAL for bad counts; ENOBUFS if the ring is full and nothing was queued
+ */
+int actuator_submit( actuator_t* pact, const actuator_cmd_t* pcmds, int count, int flags );
+
+/*
+ * Queues one immediate command replacing anything pending
+ *
+ * returns same as actuator_submit
+ */
+int actuator_submit_now( actuator_t* pact, arm_movement_state_t movement, int speed_percent );
+
+/*
+ * Retrieves execution counts and achieved timing
+ */
+void actuator_get_stats( actuator_t* pact, actuator_stats_t* pstats );
+
+/*
+ * Writes counts and timing percentiles as one line
+ */
+void actuator_report( actuator_t* pact, FILE* pout );
+
+#endif
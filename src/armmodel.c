@@ -0,0 +1,280 @@
+#include "armmodel.h"
+#include "util.h"
+
+#include <string.h>
+
+#define STDPRINT_NAME                       __FILE__ ":"
+
+/*
+ * Internal function folding one sample into an estimate (gains 1/8 and 1/4)
+ */
+static void arm_model_estimate_update( arm_model_estimate_t* pest, uint64_t nsec )
+{
+    if ( pest->samples++ == 0 )
+    {
+        pest->mean_nsec = nsec;
+        pest->dev_nsec = nsec / 2;
+        return;
+    }
+
+    int64_t err = (int64_t)nsec - (int64_t)pest->mean_nsec;
+    uint64_t abs_err = ( err < 0 ) ? (uint64_t)-err : (uint64_t)err;
+
+    pest->mean_nsec = (uint64_t)( (int64_t)pest->mean_nsec + err / 8 );
+    pest->dev_nsec = (uint64_t)( (int64_t)pest->dev_nsec + ( (int64_t)abs_err - (int64_t)pest->dev_nsec ) / 4 );
+}
+
+/*
+ * Internal function recomputing the overrun from forward travel and the learned share
+ */
+static void arm_model_update_overrun_nolock( arm_model_t* pmodel )
+{
+    arm_model_params_t* pparams = &pmodel->params;
+    uint64_t overrun_nsec;
+
+    if ( pparams->fwd_travel.samples == 0 )
+    {
+        pparams->overrun_nsec = pmodel->default_overrun_nsec;
+        return;
+    }
+
+    if ( pparams->overrun_permille == 0 )
+    {
+        //start out from the default; probing takes it down from there
+        pparams->overrun_permille = (uint32_t)( pmodel->default_overrun_nsec * 1000 / pparams->fwd_travel.mean_nsec );
+        if ( pparams->overrun_permille == 0 )
+        {
+            pparams->overrun_permille = 1;
+        }
+    }
+
+    overrun_nsec = pparams->fwd_travel.mean_nsec * pparams->overrun_permille / 1000;
+    if ( overrun_nsec < ARM_MODEL_OVERRUN_MIN_NSEC )
+    {
+        overrun_nsec = ARM_MODEL_OVERRUN_MIN_NSEC;
+    }
+    else if ( overrun_nsec > ARM_MODEL_OVERRUN_MAX_NSEC )
+    {
+        overrun_nsec = ARM_MODEL_OVERRUN_MAX_NSEC;
+    }
+
+    pparams->overrun_nsec = overrun_nsec;
+}
+
+/*
+ * Internal function closing a flip cycle and adapting the overrun share
+ */
+static void arm_model_end_cycle_nolock( arm_model_t* pmodel, bool flipped )
+{
+    arm_model_params_t* pparams = &pmodel->params;
+    uint32_t permille = pparams->overrun_permille;
+
+    pparams->cycles++;
+
+    if ( flipped )
+    {
+        //probe down towards the lowest share not known to fail
+        if ( permille > pparams->floor_permille )
+        {
+            uint32_t step = ( permille - pparams->floor_permille ) / 16;
+            permille -= ( step > 0 ) ? step : 1;
+        }
+        pparams->cycles_since_failure++;
+    }
+    else
+    {
+        uint32_t floor_permille = permille + permille / 8;
+
+        if ( floor_permille > pparams->floor_permille )
+        {
+            pparams->floor_permille = floor_permille;
+        }
+
+        permille += permille / 2;
+        if ( permille < pparams->floor_permille )
+        {
+            permille = pparams->floor_permille;
+        }
+
+        pparams->flip_failures++;
+        pparams->cycles_since_failure = 0;
+    }
+
+    pparams->overrun_permille = permille;
+    arm_model_update_overrun_nolock( pmodel );
+
+    //settled once flips keep working, the overrun stopped moving and travel is steady
+    uint64_t moved_nsec = ( pparams->overrun_nsec > pmodel->prev_overrun_nsec )
+        ? pparams->overrun_nsec - pmodel->prev_overrun_nsec
+        : pmodel->prev_overrun_nsec - pparams->overrun_nsec;
+
+    pparams->converged = ( pparams->cycles_since_failure >= ARM_MODEL_CONVERGED_CYCLES )
+        && ( moved_nsec <= pparams->overrun_nsec / 50 )
+        && ( pparams->fwd_travel.dev_nsec <= pparams->fwd_travel.mean_nsec / 8 );
+
+    pmodel->prev_overrun_nsec = pparams->overrun_nsec;
+    pmodel->phase = amp_idle;
+
+    printlvl_stdout( verblvl_more, STDPRINT_NAME "arm model cycle; flipped=%d fwd=%llums bwd=%llums overrun=%llums share=%u floor=%u converged=%d\n",
+        flipped,
+        (unsigned long long)( pparams->fwd_travel.mean_nsec / 1000000 ),
+        (unsigned long long)( pparams->bwd_travel.mean_nsec / 1000000 ),
+        (unsigned long long)( pparams->overrun_nsec / 1000000 ),
+        pparams->overrun_permille,
+        pparams->floor_permille,
+        pparams->converged );
+}
+
+void arm_model_init( arm_model_t* pmodel, uint64_t default_overrun_nsec )
+{
+    memset( pmodel, 0, sizeof( *pmodel ) );
+    pthread_mutex_init( &pmodel->mutex, NULL );
+
+    pmodel->default_overrun_nsec = default_overrun_nsec;
+    pmodel->params.overrun_nsec = default_overrun_nsec;
+    pmodel->prev_overrun_nsec = default_overrun_nsec;
+    pmodel->phase = amp_idle;
+}
+
+void arm_model_destroy( arm_model_t* pmodel )
+{
+    pthread_mutex_destroy( &pmodel->mutex );
+}
+
+void arm_model_motor( arm_model_t* pmodel, arm_movement_state_t movement, uint64_t ts_nsec )
+{
+    pthread_mutex_lock( &pmodel->mutex );
+
+    switch ( pmodel->phase )
+    {
+        case amp_idle:
+            //only runs starting from home have a known length
+            if ( ( movement == am_fwd ) && pmodel->int_switch1 )
+            {
+                pmodel->phase = amp_forward;
+                pmodel->phase_nsec = ts_nsec;
+            }
+            break;
+        case amp_forward:
+            if ( movement != am_fwd )
+            {
+                pmodel->phase = amp_idle;
+            }
+            break;
+        case amp_overrun:
+            if ( movement == am_bwd )
+            {
+                pmodel->phase = amp_backward;
+                pmodel->phase_nsec = ts_nsec;
+            }
+            else if ( movement != am_fwd )
+            {
+                pmodel->phase = amp_idle;
+            }
+            break;
+        case amp_backward:
+            //the arm home stop arrives after the edge that ends the cycle
+            if ( movement != am_bwd )
+            {
+                pmodel->phase = amp_idle;
+            }
+            break;
+    }
+
+    pthread_mutex_unlock( &pmodel->mutex );
+}
+
+void arm_model_edge( arm_model_t* pmodel, bool int_switch1, bool ext_switch1, uint64_t ts_nsec )
+{
+    pthread_mutex_lock( &pmodel->mutex );
+
+    bool int_on = int_switch1 && !pmodel->int_switch1;
+    bool ext_on = ext_switch1 && !pmodel->ext_switch1;
+    bool ext_off = !ext_switch1 && pmodel->ext_switch1;
+    uint64_t elapsed_nsec = ts_nsec - pmodel->phase_nsec;
+    uint64_t check_nsec;
+
+    pmodel->int_switch1 = int_switch1;
+    pmodel->ext_switch1 = ext_switch1;
+
+    switch ( pmodel->phase )
+    {
+        case amp_idle:
+            break;
+        case amp_forward:
+            if ( ext_off )
+            {
+                arm_model_estimate_update( &pmodel->params.fwd_travel, elapsed_nsec );
+                arm_model_update_overrun_nolock( pmodel );
+                pmodel->phase = amp_overrun;
+                pmodel->phase_nsec = ts_nsec;
+            }
+            else if ( int_on )
+            {
+                pmodel->phase = amp_idle;
+            }
+            break;
+        case amp_overrun:
+            break;
+        case amp_backward:
+            check_nsec = ( pmodel->params.bwd_travel.samples > 0 )
+                ? pmodel->params.bwd_travel.mean_nsec / 2
+                : ARM_MODEL_FLIP_CHECK_NSEC;
+
+            if ( int_on )
+            {
+                arm_model_estimate_update( &pmodel->params.bwd_travel, elapsed_nsec );
+                arm_model_end_cycle_nolock( pmodel, true );
+            }
+            else if ( ext_on && ( elapsed_nsec < check_nsec ) )
+            {
+                //toggle sprang back right away; it sat halfway
+                arm_model_end_cycle_nolock( pmodel, false );
+            }
+            else if ( ext_on )
+            {
+                //flipped on again by hand; says nothing about the overrun
+                pmodel->phase = amp_idle;
+            }
+            break;
+    }
+
+    pthread_mutex_unlock( &pmodel->mutex );
+}
+
+uint64_t arm_model_overrun_nsec( arm_model_t* pmodel )
+{
+    pthread_mutex_lock( &pmodel->mutex );
+    uint64_t overrun_nsec = pmodel->params.overrun_nsec;
+    pthread_mutex_unlock( &pmodel->mutex );
+
+    return overrun_nsec;
+}
+
+void arm_model_get_params( arm_model_t* pmodel, arm_model_params_t* pparams )
+{
+    pthread_mutex_lock( &pmodel->mutex );
+    *pparams = pmodel->params;
+    pthread_mutex_unlock( &pmodel->mutex );
+}
+
+void arm_model_report( arm_model_t* pmodel, FILE* pout )
+{
+    arm_model_params_t params;
+
+    arm_model_get_params( pmodel, &params );
+
+    fprintf( pout, "arm model; fwd=%llums+-%llums (n=%llu) bwd=%llums+-%llums (n=%llu) overrun=%llums share=%u floor=%u cycles=%llu failures=%llu converged=%s\n",
+        (unsigned long long)( params.fwd_travel.mean_nsec / 1000000 ),
+        (unsigned long long)( params.fwd_travel.dev_nsec / 1000000 ),
+        (unsigned long long)params.fwd_travel.samples,
+        (unsigned long long)( params.bwd_travel.mean_nsec / 1000000 ),
+        (unsigned long long)( params.bwd_travel.dev_nsec / 1000000 ),
+        (unsigned long long)params.bwd_travel.samples,
+        (unsigned long long)( params.overrun_nsec / 1000000 ),
+        params.overrun_permille,
+        params.floor_permille,
+        (unsigned long long)params.cycles,
+        (unsigned long long)params.flip_failures,
+        params.converged ? "yes" : "no" );
+}
@@ -0,0 +1,116 @@
+#ifndef armmodel_H_
+#define armmodel_H_
+
+#include "behaviour.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * Learned arm travel model
+ *
+ * The switches are the only position sensors, so travel is learned from
+ * timestamped motor commands and switch edges:
+ *  forward travel      forward command from home until the toggle switch opens
+ *  backward travel     reversal until the arm is home again
+ *
+ * Travel estimates are smoothed averages with a mean deviation, the same way
+ * round trip times are estimated for retransmits. After the toggle opens the
+ * arm keeps pushing for an overrun so the toggle flops fully; the overrun is
+ * kept as a share of forward travel, so a slower motor pushes longer.
+ *
+ * The share is probed downwards after every cycle that flipped the toggle.
+ * A cycle where the toggle springs back on shortly after reversing counts as
+ * a failed flip: the share goes up by half and never again drops below what
+ * failed (plus a margin).
+ *
+ * thread-safe: yes
+ */
+
+#define ARM_MODEL_OVERRUN_MIN_NSEC          20000000ULL     //20msec
+#define ARM_MODEL_OVERRUN_MAX_NSEC          500000000ULL    //500msec
+#define ARM_MODEL_FLIP_CHECK_NSEC           150000000ULL    //window for a failed flip until backward travel is known
+#define ARM_MODEL_CONVERGED_CYCLES          8
+
+typedef enum
+{
+    amp_idle,
+    amp_forward,            //left home, toggle not reached yet
+    amp_overrun,            //toggle opened, pushing on
+    amp_backward,           //reversed, not home yet
+} arm_model_phase_t;
+
+typedef struct
+{
+    uint64_t            samples;
+    uint64_t            mean_nsec;
+    uint64_t            dev_nsec;           //mean deviation
+} arm_model_estimate_t;
+
+typedef struct
+{
+    arm_model_estimate_t    fwd_travel;
+    arm_model_estimate_t    bwd_travel;
+    uint32_t                overrun_permille;   //overrun as share of forward travel; 0 until travel is known
+    uint32_t                floor_permille;     //lowest share not known to fail
+    uint64_t                overrun_nsec;       //overrun applied to the next flip
+    uint64_t                cycles;             //flips seen through
+    uint64_t                flip_failures;
+    uint64_t                cycles_since_failure;
+    bool                    converged;
+} arm_model_params_t;
+
+typedef struct
+{
+    pthread_mutex_t         mutex;
+    uint64_t                default_overrun_nsec;
+    arm_model_params_t      params;
+    arm_model_phase_t       phase;
+    bool                    int_switch1;        //levels last fed
+    bool                    ext_switch1;
+    uint64_t                phase_nsec;         //when the current phase started
+    uint64_t                prev_overrun_nsec;  //to tell whether the overrun still moves
+} arm_model_t;
+
+/*
+ * Initializes a model knowing nothing yet
+ *
+ * default_overrun_nsec     overrun used until forward travel has been measured
+ */
+void arm_model_init( arm_model_t* pmodel, uint64_t default_overrun_nsec );
+
+/*
+ * Destroys a model
+ */
+void arm_model_destroy( arm_model_t* pmodel );
+
+/*
+ * Feeds a motor command as it is written
+ */
+void arm_model_motor( arm_model_t* pmodel, arm_movement_state_t movement, uint64_t ts_nsec );
+
+/*
+ * Feeds switch levels sampled after an edge
+ *
+ * ts_nsec      when the edge was seen, not when the levels were sampled
+ */
+void arm_model_edge( arm_model_t* pmodel, bool int_switch1, bool ext_switch1, uint64_t ts_nsec );
+
+/*
+ * Retrieves how long to keep pushing forward after the toggle opened
+ */
+uint64_t arm_model_overrun_nsec( arm_model_t* pmodel );
+
+/*
+ * Retrieves a copy of the learned parameters
+ */
+void arm_model_get_params( arm_model_t* pmodel, arm_model_params_t* pparams );
+
+/*
+ * Writes the learned parameters as one line
+ */
+void arm_model_report( arm_model_t* pmodel, FILE* pout );
+
+#endif
@@ -0,0 +1,346 @@
+#include "behaviour.h"
+#include "util.h"
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define STDPRINT_NAME                       __FILE__ ":"
+
+int behaviour_arm_movement_backward( const box_ops_t* pops, void* ctx )
+{
+    bool int_switch1 = false;
+    bool ext_switch1 = false;
+
+    pops->read_swstates( ctx, &int_switch1, &ext_switch1 );
+
+    if (int_switch1 == false)
+    {
+        return pops->arm_movement( ctx, am_bwd );
+    }
+
+    print_stdout( STDPRINT_NAME "arm movement skipped\n");
+    if (ext_switch1 == true)
+    {
+        pops->next_state( ctx, sa_arm_alarm, NULL );
+    }
+    else
+    {
+        pops->next_state( ctx, sa_arm_off, NULL );
+    }
+
+    return EOK;
+}
+
+statemachine_actions_t behaviour_swstate_action( bool int_switch1, bool ext_switch1 )
+{
+    if ( (int_switch1 == false)
+            && (ext_switch1 == false) )
+    {
+        return sa_arm_reset;
+    }
+
+    if ( (int_switch1 == true)
+            && (ext_switch1 == true) )
+    {
+        return sa_arm_alarm;
+    }
+
+    if ( (int_switch1 == false)
+            && (ext_switch1 == true) )
+    {
+        return sa_arm_motion;
+    }
+
+    return sa_arm_off;
+}
+
+static int behaviour_enter_idle( const box_ops_t* pops, void* ctx, statemachine_states_t* pcurrent_state, bool* pfinished )
+{
+    __unused( pcurrent_state );
+    __unused( pfinished );
+
+    pops->arm_movement( ctx, am_idle );
+
+    return EOK;
+}
+
+static int behaviour_enter_powerup( const box_ops_t* pops, void* ctx, statemachine_states_t* pcurrent_state, bool* pfinished )
+{
+    __unused( pcurrent_state );
+    __unused( pfinished );
+
+    pops->sample_swstates( ctx );
+
+    return EOK;
+}
+
+static int behaviour_enter_alarming( const box_ops_t* pops, void* ctx, statemachine_states_t* pcurrent_state, bool* pfinished )
+{
+    __unused( pcurrent_state );
+    __unused( pfinished );
+
+    pops->arm_movement( ctx, am_fwd );
+
+    return EOK;
+}
+
+static int behaviour_enter_reseting( const box_ops_t* pops, void* ctx, statemachine_states_t* pcurrent_state, bool* pfinished )
+{
+    __unused( pcurrent_state );
+    __unused( pfinished );
+
+    behaviour_arm_movement_backward( pops, ctx );
+
+    return EOK;
+}
+
+static int behaviour_enter_scare_setup( const box_ops_t* pops, void* ctx, statemachine_states_t* pcurrent_state, bool* pfinished )
+{
+    bool int_switch1 = false;
+    bool ext_switch1 = false;
+
+    __unused( pcurrent_state );
+    __unused( pfinished );
+
+    pops->setup_timer_action( ctx, STATE_SCARE_EXIT_USEC, sa_scare_exit );
+
+    pops->read_swstates( ctx, &int_switch1, &ext_switch1 );
+    if (int_switch1 == false)
+    {
+        behaviour_arm_movement_backward( pops, ctx );
+    }
+    else
+    {
+        pops->arm_movement( ctx, am_fwd );
+    }
+
+    return EOK;
+}
+
+static int behaviour_enter_scare_step1( const box_ops_t* pops, void* ctx, statemachine_states_t* pcurrent_state, bool* pfinished )
+{
+    __unused( pcurrent_state );
+    __unused( pfinished );
+
+    pops->setup_timer_action( ctx, STATE_SCARE1_VIB_USEC, sa_scare_timeout );
+    pops->arm_movement( ctx, am_fwd );
+
+    return EOK;
+}
+
+static int behaviour_enter_scare_step2( const box_ops_t* pops, void* ctx, statemachine_states_t* pcurrent_state, bool* pfinished )
+{
+    __unused( pcurrent_state );
+    __unused( pfinished );
+
+    pops->setup_timer_action( ctx, STATE_SCARE2_VIB_USEC, sa_scare_timeout );
+    behaviour_arm_movement_backward( pops, ctx );
+
+    return EOK;
+}
+
+static int behaviour_enter_scare_step3( const box_ops_t* pops, void* ctx, statemachine_states_t* pcurrent_state, bool* pfinished )
+{
+    __unused( pcurrent_state );
+    __unused( pfinished );
+
+    pops->arm_movement( ctx, am_fwd );
+
+    return EOK;
+}
+
+static int behaviour_enter_timeout_then_reset( const box_ops_t* pops, void* ctx, statemachine_states_t* pcurrent_state, bool* pfinished )
+{
+    __unused( pcurrent_state );
+    __unused( pfinished );
+
+    pops->setup_timer_action( ctx, STATE_TIMEOUT_RESET_USEC, sa_timeout );
+    pops->arm_movement( ctx, am_idle );
+
+    return EOK;
+}
+
+static int behaviour_enter_reseting_retry( const box_ops_t* pops, void* ctx, statemachine_states_t* pcurrent_state, bool* pfinished )
+{
+    __unused( pcurrent_state );
+    __unused( pfinished );
+
+    behaviour_arm_movement_backward( pops, ctx );
+
+    return EOK;
+}
+
+static int behaviour_enter_offence( const box_ops_t* pops, void* ctx, statemachine_states_t* pcurrent_state, bool* pfinished )
+{
+    __unused( pcurrent_state );
+    __unused( pfinished );
+
+    pops->arm_movement( ctx, am_fwd );
+
+    return EOK;
+}
+
+static int behaviour_enter_suspicion_setup( const box_ops_t* pops, void* ctx, statemachine_states_t* pcurrent_state, bool* pfinished )
+{
+    __unused( pcurrent_state );
+    __unused( pfinished );
+
+    pops->setup_timer_action( ctx, STATE_SUSPICION_EXIT_USEC, sa_suspicion_exit );
+    pops->setup_timer_action( ctx,
+        pops->random_number( ctx,
+            STATE_SUSPICION_PEEK_MIN_USEC,
+            STATE_SUSPICION_PEEK_MAX_USEC),
+        sa_suspicion_timeout);
+
+    pops->arm_movement( ctx, am_idle );
+
+    return EOK;
+}
+
+static int behaviour_enter_suspicion_step1( const box_ops_t* pops, void* ctx, statemachine_states_t* pcurrent_state, bool* pfinished )
+{
+    __unused( pcurrent_state );
+    __unused( pfinished );
+
+    pops->setup_timer_action( ctx,
+        pops->random_number( ctx,
+            STATE_SUSPICION_PEEK_OPEN_MIN_USEC,
+            STATE_SUSPICION_PEEK_OPEN_MAX_USEC),
+        sa_suspicion_timeout);
+
+    pops->arm_movement( ctx, am_fwd );
+
+    return EOK;
+}
+
+static int behaviour_enter_suspicion_step2( const box_ops_t* pops, void* ctx, statemachine_states_t* pcurrent_state, bool* pfinished )
+{
+    __unused( pcurrent_state );
+    __unused( pfinished );
+
+    pops->setup_timer_action( ctx,
+        pops->random_number( ctx,
+            STATE_SUSPICION_PEEK_LEN_MIN_USEC,
+            STATE_SUSPICION_PEEK_LEN_MAX_USEC),
+        sa_suspicion_timeout);
+
+    pops->arm_movement( ctx, am_idle );
+
+    return EOK;
+}
+
+static int behaviour_enter_suspicion_step3( const box_ops_t* pops, void* ctx, statemachine_states_t* pcurrent_state, bool* pfinished )
+{
+    __unused( pcurrent_state );
+    __unused( pfinished );
+
+    behaviour_arm_movement_backward( pops, ctx );
+
+    return EOK;
+}
+
+static int behaviour_enter_slow_finger_setup( const box_ops_t* pops, void* ctx, statemachine_states_t* pcurrent_state, bool* pfinished )
+{
+    __unused( pcurrent_state );
+    __unused( pfinished );
+
+    //with pwm the arm creeps forward in one go until the toggle flips
+    if ( pops->arm_movement_speed != NULL )
+    {
+        return pops->arm_movement_speed( ctx, am_fwd, STATE_SLOWFINGER_SPEED_PERCENT );
+    }
+
+    pops->setup_timer_action( ctx, STATE_SLOWFINGER_DUTYON_USEC, sa_slowfinger_timeout );
+    pops->arm_movement( ctx, am_fwd );
+
+    return EOK;
+}
+
+static int behaviour_enter_slow_finger_step1( const box_ops_t* pops, void* ctx, statemachine_states_t* pcurrent_state, bool* pfinished )
+{
+    __unused( pcurrent_state );
+    __unused( pfinished );
+
+    pops->setup_timer_action( ctx, STATE_SLOWFINGER_DUTYOFF_USEC, sa_slowfinger_timeout );
+    pops->arm_movement( ctx, am_idle );
+
+    return EOK;
+}
+
+static int behaviour_enter_slow_finger_step2( const box_ops_t* pops, void* ctx, statemachine_states_t* pcurrent_state, bool* pfinished )
+{
+    __unused( pcurrent_state );
+    __unused( pfinished );
+
+    behaviour_arm_movement_backward( pops, ctx );
+
+    return EOK;
+}
+
+static int behaviour_enter_before_shutdown( const box_ops_t* pops, void* ctx, statemachine_states_t* pcurrent_state, bool* pfinished )
+{
+    __unused( pfinished );
+
+    pops->arm_movement( ctx, am_idle );
+    pops->next_state( ctx, sa_shutdown_done, pcurrent_state );
+
+    return EOK;
+}
+
+static int behaviour_enter_shutdown( const box_ops_t* pops, void* ctx, statemachine_states_t* pcurrent_state, bool* pfinished )
+{
+    __unused( pops );
+    __unused( ctx );
+    __unused( pcurrent_state );
+
+    *pfinished = true;
+
+    return EOK;
+}
+
+//indexed by state; O(1) in place of a switch
+static const behaviour_handler_t    behaviour_entry_handlers[ ss_END ] =
+    {
+        [ ss_idle ]               = behaviour_enter_idle,
+        [ ss_powerup ]            = behaviour_enter_powerup,
+        [ ss_alarming ]           = behaviour_enter_alarming,
+        [ ss_reseting ]           = behaviour_enter_reseting,
+        [ ss_scare_setup ]        = behaviour_enter_scare_setup,
+        [ ss_scare_step1 ]        = behaviour_enter_scare_step1,
+        [ ss_scare_step2 ]        = behaviour_enter_scare_step2,
+        [ ss_scare_step3 ]        = behaviour_enter_scare_step3,
+        [ ss_timeout_then_reset ] = behaviour_enter_timeout_then_reset,
+        [ ss_reseting_retry ]     = behaviour_enter_reseting_retry,
+        [ ss_offence ]            = behaviour_enter_offence,
+        [ ss_suspicion_setup ]    = behaviour_enter_suspicion_setup,
+        [ ss_suspicion_step1 ]    = behaviour_enter_suspicion_step1,
+        [ ss_suspicion_step2 ]    = behaviour_enter_suspicion_step2,
+        [ ss_suspicion_step3 ]    = behaviour_enter_suspicion_step3,
+        [ ss_slow_finger_setup ]  = behaviour_enter_slow_finger_setup,
+        [ ss_slow_finger_step1 ]  = behaviour_enter_slow_finger_step1,
+        [ ss_slow_finger_step2 ]  = behaviour_enter_slow_finger_step2,
+        [ ss_before_shutdown ]    = behaviour_enter_before_shutdown,
+        [ ss_shutdown ]           = behaviour_enter_shutdown,
+    };
+
+behaviour_handler_t behaviour_get_entry_handler( statemachine_states_t state )
+{
+    return_if( ( (unsigned)state >= ss_END ), NULL );
+
+    return behaviour_entry_handlers[ state ];
+}
+
+int behaviour_enter_state( const box_ops_t* pops, void* ctx, statemachine_states_t* pcurrent_state, bool* pfinished )
+{
+    behaviour_handler_t handler = behaviour_get_entry_handler( *pcurrent_state );
+
+    if ( handler == NULL )
+    {
+        //unknown state (should never happen)
+        print_stderr( STDPRINT_NAME "unknown state entered; currentstate=%d\n", *pcurrent_state );
+        return EINVAL;
+    }
+
+    return handler( pops, ctx, pcurrent_state, pfinished );
+}
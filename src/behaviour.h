@@ -0,0 +1,94 @@
+#ifndef behaviour_H_
+#define behaviour_H_
+
+#include "statemachine.h"
+
+#include <stdbool.h>
+
+#define STATE_SCARE1_VIB_USEC               500000  //500msec
+#define STATE_SCARE2_VIB_USEC               500000  //500msec
+#define STATE_SCARE_EXIT_USEC               3000000 //3sec
+#define STATE_TIMEOUT_RESET_USEC            10000000 //10sec
+#define STATE_SUSPICION_EXIT_USEC           45000000 //45sec
+#define STATE_SUSPICION_PEEK_MIN_USEC       1000000 //1sec
+#define STATE_SUSPICION_PEEK_MAX_USEC       12000000 //8sec
+#define STATE_SUSPICION_PEEK_OPEN_MIN_USEC  400000
+#define STATE_SUSPICION_PEEK_OPEN_MAX_USEC  600000
+#define STATE_SUSPICION_PEEK_LEN_MIN_USEC   1000000
+#define STATE_SUSPICION_PEEK_LEN_MAX_USEC   3000000
+#define STATE_SLOWFINGER_DUTYFULL_USEC      200000 //200ms
+#define STATE_SLOWFINGER_DUTYON_USEC        100000
+#define STATE_SLOWFINGER_DUTYOFF_USEC       (STATE_SLOWFINGER_DUTYFULL_USEC-STATE_SLOWFINGER_DUTYON_USEC)
+#define STATE_SLOWFINGER_SPEED_PERCENT      (100*STATE_SLOWFINGER_DUTYON_USEC/STATE_SLOWFINGER_DUTYFULL_USEC)
+
+typedef enum
+{
+    am_idle,
+    am_fwd,
+    am_bwd,
+} arm_movement_state_t;
+
+/*
+ * Box operations used by the state entry behaviour
+ * A real box backs these with gpio; simulated boxes back them with plain memory.
+ *
+ * ctx is passed back untouched to every call
+ * arm_movement_speed is optional; boxes without pwm leave it NULL and slow
+ * movements are then made from state transitions
+ */
+typedef struct
+{
+    int     (*arm_movement)( void* ctx, arm_movement_state_t movement );
+    int     (*arm_movement_speed)( void* ctx, arm_movement_state_t movement, int speed_percent );
+    int     (*read_swstates)( void* ctx, bool* pint_switch1, bool* pext_switch1 );
+    int     (*sample_swstates)( void* ctx );
+    int     (*setup_timer_action)( void* ctx, int usec, statemachine_actions_t action );
+    int     (*next_state)( void* ctx, statemachine_actions_t action, statemachine_states_t* pnew_state );
+    int     (*random_number)( void* ctx, int min_num, int max_num );
+} box_ops_t;
+
+/*
+ * Entry (or exit) behaviour of one state
+ *
+ * pops             box operations
+ * ctx              opaque box context passed to pops
+ * pcurrent_state   state the handler runs for; an entry handler updates it if it transitions itself
+ * pfinished        set true once the box reached its final state
+ *
+ * returns EOK on success; EErr type otherwise
+ */
+typedef int (*behaviour_handler_t)( const box_ops_t* pops, void* ctx, statemachine_states_t* pcurrent_state, bool* pfinished );
+
+/*
+ * Retrieves the builtin entry handler of a state
+ *
+ * returns the handler; NULL for unknown states
+ */
+behaviour_handler_t behaviour_get_entry_handler( statemachine_states_t state );
+
+/*
+ * Runs the entry behaviour (motor commands and timers) of a newly entered state
+ *
+ * pops             box operations
+ * ctx              opaque box context passed to pops
+ * pcurrent_state   state just entered; updated if the behaviour itself transitions
+ * pfinished        set true once the box reached ss_shutdown
+ *
+ * returns EOK on success; EINVAL for unknown states
+ */
+int behaviour_enter_state( const box_ops_t* pops, void* ctx, statemachine_states_t* pcurrent_state, bool* pfinished );
+
+/*
+ * Moves the arm backward
+ * if the arm is already home, the switch levels are fed back instead
+ *
+ * returns EOK on success; EErr type otherwise
+ */
+int behaviour_arm_movement_backward( const box_ops_t* pops, void* ctx );
+
+/*
+ * Maps sampled switch levels to the action fed to the statemachine
+ */
+statemachine_actions_t behaviour_swstate_action( bool int_switch1, bool ext_switch1 );
+
+#endif
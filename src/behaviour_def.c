@@ -0,0 +1,420 @@
+#include "behaviour_def.h"
+#include "util.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define STDPRINT_NAME                       __FILE__ ":"
+#define BEHAVIOUR_SLOT_GRACE_POLL_USEC      100
+
+struct behaviour_def
+{
+    const uint8_t*                          pbase;
+    size_t                                  size;
+    bool                                    mapped;         //pbase is ours to munmap
+    const behaviour_def_header_t*           pheader;
+    const uint8_t*                          ptransitions;
+    const behaviour_def_entry_t*            pentries;
+    const behaviour_def_op_t*               pops;
+};
+
+struct behaviour_slot
+{
+    behaviour_def_t*                        pdef;           //published; swapped atomically
+    unsigned int                            epoch;          //low bit selects the reader counter
+    unsigned long                           readers[ 2 ];
+    uint32_t                                generation;
+    pthread_mutex_t                         publish_mutex;  //serialises publishers only
+};
+
+static const char*          behaviour_def_op_names[] =
+    {
+        "motor",
+        "arm_home",
+        "timer",
+        "sample",
+        "next",
+        "skip_if_int_on",
+        "skip",
+        "finish",
+    };
+
+/*
+ * Internal function checking a table lies within the buffer
+ */
+static bool behaviour_def_range_ok( size_t size, uint32_t offset, size_t count, size_t elem_size, size_t align )
+{
+    return_if( ( offset % align ) != 0, false );
+    return_if( offset > size, false );
+
+    return ( count <= ( size - offset ) / elem_size );
+}
+
+/*
+ * Internal function validating one op of a state's entry list
+ * index is the op position within the list, count the list length
+ */
+static bool behaviour_def_op_ok( const behaviour_def_op_t* pop, int index, int count )
+{
+    return_if( pop->reserved != 0, false );
+
+    switch ( pop->opcode )
+    {
+        case bop_motor:
+            return ( pop->arg <= am_bwd );
+
+        case bop_timer:
+            return ( ( pop->arg < sa_END ) && ( pop->min_usec <= pop->max_usec ) && ( pop->max_usec <= INT_MAX ) );
+
+        case bop_next_state:
+            return ( pop->arg < sa_END );
+
+        case bop_skip_if_int_on:
+        case bop_skip:
+            //may land one past the last op, never further
+            return ( index + 1 + pop->arg <= count );
+
+        case bop_arm_home:
+        case bop_sample_swstates:
+        case bop_finish:
+            return true;
+
+        default:
+            return false;
+    }
+}
+
+/*
+ * Internal function validating the whole definition once so lookups need no checks
+ */
+static int behaviour_def_validate( behaviour_def_t* pdef )
+{
+    const behaviour_def_header_t* pheader = (const behaviour_def_header_t*)pdef->pbase;
+    int state;
+    int i;
+
+    return_if( pdef->size < sizeof( behaviour_def_header_t ), EILSEQ );
+    return_if( ( pheader->magic != BEHAVIOUR_DEF_MAGIC ) || ( pheader->version != BEHAVIOUR_DEF_VERSION ), EILSEQ );
+    return_if( pheader->file_size != pdef->size, EILSEQ );
+
+    //states and actions are compiled into the rest of the box; a definition cannot add any
+    return_if( ( pheader->state_count != ss_END ) || ( pheader->action_count != sa_END ), EILSEQ );
+
+    return_if_not( behaviour_def_range_ok( pdef->size, pheader->transitions_offset, (size_t)ss_END * sa_END, 1, 1 ), EILSEQ );
+    return_if_not( behaviour_def_range_ok( pdef->size, pheader->entries_offset, ss_END, sizeof( behaviour_def_entry_t ), 4 ), EILSEQ );
+    return_if_not( behaviour_def_range_ok( pdef->size, pheader->ops_offset, pheader->op_count, sizeof( behaviour_def_op_t ), 4 ), EILSEQ );
+
+    pdef->pheader = pheader;
+    pdef->ptransitions = pdef->pbase + pheader->transitions_offset;
+    pdef->pentries = (const behaviour_def_entry_t*)( pdef->pbase + pheader->entries_offset );
+    pdef->pops = (const behaviour_def_op_t*)( pdef->pbase + pheader->ops_offset );
+
+    for ( i = 0; i < ss_END * sa_END; i++ )
+    {
+        return_if( ( pdef->ptransitions[ i ] & BEHAVIOUR_DEF_STATE_MASK ) >= ss_END, EILSEQ );
+    }
+
+    for ( state = 0; state < ss_END; state++ )
+    {
+        const behaviour_def_entry_t* pentry = &pdef->pentries[ state ];
+
+        return_if( (uint32_t)pentry->first_op + pentry->op_count > pheader->op_count, EILSEQ );
+
+        for ( i = 0; i < pentry->op_count; i++ )
+        {
+            return_if_not( behaviour_def_op_ok( &pdef->pops[ pentry->first_op + i ], i, pentry->op_count ), EILSEQ );
+        }
+    }
+
+    return EOK;
+}
+
+int behaviour_def_from_buffer( behaviour_def_t** ppdef, const void* pbuf, size_t size )
+{
+    behaviour_def_t* pdef = calloc( 1, sizeof( behaviour_def_t ) );
+    int ret;
+
+    return_if( pdef == NULL, ENOMEM );
+
+    pdef->pbase = pbuf;
+    pdef->size = size;
+    pdef->mapped = false;
+
+    ret = behaviour_def_validate( pdef );
+    if ( ret != EOK )
+    {
+        free( pdef );
+        return ret;
+    }
+
+    *ppdef = pdef;
+
+    return EOK;
+}
+
+int behaviour_def_load( behaviour_def_t** ppdef, const char* path )
+{
+    behaviour_def_t* pdef;
+    struct stat st;
+    void* pmap;
+    int ret;
+    int fd;
+
+    fd = open( path, O_RDONLY );
+    return_if( fd < 0, errno );
+
+    if ( ( fstat( fd, &st ) != 0 ) || ( (size_t)st.st_size < sizeof( behaviour_def_header_t ) ) )
+    {
+        close( fd );
+        print_stderr( STDPRINT_NAME "behaviour definition too short; path=%s\n", path );
+        return EILSEQ;
+    }
+
+    pmap = mmap( NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+    ret = errno;
+    //the mapping keeps the file referenced
+    close( fd );
+    return_if( pmap == MAP_FAILED, ret );
+
+    ret = behaviour_def_from_buffer( &pdef, pmap, (size_t)st.st_size );
+    if ( ret != EOK )
+    {
+        print_stderr( STDPRINT_NAME "behaviour definition rejected; path=%s err=%d\n", path, ret );
+        munmap( pmap, (size_t)st.st_size );
+        return ret;
+    }
+
+    pdef->mapped = true;
+    *ppdef = pdef;
+
+    return EOK;
+}
+
+int behaviour_def_unload( behaviour_def_t* pdef )
+{
+    return_if( pdef == NULL, EOK );
+
+    if ( pdef->mapped )
+    {
+        munmap( (void*)pdef->pbase, pdef->size );
+    }
+    free( pdef );
+
+    return EOK;
+}
+
+int behaviour_def_transition( const behaviour_def_t* pdef, statemachine_states_t current_state, statemachine_actions_t action, statemachine_states_t* pnext_state )
+{
+    if ( ( current_state >= ss_END ) || ( action >= sa_END ) )
+    {
+        *pnext_state = current_state;
+        return EINVAL;
+    }
+
+    uint8_t cell = pdef->ptransitions[ current_state * sa_END + action ];
+
+    *pnext_state = (statemachine_states_t)( cell & BEHAVIOUR_DEF_STATE_MASK );
+
+    return ( cell & BEHAVIOUR_DEF_REJECT ) ? EINVAL : EOK;
+}
+
+int behaviour_def_enter_state( const behaviour_def_t* pdef, const box_ops_t* pops, void* ctx, statemachine_states_t* pcurrent_state, bool* pfinished )
+{
+    const behaviour_def_op_t* pop;
+    int count;
+    int i;
+
+    if ( *pcurrent_state >= ss_END )
+    {
+        //unknown state (should never happen)
+        print_stderr( STDPRINT_NAME "unknown state entered; currentstate=%d\n", *pcurrent_state );
+        return EINVAL;
+    }
+
+    pop = behaviour_def_entry_ops( pdef, *pcurrent_state, &count );
+
+    for ( i = 0; i < count; i++ )
+    {
+        switch ( pop[ i ].opcode )
+        {
+            case bop_motor:
+                pops->arm_movement( ctx, (arm_movement_state_t)pop[ i ].arg );
+                break;
+
+            case bop_arm_home:
+                behaviour_arm_movement_backward( pops, ctx );
+                break;
+
+            case bop_timer:
+            {
+                int usec = (int)pop[ i ].min_usec;
+
+                if ( pop[ i ].max_usec != pop[ i ].min_usec )
+                {
+                    usec = pops->random_number( ctx, (int)pop[ i ].min_usec, (int)pop[ i ].max_usec );
+                }
+                pops->setup_timer_action( ctx, usec, (statemachine_actions_t)pop[ i ].arg );
+                break;
+            }
+
+            case bop_sample_swstates:
+                pops->sample_swstates( ctx );
+                break;
+
+            case bop_next_state:
+                pops->next_state( ctx, (statemachine_actions_t)pop[ i ].arg, pcurrent_state );
+                break;
+
+            case bop_skip_if_int_on:
+            {
+                bool int_switch1 = false;
+                bool ext_switch1 = false;
+
+                pops->read_swstates( ctx, &int_switch1, &ext_switch1 );
+                if ( int_switch1 )
+                {
+                    i += pop[ i ].arg;
+                }
+                break;
+            }
+
+            case bop_skip:
+                i += pop[ i ].arg;
+                break;
+
+            case bop_finish:
+                *pfinished = true;
+                break;
+        }
+    }
+
+    return EOK;
+}
+
+const behaviour_def_header_t* behaviour_def_header( const behaviour_def_t* pdef )
+{
+    return pdef->pheader;
+}
+
+const behaviour_def_op_t* behaviour_def_entry_ops( const behaviour_def_t* pdef, statemachine_states_t state, int* pop_count )
+{
+    const behaviour_def_entry_t* pentry = &pdef->pentries[ state ];
+
+    *pop_count = pentry->op_count;
+
+    return &pdef->pops[ pentry->first_op ];
+}
+
+int behaviour_slot_create( behaviour_slot_t** ppslot, behaviour_def_t* pdef )
+{
+    behaviour_slot_t* pslot = calloc( 1, sizeof( behaviour_slot_t ) );
+
+    return_if( pslot == NULL, ENOMEM );
+
+    pslot->pdef = pdef;
+    pthread_mutex_init( &pslot->publish_mutex, NULL );
+
+    *ppslot = pslot;
+
+    return EOK;
+}
+
+int behaviour_slot_destroy( behaviour_slot_t* pslot )
+{
+    return_if( pslot == NULL, EOK );
+
+    behaviour_def_unload( pslot->pdef );
+    pthread_mutex_destroy( &pslot->publish_mutex );
+    free( pslot );
+
+    return EOK;
+}
+
+const behaviour_def_t* behaviour_slot_read_lock( behaviour_slot_t* pslot, int* pepoch )
+{
+    int epoch = (int)( __atomic_load_n( &pslot->epoch, __ATOMIC_ACQUIRE ) & 1 );
+
+    //count ourselves in before looking at the pointer; a publisher that
+    //finds the counter empty is then sure we will see its new pointer
+    __atomic_add_fetch( &pslot->readers[ epoch ], 1, __ATOMIC_SEQ_CST );
+    *pepoch = epoch;
+
+    return __atomic_load_n( &pslot->pdef, __ATOMIC_SEQ_CST );
+}
+
+void behaviour_slot_read_unlock( behaviour_slot_t* pslot, int epoch )
+{
+    __atomic_sub_fetch( &pslot->readers[ epoch ], 1, __ATOMIC_RELEASE );
+}
+
+/*
+ * Internal function moving new readers to the other counter and waiting for the old one to drain
+ * Note: callers hold the publish mutex
+ */
+static void behaviour_slot_flip_and_wait( behaviour_slot_t* pslot )
+{
+    unsigned int old_epoch = __atomic_fetch_add( &pslot->epoch, 1, __ATOMIC_SEQ_CST ) & 1;
+
+    while ( __atomic_load_n( &pslot->readers[ old_epoch ], __ATOMIC_ACQUIRE ) != 0 )
+    {
+        usleep( BEHAVIOUR_SLOT_GRACE_POLL_USEC );
+    }
+}
+
+int behaviour_slot_publish( behaviour_slot_t* pslot, behaviour_def_t* pdef )
+{
+    //do following:
+    //swap the pointer; new readers see the new definition from here on
+    //wait out readers that may still hold the old one
+    //  a reader can pick its counter just before a flip and increment it just after,
+    //  so one flip is not enough; after the second both counters have drained once
+    //unload the old definition
+
+    pthread_mutex_lock( &pslot->publish_mutex );
+
+    behaviour_def_t* pold = __atomic_exchange_n( &pslot->pdef, pdef, __ATOMIC_SEQ_CST );
+    __atomic_add_fetch( &pslot->generation, 1, __ATOMIC_RELEASE );
+
+    behaviour_slot_flip_and_wait( pslot );
+    behaviour_slot_flip_and_wait( pslot );
+
+    pthread_mutex_unlock( &pslot->publish_mutex );
+
+    behaviour_def_unload( pold );
+
+    return EOK;
+}
+
+int behaviour_slot_reload( behaviour_slot_t* pslot, const char* path )
+{
+    behaviour_def_t* pdef;
+
+    int ret = behaviour_def_load( &pdef, path );
+    return_if( ret != EOK, ret );
+
+    behaviour_slot_publish( pslot, pdef );
+    print_stdout( STDPRINT_NAME "behaviour definition published; path=%s generation=%u\n", path, behaviour_slot_generation( pslot ) );
+
+    return EOK;
+}
+
+uint32_t behaviour_slot_generation( behaviour_slot_t* pslot )
+{
+    return __atomic_load_n( &pslot->generation, __ATOMIC_ACQUIRE );
+}
+
+const char* behaviour_def_get_opname( behaviour_opcode_t opcode )
+{
+    if ( opcode < bop_END )
+    {
+        return behaviour_def_op_names[ opcode ];
+    }
+
+    return "unknown";
+}
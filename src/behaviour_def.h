@@ -0,0 +1,193 @@
+#ifndef behaviour_def_H_
+#define behaviour_def_H_
+
+#include "statemachine.h"
+#include "behaviour.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Data driven behaviour definitions
+ *
+ * A compiled definition replaces both the transition switch in
+ * statemachine_transition and the entry switch in behaviour_enter_state.
+ * It is mapped read-only and validated once at load; afterwards a
+ * transition is one byte load and an entry runs a short op list.
+ *
+ * file layout (host endian, all offsets from file start)
+ *  header          behaviour_def_header_t
+ *  transitions     uint8_t[ state_count ][ action_count ]; next state, BEHAVIOUR_DEF_REJECT flagged
+ *  entries         behaviour_def_entry_t[ state_count ]
+ *  ops             behaviour_def_op_t[ op_count ]
+ *
+ * Text sources are compiled with tools/behaviour_compile.
+ */
+
+#define BEHAVIOUR_DEF_MAGIC                 0x44424255  //"UBBD"
+#define BEHAVIOUR_DEF_VERSION               1
+#define BEHAVIOUR_DEF_REJECT                0x80        //pair is rejected (EINVAL); low bits still give the next state
+#define BEHAVIOUR_DEF_STATE_MASK            0x7F
+
+typedef enum
+{
+    bop_motor,              //arg: arm_movement_state_t
+    bop_arm_home,           //move back, or feed the switch levels back if already home
+    bop_timer,              //arg: action; fires after min_usec, or random in [min_usec, max_usec]
+    bop_sample_swstates,
+    bop_next_state,         //arg: action applied right away
+    bop_skip_if_int_on,     //arg: ops to skip when the internal switch is on
+    bop_skip,               //arg: ops to skip
+    bop_finish,             //box reached its final state
+    bop_END,   //not valid; marks end of enum
+} behaviour_opcode_t;
+
+typedef struct
+{
+    uint32_t        magic;
+    uint16_t        version;
+    uint8_t         state_count;
+    uint8_t         action_count;
+    uint32_t        file_size;
+    uint32_t        transitions_offset;
+    uint32_t        entries_offset;
+    uint32_t        ops_offset;
+    uint32_t        op_count;
+} behaviour_def_header_t;
+
+typedef struct
+{
+    uint16_t        first_op;
+    uint16_t        op_count;
+} behaviour_def_entry_t;
+
+typedef struct
+{
+    uint8_t         opcode;
+    uint8_t         arg;
+    uint16_t        reserved;
+    uint32_t        min_usec;
+    uint32_t        max_usec;
+} behaviour_def_op_t;
+
+typedef struct behaviour_def behaviour_def_t;
+
+/*
+ * Maps and validates a compiled definition
+ * the file is used in place; replace it by rename, never rewrite it while loaded
+ *
+ * ppdef        pointer to receive the definition
+ * path         compiled definition file
+ *
+ * returns EOK on success; EILSEQ if the file fails validation; EErr type otherwise
+ */
+int behaviour_def_load( behaviour_def_t** ppdef, const char* path );
+
+/*
+ * Validates and wraps a definition already in memory; the buffer is not copied
+ * and must outlive the definition
+ *
+ * returns EOK on success; EILSEQ if the buffer fails validation; EErr type otherwise
+ */
+int behaviour_def_from_buffer( behaviour_def_t** ppdef, const void* pbuf, size_t size );
+
+/*
+ * Unmaps a definition
+ *
+ * returns EOK always
+ */
+int behaviour_def_unload( behaviour_def_t* pdef );
+
+/*
+ * Evaluates the transition table of a definition
+ * same contract as statemachine_transition
+ *
+ * thread-safe: yes (pure)
+ */
+int behaviour_def_transition( const behaviour_def_t* pdef, statemachine_states_t current_state, statemachine_actions_t action, statemachine_states_t* pnext_state );
+
+/*
+ * Runs the entry ops of a newly entered state
+ * same contract as behaviour_enter_state
+ */
+int behaviour_def_enter_state( const behaviour_def_t* pdef, const box_ops_t* pops, void* ctx, statemachine_states_t* pcurrent_state, bool* pfinished );
+
+/*
+ * Raw access for tools
+ */
+const behaviour_def_header_t* behaviour_def_header( const behaviour_def_t* pdef );
+const behaviour_def_op_t* behaviour_def_entry_ops( const behaviour_def_t* pdef, statemachine_states_t state, int* pop_count );
+
+/*
+ * Hot swappable definition
+ *
+ * A slot publishes the definition in use with one atomic pointer swap.
+ * Readers bracket each use with read_lock/read_unlock; they never block
+ * and keep whichever version they started with. The publisher waits for
+ * readers of the old version to drain (two reader epochs, SRCU style)
+ * before unmapping it, so only the publishing thread ever waits.
+ *
+ * A slot holding NULL means the builtin tables.
+ */
+typedef struct behaviour_slot behaviour_slot_t;
+
+/*
+ * Creates a slot
+ *
+ * ppslot       pointer to receive the slot
+ * pdef         initial definition, owned by the slot from now on; NULL for builtin
+ *
+ * returns EOK on success; EErr type otherwise
+ */
+int behaviour_slot_create( behaviour_slot_t** ppslot, behaviour_def_t* pdef );
+
+/*
+ * Destroys a slot and unloads its definition; no readers may remain
+ *
+ * returns EOK always
+ */
+int behaviour_slot_destroy( behaviour_slot_t* pslot );
+
+/*
+ * Enters a read section and returns the current definition (NULL for builtin)
+ *
+ * thread-safe: yes; never blocks; sections may nest
+ *
+ * pepoch       receives the token to pass to behaviour_slot_read_unlock
+ */
+const behaviour_def_t* behaviour_slot_read_lock( behaviour_slot_t* pslot, int* pepoch );
+
+/*
+ * Leaves a read section; the definition returned by read_lock must not be used afterwards
+ */
+void behaviour_slot_read_unlock( behaviour_slot_t* pslot, int epoch );
+
+/*
+ * Publishes a new definition and unloads the previous one once no reader uses it
+ * blocks the caller (only) for the grace period
+ *
+ * pdef         definition owned by the slot from now on; NULL for builtin
+ *
+ * returns EOK always
+ */
+int behaviour_slot_publish( behaviour_slot_t* pslot, behaviour_def_t* pdef );
+
+/*
+ * Loads, validates and publishes a definition file
+ * the current definition stays in place if the file is rejected
+ *
+ * returns EOK on success; EErr type from behaviour_def_load otherwise
+ */
+int behaviour_slot_reload( behaviour_slot_t* pslot, const char* path );
+
+/*
+ * Number of definitions published since the slot was created
+ */
+uint32_t behaviour_slot_generation( behaviour_slot_t* pslot );
+
+/*
+ * Converts opcode enum to string literal
+ */
+const char* behaviour_def_get_opname( behaviour_opcode_t opcode );
+
+#endif
@@ -0,0 +1,279 @@
+#include "behaviour_dispatch.h"
+#include "rtmode.h"
+#include "trace.h"
+#include "util.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+
+#define STDPRINT_NAME                       __FILE__ ":"
+
+#define BEHAVIOUR_DISPATCH_QUEUE_SIZE       16
+
+typedef struct
+{
+    behaviour_handler_t                     handler;
+    int                                     flags;
+} behaviour_dispatch_handler_t;
+
+typedef struct
+{
+    behaviour_handler_t                     handler;
+    const box_ops_t*                        pops;
+    void*                                   ctx;
+    statemachine_states_t                   state;
+    behaviour_hook_t                        hook;
+} behaviour_dispatch_call_t;
+
+struct behaviour_dispatch
+{
+    uint64_t                                budget_nsec;
+    behaviour_dispatch_handler_t            handlers[ ss_END ][ bh_END ];
+    pthread_mutex_t                         mutex_stats;
+    behaviour_dispatch_stats_t              stats[ ss_END ][ bh_END ];
+    pthread_t                               tid;
+    pthread_mutex_t                         mutex_queue;
+    pthread_cond_t                          signal_queue;
+    bool                                    running;
+    unsigned                                head;           //next call to run
+    unsigned                                count;
+    behaviour_dispatch_call_t               queue[ BEHAVIOUR_DISPATCH_QUEUE_SIZE ];
+};
+
+/*
+ * Internal function running one handler and recording its run time
+ */
+static int behaviour_dispatch_run( behaviour_dispatch_t* pdispatch, const behaviour_dispatch_call_t* pcall, statemachine_states_t* pcurrent_state, bool* pfinished, bool deferred )
+{
+    uint64_t start_nsec = get_monotonic_nsec();
+    int ret = pcall->handler( pcall->pops, pcall->ctx, pcurrent_state, pfinished );
+    uint64_t elapsed_nsec = get_monotonic_nsec() - start_nsec;
+    behaviour_dispatch_stats_t* pstats = &pdispatch->stats[ pcall->state ][ pcall->hook ];
+
+    pthread_mutex_lock( &pdispatch->mutex_stats );
+    latency_hist_record( &pstats->hist, elapsed_nsec );
+    if ( deferred )
+    {
+        pstats->deferred++;
+    }
+    else if ( ( pdispatch->budget_nsec > 0 ) && ( elapsed_nsec > pdispatch->budget_nsec ) )
+    {
+        pstats->overruns++;
+        printlvl_stderr( verblvl_more, STDPRINT_NAME "%s handler over budget; state=%s usec=%llu\n",
+            ( pcall->hook == bh_entry ) ? "entry" : "exit",
+            statemachine_get_statename( pcall->state ),
+            (unsigned long long)( elapsed_nsec / 1000 ) );
+    }
+    pthread_mutex_unlock( &pdispatch->mutex_stats );
+
+    return ret;
+}
+
+static void* behaviour_dispatch_helper_entry( void* args )
+{
+    behaviour_dispatch_t* pdispatch = (behaviour_dispatch_t*)args;
+
+    //whatever deferred handlers apply counts as entry behaviour
+    trace_set_source( trace_src_entry );
+
+    pthread_mutex_lock( &pdispatch->mutex_queue );
+    for (;;)
+    {
+        while ( ( pdispatch->count == 0 ) && pdispatch->running )
+        {
+            pthread_cond_wait( &pdispatch->signal_queue, &pdispatch->mutex_queue );
+        }
+
+        if ( pdispatch->count == 0 )
+        {
+            break;
+        }
+
+        behaviour_dispatch_call_t call = pdispatch->queue[ pdispatch->head ];
+        pdispatch->head = ( pdispatch->head + 1 ) % BEHAVIOUR_DISPATCH_QUEUE_SIZE;
+        pdispatch->count--;
+        pthread_mutex_unlock( &pdispatch->mutex_queue );
+
+        //results go nowhere; the caller has moved on already
+        statemachine_states_t state = call.state;
+        bool finished = false;
+
+        behaviour_dispatch_run( pdispatch, &call, &state, &finished, true );
+
+        pthread_mutex_lock( &pdispatch->mutex_queue );
+    }
+    pthread_mutex_unlock( &pdispatch->mutex_queue );
+
+    return NULL;
+}
+
+/*
+ * Internal function running a handler inline or handing it to the helper
+ */
+static int behaviour_dispatch_call( behaviour_dispatch_t* pdispatch, behaviour_hook_t hook, const box_ops_t* pops, void* ctx, statemachine_states_t* pcurrent_state, bool* pfinished )
+{
+    const behaviour_dispatch_handler_t* phandler = &pdispatch->handlers[ *pcurrent_state ][ hook ];
+    behaviour_dispatch_call_t call;
+
+    return_if( phandler->handler == NULL, EOK );
+
+    call.handler = phandler->handler;
+    call.pops = pops;
+    call.ctx = ctx;
+    call.state = *pcurrent_state;
+    call.hook = hook;
+
+    if ( phandler->flags & BEHAVIOUR_DISPATCH_DEFERRED )
+    {
+        pthread_mutex_lock( &pdispatch->mutex_queue );
+        if ( pdispatch->count < BEHAVIOUR_DISPATCH_QUEUE_SIZE )
+        {
+            pdispatch->queue[ ( pdispatch->head + pdispatch->count ) % BEHAVIOUR_DISPATCH_QUEUE_SIZE ] = call;
+            pdispatch->count++;
+            pthread_cond_signal( &pdispatch->signal_queue );
+            pthread_mutex_unlock( &pdispatch->mutex_queue );
+            return EOK;
+        }
+        pthread_mutex_unlock( &pdispatch->mutex_queue );
+
+        print_stderr( STDPRINT_NAME "helper queue full; running inline; state=%s\n", statemachine_get_statename( call.state ) );
+    }
+
+    return behaviour_dispatch_run( pdispatch, &call, pcurrent_state, pfinished, false );
+}
+
+int behaviour_dispatch_create( behaviour_dispatch_t** ppdispatch, int budget_usec )
+{
+    behaviour_dispatch_t* pdispatch = calloc( 1, sizeof( behaviour_dispatch_t ) );
+    pthread_attr_t attr;
+    int state;
+    int hook;
+    int ret;
+
+    return_if( pdispatch == NULL, ENOMEM );
+
+    pdispatch->budget_nsec = (uint64_t)budget_usec * 1000;
+
+    for ( state = 0; state < ss_END; state++ )
+    {
+        pdispatch->handlers[ state ][ bh_entry ].handler = behaviour_get_entry_handler( state );
+
+        for ( hook = 0; hook < bh_END; hook++ )
+        {
+            latency_hist_init( &pdispatch->stats[ state ][ hook ].hist );
+        }
+    }
+
+    pthread_mutex_init( &pdispatch->mutex_stats, NULL );
+    pthread_mutex_init( &pdispatch->mutex_queue, NULL );
+    pthread_cond_init( &pdispatch->signal_queue, NULL );
+    pdispatch->running = true;
+
+    ret = rtmode_thread_attr_init( &attr, rt_role_dispatch );
+    if ( ret == EOK )
+    {
+        ret = pthread_create( &pdispatch->tid, &attr, behaviour_dispatch_helper_entry, pdispatch );
+        pthread_attr_destroy( &attr );
+    }
+
+    if ( ret != EOK )
+    {
+        pthread_cond_destroy( &pdispatch->signal_queue );
+        pthread_mutex_destroy( &pdispatch->mutex_queue );
+        pthread_mutex_destroy( &pdispatch->mutex_stats );
+        free( pdispatch );
+        return ret;
+    }
+
+    *ppdispatch = pdispatch;
+
+    return EOK;
+}
+
+int behaviour_dispatch_destroy( behaviour_dispatch_t* pdispatch )
+{
+    return_if( pdispatch == NULL, EOK );
+
+    pthread_mutex_lock( &pdispatch->mutex_queue );
+    pdispatch->running = false;
+    pthread_cond_signal( &pdispatch->signal_queue );
+    pthread_mutex_unlock( &pdispatch->mutex_queue );
+
+    pthread_join( pdispatch->tid, NULL );
+
+    pthread_cond_destroy( &pdispatch->signal_queue );
+    pthread_mutex_destroy( &pdispatch->mutex_queue );
+    pthread_mutex_destroy( &pdispatch->mutex_stats );
+    free( pdispatch );
+
+    return EOK;
+}
+
+int behaviour_dispatch_register( behaviour_dispatch_t* pdispatch, statemachine_states_t state, behaviour_hook_t hook, behaviour_handler_t handler, int flags )
+{
+    return_if( ( (unsigned)state >= ss_END ) || ( (unsigned)hook >= bh_END ), EINVAL );
+
+    pdispatch->handlers[ state ][ hook ].handler = handler;
+    pdispatch->handlers[ state ][ hook ].flags = flags;
+
+    return EOK;
+}
+
+int behaviour_dispatch_exit( behaviour_dispatch_t* pdispatch, const box_ops_t* pops, void* ctx, statemachine_states_t state, bool* pfinished )
+{
+    return_if( (unsigned)state >= ss_END, EINVAL );
+
+    //leaving a state does not move the caller anywhere
+    return behaviour_dispatch_call( pdispatch, bh_exit, pops, ctx, &state, pfinished );
+}
+
+int behaviour_dispatch_enter( behaviour_dispatch_t* pdispatch, const box_ops_t* pops, void* ctx, statemachine_states_t* pcurrent_state, bool* pfinished )
+{
+    if ( (unsigned)*pcurrent_state >= ss_END )
+    {
+        //unknown state (should never happen)
+        print_stderr( STDPRINT_NAME "unknown state entered; currentstate=%d\n", *pcurrent_state );
+        return EINVAL;
+    }
+
+    return behaviour_dispatch_call( pdispatch, bh_entry, pops, ctx, pcurrent_state, pfinished );
+}
+
+void behaviour_dispatch_get_stats( behaviour_dispatch_t* pdispatch, statemachine_states_t state, behaviour_hook_t hook, behaviour_dispatch_stats_t* pstats )
+{
+    pthread_mutex_lock( &pdispatch->mutex_stats );
+    *pstats = pdispatch->stats[ state ][ hook ];
+    pthread_mutex_unlock( &pdispatch->mutex_stats );
+}
+
+void behaviour_dispatch_report( behaviour_dispatch_t* pdispatch, FILE* pout )
+{
+    int state;
+    int hook;
+
+    pthread_mutex_lock( &pdispatch->mutex_stats );
+    for ( state = 0; state < ss_END; state++ )
+    {
+        for ( hook = 0; hook < bh_END; hook++ )
+        {
+            const behaviour_dispatch_stats_t* pstats = &pdispatch->stats[ state ][ hook ];
+
+            if ( pstats->hist.count == 0 )
+            {
+                continue;
+            }
+
+            fprintf( pout, "  %-22s %-5s calls=%llu mean=%lluus p99=%lluus max=%lluus overruns=%llu deferred=%llu\n",
+                statemachine_get_statename( state ),
+                ( hook == bh_entry ) ? "entry" : "exit",
+                (unsigned long long)pstats->hist.count,
+                (unsigned long long)( latency_hist_mean( &pstats->hist ) / 1000 ),
+                (unsigned long long)( latency_hist_percentile( &pstats->hist, 99.0 ) / 1000 ),
+                (unsigned long long)( pstats->hist.max_nsec / 1000 ),
+                (unsigned long long)pstats->overruns,
+                (unsigned long long)pstats->deferred );
+        }
+    }
+    pthread_mutex_unlock( &pdispatch->mutex_stats );
+}
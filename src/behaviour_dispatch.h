@@ -0,0 +1,93 @@
+#ifndef behaviour_dispatch_H_
+#define behaviour_dispatch_H_
+
+#include "behaviour.h"
+#include "latency.h"
+
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * Per-state entry/exit handler dispatch
+ *
+ * Each state has an entry and an exit handler in a table indexed by state,
+ * filled with the builtin entry behaviour at create. Every call is timed;
+ * inline handlers running over the budget are counted as overruns.
+ *
+ * Handlers registered with BEHAVIOUR_DISPATCH_DEFERRED run on a helper
+ * thread so the caller can go back to waiting for the next transition.
+ * A deferred handler may still drive the box through pops, but whatever
+ * it writes to its state and finished arguments is discarded. If the
+ * helper queue is full the handler runs inline.
+ */
+
+#define BEHAVIOUR_DISPATCH_DEFERRED         0x01    //run on the helper thread
+
+typedef enum
+{
+    bh_entry,
+    bh_exit,
+    bh_END,   //not valid; marks end of enum
+} behaviour_hook_t;
+
+typedef struct
+{
+    uint64_t        overruns;       //inline calls over budget
+    uint64_t        deferred;       //calls run on the helper thread
+    latency_hist_t  hist;           //handler run time
+} behaviour_dispatch_stats_t;
+
+typedef struct behaviour_dispatch behaviour_dispatch_t;
+
+/*
+ * Creates a dispatcher holding the builtin entry handlers and no exit handlers
+ *
+ * ppdispatch   pointer to receive the dispatcher
+ * budget_usec  inline run time above which a call counts as an overrun; 0 disables
+ *
+ * returns EOK on success; EErr type otherwise
+ */
+int behaviour_dispatch_create( behaviour_dispatch_t** ppdispatch, int budget_usec );
+
+/*
+ * Runs what the helper still has queued and destroys the dispatcher
+ *
+ * returns EOK always
+ */
+int behaviour_dispatch_destroy( behaviour_dispatch_t* pdispatch );
+
+/*
+ * Replaces the entry or exit handler of a state
+ * not thread-safe against dispatching; register before the first transition
+ *
+ * handler      handler to run; NULL runs nothing
+ * flags        BEHAVIOUR_DISPATCH_ flags
+ *
+ * returns EOK on success; EINVAL for unknown states or hooks
+ */
+int behaviour_dispatch_register( behaviour_dispatch_t* pdispatch, statemachine_states_t state, behaviour_hook_t hook, behaviour_handler_t handler, int flags );
+
+/*
+ * Runs the exit handler of the state being left
+ *
+ * returns the handler's result; EOK if there is none or it was deferred
+ */
+int behaviour_dispatch_exit( behaviour_dispatch_t* pdispatch, const box_ops_t* pops, void* ctx, statemachine_states_t state, bool* pfinished );
+
+/*
+ * Runs the entry handler of the state just entered
+ * same contract as behaviour_enter_state
+ */
+int behaviour_dispatch_enter( behaviour_dispatch_t* pdispatch, const box_ops_t* pops, void* ctx, statemachine_states_t* pcurrent_state, bool* pfinished );
+
+/*
+ * Retrieves timing of one handler; deferred calls may lag by the helper queue
+ */
+void behaviour_dispatch_get_stats( behaviour_dispatch_t* pdispatch, statemachine_states_t state, behaviour_hook_t hook, behaviour_dispatch_stats_t* pstats );
+
+/*
+ * Writes one line per handler that ran: calls, mean, p99, max, overruns and deferred calls
+ */
+void behaviour_dispatch_report( behaviour_dispatch_t* pdispatch, FILE* pout );
+
+#endif
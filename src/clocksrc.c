@@ -0,0 +1,211 @@
+#include "clocksrc.h"
+#include "util.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define STDPRINT_NAME                       __FILE__ ":"
+
+typedef struct clocksrc_sleeper
+{
+    uint64_t                                deadline_nsec;
+    struct clocksrc_sleeper*                pnext;
+} clocksrc_sleeper_t;
+
+struct clocksrc
+{
+    bool                                    is_virtual;
+    uint64_t                                now_nsec;       //virtual only; atomically read
+    int                                     participants;
+    pthread_mutex_t                         mutex;
+    pthread_cond_t                          signal_advanced;
+    clocksrc_sleeper_t*                     psleepers;      //sleepers live on their own stacks
+    int                                     sleeper_count;
+};
+
+static clocksrc_t                           clocksrc_real =
+    {
+        .is_virtual             = false,
+        .now_nsec               = 0,
+        .participants           = 0,
+        .mutex                  = PTHREAD_MUTEX_INITIALIZER,
+        .signal_advanced        = PTHREAD_COND_INITIALIZER,
+        .psleepers              = NULL,
+        .sleeper_count          = 0,
+    };
+
+clocksrc_t* clocksrc_get_real( void )
+{
+    return &clocksrc_real;
+}
+
+int clocksrc_create_virtual( clocksrc_t** ppclk, uint64_t start_nsec, int participants )
+{
+    clocksrc_t* pclk = calloc( 1, sizeof( clocksrc_t ) );
+
+    return_if( pclk == NULL, ENOMEM );
+
+    pclk->is_virtual = true;
+    pclk->now_nsec = start_nsec;
+    pclk->participants = participants;
+    pthread_mutex_init( &pclk->mutex, NULL );
+    pthread_cond_init( &pclk->signal_advanced, NULL );
+
+    *ppclk = pclk;
+
+    return EOK;
+}
+
+int clocksrc_destroy( clocksrc_t* pclk )
+{
+    return_if( ( pclk == NULL ) || !pclk->is_virtual, EOK );
+
+    pthread_cond_destroy( &pclk->signal_advanced );
+    pthread_mutex_destroy( &pclk->mutex );
+    free( pclk );
+
+    return EOK;
+}
+
+bool clocksrc_is_virtual( clocksrc_t* pclk )
+{
+    return pclk->is_virtual;
+}
+
+uint64_t clocksrc_now_nsec( clocksrc_t* pclk )
+{
+    if ( !pclk->is_virtual )
+    {
+        return get_monotonic_nsec();
+    }
+
+    return __atomic_load_n( &pclk->now_nsec, __ATOMIC_ACQUIRE );
+}
+
+/*
+ * Internal function moving virtual time forward and waking sleepers
+ * Note: callers hold the clock mutex
+ */
+static void clocksrc_advance_to_nolock( clocksrc_t* pclk, uint64_t now_nsec )
+{
+    if ( now_nsec > pclk->now_nsec )
+    {
+        __atomic_store_n( &pclk->now_nsec, now_nsec, __ATOMIC_RELEASE );
+        pthread_cond_broadcast( &pclk->signal_advanced );
+    }
+}
+
+/*
+ * Internal function finding the earliest sleeper deadline
+ * Note: callers hold the clock mutex
+ */
+static bool clocksrc_next_deadline_nolock( clocksrc_t* pclk, uint64_t* pdeadline_nsec )
+{
+    clocksrc_sleeper_t* psleeper;
+    bool found = false;
+
+    for ( psleeper = pclk->psleepers; psleeper != NULL; psleeper = psleeper->pnext )
+    {
+        if ( !found || ( psleeper->deadline_nsec < *pdeadline_nsec ) )
+        {
+            *pdeadline_nsec = psleeper->deadline_nsec;
+            found = true;
+        }
+    }
+
+    return found;
+}
+
+int clocksrc_sleep_until( clocksrc_t* pclk, uint64_t deadline_nsec )
+{
+    if ( !pclk->is_virtual )
+    {
+        struct timespec ts;
+        int ret;
+
+        ts.tv_sec = deadline_nsec / 1000000000ULL;
+        ts.tv_nsec = deadline_nsec % 1000000000ULL;
+
+        do
+        {
+            ret = clock_nanosleep( CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL );
+        } while ( ret == EINTR );
+
+        return ret;
+    }
+
+    //do following:
+    //lock the clock
+    //register as sleeper
+    //if all participants now sleep, jump to the earliest deadline
+    //block until time reaches our deadline
+    //unregister and unlock
+
+    clocksrc_sleeper_t sleeper;
+
+    pthread_mutex_lock( &pclk->mutex );
+
+    if ( pclk->now_nsec < deadline_nsec )
+    {
+        sleeper.deadline_nsec = deadline_nsec;
+        sleeper.pnext = pclk->psleepers;
+        pclk->psleepers = &sleeper;
+        pclk->sleeper_count++;
+
+        if ( ( pclk->participants > 0 ) && ( pclk->sleeper_count >= pclk->participants ) )
+        {
+            uint64_t next_nsec = deadline_nsec;
+
+            clocksrc_next_deadline_nolock( pclk, &next_nsec );
+            clocksrc_advance_to_nolock( pclk, next_nsec );
+        }
+
+        while ( pclk->now_nsec < deadline_nsec )
+        {
+            pthread_cond_wait( &pclk->signal_advanced, &pclk->mutex );
+        }
+
+        //unlink
+        clocksrc_sleeper_t** ppsleeper = &pclk->psleepers;
+        while ( *ppsleeper != &sleeper )
+        {
+            ppsleeper = &(*ppsleeper)->pnext;
+        }
+        *ppsleeper = sleeper.pnext;
+        pclk->sleeper_count--;
+    }
+
+    pthread_mutex_unlock( &pclk->mutex );
+
+    return EOK;
+}
+
+int clocksrc_sleep_usec( clocksrc_t* pclk, int usec )
+{
+    return clocksrc_sleep_until( pclk, clocksrc_now_nsec( pclk ) + ( (uint64_t)usec * 1000ULL ) );
+}
+
+int clocksrc_advance_to( clocksrc_t* pclk, uint64_t now_nsec )
+{
+    return_if( !pclk->is_virtual, EINVAL );
+
+    pthread_mutex_lock( &pclk->mutex );
+    clocksrc_advance_to_nolock( pclk, now_nsec );
+    pthread_mutex_unlock( &pclk->mutex );
+
+    return EOK;
+}
+
+int clocksrc_next_deadline( clocksrc_t* pclk, uint64_t* pdeadline_nsec )
+{
+    bool found;
+
+    pthread_mutex_lock( &pclk->mutex );
+    found = clocksrc_next_deadline_nolock( pclk, pdeadline_nsec );
+    pthread_mutex_unlock( &pclk->mutex );
+
+    return found ? EOK : ENOENT;
+}
@@ -0,0 +1,82 @@
+#ifndef clocksrc_H_
+#define clocksrc_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Clock source abstraction
+ *
+ * real     CLOCK_MONOTONIC; sleeps block in the kernel
+ * virtual  time only moves when advanced; sleepers block until then
+ *
+ * A virtual clock created with participants > 0 advances itself: once that
+ * many threads sleep on it, time jumps straight to the earliest sleeper deadline.
+ * Otherwise a driver (e.g. the fleet runtime) calls clocksrc_advance_to.
+ */
+typedef struct clocksrc clocksrc_t;
+
+/*
+ * Retrieves the shared real (monotonic) clock
+ */
+clocksrc_t* clocksrc_get_real( void );
+
+/*
+ * Creates a virtual clock
+ *
+ * ppclk            pointer to receive the clock
+ * start_nsec       initial time
+ * participants     self-advance once this many threads sleep; 0 for driver advanced
+ *
+ * returns EOK on success; EErr type otherwise describing the failure
+ */
+int clocksrc_create_virtual( clocksrc_t** ppclk, uint64_t start_nsec, int participants );
+
+/*
+ * Destroys a virtual clock; the real clock is left alone
+ *
+ * returns EOK always
+ */
+int clocksrc_destroy( clocksrc_t* pclk );
+
+/*
+ * true for virtual clocks
+ */
+bool clocksrc_is_virtual( clocksrc_t* pclk );
+
+/*
+ * Current time in nanoseconds
+ *
+ * thread-safe: yes
+ */
+uint64_t clocksrc_now_nsec( clocksrc_t* pclk );
+
+/*
+ * Blocks until the clock reaches deadline_nsec
+ *
+ * thread-safe: yes
+ *
+ * returns EOK on success; EErr type otherwise describing the failure
+ */
+int clocksrc_sleep_until( clocksrc_t* pclk, uint64_t deadline_nsec );
+
+/*
+ * Blocks for usec on the clock
+ */
+int clocksrc_sleep_usec( clocksrc_t* pclk, int usec );
+
+/*
+ * Moves a virtual clock forward (never back) and wakes due sleepers
+ *
+ * returns EOK on success; EINVAL for the real clock
+ */
+int clocksrc_advance_to( clocksrc_t* pclk, uint64_t now_nsec );
+
+/*
+ * Retrieves the earliest deadline any thread sleeps on
+ *
+ * returns EOK when a sleeper exists; ENOENT otherwise
+ */
+int clocksrc_next_deadline( clocksrc_t* pclk, uint64_t* pdeadline_nsec );
+
+#endif
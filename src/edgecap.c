@@ -0,0 +1,387 @@
+#include "edgecap.h"
+#include "clocksrc.h"
+#include "util.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define STDPRINT_NAME                       __FILE__ ":"
+
+#define EDGECAP_RING_SIZE                   16384   //power of two; ~1.6s of continuous 100us bounce
+#define EDGECAP_ENCODE_BUFFER               65536
+#define EDGECAP_RECORD_MAX                  11      //10 byte varint + event byte
+#define EDGECAP_DRAIN_USEC                  5000
+#define EDGECAP_HEADER_V1_SIZE              16      //no input snapshot
+
+#define EDGECAP_EVENT_OUTPUT                0x80
+#define EDGECAP_EVENT_LEVEL                 0x40
+#define EDGECAP_EVENT_PIN_MASK              0x3F
+
+typedef struct
+{
+    uint64_t                                seq;            //index + 1 once published
+    uint64_t                                ts_nsec;
+    uint8_t                                 event;
+} edgecap_slot_t;
+
+struct edgecap_writer
+{
+    int                                     fd;
+    pthread_t                               tid;
+    volatile bool                           running;
+    edgecap_file_header_t                   header;         //rewritten in place by set_snapshot
+    uint64_t                                head;           //next slot to claim
+    uint64_t                                tail;           //next slot to encode
+    uint64_t                                dropped;
+    uint64_t                                last_nsec;      //encoder only
+    int                                     buffer_len;     //encoder only
+    uint8_t                                 buffer[ EDGECAP_ENCODE_BUFFER ];
+    edgecap_slot_t                          ring[ EDGECAP_RING_SIZE ];
+};
+
+struct edgecap_reader
+{
+    int                                     fd;
+    const uint8_t*                          pmap;
+    size_t                                  map_size;
+    const uint8_t*                          pfirst;         //first record; after a header of either version
+    const uint8_t*                          pnext;
+    const uint8_t*                          pend;
+    uint64_t                                start_nsec;
+    uint64_t                                ts_nsec;
+    uint32_t                                snapshot_pins;
+    uint32_t                                snapshot_levels;
+};
+
+/*
+ * Internal function writing a whole buffer, retrying short writes
+ */
+static int edgecap_write_all( int fd, const uint8_t* pbuf, size_t size )
+{
+    while ( size > 0 )
+    {
+        ssize_t written = write( fd, pbuf, size );
+
+        if ( written < 0 )
+        {
+            if ( errno == EINTR )
+            {
+                continue;
+            }
+            return errno;
+        }
+
+        pbuf += written;
+        size -= written;
+    }
+
+    return EOK;
+}
+
+static int edgecap_flush( edgecap_writer_t* pcap )
+{
+    int ret = edgecap_write_all( pcap->fd, pcap->buffer, pcap->buffer_len );
+
+    pcap->buffer_len = 0;
+
+    return ret;
+}
+
+/*
+ * Internal function encoding all published slots
+ * Note: encoder thread only (or after it has been joined)
+ */
+static void edgecap_drain( edgecap_writer_t* pcap )
+{
+    uint64_t tail = pcap->tail;
+
+    for (;;)
+    {
+        edgecap_slot_t* pslot = &pcap->ring[ tail & ( EDGECAP_RING_SIZE - 1 ) ];
+
+        if ( __atomic_load_n( &pslot->seq, __ATOMIC_ACQUIRE ) != ( tail + 1 ) )
+        {
+            break;
+        }
+
+        if ( pcap->buffer_len > ( EDGECAP_ENCODE_BUFFER - EDGECAP_RECORD_MAX ) )
+        {
+            edgecap_flush( pcap );
+        }
+
+        //racing producers may stamp slightly out of claim order; never go back in time
+        uint64_t delta = ( pslot->ts_nsec > pcap->last_nsec ) ? ( pslot->ts_nsec - pcap->last_nsec ) : 0;
+        uint8_t* pout = &pcap->buffer[ pcap->buffer_len ];
+
+        pcap->last_nsec += delta;
+
+        while ( delta >= 0x80 )
+        {
+            *pout++ = (uint8_t)( delta | 0x80 );
+            delta >>= 7;
+        }
+        *pout++ = (uint8_t)delta;
+        *pout++ = pslot->event;
+
+        pcap->buffer_len = (int)( pout - pcap->buffer );
+
+        tail++;
+        __atomic_store_n( &pcap->tail, tail, __ATOMIC_RELEASE );
+    }
+}
+
+static void* edgecap_encoder_entry( void* args )
+{
+    edgecap_writer_t* pcap = (edgecap_writer_t*)args;
+
+    while ( pcap->running )
+    {
+        edgecap_drain( pcap );
+        clocksrc_sleep_usec( clocksrc_get_real(), EDGECAP_DRAIN_USEC );
+    }
+
+    return NULL;
+}
+
+int edgecap_writer_open( edgecap_writer_t** ppcap, const char* path )
+{
+    edgecap_writer_t* pcap = calloc( 1, sizeof( edgecap_writer_t ) );
+    int ret;
+
+    return_if( pcap == NULL, ENOMEM );
+
+    pcap->fd = open( path, O_WRONLY | O_CREAT | O_TRUNC, 0644 );
+    if ( pcap->fd < 0 )
+    {
+        ret = errno;
+        print_stderr( STDPRINT_NAME "failed to create capture; path=%s err=%d\n", path, ret );
+        free( pcap );
+        return ret;
+    }
+
+    pcap->last_nsec = get_monotonic_nsec();
+
+    pcap->header.magic = EDGECAP_FILE_MAGIC;
+    pcap->header.version = EDGECAP_FILE_VERSION;
+    pcap->header.start_nsec = pcap->last_nsec;
+
+    ret = edgecap_write_all( pcap->fd, (const uint8_t*)&pcap->header, sizeof( pcap->header ) );
+    if ( ret == EOK )
+    {
+        pcap->running = true;
+        ret = pthread_create( &pcap->tid, NULL, edgecap_encoder_entry, pcap );
+    }
+
+    if ( ret != EOK )
+    {
+        close( pcap->fd );
+        free( pcap );
+        return ret;
+    }
+
+    *ppcap = pcap;
+
+    return EOK;
+}
+
+int edgecap_writer_close( edgecap_writer_t* pcap )
+{
+    return_if( pcap == NULL, EOK );
+
+    pcap->running = false;
+    pthread_join( pcap->tid, NULL );
+
+    edgecap_drain( pcap );
+    int ret = edgecap_flush( pcap );
+
+    if ( pcap->dropped > 0 )
+    {
+        print_stderr( STDPRINT_NAME "capture ring overflowed; dropped=%llu\n", (unsigned long long)pcap->dropped );
+    }
+
+    close( pcap->fd );
+    free( pcap );
+
+    return ret;
+}
+
+int edgecap_writer_set_snapshot( edgecap_writer_t* pcap, uint32_t pins, uint32_t levels )
+{
+    pcap->header.snapshot_pins = pins;
+    pcap->header.snapshot_levels = levels & pins;
+
+    //positional; the encoder keeps appending at its own file offset
+    return_if( pwrite( pcap->fd, &pcap->header, sizeof( pcap->header ), 0 ) != (ssize_t)sizeof( pcap->header ), errno );
+
+    return EOK;
+}
+
+int edgecap_record( edgecap_writer_t* pcap, edgecap_kind_t kind, int pin, int level )
+{
+    uint64_t now_nsec = get_monotonic_nsec();
+    uint64_t idx = __atomic_load_n( &pcap->head, __ATOMIC_RELAXED );
+
+    //claim a slot unless that would lap the encoder
+    do
+    {
+        if ( ( idx - __atomic_load_n( &pcap->tail, __ATOMIC_ACQUIRE ) ) >= EDGECAP_RING_SIZE )
+        {
+            __atomic_add_fetch( &pcap->dropped, 1, __ATOMIC_RELAXED );
+            return ENOBUFS;
+        }
+    } while ( !__atomic_compare_exchange_n( &pcap->head, &idx, idx + 1, true, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED ) );
+
+    edgecap_slot_t* pslot = &pcap->ring[ idx & ( EDGECAP_RING_SIZE - 1 ) ];
+
+    pslot->ts_nsec = now_nsec;
+    pslot->event = (uint8_t)( ( pin & EDGECAP_EVENT_PIN_MASK )
+        | ( level ? EDGECAP_EVENT_LEVEL : 0 )
+        | ( ( kind == edgecap_output ) ? EDGECAP_EVENT_OUTPUT : 0 ) );
+
+    __atomic_store_n( &pslot->seq, idx + 1, __ATOMIC_RELEASE );
+
+    return EOK;
+}
+
+uint64_t edgecap_writer_dropped( edgecap_writer_t* pcap )
+{
+    return __atomic_load_n( &pcap->dropped, __ATOMIC_RELAXED );
+}
+
+int edgecap_reader_open( edgecap_reader_t** ppcap, const char* path )
+{
+    edgecap_reader_t* pcap = calloc( 1, sizeof( edgecap_reader_t ) );
+    const edgecap_file_header_t* pheader;
+    struct stat st;
+    int ret;
+
+    return_if( pcap == NULL, ENOMEM );
+
+    pcap->fd = open( path, O_RDONLY );
+    if ( pcap->fd < 0 )
+    {
+        ret = errno;
+        free( pcap );
+        return ret;
+    }
+
+    if ( ( fstat( pcap->fd, &st ) != 0 ) || ( (size_t)st.st_size < EDGECAP_HEADER_V1_SIZE ) )
+    {
+        close( pcap->fd );
+        free( pcap );
+        return EILSEQ;
+    }
+
+    pcap->map_size = (size_t)st.st_size;
+    pcap->pmap = mmap( NULL, pcap->map_size, PROT_READ, MAP_PRIVATE, pcap->fd, 0 );
+    if ( pcap->pmap == MAP_FAILED )
+    {
+        ret = errno;
+        close( pcap->fd );
+        free( pcap );
+        return ret;
+    }
+
+    madvise( (void*)pcap->pmap, pcap->map_size, MADV_SEQUENTIAL );
+
+    pheader = (const edgecap_file_header_t*)pcap->pmap;
+    if ( ( pheader->magic != EDGECAP_FILE_MAGIC )
+            || ( ( pheader->version != 1 ) && ( pheader->version != EDGECAP_FILE_VERSION ) )
+            || ( ( pheader->version == EDGECAP_FILE_VERSION ) && ( pcap->map_size < sizeof( edgecap_file_header_t ) ) ) )
+    {
+        edgecap_reader_close( pcap );
+        return EILSEQ;
+    }
+
+    pcap->start_nsec = pheader->start_nsec;
+
+    if ( pheader->version == 1 )
+    {
+        pcap->pfirst = pcap->pmap + EDGECAP_HEADER_V1_SIZE;
+    }
+    else
+    {
+        pcap->pfirst = pcap->pmap + sizeof( edgecap_file_header_t );
+        pcap->snapshot_pins = pheader->snapshot_pins;
+        pcap->snapshot_levels = pheader->snapshot_levels;
+    }
+
+    pcap->pend = pcap->pmap + pcap->map_size;
+    edgecap_reader_rewind( pcap );
+
+    *ppcap = pcap;
+
+    return EOK;
+}
+
+int edgecap_reader_close( edgecap_reader_t* pcap )
+{
+    return_if( pcap == NULL, EOK );
+
+    munmap( (void*)pcap->pmap, pcap->map_size );
+    close( pcap->fd );
+    free( pcap );
+
+    return EOK;
+}
+
+int edgecap_reader_next( edgecap_reader_t* pcap, edgecap_event_t* pevent )
+{
+    const uint8_t* p = pcap->pnext;
+    uint64_t delta = 0;
+    int shift = 0;
+
+    return_if( p >= pcap->pend, ENOENT );
+
+    for (;;)
+    {
+        //a torn last record (writer killed mid flush) reads as end of capture
+        return_if( p >= pcap->pend, ENOENT );
+        return_if( shift > 63, EILSEQ );
+
+        delta |= (uint64_t)( *p & 0x7F ) << shift;
+        shift += 7;
+
+        if ( ( *p++ & 0x80 ) == 0 )
+        {
+            break;
+        }
+    }
+
+    return_if( p >= pcap->pend, ENOENT );
+
+    uint8_t event = *p++;
+
+    pcap->pnext = p;
+    pcap->ts_nsec += delta;
+
+    pevent->ts_nsec = pcap->ts_nsec;
+    pevent->kind = ( event & EDGECAP_EVENT_OUTPUT ) ? edgecap_output : edgecap_input;
+    pevent->pin = event & EDGECAP_EVENT_PIN_MASK;
+    pevent->level = ( event & EDGECAP_EVENT_LEVEL ) ? 1 : 0;
+
+    return EOK;
+}
+
+void edgecap_reader_rewind( edgecap_reader_t* pcap )
+{
+    pcap->pnext = pcap->pfirst;
+    pcap->ts_nsec = pcap->start_nsec;
+}
+
+uint64_t edgecap_reader_start_nsec( edgecap_reader_t* pcap )
+{
+    return pcap->start_nsec;
+}
+
+void edgecap_reader_snapshot( edgecap_reader_t* pcap, uint32_t* ppins, uint32_t* plevels )
+{
+    *ppins = pcap->snapshot_pins;
+    *plevels = pcap->snapshot_levels;
+}
@@ -0,0 +1,130 @@
+#ifndef edgecap_H_
+#define edgecap_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Raw gpio edge capture
+ *
+ * Every input edge and output write is stamped with monotonic nanoseconds.
+ * Producers only claim a slot in an in-memory ring; a background thread
+ * delta-encodes the slots and streams them to the file.
+ *
+ * file layout
+ *  header      edgecap_file_header_t (little endian)
+ *  records     varint delta_nsec, then one event byte
+ *              event byte: bit7 output write, bit6 level, bits0-5 pin
+ *
+ * Records are edges only; the header carries the input levels sampled when
+ * capturing started, so playback can begin from the same levels. Version 1
+ * files have no snapshot and read as all inputs unknown.
+ */
+
+#define EDGECAP_FILE_MAGIC                  0x43454255  //"UBEC"
+#define EDGECAP_FILE_VERSION                2
+#define EDGECAP_PIN_MAX                     63
+
+typedef enum
+{
+    edgecap_input,          //edge seen on an input pin
+    edgecap_output,         //value written to an output pin
+} edgecap_kind_t;
+
+typedef struct
+{
+    uint32_t        magic;
+    uint16_t        version;
+    uint16_t        reserved;
+    uint64_t        start_nsec;         //base for the first delta
+    uint32_t        snapshot_pins;      //bit per input pin (< 32) sampled at capture start
+    uint32_t        snapshot_levels;    //bit set for each of those sampled high
+} edgecap_file_header_t;
+
+typedef struct
+{
+    uint64_t        ts_nsec;
+    edgecap_kind_t  kind;
+    int             pin;
+    int             level;
+} edgecap_event_t;
+
+typedef struct edgecap_writer edgecap_writer_t;
+typedef struct edgecap_reader edgecap_reader_t;
+
+/*
+ * Creates a capture file and starts its encoder thread
+ *
+ * returns EOK on success; EErr type otherwise describing the failure
+ */
+int edgecap_writer_open( edgecap_writer_t** ppcap, const char* path );
+
+/*
+ * Drains pending events, stops the encoder and closes the file
+ *
+ * returns EOK on success; EErr type otherwise describing the failure
+ */
+int edgecap_writer_close( edgecap_writer_t* pcap );
+
+/*
+ * Stores the input levels at capture start in the file header
+ * may be called again as inputs are set up; the last call wins
+ *
+ * pins     bit per input pin sampled
+ * levels   bit set for each of those that is high
+ *
+ * returns EOK on success; EErr type otherwise describing the failure
+ */
+int edgecap_writer_set_snapshot( edgecap_writer_t* pcap, uint32_t pins, uint32_t levels );
+
+/*
+ * Records one event; lock free, never blocks
+ *
+ * thread-safe: yes
+ *
+ * returns EOK on success; ENOBUFS if the ring is full and the event was dropped
+ */
+int edgecap_record( edgecap_writer_t* pcap, edgecap_kind_t kind, int pin, int level );
+
+/*
+ * Number of events dropped to a full ring
+ */
+uint64_t edgecap_writer_dropped( edgecap_writer_t* pcap );
+
+/*
+ * Maps a capture file for sequential reading
+ *
+ * returns EOK on success; EILSEQ for a foreign header; EErr type otherwise
+ */
+int edgecap_reader_open( edgecap_reader_t** ppcap, const char* path );
+
+/*
+ * Unmaps and closes a reader
+ *
+ * returns EOK always
+ */
+int edgecap_reader_close( edgecap_reader_t* pcap );
+
+/*
+ * Retrieves the next event
+ *
+ * returns EOK on success; ENOENT at end of capture; EILSEQ on a damaged record
+ */
+int edgecap_reader_next( edgecap_reader_t* pcap, edgecap_event_t* pevent );
+
+/*
+ * Restarts reading from the first record
+ */
+void edgecap_reader_rewind( edgecap_reader_t* pcap );
+
+/*
+ * Base timestamp from the capture header
+ */
+uint64_t edgecap_reader_start_nsec( edgecap_reader_t* pcap );
+
+/*
+ * Input levels at capture start; ppins receives 0 if the capture has none
+ */
+void edgecap_reader_snapshot( edgecap_reader_t* pcap, uint32_t* ppins, uint32_t* plevels );
+
+#endif
@@ -0,0 +1,1036 @@
+#include "fleet.h"
+#include "util.h"
+#include "clocksrc.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define STDPRINT_NAME                       __FILE__ ":"
+#define FLEET_MAILBOX_SIZE                  16              //pending actions per box
+#define FLEET_BOX_BATCH                     FLEET_MAILBOX_SIZE //actions handled per scheduling
+#define FLEET_IDLE_WAIT_NSEC                100000000ULL    //100msec idle recheck
+
+typedef struct
+{
+    statemachine_actions_t                  action;
+    uint64_t                                post_nsec;
+} fleet_msg_t;
+
+typedef struct
+{
+    uint64_t                                deadline_nsec;
+    fleet_box_t*                            pbox;
+    statemachine_actions_t                  action;
+    fleet_timer_callback_t                  callback;       //when set, called instead of posting action
+    int                                     arg;
+    uint64_t                                seq;            //ties fire in arming order
+} fleet_timer_t;
+
+struct fleet_box
+{
+    fleet_t*                                pfleet;
+    int                                     index;
+    int                                     home_worker;
+    statemachine_t*                         psm;
+    statemachine_cid                        cid;
+    const fleet_box_hooks_t*                phooks;
+    void*                                   user;
+
+    pthread_mutex_t                         mutex;          //guards everything below
+    fleet_msg_t                             mailbox[FLEET_MAILBOX_SIZE];
+    int                                     mailbox_head;
+    int                                     mailbox_count;
+    bool                                    scheduled;      //box sits on a run queue or is being processed
+    bool                                    int_switch1;
+    bool                                    ext_switch1;
+
+    //only touched by the worker processing the box
+    statemachine_states_t                   state;
+    bool                                    entry_pending;
+    bool                                    finished;
+    arm_movement_state_t                    arm_movement;
+    unsigned int                            rand_seed;
+};
+
+typedef struct
+{
+    fleet_t*                                pfleet;
+    int                                     index;
+    pthread_t                               tid;
+
+    pthread_mutex_t                         mutex;          //guards run queue, timers and idle
+    pthread_cond_t                          signal_work;
+    fleet_box_t**                           runqueue;
+    int                                     rq_head;
+    int                                     rq_count;
+    fleet_timer_t*                          timers;         //min-heap on deadline, seq
+    int                                     timer_count;
+    int                                     timer_size;
+    uint64_t                                timer_seq;
+    bool                                    idle;
+
+    fleet_stats_t                           stats;          //written by this worker; depth under mutex
+} fleet_worker_t;
+
+struct fleet
+{
+    int                                     worker_count;
+    fleet_worker_t*                         workers;
+    int                                     box_count;
+    int                                     box_capacity;
+    fleet_box_t*                            boxes;
+    volatile bool                           running;
+    bool                                    started;
+    clocksrc_t*                             pclk;
+    int                                     active;         //scheduled boxes + firing timers; 0 when quiescent
+    pthread_mutex_t                         advance_mutex;  //serialises virtual clock advances
+    uint64_t                                horizon_nsec;   //virtual time never moves past this
+};
+
+static __thread fleet_worker_t*             fleet_worker_current = NULL;
+
+static const box_ops_t                      fleet_box_ops;
+
+/*
+ * Internal function pushing a box onto a worker run queue and waking a worker for it
+ */
+static void fleet_runqueue_push( fleet_worker_t* pworker, fleet_box_t* pbox )
+{
+    fleet_t* pfleet = pworker->pfleet;
+    int depth;
+    int i;
+
+    pthread_mutex_lock( &pworker->mutex );
+
+    pworker->runqueue[ ( pworker->rq_head + pworker->rq_count ) % pfleet->box_capacity ] = pbox;
+    pworker->rq_count++;
+    depth = pworker->rq_count;
+
+    if ( depth > pworker->stats.runqueue_depth_max )
+    {
+        pworker->stats.runqueue_depth_max = depth;
+    }
+
+    if ( pworker->idle )
+    {
+        pthread_cond_signal( &pworker->signal_work );
+    }
+
+    pthread_mutex_unlock( &pworker->mutex );
+
+    //queue is backing up; nudge one idle worker so it steals
+    if ( depth > 1 )
+    {
+        for ( i = 1; i < pfleet->worker_count; i++ )
+        {
+            fleet_worker_t* pother = &pfleet->workers[ ( pworker->index + i ) % pfleet->worker_count ];
+
+            if ( pother->idle )
+            {
+                pthread_mutex_lock( &pother->mutex );
+                pthread_cond_signal( &pother->signal_work );
+                pthread_mutex_unlock( &pother->mutex );
+                break;
+            }
+        }
+    }
+}
+
+/*
+ * Internal function popping the oldest box off the worker's own run queue
+ */
+static fleet_box_t* fleet_runqueue_pop( fleet_worker_t* pworker )
+{
+    fleet_box_t* pbox = NULL;
+
+    pthread_mutex_lock( &pworker->mutex );
+
+    if ( pworker->rq_count > 0 )
+    {
+        pbox = pworker->runqueue[ pworker->rq_head ];
+        pworker->rq_head = ( pworker->rq_head + 1 ) % pworker->pfleet->box_capacity;
+        pworker->rq_count--;
+    }
+
+    pthread_mutex_unlock( &pworker->mutex );
+
+    return pbox;
+}
+
+/*
+ * Internal function stealing half of another worker's run queue
+ *
+ * returns one stolen box to process now; others are moved onto the thief's queue
+ */
+static fleet_box_t* fleet_runqueue_steal( fleet_worker_t* pworker )
+{
+    fleet_t* pfleet = pworker->pfleet;
+    fleet_box_t* pstolen[FLEET_MAILBOX_SIZE];
+    int i;
+
+    for ( i = 1; i < pfleet->worker_count; i++ )
+    {
+        fleet_worker_t* pvictim = &pfleet->workers[ ( pworker->index + i ) % pfleet->worker_count ];
+        int count = 0;
+
+        pthread_mutex_lock( &pvictim->mutex );
+
+        if ( pvictim->rq_count > 0 )
+        {
+            count = ( pvictim->rq_count + 1 ) / 2;
+            if ( count > (int)NUM_OF( pstolen ) )
+            {
+                count = NUM_OF( pstolen );
+            }
+
+            //take from the tail; the victim keeps its oldest work
+            int n;
+            for ( n = 0; n < count; n++ )
+            {
+                pvictim->rq_count--;
+                pstolen[ n ] = pvictim->runqueue[ ( pvictim->rq_head + pvictim->rq_count ) % pfleet->box_capacity ];
+            }
+        }
+
+        pthread_mutex_unlock( &pvictim->mutex );
+
+        if ( count > 0 )
+        {
+            int n;
+
+            pworker->stats.steals += count;
+
+            if ( count > 1 )
+            {
+                pthread_mutex_lock( &pworker->mutex );
+                for ( n = 1; n < count; n++ )
+                {
+                    pworker->runqueue[ ( pworker->rq_head + pworker->rq_count ) % pfleet->box_capacity ] = pstolen[ n ];
+                    pworker->rq_count++;
+                }
+                pthread_mutex_unlock( &pworker->mutex );
+            }
+
+            return pstolen[ 0 ];
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * Internal function queueing an action on a box; schedules the box if needed
+ */
+static int fleet_box_post_action_at( fleet_box_t* pbox, statemachine_actions_t action, uint64_t post_nsec )
+{
+    bool need_schedule = false;
+
+    pthread_mutex_lock( &pbox->mutex );
+
+    if ( pbox->mailbox_count >= FLEET_MAILBOX_SIZE )
+    {
+        pthread_mutex_unlock( &pbox->mutex );
+
+        //lossy by design; a box hammered faster than it reacts drops stimuli
+        fleet_worker_t* pworker = ( fleet_worker_current != NULL ) ? fleet_worker_current : &pbox->pfleet->workers[ pbox->home_worker ];
+        __atomic_add_fetch( &pworker->stats.actions_dropped, 1, __ATOMIC_RELAXED );
+        return EAGAIN;
+    }
+
+    fleet_msg_t* pmsg = &pbox->mailbox[ ( pbox->mailbox_head + pbox->mailbox_count ) % FLEET_MAILBOX_SIZE ];
+    pmsg->action = action;
+    pmsg->post_nsec = post_nsec;
+    pbox->mailbox_count++;
+
+    if ( !pbox->scheduled )
+    {
+        pbox->scheduled = true;
+        need_schedule = true;
+        __atomic_add_fetch( &pbox->pfleet->active, 1, __ATOMIC_ACQ_REL );
+    }
+
+    pthread_mutex_unlock( &pbox->mutex );
+
+    if ( need_schedule )
+    {
+        //posts from a worker stay local; others go to the box's home worker
+        fleet_worker_t* pworker = ( ( fleet_worker_current != NULL ) && ( fleet_worker_current->pfleet == pbox->pfleet ) )
+            ? fleet_worker_current
+            : &pbox->pfleet->workers[ pbox->home_worker ];
+
+        fleet_runqueue_push( pworker, pbox );
+    }
+
+    return EOK;
+}
+
+/*
+ * Internal function applying an action to the box statemachine
+ * runs on the worker processing the box
+ */
+static int fleet_box_apply( fleet_box_t* pbox, statemachine_actions_t action, statemachine_states_t* pnew_state )
+{
+    fleet_worker_t* pworker = fleet_worker_current;
+    statemachine_states_t from_state = pbox->state;
+    statemachine_states_t new_state;
+
+    int ret = statemachine_next_state_r( pbox->psm, action, &new_state );
+
+    pworker->stats.actions++;
+
+    if ( new_state != from_state )
+    {
+        pbox->state = new_state;
+        pbox->entry_pending = true;
+        pworker->stats.transitions++;
+
+        if ( ( pbox->phooks != NULL ) && ( pbox->phooks->on_transition != NULL ) )
+        {
+            pbox->phooks->on_transition( pbox, pbox->user, from_state, new_state );
+        }
+    }
+
+    if ( pnew_state != NULL )
+    {
+        *pnew_state = new_state;
+    }
+
+    return ret;
+}
+
+/*
+ * Internal function running entry behaviour until the box settles
+ */
+static void fleet_box_run_entries( fleet_box_t* pbox )
+{
+    while ( pbox->entry_pending && !pbox->finished )
+    {
+        pbox->entry_pending = false;
+        behaviour_enter_state( &fleet_box_ops, pbox, &pbox->state, &pbox->finished );
+    }
+}
+
+/*
+ * Internal function draining a batch of a box's mailbox
+ */
+static void fleet_box_process( fleet_worker_t* pworker, fleet_box_t* pbox )
+{
+    int handled = 0;
+
+    fleet_box_run_entries( pbox );
+
+    while ( handled < FLEET_BOX_BATCH )
+    {
+        fleet_msg_t msg;
+
+        pthread_mutex_lock( &pbox->mutex );
+        if ( pbox->mailbox_count == 0 )
+        {
+            pthread_mutex_unlock( &pbox->mutex );
+            break;
+        }
+        msg = pbox->mailbox[ pbox->mailbox_head ];
+        pbox->mailbox_head = ( pbox->mailbox_head + 1 ) % FLEET_MAILBOX_SIZE;
+        pbox->mailbox_count--;
+        pthread_mutex_unlock( &pbox->mutex );
+
+        fleet_box_apply( pbox, msg.action, NULL );
+        fleet_box_run_entries( pbox );
+
+        uint64_t now_nsec = clocksrc_now_nsec( pworker->pfleet->pclk );
+        latency_hist_record( &pworker->stats.reaction_latency, ( now_nsec > msg.post_nsec ) ? ( now_nsec - msg.post_nsec ) : 0 );
+
+        handled++;
+    }
+
+    //unschedule, or requeue at the back if more work arrived
+    bool requeue = false;
+
+    pthread_mutex_lock( &pbox->mutex );
+    if ( pbox->mailbox_count > 0 )
+    {
+        requeue = true;
+    }
+    else
+    {
+        pbox->scheduled = false;
+        __atomic_sub_fetch( &pworker->pfleet->active, 1, __ATOMIC_ACQ_REL );
+    }
+    pthread_mutex_unlock( &pbox->mutex );
+
+    if ( requeue )
+    {
+        fleet_runqueue_push( pworker, pbox );
+    }
+}
+
+/*
+ * Internal timer heap helpers; callers hold the worker mutex
+ */
+static inline bool fleet_timer_before( const fleet_timer_t* pa, const fleet_timer_t* pb )
+{
+    return ( pa->deadline_nsec < pb->deadline_nsec )
+        || ( ( pa->deadline_nsec == pb->deadline_nsec ) && ( pa->seq < pb->seq ) );
+}
+
+static void fleet_timer_sift_down( fleet_worker_t* pworker, int i )
+{
+    fleet_timer_t* pheap = pworker->timers;
+
+    for (;;)
+    {
+        int smallest = i;
+        int l = ( 2 * i ) + 1;
+        int r = l + 1;
+
+        if ( ( l < pworker->timer_count ) && fleet_timer_before( &pheap[ l ], &pheap[ smallest ] ) )
+        {
+            smallest = l;
+        }
+        if ( ( r < pworker->timer_count ) && fleet_timer_before( &pheap[ r ], &pheap[ smallest ] ) )
+        {
+            smallest = r;
+        }
+        if ( smallest == i )
+        {
+            break;
+        }
+
+        fleet_timer_t tmp = pheap[ i ];
+        pheap[ i ] = pheap[ smallest ];
+        pheap[ smallest ] = tmp;
+        i = smallest;
+    }
+}
+
+static int fleet_timer_push_nolock( fleet_worker_t* pworker, const fleet_timer_t* ptimer )
+{
+    if ( pworker->timer_count >= pworker->timer_size )
+    {
+        int new_size = ( pworker->timer_size > 0 ) ? ( pworker->timer_size * 2 ) : 64;
+        fleet_timer_t* pnew = realloc( pworker->timers, new_size * sizeof( fleet_timer_t ) );
+
+        return_if( pnew == NULL, ENOMEM );
+
+        pworker->timers = pnew;
+        pworker->timer_size = new_size;
+    }
+
+    int i = pworker->timer_count++;
+    pworker->timers[ i ] = *ptimer;
+    pworker->timers[ i ].seq = pworker->timer_seq++;
+
+    pworker->stats.timers_armed++;
+    if ( pworker->timer_count > pworker->stats.timers_pending_max )
+    {
+        pworker->stats.timers_pending_max = pworker->timer_count;
+    }
+
+    //sift up
+    while ( i > 0 )
+    {
+        int parent = ( i - 1 ) / 2;
+
+        if ( !fleet_timer_before( &pworker->timers[ i ], &pworker->timers[ parent ] ) )
+        {
+            break;
+        }
+
+        fleet_timer_t tmp = pworker->timers[ i ];
+        pworker->timers[ i ] = pworker->timers[ parent ];
+        pworker->timers[ parent ] = tmp;
+        i = parent;
+    }
+
+    return EOK;
+}
+
+/*
+ * Internal function firing all expired timers of a worker
+ */
+static void fleet_timers_fire( fleet_worker_t* pworker, uint64_t now_nsec )
+{
+    fleet_t* pfleet = pworker->pfleet;
+
+    for (;;)
+    {
+        fleet_timer_t timer;
+
+        pthread_mutex_lock( &pworker->mutex );
+        if ( ( pworker->timer_count == 0 ) || ( pworker->timers[ 0 ].deadline_nsec > now_nsec ) )
+        {
+            pthread_mutex_unlock( &pworker->mutex );
+            break;
+        }
+        timer = pworker->timers[ 0 ];
+        pworker->timers[ 0 ] = pworker->timers[ --pworker->timer_count ];
+        fleet_timer_sift_down( pworker, 0 );
+
+        //counted active before it leaves the heap so the fleet never looks quiescent in between
+        __atomic_add_fetch( &pfleet->active, 1, __ATOMIC_ACQ_REL );
+        pthread_mutex_unlock( &pworker->mutex );
+
+        pworker->stats.timers_fired++;
+
+        if ( timer.callback != NULL )
+        {
+            timer.callback( timer.pbox, timer.pbox->user, timer.arg );
+        }
+        else
+        {
+            //latency is measured from the deadline so timer lateness counts too
+            fleet_box_post_action_at( timer.pbox, timer.action, timer.deadline_nsec );
+        }
+
+        __atomic_sub_fetch( &pfleet->active, 1, __ATOMIC_ACQ_REL );
+    }
+}
+
+/*
+ * Internal function jumping a virtual clock to the next pending deadline
+ * only once the whole fleet is quiescent
+ */
+static bool fleet_virtual_advance( fleet_t* pfleet )
+{
+    uint64_t next_nsec = 0;
+    uint64_t sleeper_nsec;
+    bool found = false;
+    int i;
+
+    pthread_mutex_lock( &pfleet->advance_mutex );
+
+    if ( __atomic_load_n( &pfleet->active, __ATOMIC_ACQUIRE ) == 0 )
+    {
+        for ( i = 0; i < pfleet->worker_count; i++ )
+        {
+            fleet_worker_t* pworker = &pfleet->workers[ i ];
+
+            pthread_mutex_lock( &pworker->mutex );
+            if ( ( pworker->timer_count > 0 ) && ( !found || ( pworker->timers[ 0 ].deadline_nsec < next_nsec ) ) )
+            {
+                next_nsec = pworker->timers[ 0 ].deadline_nsec;
+                found = true;
+            }
+            pthread_mutex_unlock( &pworker->mutex );
+        }
+
+        //threads sleeping on the clock (e.g. a driver waiting for the run to end) count too
+        //already due sleepers are on their way out and need no advance
+        if ( ( clocksrc_next_deadline( pfleet->pclk, &sleeper_nsec ) == EOK )
+                && ( sleeper_nsec > clocksrc_now_nsec( pfleet->pclk ) )
+                && ( !found || ( sleeper_nsec < next_nsec ) ) )
+        {
+            next_nsec = sleeper_nsec;
+            found = true;
+        }
+
+        if ( next_nsec > __atomic_load_n( &pfleet->horizon_nsec, __ATOMIC_ACQUIRE ) )
+        {
+            next_nsec = __atomic_load_n( &pfleet->horizon_nsec, __ATOMIC_ACQUIRE );
+        }
+
+        //a due but unfired timer belongs to a worker about to run it; no advance needed
+        found = found && ( next_nsec > clocksrc_now_nsec( pfleet->pclk ) );
+
+        if ( found )
+        {
+            clocksrc_advance_to( pfleet->pclk, next_nsec );
+
+            for ( i = 0; i < pfleet->worker_count; i++ )
+            {
+                fleet_worker_t* pworker = &pfleet->workers[ i ];
+
+                pthread_mutex_lock( &pworker->mutex );
+                pthread_cond_signal( &pworker->signal_work );
+                pthread_mutex_unlock( &pworker->mutex );
+            }
+        }
+    }
+
+    pthread_mutex_unlock( &pfleet->advance_mutex );
+
+    return found;
+}
+
+static void* fleet_worker_entry( void* args )
+{
+    fleet_worker_t* pworker = (fleet_worker_t*)args;
+    fleet_t* pfleet = pworker->pfleet;
+
+    fleet_worker_current = pworker;
+
+    while ( pfleet->running )
+    {
+        fleet_timers_fire( pworker, clocksrc_now_nsec( pfleet->pclk ) );
+
+        fleet_box_t* pbox = fleet_runqueue_pop( pworker );
+
+        if ( pbox == NULL )
+        {
+            pbox = fleet_runqueue_steal( pworker );
+        }
+
+        if ( pbox != NULL )
+        {
+            fleet_box_process( pworker, pbox );
+            continue;
+        }
+
+        //nothing runnable; with a virtual clock, jump time forward once everyone is idle
+        bool is_virtual = clocksrc_is_virtual( pfleet->pclk );
+
+        if ( is_virtual
+                && ( __atomic_load_n( &pfleet->active, __ATOMIC_ACQUIRE ) == 0 )
+                && fleet_virtual_advance( pfleet ) )
+        {
+            continue;
+        }
+
+        //sleep until the next timer or new work
+        pthread_mutex_lock( &pworker->mutex );
+
+        if ( ( pworker->rq_count == 0 ) && pfleet->running
+                && ( ( pworker->timer_count == 0 ) || ( pworker->timers[ 0 ].deadline_nsec > clocksrc_now_nsec( pfleet->pclk ) ) ) )
+        {
+            uint64_t wake_nsec = get_monotonic_nsec() + FLEET_IDLE_WAIT_NSEC;
+            struct timespec ts;
+
+            //virtual deadlines mean nothing to the kernel; an advance signals us instead
+            if ( !is_virtual && ( pworker->timer_count > 0 ) && ( pworker->timers[ 0 ].deadline_nsec < wake_nsec ) )
+            {
+                wake_nsec = pworker->timers[ 0 ].deadline_nsec;
+            }
+
+            ts.tv_sec = wake_nsec / 1000000000ULL;
+            ts.tv_nsec = wake_nsec % 1000000000ULL;
+
+            pworker->idle = true;
+            pthread_cond_timedwait( &pworker->signal_work, &pworker->mutex, &ts );
+            pworker->idle = false;
+        }
+
+        pthread_mutex_unlock( &pworker->mutex );
+    }
+
+    fleet_worker_current = NULL;
+
+    return NULL;
+}
+
+/*
+ * Box operations backing the shared entry behaviour
+ */
+static int fleet_box_ops_arm_movement( void* ctx, arm_movement_state_t movement )
+{
+    fleet_box_t* pbox = (fleet_box_t*)ctx;
+
+    pbox->arm_movement = movement;
+
+    if ( ( pbox->phooks != NULL ) && ( pbox->phooks->on_arm_movement != NULL ) )
+    {
+        pbox->phooks->on_arm_movement( pbox, pbox->user, movement );
+    }
+
+    return EOK;
+}
+
+static int fleet_box_ops_read_swstates( void* ctx, bool* pint_switch1, bool* pext_switch1 )
+{
+    return fleet_box_get_swstates( (fleet_box_t*)ctx, pint_switch1, pext_switch1 );
+}
+
+static int fleet_box_ops_sample_swstates( void* ctx )
+{
+    fleet_box_t* pbox = (fleet_box_t*)ctx;
+    bool int_switch1;
+    bool ext_switch1;
+
+    fleet_box_get_swstates( pbox, &int_switch1, &ext_switch1 );
+
+    return fleet_box_post_action_at( pbox, behaviour_swstate_action( int_switch1, ext_switch1 ), clocksrc_now_nsec( pbox->pfleet->pclk ) );
+}
+
+/*
+ * Internal function arming a timer on the current worker (or the box's home worker off-pool)
+ */
+static int fleet_box_setup_timer( fleet_box_t* pbox, int usec, statemachine_actions_t action, fleet_timer_callback_t callback, int arg )
+{
+    fleet_worker_t* pworker = ( ( fleet_worker_current != NULL ) && ( fleet_worker_current->pfleet == pbox->pfleet ) )
+        ? fleet_worker_current
+        : &pbox->pfleet->workers[ pbox->home_worker ];
+    fleet_timer_t timer;
+    int ret;
+
+    timer.deadline_nsec = clocksrc_now_nsec( pbox->pfleet->pclk ) + ( (uint64_t)usec * 1000ULL );
+    timer.pbox = pbox;
+    timer.action = action;
+    timer.callback = callback;
+    timer.arg = arg;
+
+    pthread_mutex_lock( &pworker->mutex );
+    ret = fleet_timer_push_nolock( pworker, &timer );
+
+    //an idle worker may be sleeping past the new deadline
+    if ( ( ret == EOK ) && pworker->idle )
+    {
+        pthread_cond_signal( &pworker->signal_work );
+    }
+    pthread_mutex_unlock( &pworker->mutex );
+
+    return ret;
+}
+
+static int fleet_box_ops_setup_timer_action( void* ctx, int usec, statemachine_actions_t action )
+{
+    return fleet_box_setup_timer( (fleet_box_t*)ctx, usec, action, NULL, 0 );
+}
+
+static int fleet_box_ops_next_state( void* ctx, statemachine_actions_t action, statemachine_states_t* pnew_state )
+{
+    return fleet_box_apply( (fleet_box_t*)ctx, action, pnew_state );
+}
+
+static int fleet_box_ops_random_number( void* ctx, int min_num, int max_num )
+{
+    fleet_box_t* pbox = (fleet_box_t*)ctx;
+    int low_num = min_num;
+    int hi_num = max_num + 1;   //include max_num in output
+
+    if ( min_num >= max_num )
+    {
+        low_num = max_num + 1;
+        hi_num = min_num;
+    }
+
+    return ( rand_r( &pbox->rand_seed ) % ( hi_num - low_num ) ) + low_num;
+}
+
+static const box_ops_t                      fleet_box_ops =
+    {
+        .arm_movement           = fleet_box_ops_arm_movement,
+        .read_swstates          = fleet_box_ops_read_swstates,
+        .sample_swstates        = fleet_box_ops_sample_swstates,
+        .setup_timer_action     = fleet_box_ops_setup_timer_action,
+        .next_state             = fleet_box_ops_next_state,
+        .random_number          = fleet_box_ops_random_number,
+    };
+
+int fleet_create( fleet_t** ppfleet, int worker_count, int box_capacity )
+{
+    return_if( ( worker_count <= 0 ) || ( box_capacity <= 0 ), EINVAL );
+
+    fleet_t* pfleet = calloc( 1, sizeof( fleet_t ) );
+    return_if( pfleet == NULL, ENOMEM );
+
+    pfleet->worker_count = worker_count;
+    pfleet->box_capacity = box_capacity;
+    pfleet->pclk = clocksrc_get_real();
+    pfleet->horizon_nsec = UINT64_MAX;
+    pthread_mutex_init( &pfleet->advance_mutex, NULL );
+    pfleet->workers = calloc( worker_count, sizeof( fleet_worker_t ) );
+    pfleet->boxes = calloc( box_capacity, sizeof( fleet_box_t ) );
+
+    if ( ( pfleet->workers == NULL ) || ( pfleet->boxes == NULL ) )
+    {
+        free( pfleet->workers );
+        free( pfleet->boxes );
+        free( pfleet );
+        return ENOMEM;
+    }
+
+    //timer deadlines are monotonic; so must be the idle waits
+    pthread_condattr_t cond_attr;
+    pthread_condattr_init( &cond_attr );
+    pthread_condattr_setclock( &cond_attr, CLOCK_MONOTONIC );
+
+    int i;
+    for ( i = 0; i < worker_count; i++ )
+    {
+        fleet_worker_t* pworker = &pfleet->workers[ i ];
+
+        pworker->pfleet = pfleet;
+        pworker->index = i;
+        pthread_mutex_init( &pworker->mutex, NULL );
+        pthread_cond_init( &pworker->signal_work, &cond_attr );
+        latency_hist_init( &pworker->stats.reaction_latency );
+
+        //a box is on at most one queue at a time
+        pworker->runqueue = calloc( box_capacity, sizeof( fleet_box_t* ) );
+        if ( pworker->runqueue == NULL )
+        {
+            pthread_condattr_destroy( &cond_attr );
+            pfleet->worker_count = i + 1;
+            fleet_destroy( pfleet );
+            return ENOMEM;
+        }
+    }
+
+    pthread_condattr_destroy( &cond_attr );
+
+    *ppfleet = pfleet;
+
+    return EOK;
+}
+
+int fleet_destroy( fleet_t* pfleet )
+{
+    int i;
+
+    fleet_stop( pfleet );
+
+    for ( i = 0; i < pfleet->box_count; i++ )
+    {
+        fleet_box_t* pbox = &pfleet->boxes[ i ];
+
+        statemachine_fini_r( pbox->psm, &pbox->cid );
+        statemachine_destroy( pbox->psm );
+        pthread_mutex_destroy( &pbox->mutex );
+    }
+
+    for ( i = 0; i < pfleet->worker_count; i++ )
+    {
+        fleet_worker_t* pworker = &pfleet->workers[ i ];
+
+        free( pworker->runqueue );
+        free( pworker->timers );
+        pthread_cond_destroy( &pworker->signal_work );
+        pthread_mutex_destroy( &pworker->mutex );
+    }
+
+    pthread_mutex_destroy( &pfleet->advance_mutex );
+    free( pfleet->workers );
+    free( pfleet->boxes );
+    free( pfleet );
+
+    return EOK;
+}
+
+int fleet_set_clock( fleet_t* pfleet, clocksrc_t* pclk )
+{
+    return_if( pfleet->started, EBUSY );
+    return_if( pclk == NULL, EINVAL );
+
+    pfleet->pclk = pclk;
+
+    return EOK;
+}
+
+int fleet_add_box( fleet_t* pfleet, const fleet_box_hooks_t* phooks, void* user, fleet_box_t** ppbox )
+{
+    return_if( pfleet->started, EBUSY );
+    return_if( pfleet->box_count >= pfleet->box_capacity, ENOSPC );
+
+    fleet_box_t* pbox = &pfleet->boxes[ pfleet->box_count ];
+    int ret = statemachine_create( &pbox->psm );
+
+    return_if( ret != EOK, ret );
+
+    statemachine_init_r( pbox->psm, &pbox->cid );
+    statemachine_subscribe_r( pbox->psm, &pbox->cid, 0, 0 );    //keeps the instance alive; never waits
+
+    pbox->pfleet = pfleet;
+    pbox->index = pfleet->box_count;
+    pbox->home_worker = pbox->index % pfleet->worker_count;
+    pbox->phooks = phooks;
+    pbox->user = user;
+    pthread_mutex_init( &pbox->mutex, NULL );
+    pbox->int_switch1 = true;       //arm home
+    pbox->ext_switch1 = false;      //switch off
+    pbox->state = statemachine_get_current_state_r( pbox->psm );
+    pbox->entry_pending = true;     //run ss_powerup entry on start
+    pbox->arm_movement = am_idle;
+    pbox->rand_seed = (unsigned int)pbox->index + 1;
+
+    pfleet->box_count++;
+
+    if ( ppbox != NULL )
+    {
+        *ppbox = pbox;
+    }
+
+    return EOK;
+}
+
+int fleet_start( fleet_t* pfleet )
+{
+    int i;
+
+    return_if( pfleet->started, EBUSY );
+
+    pfleet->started = true;
+    pfleet->running = true;
+
+    //queue every box so its powerup entry runs
+    for ( i = 0; i < pfleet->box_count; i++ )
+    {
+        fleet_box_t* pbox = &pfleet->boxes[ i ];
+        fleet_worker_t* pworker = &pfleet->workers[ pbox->home_worker ];
+
+        pbox->scheduled = true;
+        pworker->runqueue[ pworker->rq_count++ ] = pbox;
+    }
+
+    __atomic_store_n( &pfleet->active, pfleet->box_count, __ATOMIC_RELEASE );
+
+    for ( i = 0; i < pfleet->worker_count; i++ )
+    {
+        int ret = pthread_create( &pfleet->workers[ i ].tid, NULL, fleet_worker_entry, &pfleet->workers[ i ] );
+
+        if ( ret != EOK )
+        {
+            print_stderr( STDPRINT_NAME "worker create failed; worker=%d err=%d\n", i, ret );
+            pfleet->worker_count = i;
+            fleet_stop( pfleet );
+            return ret;
+        }
+    }
+
+    return EOK;
+}
+
+int fleet_stop( fleet_t* pfleet )
+{
+    int i;
+
+    return_if( !pfleet->running, EOK );
+
+    pfleet->running = false;
+
+    for ( i = 0; i < pfleet->worker_count; i++ )
+    {
+        fleet_worker_t* pworker = &pfleet->workers[ i ];
+
+        pthread_mutex_lock( &pworker->mutex );
+        pthread_cond_signal( &pworker->signal_work );
+        pthread_mutex_unlock( &pworker->mutex );
+    }
+
+    for ( i = 0; i < pfleet->worker_count; i++ )
+    {
+        pthread_join( pfleet->workers[ i ].tid, NULL );
+    }
+
+    return EOK;
+}
+
+int fleet_run_until( fleet_t* pfleet, uint64_t deadline_nsec )
+{
+    //do following:
+    //fence virtual time before any worker can advance it
+    //start unless already running
+    //sleep on the fleet clock until the deadline, then stop
+
+    __atomic_store_n( &pfleet->horizon_nsec, deadline_nsec, __ATOMIC_RELEASE );
+
+    if ( !pfleet->running )
+    {
+        int ret = fleet_start( pfleet );
+        return_if( ret != EOK, ret );
+    }
+
+    clocksrc_sleep_until( pfleet->pclk, deadline_nsec );
+
+    return fleet_stop( pfleet );
+}
+
+int fleet_box_post_action( fleet_box_t* pbox, statemachine_actions_t action )
+{
+    return fleet_box_post_action_at( pbox, action, clocksrc_now_nsec( pbox->pfleet->pclk ) );
+}
+
+int fleet_box_setup_timer_callback( fleet_box_t* pbox, int usec, fleet_timer_callback_t callback, int arg )
+{
+    return_if( callback == NULL, EINVAL );
+
+    return fleet_box_setup_timer( pbox, usec, sa_END, callback, arg );
+}
+
+int fleet_box_set_swstates( fleet_box_t* pbox, bool int_switch1, bool ext_switch1 )
+{
+    bool changed = false;
+
+    pthread_mutex_lock( &pbox->mutex );
+
+    //only issue state changes if we had changes!
+    if ( ( pbox->int_switch1 != int_switch1 ) || ( pbox->ext_switch1 != ext_switch1 ) )
+    {
+        pbox->int_switch1 = int_switch1;
+        pbox->ext_switch1 = ext_switch1;
+        changed = true;
+    }
+
+    pthread_mutex_unlock( &pbox->mutex );
+
+    return_if( !changed, EOK );
+
+    return fleet_box_post_action( pbox, behaviour_swstate_action( int_switch1, ext_switch1 ) );
+}
+
+int fleet_box_get_swstates( fleet_box_t* pbox, bool* pint_switch1, bool* pext_switch1 )
+{
+    pthread_mutex_lock( &pbox->mutex );
+
+    *pint_switch1 = pbox->int_switch1;
+    *pext_switch1 = pbox->ext_switch1;
+
+    pthread_mutex_unlock( &pbox->mutex );
+
+    return EOK;
+}
+
+statemachine_states_t fleet_box_get_state( fleet_box_t* pbox )
+{
+    return statemachine_get_current_state_r( pbox->psm );
+}
+
+int fleet_box_get_index( fleet_box_t* pbox )
+{
+    return pbox->index;
+}
+
+void* fleet_box_get_user( fleet_box_t* pbox )
+{
+    return pbox->user;
+}
+
+uint64_t fleet_box_now_nsec( fleet_box_t* pbox )
+{
+    return clocksrc_now_nsec( pbox->pfleet->pclk );
+}
+
+int fleet_get_stats( fleet_t* pfleet, fleet_stats_t* pstats )
+{
+    int i;
+
+    memset( pstats, 0, sizeof( *pstats ) );
+    latency_hist_init( &pstats->reaction_latency );
+
+    for ( i = 0; i < pfleet->worker_count; i++ )
+    {
+        const fleet_stats_t* pws = &pfleet->workers[ i ].stats;
+
+        pstats->actions += pws->actions;
+        pstats->actions_dropped += pws->actions_dropped;
+        pstats->transitions += pws->transitions;
+        pstats->steals += pws->steals;
+        pstats->timers_armed += pws->timers_armed;
+        pstats->timers_fired += pws->timers_fired;
+        latency_hist_merge( &pstats->reaction_latency, &pws->reaction_latency );
+
+        if ( pws->runqueue_depth_max > pstats->runqueue_depth_max )
+        {
+            pstats->runqueue_depth_max = pws->runqueue_depth_max;
+        }
+
+        if ( pws->timers_pending_max > pstats->timers_pending_max )
+        {
+            pstats->timers_pending_max = pws->timers_pending_max;
+        }
+    }
+
+    return EOK;
+}
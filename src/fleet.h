@@ -0,0 +1,182 @@
+#ifndef fleet_H_
+#define fleet_H_
+
+#include "statemachine.h"
+#include "behaviour.h"
+#include "latency.h"
+#include "clocksrc.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Fleet runtime
+ *
+ * Hosts many independent simulated boxes on a fixed pool of worker threads.
+ * Each box owns a statemachine_t instance and runs the same entry behaviour
+ * as the gpio box; timers live in per-worker heaps instead of one thread each.
+ * Boxes with pending actions sit on per-worker run queues; idle workers steal.
+ *
+ * With a virtual clock the fleet is a discrete event simulation: once no box
+ * is runnable, time jumps to the next timer deadline. Timers with equal
+ * deadlines fire in arming order, so a single worker run replays exactly.
+ */
+
+typedef struct fleet fleet_t;
+typedef struct fleet_box fleet_box_t;
+
+/*
+ * Optional per-box callbacks; invoked on the worker processing the box
+ */
+typedef struct
+{
+    void    (*on_arm_movement)( fleet_box_t* pbox, void* user, arm_movement_state_t movement );
+    void    (*on_transition)( fleet_box_t* pbox, void* user, statemachine_states_t from_state, statemachine_states_t to_state );
+} fleet_box_hooks_t;
+
+/*
+ * Timer callback; invoked on a worker when a callback timer expires
+ */
+typedef void (*fleet_timer_callback_t)( fleet_box_t* pbox, void* user, int arg );
+
+typedef struct
+{
+    uint64_t            actions;                //actions applied
+    uint64_t            actions_dropped;        //actions lost to full box mailboxes
+    uint64_t            transitions;            //actions that changed state
+    uint64_t            steals;                 //boxes taken from another worker's queue
+    uint64_t            timers_armed;
+    uint64_t            timers_fired;
+    int                 timers_pending_max;     //deepest single worker timer heap
+    int                 runqueue_depth_max;
+    latency_hist_t      reaction_latency;       //action posted -> transition and entry behaviour done
+} fleet_stats_t;
+
+/*
+ * Creates a fleet
+ *
+ * ppfleet          pointer to receive the fleet
+ * worker_count     number of worker threads
+ * box_capacity     maximum number of boxes
+ *
+ * returns EOK on success; EErr type otherwise describing the failure
+ */
+int fleet_create( fleet_t** ppfleet, int worker_count, int box_capacity );
+
+/*
+ * Destroys a fleet; stops it first if running
+ *
+ * returns EOK always
+ */
+int fleet_destroy( fleet_t* pfleet );
+
+/*
+ * Selects the clock driving timers and latency; must be called before fleet_start
+ * defaults to the real clock
+ *
+ * returns EOK on success; EBUSY once started
+ */
+int fleet_set_clock( fleet_t* pfleet, clocksrc_t* pclk );
+
+/*
+ * Adds a box to the fleet; must be called before fleet_start
+ * the box powers up with the arm home and the external switch off
+ *
+ * phooks           optional callbacks; may be NULL
+ * user             opaque pointer passed back to hooks
+ * ppbox            pointer to receive the box
+ *
+ * returns EOK on success; ENOSPC when at capacity; EBUSY once started
+ */
+int fleet_add_box( fleet_t* pfleet, const fleet_box_hooks_t* phooks, void* user, fleet_box_t** ppbox );
+
+/*
+ * Starts the worker threads; every box runs its ss_powerup entry
+ *
+ * returns EOK on success; EErr type otherwise describing the failure
+ */
+int fleet_start( fleet_t* pfleet );
+
+/*
+ * Stops and joins the worker threads; pending actions and timers are dropped
+ *
+ * returns EOK always
+ */
+int fleet_stop( fleet_t* pfleet );
+
+/*
+ * Starts the fleet unless running, blocks until its clock reaches deadline_nsec
+ * and stops it; with a virtual clock nothing due after the deadline is processed
+ *
+ * returns EOK on success; EErr type otherwise describing the failure
+ */
+int fleet_run_until( fleet_t* pfleet, uint64_t deadline_nsec );
+
+/*
+ * Produces stimuli to a box
+ *
+ * thread-safe: yes
+ *
+ * returns EOK on success; EAGAIN if the box mailbox is full
+ */
+int fleet_box_post_action( fleet_box_t* pbox, statemachine_actions_t action );
+
+/*
+ * Arms a one-shot timer that calls back instead of posting an action
+ * used by simulations to model arm travel and people
+ *
+ * thread-safe: yes
+ *
+ * usec             delay until expiry
+ * callback         called on a worker at expiry
+ * arg              passed back to callback
+ *
+ * returns EOK on success; EErr type otherwise describing the failure
+ */
+int fleet_box_setup_timer_callback( fleet_box_t* pbox, int usec, fleet_timer_callback_t callback, int arg );
+
+/*
+ * Sets the simulated switch levels of a box; issues the matching action on change
+ *
+ * thread-safe: yes
+ *
+ * returns EOK on success; EErr type otherwise describing the failure
+ */
+int fleet_box_set_swstates( fleet_box_t* pbox, bool int_switch1, bool ext_switch1 );
+
+/*
+ * Retrieves the simulated switch levels of a box
+ *
+ * thread-safe: yes
+ */
+int fleet_box_get_swstates( fleet_box_t* pbox, bool* pint_switch1, bool* pext_switch1 );
+
+/*
+ * Retrieves the current state of a box
+ *
+ * thread-safe: yes
+ */
+statemachine_states_t fleet_box_get_state( fleet_box_t* pbox );
+
+/*
+ * Retrieves the index of a box within its fleet
+ */
+int fleet_box_get_index( fleet_box_t* pbox );
+
+/*
+ * Retrieves the user pointer given to fleet_add_box
+ */
+void* fleet_box_get_user( fleet_box_t* pbox );
+
+/*
+ * Current time on the fleet clock
+ */
+uint64_t fleet_box_now_nsec( fleet_box_t* pbox );
+
+/*
+ * Retrieves aggregate stats over all workers
+ * exact once stopped; approximate while running
+ */
+int fleet_get_stats( fleet_t* pfleet, fleet_stats_t* pstats );
+
+#endif
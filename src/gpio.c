@@ -0,0 +1,251 @@
+#include "gpio.h"
+#include "util.h"
+
+#include <errno.h>
+#include <stddef.h>
+#include <string.h>
+
+#define STDPRINT_NAME                       __FILE__ ":"
+
+static const gpio_backend_t*                gpio_backend = NULL;
+static edgecap_writer_t*                    gpio_capture = NULL;
+static gpio_isr_callback_t                  gpio_isr_callbacks[ GPIO_ISR_PIN_MAX ];
+static uint32_t                             gpio_shadow_levels;     //last level written per pin
+static uint32_t                             gpio_shadow_known;      //pins written since set up
+static uint32_t                             gpio_input_pins;        //pins set up as inputs
+static gpio_write_stats_t                   gpio_write_stats;
+
+/*
+ * Internal isr trampolines; backend isrs carry no pin so each pin gets its own
+ * entry that stamps the edge before handing over to the installed callback
+ */
+static inline void gpio_isr_dispatch( int pin )
+{
+    edgecap_writer_t* pcap = __atomic_load_n( &gpio_capture, __ATOMIC_ACQUIRE );
+
+    if ( pcap != NULL )
+    {
+        edgecap_record( pcap, edgecap_input, pin, gpio_backend->read( pin ) );
+    }
+
+    gpio_isr_callbacks[ pin ]();
+}
+
+#define GPIO_ISR_TRAMPOLINE( _pin ) \
+    static void gpio_isr_trampoline_##_pin( void ) { gpio_isr_dispatch( _pin ); }
+
+GPIO_ISR_TRAMPOLINE( 0 )
+GPIO_ISR_TRAMPOLINE( 1 )
+GPIO_ISR_TRAMPOLINE( 2 )
+GPIO_ISR_TRAMPOLINE( 3 )
+GPIO_ISR_TRAMPOLINE( 4 )
+GPIO_ISR_TRAMPOLINE( 5 )
+GPIO_ISR_TRAMPOLINE( 6 )
+GPIO_ISR_TRAMPOLINE( 7 )
+
+static const gpio_isr_callback_t            gpio_isr_trampolines[ GPIO_ISR_PIN_MAX ] =
+    {
+        gpio_isr_trampoline_0,
+        gpio_isr_trampoline_1,
+        gpio_isr_trampoline_2,
+        gpio_isr_trampoline_3,
+        gpio_isr_trampoline_4,
+        gpio_isr_trampoline_5,
+        gpio_isr_trampoline_6,
+        gpio_isr_trampoline_7,
+    };
+
+int gpio_init( const gpio_backend_t* pbackend )
+{
+    return_if( pbackend == NULL, EINVAL );
+
+    gpio_backend = pbackend;
+    __atomic_store_n( &gpio_shadow_levels, 0, __ATOMIC_RELAXED );
+    __atomic_store_n( &gpio_shadow_known, 0, __ATOMIC_RELAXED );
+    __atomic_store_n( &gpio_input_pins, 0, __ATOMIC_RELAXED );
+    memset( &gpio_write_stats, 0, sizeof( gpio_write_stats ) );
+    print_stdout( STDPRINT_NAME "gpio backend; name=%s\n", pbackend->name );
+
+    return gpio_backend->setup();
+}
+
+/*
+ * Internal function storing the current level of every input in the capture header
+ */
+static int gpio_capture_snapshot( edgecap_writer_t* pcap )
+{
+    uint32_t pins = __atomic_load_n( &gpio_input_pins, __ATOMIC_ACQUIRE );
+    uint32_t levels = 0;
+    int pin;
+
+    for ( pin = 0; pin < GPIO_SHADOW_PIN_MAX; pin++ )
+    {
+        if ( ( pins & GPIO_PIN_BIT( pin ) ) && gpio_backend->read( pin ) )
+        {
+            levels |= GPIO_PIN_BIT( pin );
+        }
+    }
+
+    return edgecap_writer_set_snapshot( pcap, pins, levels );
+}
+
+int gpio_set_capture( edgecap_writer_t* pcap )
+{
+    //edges alone cannot tell playback where the inputs started
+    if ( pcap != NULL )
+    {
+        gpio_capture_snapshot( pcap );
+    }
+
+    __atomic_store_n( &gpio_capture, pcap, __ATOMIC_RELEASE );
+
+    return EOK;
+}
+
+/*
+ * Internal function updating the shadow of the pins in mask
+ *
+ * returns the pins in mask whose level changes
+ */
+static uint32_t gpio_shadow_update( uint32_t mask, uint32_t levels )
+{
+    uint32_t known = __atomic_fetch_or( &gpio_shadow_known, mask, __ATOMIC_ACQ_REL );
+    uint32_t changed = mask & ( ~known | ( __atomic_load_n( &gpio_shadow_levels, __ATOMIC_ACQUIRE ) ^ levels ) );
+
+    if ( changed & levels )
+    {
+        __atomic_fetch_or( &gpio_shadow_levels, changed & levels, __ATOMIC_ACQ_REL );
+    }
+
+    if ( changed & ~levels )
+    {
+        __atomic_fetch_and( &gpio_shadow_levels, ~( changed & ~levels ), __ATOMIC_ACQ_REL );
+    }
+
+    __atomic_add_fetch( &gpio_write_stats.requested, (uint64_t)__builtin_popcount( mask ), __ATOMIC_RELAXED );
+    __atomic_add_fetch( &gpio_write_stats.elided, (uint64_t)__builtin_popcount( mask & ~changed ), __ATOMIC_RELAXED );
+
+    return changed;
+}
+
+int gpio_pin_mode( int pin, gpio_mode_t mode )
+{
+    edgecap_writer_t* pcap;
+    int ret;
+
+    //whatever the pin held before says nothing about it now
+    if ( ( pin >= 0 ) && ( pin < GPIO_SHADOW_PIN_MAX ) )
+    {
+        __atomic_fetch_and( &gpio_shadow_known, ~GPIO_PIN_BIT( pin ), __ATOMIC_ACQ_REL );
+
+        if ( mode == gpio_mode_input )
+        {
+            __atomic_fetch_or( &gpio_input_pins, GPIO_PIN_BIT( pin ), __ATOMIC_ACQ_REL );
+        }
+        else
+        {
+            __atomic_fetch_and( &gpio_input_pins, ~GPIO_PIN_BIT( pin ), __ATOMIC_ACQ_REL );
+        }
+    }
+
+    ret = gpio_backend->pin_mode( pin, mode );
+
+    //inputs set up after capturing started join the snapshot
+    pcap = __atomic_load_n( &gpio_capture, __ATOMIC_ACQUIRE );
+    if ( ( ret == EOK ) && ( pcap != NULL ) && ( mode == gpio_mode_input ) )
+    {
+        gpio_capture_snapshot( pcap );
+    }
+
+    return ret;
+}
+
+int gpio_write( int pin, int value )
+{
+    edgecap_writer_t* pcap;
+
+    value = value ? GPIO_HIGH : GPIO_LOW;
+
+    if ( ( pin >= 0 ) && ( pin < GPIO_SHADOW_PIN_MAX ) )
+    {
+        return_if( gpio_shadow_update( GPIO_PIN_BIT( pin ), value ? GPIO_PIN_BIT( pin ) : 0 ) == 0, EOK );
+    }
+    else
+    {
+        __atomic_add_fetch( &gpio_write_stats.requested, 1, __ATOMIC_RELAXED );
+    }
+
+    __atomic_add_fetch( &gpio_write_stats.backend_ops, 1, __ATOMIC_RELAXED );
+
+    pcap = __atomic_load_n( &gpio_capture, __ATOMIC_ACQUIRE );
+
+    if ( pcap != NULL )
+    {
+        edgecap_record( pcap, edgecap_output, pin, value );
+    }
+
+    return gpio_backend->write( pin, value );
+}
+
+int gpio_write_mask( uint32_t mask, uint32_t levels )
+{
+    edgecap_writer_t* pcap = __atomic_load_n( &gpio_capture, __ATOMIC_ACQUIRE );
+    uint32_t changed;
+    int ret = EOK;
+    int pin;
+
+    levels &= mask;
+    changed = gpio_shadow_update( mask, levels );
+    return_if( changed == 0, EOK );
+
+    for ( pin = 0; pin < GPIO_SHADOW_PIN_MAX; pin++ )
+    {
+        if ( ( pcap != NULL ) && ( changed & GPIO_PIN_BIT( pin ) ) )
+        {
+            edgecap_record( pcap, edgecap_output, pin, ( levels & GPIO_PIN_BIT( pin ) ) ? GPIO_HIGH : GPIO_LOW );
+        }
+    }
+
+    if ( gpio_backend->write_bank != NULL )
+    {
+        __atomic_add_fetch( &gpio_write_stats.backend_ops, 1, __ATOMIC_RELAXED );
+        return gpio_backend->write_bank( changed & levels, changed & ~levels );
+    }
+
+    for ( pin = 0; pin < GPIO_SHADOW_PIN_MAX; pin++ )
+    {
+        if ( changed & GPIO_PIN_BIT( pin ) )
+        {
+            int ret_pin = gpio_backend->write( pin, ( levels & GPIO_PIN_BIT( pin ) ) ? GPIO_HIGH : GPIO_LOW );
+
+            __atomic_add_fetch( &gpio_write_stats.backend_ops, 1, __ATOMIC_RELAXED );
+            if ( ret == EOK )
+            {
+                ret = ret_pin;
+            }
+        }
+    }
+
+    return ret;
+}
+
+void gpio_get_write_stats( gpio_write_stats_t* pstats )
+{
+    pstats->requested = __atomic_load_n( &gpio_write_stats.requested, __ATOMIC_RELAXED );
+    pstats->elided = __atomic_load_n( &gpio_write_stats.elided, __ATOMIC_RELAXED );
+    pstats->backend_ops = __atomic_load_n( &gpio_write_stats.backend_ops, __ATOMIC_RELAXED );
+}
+
+int gpio_read( int pin )
+{
+    return gpio_backend->read( pin );
+}
+
+int gpio_isr( int pin, gpio_isr_callback_t callback )
+{
+    return_if( ( pin < 0 ) || ( pin >= GPIO_ISR_PIN_MAX ) || ( callback == NULL ), EINVAL );
+
+    gpio_isr_callbacks[ pin ] = callback;
+
+    return gpio_backend->isr( pin, gpio_isr_trampolines[ pin ] );
+}
@@ -0,0 +1,136 @@
+#ifndef gpio_H_
+#define gpio_H_
+
+#include "edgecap.h"
+#include "clocksrc.h"
+
+#include <stdint.h>
+
+/*
+ * Gpio access
+ *
+ * The box logic talks to pins through this layer so the backend can be the
+ * wiringPi hardware or a simulation, and so every edge and write can be
+ * captured (see edgecap.h) without touching the callers.
+ *
+ * Outputs below GPIO_SHADOW_PIN_MAX are shadowed: a write that would not
+ * change the level is skipped (and not captured). Writes to one pin must be
+ * serialized by the caller, as they would have to be without the shadow.
+ */
+
+#define GPIO_LOW                            0
+#define GPIO_HIGH                           1
+#define GPIO_ISR_PIN_MAX                    8       //pins that may carry an isr
+#define GPIO_SHADOW_PIN_MAX                 32      //pins whose output level is shadowed
+#define GPIO_PIN_BIT( _pin )                ( 1u << ( _pin ) )
+
+typedef enum
+{
+    gpio_mode_input,
+    gpio_mode_output,
+} gpio_mode_t;
+
+typedef void (*gpio_isr_callback_t)( void );
+
+typedef struct
+{
+    const char*     name;
+    int             (*setup)( void );
+    int             (*pin_mode)( int pin, gpio_mode_t mode );
+    int             (*write)( int pin, int value );
+    int             (*read)( int pin );
+    int             (*isr)( int pin, gpio_isr_callback_t callback );   //both edges
+    int             (*write_bank)( uint32_t set_mask, uint32_t clear_mask );   //optional; one register operation
+} gpio_backend_t;
+
+typedef struct
+{
+    uint64_t        requested;      //pin writes asked for
+    uint64_t        elided;         //skipped as the pin already had the level
+    uint64_t        backend_ops;    //writes (or bank writes) issued to the backend
+} gpio_write_stats_t;
+
+extern const gpio_backend_t     gpio_backend_wiringpi;
+extern const gpio_backend_t     gpio_backend_sim;
+
+/*
+ * Selects and sets up the backend; must be called before any other gpio call
+ *
+ * returns EOK on success; EErr type otherwise describing the failure
+ */
+int gpio_init( const gpio_backend_t* pbackend );
+
+/*
+ * Starts or stops capturing edges and writes
+ * starting stores the levels of inputs below GPIO_SHADOW_PIN_MAX in the
+ * capture header, refreshed as more pins are set up as inputs
+ *
+ * pcap     writer to record into; NULL stops capturing
+ *
+ * returns EOK always
+ */
+int gpio_set_capture( edgecap_writer_t* pcap );
+
+int gpio_pin_mode( int pin, gpio_mode_t mode );
+int gpio_write( int pin, int value );
+int gpio_read( int pin );
+
+/*
+ * Writes several shadowed pins at once; only pins changing level are written,
+ * in one bank operation if the backend has one
+ *
+ * mask     GPIO_PIN_BIT of each pin to write
+ * levels   GPIO_PIN_BIT of each pin in mask to drive high
+ *
+ * returns EOK on success; EErr type otherwise
+ */
+int gpio_write_mask( uint32_t mask, uint32_t levels );
+
+/*
+ * Retrieves write counts since gpio_init
+ */
+void gpio_get_write_stats( gpio_write_stats_t* pstats );
+
+/*
+ * Installs an isr called on both edges of pin
+ *
+ * returns EOK on success; EINVAL if pin >= GPIO_ISR_PIN_MAX; EErr type otherwise
+ */
+int gpio_isr( int pin, gpio_isr_callback_t callback );
+
+/*
+ * Simulated backend controls
+ */
+
+/*
+ * Drives a simulated input; runs its isr on a level change
+ *
+ * thread-safe: yes
+ */
+int gpio_sim_set_input( int pin, int level );
+
+/*
+ * Retrieves the last value written to a simulated output
+ */
+int gpio_sim_get_output( int pin );
+
+/*
+ * Plays the input edges of a capture into the simulated backend
+ * on a background thread, keeping the captured timing on pclk
+ * inputs are set to the captured start levels before this returns,
+ * without running their isrs
+ *
+ * returns EOK on success; EBUSY if already playing; EErr type otherwise
+ */
+int gpio_sim_play_start( const char* path, clocksrc_t* pclk );
+
+/*
+ * Waits for playback to finish
+ *
+ * stop     true to abandon the rest of the capture
+ *
+ * returns EOK on success; EErr type from playback otherwise
+ */
+int gpio_sim_play_join( bool stop );
+
+#endif
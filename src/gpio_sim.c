@@ -0,0 +1,242 @@
+#include "gpio.h"
+#include "util.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+#define STDPRINT_NAME                       __FILE__ ":"
+#define GPIO_SIM_PIN_MAX                    64
+#define GPIO_SIM_PLAY_SLICE_NSEC            100000000ULL    //stop requests are seen within this
+
+typedef struct
+{
+    edgecap_reader_t*                       preader;
+    clocksrc_t*                             pclk;
+    pthread_t                               tid;
+    bool                                    playing;
+    volatile bool                           stop;
+    int                                     result;
+} gpio_sim_player_t;
+
+static pthread_mutex_t                      gpio_sim_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int                                  gpio_sim_levels[ GPIO_SIM_PIN_MAX ];
+static gpio_isr_callback_t                  gpio_sim_isrs[ GPIO_SIM_PIN_MAX ];
+static gpio_sim_player_t                    gpio_sim_player;
+
+static int gpio_sim_setup( void )
+{
+    pthread_mutex_lock( &gpio_sim_mutex );
+    memset( gpio_sim_levels, 0, sizeof( gpio_sim_levels ) );
+    memset( gpio_sim_isrs, 0, sizeof( gpio_sim_isrs ) );
+    pthread_mutex_unlock( &gpio_sim_mutex );
+
+    return EOK;
+}
+
+static int gpio_sim_pin_mode( int pin, gpio_mode_t mode )
+{
+    __unused( mode );
+
+    return_if( ( pin < 0 ) || ( pin >= GPIO_SIM_PIN_MAX ), EINVAL );
+
+    return EOK;
+}
+
+static int gpio_sim_write( int pin, int value )
+{
+    return_if( ( pin < 0 ) || ( pin >= GPIO_SIM_PIN_MAX ), EINVAL );
+
+    __atomic_store_n( &gpio_sim_levels[ pin ], value ? GPIO_HIGH : GPIO_LOW, __ATOMIC_RELEASE );
+
+    return EOK;
+}
+
+static int gpio_sim_write_bank( uint32_t set_mask, uint32_t clear_mask )
+{
+    int pin;
+
+    for ( pin = 0; ( pin < GPIO_SIM_PIN_MAX ) && ( pin < GPIO_SHADOW_PIN_MAX ); pin++ )
+    {
+        if ( set_mask & GPIO_PIN_BIT( pin ) )
+        {
+            __atomic_store_n( &gpio_sim_levels[ pin ], GPIO_HIGH, __ATOMIC_RELEASE );
+        }
+        else if ( clear_mask & GPIO_PIN_BIT( pin ) )
+        {
+            __atomic_store_n( &gpio_sim_levels[ pin ], GPIO_LOW, __ATOMIC_RELEASE );
+        }
+    }
+
+    return EOK;
+}
+
+static int gpio_sim_read( int pin )
+{
+    return_if( ( pin < 0 ) || ( pin >= GPIO_SIM_PIN_MAX ), GPIO_LOW );
+
+    return __atomic_load_n( &gpio_sim_levels[ pin ], __ATOMIC_ACQUIRE );
+}
+
+static int gpio_sim_isr( int pin, gpio_isr_callback_t callback )
+{
+    return_if( ( pin < 0 ) || ( pin >= GPIO_SIM_PIN_MAX ), EINVAL );
+
+    pthread_mutex_lock( &gpio_sim_mutex );
+    gpio_sim_isrs[ pin ] = callback;
+    pthread_mutex_unlock( &gpio_sim_mutex );
+
+    return EOK;
+}
+
+const gpio_backend_t                        gpio_backend_sim =
+    {
+        .name                   = "sim",
+        .setup                  = gpio_sim_setup,
+        .pin_mode               = gpio_sim_pin_mode,
+        .write                  = gpio_sim_write,
+        .read                   = gpio_sim_read,
+        .isr                    = gpio_sim_isr,
+        .write_bank             = gpio_sim_write_bank,
+    };
+
+int gpio_sim_set_input( int pin, int level )
+{
+    gpio_isr_callback_t callback = NULL;
+
+    return_if( ( pin < 0 ) || ( pin >= GPIO_SIM_PIN_MAX ), EINVAL );
+
+    level = level ? GPIO_HIGH : GPIO_LOW;
+
+    //isrs run unlocked, like the wiringPi isr threads; the box logic takes its own locks
+    pthread_mutex_lock( &gpio_sim_mutex );
+    if ( gpio_sim_levels[ pin ] != level )
+    {
+        __atomic_store_n( &gpio_sim_levels[ pin ], level, __ATOMIC_RELEASE );
+        callback = gpio_sim_isrs[ pin ];
+    }
+    pthread_mutex_unlock( &gpio_sim_mutex );
+
+    if ( callback != NULL )
+    {
+        callback();
+    }
+
+    return EOK;
+}
+
+int gpio_sim_get_output( int pin )
+{
+    return gpio_sim_read( pin );
+}
+
+static void* gpio_sim_player_entry( void* args )
+{
+    gpio_sim_player_t* pplayer = (gpio_sim_player_t*)args;
+    uint64_t cap_start_nsec = edgecap_reader_start_nsec( pplayer->preader );
+    uint64_t play_start_nsec = clocksrc_now_nsec( pplayer->pclk );
+    uint64_t inputs = 0;
+    edgecap_event_t event;
+    int ret = ENOENT;
+
+    //do following:
+    //walk the capture in order
+    //sleep until each input edge is due relative to playback start
+    //drive the input; recorded outputs are what the box did then and are skipped
+
+    while ( !pplayer->stop && ( ( ret = edgecap_reader_next( pplayer->preader, &event ) ) == EOK ) )
+    {
+        uint64_t due_nsec = play_start_nsec + ( event.ts_nsec - cap_start_nsec );
+        uint64_t now_nsec;
+
+        if ( event.kind != edgecap_input )
+        {
+            continue;
+        }
+
+        while ( !pplayer->stop && ( ( now_nsec = clocksrc_now_nsec( pplayer->pclk ) ) < due_nsec ) )
+        {
+            clocksrc_sleep_until( pplayer->pclk, ( ( due_nsec - now_nsec ) > GPIO_SIM_PLAY_SLICE_NSEC ) ? ( now_nsec + GPIO_SIM_PLAY_SLICE_NSEC ) : due_nsec );
+        }
+
+        if ( pplayer->stop )
+        {
+            break;
+        }
+
+        gpio_sim_set_input( event.pin, event.level );
+        inputs++;
+    }
+
+    print_stdout( STDPRINT_NAME "capture playback done; inputs=%llu\n", (unsigned long long)inputs );
+
+    pplayer->result = ( ret == ENOENT ) ? EOK : ret;
+
+    return NULL;
+}
+
+int gpio_sim_play_start( const char* path, clocksrc_t* pclk )
+{
+    gpio_sim_player_t* pplayer = &gpio_sim_player;
+    int ret;
+
+    return_if( pplayer->playing, EBUSY );
+
+    ret = edgecap_reader_open( &pplayer->preader, path );
+    if ( ret != EOK )
+    {
+        print_stderr( STDPRINT_NAME "failed to open capture; path=%s err=%d\n", path, ret );
+        return ret;
+    }
+
+    //seed the inputs the box samples at powerup, as they were when capturing started
+    uint32_t snapshot_pins;
+    uint32_t snapshot_levels;
+    int pin;
+
+    edgecap_reader_snapshot( pplayer->preader, &snapshot_pins, &snapshot_levels );
+
+    pthread_mutex_lock( &gpio_sim_mutex );
+    for ( pin = 0; ( pin < GPIO_SIM_PIN_MAX ) && ( pin < GPIO_SHADOW_PIN_MAX ); pin++ )
+    {
+        if ( snapshot_pins & GPIO_PIN_BIT( pin ) )
+        {
+            __atomic_store_n( &gpio_sim_levels[ pin ], ( snapshot_levels & GPIO_PIN_BIT( pin ) ) ? GPIO_HIGH : GPIO_LOW, __ATOMIC_RELEASE );
+        }
+    }
+    pthread_mutex_unlock( &gpio_sim_mutex );
+
+    print_stdout( STDPRINT_NAME "capture start levels; pins=0x%x levels=0x%x\n", snapshot_pins, snapshot_levels );
+
+    pplayer->pclk = pclk;
+    pplayer->result = EOK;
+    pplayer->stop = false;
+
+    ret = pthread_create( &pplayer->tid, NULL, gpio_sim_player_entry, pplayer );
+    if ( ret != EOK )
+    {
+        edgecap_reader_close( pplayer->preader );
+        return ret;
+    }
+
+    pplayer->playing = true;
+
+    return EOK;
+}
+
+int gpio_sim_play_join( bool stop )
+{
+    gpio_sim_player_t* pplayer = &gpio_sim_player;
+
+    return_if( !pplayer->playing, EOK );
+
+    pplayer->stop = stop;
+
+    pthread_join( pplayer->tid, NULL );
+    edgecap_reader_close( pplayer->preader );
+    pplayer->playing = false;
+
+    return pplayer->result;
+}
@@ -0,0 +1,45 @@
+#include "gpio.h"
+#include "util.h"
+
+#include <wiringPi.h>
+
+#include <errno.h>
+
+static int gpio_wiringpi_setup( void )
+{
+    return ( wiringPiSetup() < 0 ) ? EIO : EOK;
+}
+
+static int gpio_wiringpi_pin_mode( int pin, gpio_mode_t mode )
+{
+    pinMode( pin, ( mode == gpio_mode_output ) ? OUTPUT : INPUT );
+
+    return EOK;
+}
+
+static int gpio_wiringpi_write( int pin, int value )
+{
+    digitalWrite( pin, value ? HIGH : LOW );
+
+    return EOK;
+}
+
+static int gpio_wiringpi_read( int pin )
+{
+    return digitalRead( pin );
+}
+
+static int gpio_wiringpi_isr( int pin, gpio_isr_callback_t callback )
+{
+    return ( wiringPiISR( pin, INT_EDGE_BOTH, callback ) < 0 ) ? EIO : EOK;
+}
+
+const gpio_backend_t                        gpio_backend_wiringpi =
+    {
+        .name                   = "wiringpi",
+        .setup                  = gpio_wiringpi_setup,
+        .pin_mode               = gpio_wiringpi_pin_mode,
+        .write                  = gpio_wiringpi_write,
+        .read                   = gpio_wiringpi_read,
+        .isr                    = gpio_wiringpi_isr,
+    };
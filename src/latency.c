@@ -0,0 +1,117 @@
+#include "latency.h"
+#include "util.h"
+
+#include <string.h>
+
+/*
+ * Internal function mapping a value to its bucket index
+ */
+static inline int latency_hist_index( uint64_t nsec )
+{
+    if ( nsec < LATENCY_SUBBUCKET_COUNT )
+    {
+        return (int)nsec;
+    }
+
+    int msb = 63 - __builtin_clzll( nsec );
+    int shift = msb - LATENCY_SUBBUCKET_BITS;
+    int sub = (int)( ( nsec >> shift ) & ( LATENCY_SUBBUCKET_COUNT - 1 ) );
+
+    return ( ( shift + 1 ) << LATENCY_SUBBUCKET_BITS ) + sub;
+}
+
+/*
+ * Internal function mapping a bucket index to the largest value it holds
+ */
+static inline uint64_t latency_hist_upper( int index )
+{
+    if ( index < LATENCY_SUBBUCKET_COUNT )
+    {
+        return (uint64_t)index;
+    }
+
+    int shift = ( index >> LATENCY_SUBBUCKET_BITS ) - 1;
+    uint64_t sub = (uint64_t)( index & ( LATENCY_SUBBUCKET_COUNT - 1 ) ) | LATENCY_SUBBUCKET_COUNT;
+
+    return ( ( sub + 1 ) << shift ) - 1;
+}
+
+void latency_hist_init( latency_hist_t* phist )
+{
+    memset( phist, 0, sizeof( *phist ) );
+    phist->min_nsec = UINT64_MAX;
+}
+
+void latency_hist_record( latency_hist_t* phist, uint64_t nsec )
+{
+    phist->buckets[ latency_hist_index( nsec ) ]++;
+    phist->count++;
+    phist->sum_nsec += nsec;
+
+    if ( nsec < phist->min_nsec )
+    {
+        phist->min_nsec = nsec;
+    }
+
+    if ( nsec > phist->max_nsec )
+    {
+        phist->max_nsec = nsec;
+    }
+}
+
+void latency_hist_merge( latency_hist_t* pdst, const latency_hist_t* psrc )
+{
+    int i;
+
+    for ( i = 0; i < LATENCY_BUCKET_COUNT; i++ )
+    {
+        pdst->buckets[ i ] += psrc->buckets[ i ];
+    }
+
+    pdst->count += psrc->count;
+    pdst->sum_nsec += psrc->sum_nsec;
+
+    if ( psrc->min_nsec < pdst->min_nsec )
+    {
+        pdst->min_nsec = psrc->min_nsec;
+    }
+
+    if ( psrc->max_nsec > pdst->max_nsec )
+    {
+        pdst->max_nsec = psrc->max_nsec;
+    }
+}
+
+uint64_t latency_hist_percentile( const latency_hist_t* phist, double percentile )
+{
+    return_if( phist->count == 0, 0 );
+
+    uint64_t target = (uint64_t)( ( percentile / 100.0 ) * (double)phist->count + 0.5 );
+    uint64_t seen = 0;
+    int i;
+
+    if ( target == 0 )
+    {
+        target = 1;
+    }
+
+    for ( i = 0; i < LATENCY_BUCKET_COUNT; i++ )
+    {
+        seen += phist->buckets[ i ];
+
+        if ( seen >= target )
+        {
+            uint64_t upper = latency_hist_upper( i );
+            return ( upper < phist->max_nsec ) ? upper : phist->max_nsec;
+        }
+    }
+
+    return phist->max_nsec;
+}
+
+uint64_t latency_hist_mean( const latency_hist_t* phist )
+{
+    return_if( phist->count == 0, 0 );
+
+    return phist->sum_nsec / phist->count;
+}
@@ -0,0 +1,52 @@
+#ifndef latency_H_
+#define latency_H_
+
+#include <stdint.h>
+
+#define LATENCY_SUBBUCKET_BITS              3
+#define LATENCY_SUBBUCKET_COUNT             (1 << LATENCY_SUBBUCKET_BITS)
+#define LATENCY_BUCKET_COUNT                (64 * LATENCY_SUBBUCKET_COUNT)
+
+/*
+ * Log-linear latency histogram
+ * each power of two is split into LATENCY_SUBBUCKET_COUNT linear buckets (~12% resolution)
+ *
+ * not thread-safe; keep one per thread and merge
+ */
+typedef struct
+{
+    uint64_t            count;
+    uint64_t            sum_nsec;
+    uint64_t            min_nsec;
+    uint64_t            max_nsec;
+    uint64_t            buckets[LATENCY_BUCKET_COUNT];
+} latency_hist_t;
+
+/*
+ * Resets a histogram to empty
+ */
+void latency_hist_init( latency_hist_t* phist );
+
+/*
+ * Records a single sample
+ */
+void latency_hist_record( latency_hist_t* phist, uint64_t nsec );
+
+/*
+ * Adds all samples of psrc into pdst
+ */
+void latency_hist_merge( latency_hist_t* pdst, const latency_hist_t* psrc );
+
+/*
+ * Retrieves the sample value at the given percentile (0.0 - 100.0)
+ *
+ * returns upper bound of the bucket holding the percentile; 0 when empty
+ */
+uint64_t latency_hist_percentile( const latency_hist_t* phist, double percentile );
+
+/*
+ * Retrieves mean sample value; 0 when empty
+ */
+uint64_t latency_hist_mean( const latency_hist_t* phist );
+
+#endif
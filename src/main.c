@@ -1,8 +1,17 @@
 #include "util.h"
 #include "statemachine.h"
-
-#include <wiringPi.h>
-#include <piFace.h>
+#include "behaviour.h"
+#include "behaviour_def.h"
+#include "behaviour_dispatch.h"
+#include "shadow.h"
+#include "clocksrc.h"
+#include "trace.h"
+#include "gpio.h"
+#include "latency.h"
+#include "armmodel.h"
+#include "rtmode.h"
+#include "pwm.h"
+#include "actuator.h"
 
 #include <assert.h>
 #include <unistd.h>
@@ -17,6 +26,7 @@
 #include <sys/queue.h>
 #include <sys/types.h>
 #include <signal.h>
+#include <semaphore.h>
 
 #define STDPRINT_NAME           __FILE__ ":"
 #define GPIO_BASE               0
@@ -26,29 +36,10 @@
 #define BOX_INT_SWITCH1         (GPIO_BASE+3)
 #define BOX_EXT_SWITCH1         (GPIO_BASE+4)
 
-#define ARM_MOVEMENT_FWD_OVERRUN_USEC       200000 //200msec
+#define ARM_MOVEMENT_FWD_OVERRUN_USEC       200000 //200msec; until the arm model learned forward travel
+#define ARM_MOVEMENT_PWM_HZ                 100    //FINGER_MTR_EN when moving below full speed
 #define STATE_DEBOUNCE_USEC                 400000 //400msec
-#define STATE_SCARE1_VIB_USEC               500000  //500msec
-#define STATE_SCARE2_VIB_USEC               500000  //500msec
-#define STATE_SCARE_EXIT_USEC               3000000 //3sec
-#define STATE_TIMEOUT_RESET_USEC            10000000 //10sec
-#define STATE_SUSPICION_EXIT_USEC           45000000 //45sec
-#define STATE_SUSPICION_PEEK_MIN_USEC       1000000 //1sec
-#define STATE_SUSPICION_PEEK_MAX_USEC       12000000 //8sec
-#define STATE_SUSPICION_PEEK_OPEN_MIN_USEC  400000
-#define STATE_SUSPICION_PEEK_OPEN_MAX_USEC  600000
-#define STATE_SUSPICION_PEEK_LEN_MIN_USEC   1000000
-#define STATE_SUSPICION_PEEK_LEN_MAX_USEC   3000000
-#define STATE_SLOWFINGER_DUTYFULL_USEC      200000 //200ms
-#define STATE_SLOWFINGER_DUTYON_USEC        100000
-#define STATE_SLOWFINGER_DUTYOFF_USEC       (STATE_SLOWFINGER_DUTYFULL_USEC-STATE_SLOWFINGER_DUTYON_USEC)
-
-typedef enum
-{
-    am_idle,
-    am_fwd,
-    am_bwd,
-} arm_movement_state_t;
+#define STATE_HANDLER_BUDGET_USEC           2000   //2msec; entry handlers only issue gpio writes and timers
 
 typedef struct
 {
@@ -56,18 +47,72 @@ typedef struct
     statemachine_actions_t  action;
 } state_timer_action_t;
 
+//sampled switch levels; published under a sequence count so readers never take the mutex
 typedef struct
 {
+    uint32_t            seq;                //odd while an update is being written
     bool                int_switch1;
     bool                ext_switch1;
-    pthread_mutex_t     mutex_swstates;
+    uint64_t            edge_nsec;          //when the levels were sampled
+    pthread_mutex_t     mutex_swstates;     //serialises writers only
 } box_swstates_t;
 
+typedef struct
+{
+    bool                int_switch1;
+    bool                ext_switch1;
+    uint32_t            seq;                //advances by 2 per published change
+    uint64_t            edge_nsec;
+} box_swstates_snapshot_t;
+
+typedef enum
+{
+    edge_int_on,
+    edge_int_off,
+    edge_ext_on,
+    edge_ext_off,
+} box_edge_t;
+
+//motor command issued straight from the edge handler; the statemachine catches up afterwards
+typedef struct
+{
+    statemachine_states_t   state;
+    box_edge_t              edge;
+    bool                    other_level;    //level of the switch that did not change
+    arm_movement_state_t    movement;
+} box_reflex_t;
+
 static pthread_mutex_t          mutex_exit;
 static pthread_cond_t           signal_exit;
 static volatile bool            flag_exit;
 static box_swstates_t           box_swstates;
-static arm_movement_state_t     arm_movement_state;
+static arm_movement_state_t     arm_movement_state;     //written by the actuator only
+static arm_movement_state_t     arm_movement_commanded; //last movement submitted
+static int                      arm_speed_commanded;    //speed of that movement
+static uint64_t                 arm_overrun_until_nsec; //forward is held until then after an edge
+static actuator_t*              box_actuator;           //owns the motor pins
+static arm_model_t              box_arm_model;          //learned travel and toggle overrun
+static pwm_t*                   box_pwm;                //drives FINGER_MTR_EN
+static behaviour_slot_t*        box_behaviour;          //hot swappable definition; holds NULL for the builtin behaviour
+static behaviour_dispatch_t*    box_dispatch;           //builtin entry/exit handlers
+static const char*              box_behaviour_path;     //reloaded on SIGUSR1
+static sem_t                    sem_reload;
+static bool                     box_reflexes_enabled;
+static latency_hist_t           box_reflex_latency;     //sample to reflex motor command; under mutex_swstates
+static latency_hist_t           box_entry_latency;      //sample to entry behaviour motor command; entry thread only
+static uint64_t                 box_input_edge_nsec;    //sample time of the last input action not yet entered
+static uint64_t                 box_entry_edge_nsec;    //entry thread only
+
+//each one mirrors what the builtin table and entry behaviour end up doing for that edge
+static const box_reflex_t       box_reflexes[] =
+    {
+        { ss_alarming,          edge_ext_off,   false,  am_bwd  },  //toggle flipped back: reseting
+        { ss_alarming,          edge_ext_off,   true,   am_idle },  //user flipped it back before we left home: idle
+        { ss_reseting,          edge_int_on,    false,  am_idle },  //arm home: idle
+        { ss_reseting,          edge_int_on,    true,   am_fwd  },  //arm home, toggle on again: alarming
+        { ss_reseting_retry,    edge_int_on,    false,  am_idle },  //arm home: suspicion_setup
+        { ss_reseting_retry,    edge_int_on,    true,   am_fwd  },  //arm home, toggle on again: offence
+    };
 
 static int init_rand()
 {
@@ -101,6 +146,44 @@ static void signal_callback_handler(int signum)
    pthread_cond_broadcast(&signal_exit);
 }
 
+// SIGUSR1 asks for the behaviour definition to be reloaded
+static void signal_reload_handler(int signum)
+{
+   __unused(signum);
+
+   sem_post(&sem_reload);
+}
+
+static void* behaviour_reload_thread_entry(void* args)
+{
+    __unused(args);
+
+    rtmode_enter(rt_role_logging);
+
+    //loading and validating happen here; the box keeps running on the
+    //current definition and only sees the new one once it is published
+    while (true)
+    {
+        if (sem_wait(&sem_reload) != 0)
+        {
+            //interrupted by a signal
+            continue;
+        }
+
+        if (flag_exit)
+        {
+            break;
+        }
+
+        if (behaviour_slot_reload(box_behaviour, box_behaviour_path) != EOK)
+        {
+            print_stderr( STDPRINT_NAME "behaviour reload failed; keeping generation=%u\n", behaviour_slot_generation(box_behaviour) );
+        }
+    }
+
+    return NULL;
+}
+
 static void wait_for_exit()
 {
     pthread_mutex_lock(&mutex_exit);
@@ -117,167 +200,321 @@ static void wait_for_exit()
 static int arm_movement_stop()
 {
     print_stdout( STDPRINT_NAME "arm movement stop\n");
-    digitalWrite(FINGER_MTR_EN, LOW);
-    arm_movement_state = am_idle;
+    pwm_set_duty(box_pwm, 0);
+    __atomic_store_n(&arm_movement_state, am_idle, __ATOMIC_RELAXED);
 
     return EOK;
 }
 
-static int arm_movement_forward()
+static int arm_movement_forward( int speed_percent )
 {
-    print_stdout( STDPRINT_NAME "arm movement forward\n");
+    print_stdout( STDPRINT_NAME "arm movement forward; speed=%d%%\n", speed_percent);
 
-    digitalWrite(FINGER_MTR_IN1, LOW);
-    digitalWrite(FINGER_MTR_IN2, HIGH);
+    gpio_write_mask(GPIO_PIN_BIT(FINGER_MTR_IN1) | GPIO_PIN_BIT(FINGER_MTR_IN2), GPIO_PIN_BIT(FINGER_MTR_IN2));
 
-    digitalWrite(FINGER_MTR_EN, HIGH);
-    arm_movement_state = am_fwd;
+    pwm_set_duty(box_pwm, speed_percent);
+    __atomic_store_n(&arm_movement_state, am_fwd, __ATOMIC_RELAXED);
 
     return EOK;
 }
 
-static int arm_movement_backward()
+static int arm_movement_backward( int speed_percent )
 {
-    print_stdout( STDPRINT_NAME "arm movement backward\n");
+    print_stdout( STDPRINT_NAME "arm movement backward; speed=%d%%\n", speed_percent);
 
-    if (box_swstates.int_switch1 == false)
-    {
-        digitalWrite(FINGER_MTR_IN1, HIGH);
-        digitalWrite(FINGER_MTR_IN2, LOW);
+    gpio_write_mask(GPIO_PIN_BIT(FINGER_MTR_IN1) | GPIO_PIN_BIT(FINGER_MTR_IN2), GPIO_PIN_BIT(FINGER_MTR_IN1));
+
+    pwm_set_duty(box_pwm, speed_percent);
+    __atomic_store_n(&arm_movement_state, am_bwd, __ATOMIC_RELAXED);
+
+    return EOK;
+}
 
-        digitalWrite(FINGER_MTR_EN, HIGH);
-        arm_movement_state = am_bwd;
+// Actuator drive; the only caller of the arm_movement_ functions once the actuator runs
+static int box_actuator_drive( void* ctx, arm_movement_state_t movement, int speed_percent )
+{
+    __unused(ctx);
+
+    //travel at reduced speed says nothing about the arm; the model skips it
+    arm_model_motor(&box_arm_model, (speed_percent == 100) ? movement : am_idle, clocksrc_now_nsec(clocksrc_get_real()));
+
+    switch (movement)
+    {
+        case am_fwd:
+            return arm_movement_forward(speed_percent);
+        case am_bwd:
+            return arm_movement_backward(speed_percent);
+        case am_idle:
+        default:
+            return arm_movement_stop();
     }
-    else
+}
+
+// Hands a motor command to the actuator; any thread, never blocks
+static int set_arm_movement( arm_movement_state_t movement, int speed_percent )
+{
+    uint64_t overrun_until_nsec = __atomic_load_n(&arm_overrun_until_nsec, __ATOMIC_ACQUIRE);
+
+    return_if((speed_percent <= 0) || (speed_percent > 100), EINVAL);
+
+    //while a forward edge overruns: keep forward now, take the new movement when the overrun ends;
+    //a later submission supersedes both
+    if ((movement != am_fwd) && (overrun_until_nsec > clocksrc_now_nsec(clocksrc_get_real())))
     {
-        print_stdout( STDPRINT_NAME "arm movement skipped\n");
-        if (box_swstates.ext_switch1 == true)
-        {
-            statemachine_next_state(sa_arm_alarm, NULL);
-        }
-        else
-        {
-            statemachine_next_state(sa_arm_off, NULL);
-        }
+        actuator_cmd_t cmds[2];
+
+        cmds[0].at_nsec = ACTUATOR_NOW;
+        cmds[0].movement = am_fwd;
+        cmds[0].speed_percent = __atomic_load_n(&arm_speed_commanded, __ATOMIC_RELAXED);
+        cmds[1].at_nsec = overrun_until_nsec;
+        cmds[1].movement = movement;
+        cmds[1].speed_percent = speed_percent;
+
+        __atomic_store_n(&arm_movement_commanded, movement, __ATOMIC_RELAXED);
+        __atomic_store_n(&arm_speed_commanded, speed_percent, __ATOMIC_RELAXED);
+
+        return actuator_submit(box_actuator, cmds, NUM_OF(cmds), ACTUATOR_REPLACE);
     }
 
-    return EOK;
+    __atomic_store_n(&arm_movement_commanded, movement, __ATOMIC_RELAXED);
+    __atomic_store_n(&arm_speed_commanded, speed_percent, __ATOMIC_RELAXED);
+
+    return actuator_submit_now(box_actuator, movement, speed_percent);
 }
 
 static int init_pins()
 {
     //init pins
-    pinMode(FINGER_MTR_EN, OUTPUT);
-    pinMode(FINGER_MTR_IN1, OUTPUT);
-    pinMode(FINGER_MTR_IN2, OUTPUT);
-    pinMode(BOX_EXT_SWITCH1, INPUT);
-    pinMode(BOX_INT_SWITCH1, INPUT);
+    gpio_pin_mode(FINGER_MTR_EN, gpio_mode_output);
+    gpio_pin_mode(FINGER_MTR_IN1, gpio_mode_output);
+    gpio_pin_mode(FINGER_MTR_IN2, gpio_mode_output);
+    gpio_pin_mode(BOX_EXT_SWITCH1, gpio_mode_input);
+    gpio_pin_mode(BOX_INT_SWITCH1, gpio_mode_input);
 
     return EOK;
 }
 
-static int init_gpio()
+static int init_gpio(const gpio_backend_t* pbackend)
 {
-    wiringPiSetup();
-
-    return EOK;
+    return gpio_init(pbackend);
 }
 
 static int init_box_swstate( box_swstates_t* pbss )
 {
+    pbss->seq = 0;
     pbss->ext_switch1 = false;
     pbss->int_switch1 = false;
+    pbss->edge_nsec = 0;
     pthread_mutex_init(&pbss->mutex_swstates, NULL);
 
     return EOK;
 }
 
+// Publishes new levels; callers hold mutex_swstates
+static void publish_box_swstate( box_swstates_t* pbss, bool int_switch1, bool ext_switch1, uint64_t edge_nsec )
+{
+    uint32_t seq = pbss->seq;
+
+    __atomic_store_n(&pbss->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    __atomic_store_n(&pbss->int_switch1, int_switch1, __ATOMIC_RELAXED);
+    __atomic_store_n(&pbss->ext_switch1, ext_switch1, __ATOMIC_RELAXED);
+    __atomic_store_n(&pbss->edge_nsec, edge_nsec, __ATOMIC_RELAXED);
+
+    __atomic_store_n(&pbss->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+// Reads a consistent copy of the levels from any thread; never blocks the edge handler
+// retries only while an update is midway through its few stores
+static void read_box_swstate( box_swstates_t* pbss, box_swstates_snapshot_t* psnap )
+{
+    uint32_t seq;
+
+    do
+    {
+        seq = __atomic_load_n(&pbss->seq, __ATOMIC_ACQUIRE);
+
+        psnap->int_switch1 = __atomic_load_n(&pbss->int_switch1, __ATOMIC_RELAXED);
+        psnap->ext_switch1 = __atomic_load_n(&pbss->ext_switch1, __ATOMIC_RELAXED);
+        psnap->edge_nsec = __atomic_load_n(&pbss->edge_nsec, __ATOMIC_RELAXED);
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while ((seq & 1) || (seq != __atomic_load_n(&pbss->seq, __ATOMIC_RELAXED)));
+
+    psnap->seq = seq;
+}
+
+// Finds the reflex for an edge in the current state; only one switch may have changed
+static const box_reflex_t* find_box_reflex( statemachine_states_t state, const box_swstates_t* pbss, const box_swstates_snapshot_t* pnew )
+{
+    box_edge_t edge;
+    bool other_level;
+    size_t i;
+
+    if ((pnew->int_switch1 != pbss->int_switch1) && (pnew->ext_switch1 == pbss->ext_switch1))
+    {
+        edge = pnew->int_switch1 ? edge_int_on : edge_int_off;
+        other_level = pnew->ext_switch1;
+    }
+    else if ((pnew->ext_switch1 != pbss->ext_switch1) && (pnew->int_switch1 == pbss->int_switch1))
+    {
+        edge = pnew->ext_switch1 ? edge_ext_on : edge_ext_off;
+        other_level = pnew->int_switch1;
+    }
+    else
+    {
+        return NULL;
+    }
+
+    for (i = 0; i < NUM_OF(box_reflexes); i++)
+    {
+        if ((box_reflexes[i].state == state) && (box_reflexes[i].edge == edge) && (box_reflexes[i].other_level == other_level))
+        {
+            return &box_reflexes[i];
+        }
+    }
+
+    return NULL;
+}
+
+// Issues the reflex motor command for an edge, if any, ahead of the statemachine
+static void run_box_reflex( const box_swstates_t* pbss, const box_swstates_snapshot_t* pnew )
+{
+    //a compiled definition may react differently to the same edge
+    int epoch;
+    bool builtin = (behaviour_slot_read_lock(box_behaviour, &epoch) == NULL);
+    behaviour_slot_read_unlock(box_behaviour, epoch);
+
+    if (!builtin)
+    {
+        return;
+    }
+
+    const box_reflex_t* preflex = find_box_reflex(statemachine_get_current_state(), pbss, pnew);
+
+    if (preflex == NULL)
+    {
+        return;
+    }
+
+    if ((preflex->movement != __atomic_load_n(&arm_movement_commanded, __ATOMIC_RELAXED))
+        && (set_arm_movement(preflex->movement, 100) == EOK))
+    {
+        latency_hist_record(&box_reflex_latency, clocksrc_now_nsec(clocksrc_get_real()) - pnew->edge_nsec);
+    }
+}
+
 static void set_box_swstate( box_swstates_t* pbss )
 {
     pthread_mutex_lock(&pbss->mutex_swstates);
 
-    box_swstates_t bss_tmp;
+    box_swstates_snapshot_t bss_tmp;
+    uint64_t isr_nsec = clocksrc_now_nsec(clocksrc_get_real());
 
     //forward arm movements need to run a little longer to ensure togglesw flops
     //fully (otherwise it sometimes sits exactly halfway)
-    //we delay the sampling and state change for a small moment
-    if (arm_movement_state == am_fwd)
+    //the motor stays forward as long as the model says; commands meanwhile are
+    //scheduled for the end of it (see set_arm_movement), so nothing waits here
+    if (__atomic_load_n(&arm_movement_state, __ATOMIC_RELAXED) == am_fwd)
     {
-        usleep(ARM_MOVEMENT_FWD_OVERRUN_USEC);
+        __atomic_store_n(&arm_overrun_until_nsec, isr_nsec + arm_model_overrun_nsec(&box_arm_model), __ATOMIC_RELEASE);
     }
 
-
     //we don't bother debouncing as the statemachine is designed to be bounce tolerant
     //under test, seen the arm movement is cleaner and less prone of getting stuck when first
     //making contact with switches (as the debounce without arm movement stop causes overshoot and
     //the debounce with arm movement stop cause jerky undershoots... both resulting in undesired behavior
-    bss_tmp.int_switch1 = digitalRead(BOX_INT_SWITCH1);
-    bss_tmp.ext_switch1 = digitalRead(BOX_EXT_SWITCH1);
+    bss_tmp.int_switch1 = gpio_read(BOX_INT_SWITCH1);
+    bss_tmp.ext_switch1 = gpio_read(BOX_EXT_SWITCH1);
+    bss_tmp.edge_nsec = clocksrc_now_nsec(clocksrc_get_real());
 
     //only issue state changes if we had changes!
+    //(we are the only writer, so plain reads of our own levels are fine here)
     if ((bss_tmp.int_switch1 != pbss->int_switch1)
         || (bss_tmp.ext_switch1 != pbss->ext_switch1))
     {
-        pbss->int_switch1 = bss_tmp.int_switch1;
-        pbss->ext_switch1 = bss_tmp.ext_switch1;
+        //the model times travel from the edge, not from the delayed sample
+        arm_model_edge(&box_arm_model, bss_tmp.int_switch1, bss_tmp.ext_switch1, isr_nsec);
 
-        //apply actions to statemachine
-        if ( (pbss->int_switch1 == false)
-                && (pbss->ext_switch1 == false) )
-        {
-            statemachine_next_state(sa_arm_reset, NULL);
-        }
-
-        if ( (pbss->int_switch1 == true)
-                && (pbss->ext_switch1 == true) )
+        //react first; the state thread repeating the same command later is harmless
+        if (box_reflexes_enabled)
         {
-            statemachine_next_state(sa_arm_alarm, NULL);
+            run_box_reflex(pbss, &bss_tmp);
         }
 
-        if ( (pbss->int_switch1 == false)
-                && (pbss->ext_switch1 == true) )
-        {
-            statemachine_next_state(sa_arm_motion, NULL);
-        }
+        publish_box_swstate(pbss, bss_tmp.int_switch1, bss_tmp.ext_switch1, bss_tmp.edge_nsec);
+        __atomic_store_n(&box_input_edge_nsec, bss_tmp.edge_nsec, __ATOMIC_RELEASE);
 
-        if ( (pbss->int_switch1 == true)
-                && (pbss->ext_switch1 == false) )
-        {
-            statemachine_next_state(sa_arm_off, NULL);
-        }
+        //apply actions to statemachine
+        statemachine_next_state(behaviour_swstate_action(bss_tmp.int_switch1, bss_tmp.ext_switch1), NULL);
     }
 
     pthread_mutex_unlock(&pbss->mutex_swstates);
 
 }
 
+// Keeps later edges away from the behaviour slot; a handler midway through a reflex holds mutex_swstates
+static void stop_box_reflexes( box_swstates_t* pbss )
+{
+    pthread_mutex_lock(&pbss->mutex_swstates);
+    box_reflexes_enabled = false;
+    pthread_mutex_unlock(&pbss->mutex_swstates);
+}
+
 static void callback_box_ext_switch1()
 {
+    rtmode_enter(rt_role_edge);
     print_stdout( STDPRINT_NAME "box EXT switch interrupt!!\n");
 
+    trace_set_source(trace_src_input);
     set_box_swstate(&box_swstates);
 }
 
 static void callback_box_int_switch1()
 {
+    rtmode_enter(rt_role_edge);
     print_stdout( STDPRINT_NAME "box INT switch interrupt!!\n");
 
+    trace_set_source(trace_src_input);
     set_box_swstate(&box_swstates);
 }
 
 static int install_pin_isr()
 {
-    wiringPiISR(BOX_EXT_SWITCH1, INT_EDGE_BOTH, callback_box_ext_switch1);
-    wiringPiISR(BOX_INT_SWITCH1, INT_EDGE_BOTH, callback_box_int_switch1);
+    gpio_isr(BOX_EXT_SWITCH1, callback_box_ext_switch1);
+    gpio_isr(BOX_INT_SWITCH1, callback_box_int_switch1);
 
     return EOK;
 }
 
+// Starts a box thread with the stack size of its role
+static int create_box_thread(pthread_t* ptid, rtmode_role_t role, bool detached, void* (*entry)(void*), void* args)
+{
+    pthread_attr_t attr;
+    int ret = rtmode_thread_attr_init(&attr, role);
+
+    return_if(ret != EOK, ret);
+
+    if (detached)
+    {
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    }
+
+    ret = pthread_create(ptid, &attr, entry, args);
+    pthread_attr_destroy(&attr);
+
+    return ret;
+}
+
 static void* timer_action_entry(void* parg)
 {
     state_timer_action_t* timer_action = (state_timer_action_t*)parg;
-    usleep(timer_action->usec);
 
+    rtmode_enter(rt_role_timer);
+    clocksrc_sleep_usec(clocksrc_get_real(), timer_action->usec);
+
+    trace_set_source(trace_src_timer);
     statemachine_next_state(timer_action->action,NULL);
     free(parg);
 
@@ -299,13 +536,14 @@ static int setup_timer_action(int usec, statemachine_actions_t action)
         print_stdout( STDPRINT_NAME "setting up timer for %2.3f secs\n", ((float)usec / 1000000));
 
         pthread_t pid;
-        pthread_attr_t attr;
-        pthread_attr_init( &attr );
-        pthread_attr_setdetachstate( &attr, PTHREAD_CREATE_DETACHED );
-        pthread_create( &pid, &attr, timer_action_entry, parg );
+        ret = create_box_thread(&pid, rt_role_timer, true, timer_action_entry, parg);
+        if (ret != EOK)
+        {
+            print_stderr( STDPRINT_NAME "failed to start timer thread; err=%d\n", ret );
+            free(parg);
+        }
 
-        pthread_attr_destroy( &attr );
-        return EOK;
+        return ret;
     }
     else
     {
@@ -315,188 +553,131 @@ static int setup_timer_action(int usec, statemachine_actions_t action)
     return ret;
 }
 
-void* statemachine_thread_entry(void* args)
+static int box_ops_arm_movement_speed(void* ctx, arm_movement_state_t movement, int speed_percent)
 {
+    __unused(ctx);
 
-    __unused(args);
-
-    statemachine_states_t current_state = ss_powerup;
-    bool finished = false;
-    statemachine_cid ss_cid;
+    //first motor command of the entry that follows an input edge
+    if (box_entry_edge_nsec != 0)
+    {
+        latency_hist_record(&box_entry_latency, clocksrc_now_nsec(clocksrc_get_real()) - box_entry_edge_nsec);
+        box_entry_edge_nsec = 0;
+    }
 
-    statemachine_init(&ss_cid);
+    //a reflex may have issued this very command already; repeating it is harmless
+    return set_arm_movement(movement, speed_percent);
+}
 
+static int box_ops_arm_movement(void* ctx, arm_movement_state_t movement)
+{
+    return box_ops_arm_movement_speed(ctx, movement, 100);
+}
 
-    while ( !finished )
-    {
-        statemachine_wait_state_change( &ss_cid, &current_state);
+static int box_ops_read_swstates(void* ctx, bool* pint_switch1, bool* pext_switch1)
+{
+    __unused(ctx);
 
-        print_stdout( STDPRINT_NAME "wakingup to handle state change; currentstate=%s \n", statemachine_get_statename( current_state ) );
-        switch (current_state)
-        {
-            case ss_idle:
-            {
-                arm_movement_stop();
-                break;
-            }
+    box_swstates_snapshot_t snap;
 
-            case ss_powerup:
-            {
-                set_box_swstate(&box_swstates);
-                break;
-            }
+    //both levels come from the same edge
+    read_box_swstate(&box_swstates, &snap);
 
-            case ss_alarming:
-            {
-                arm_movement_forward();
-                break;
-            }
+    *pint_switch1 = snap.int_switch1;
+    *pext_switch1 = snap.ext_switch1;
 
-            case ss_reseting:
-            {
-                arm_movement_backward();
-                break;
-            }
+    return EOK;
+}
 
-            case ss_scare_setup:
-            {
-                setup_timer_action(STATE_SCARE_EXIT_USEC, sa_scare_exit);
+// Guard input; runs with the statemachine locked, so it must only read the snapshot
+static int box_input_swstates(void* ctx, bool* pint_switch1, bool* pext_switch1)
+{
+    return box_ops_read_swstates(ctx, pint_switch1, pext_switch1);
+}
 
-                if (box_swstates.int_switch1 == false)
-                {
-                    arm_movement_backward();
-                }
-                else
-                {
-                    arm_movement_forward();
-                }
+static int box_ops_sample_swstates(void* ctx)
+{
+    __unused(ctx);
 
-                break;
-            }
+    set_box_swstate(&box_swstates);
+    return EOK;
+}
 
-            case ss_scare_step1:
-            {
-                setup_timer_action(STATE_SCARE1_VIB_USEC, sa_scare_timeout);
-                arm_movement_forward();
-                break;
-            }
+static int box_ops_setup_timer_action(void* ctx, int usec, statemachine_actions_t action)
+{
+    __unused(ctx);
 
-            case ss_scare_step2:
-            {
-                setup_timer_action(STATE_SCARE2_VIB_USEC, sa_scare_timeout);
-                arm_movement_backward();
-                break;
-            }
+    return setup_timer_action(usec, action);
+}
 
-            case ss_scare_step3:
-            {
-                arm_movement_forward();
-                break;
-            }
+static int box_ops_next_state(void* ctx, statemachine_actions_t action, statemachine_states_t* pnew_state)
+{
+    __unused(ctx);
 
-            case ss_timeout_then_reset:
-            {
-                setup_timer_action(STATE_TIMEOUT_RESET_USEC, sa_timeout);
-                arm_movement_stop();
-                break;
-            }
+    return statemachine_next_state(action, pnew_state);
+}
 
-            case ss_reseting_retry:
-            {
-                arm_movement_backward();
-                break;
-            }
+static int box_ops_random_number(void* ctx, int min_num, int max_num)
+{
+    __unused(ctx);
 
-            case ss_offence:
-            {
-                arm_movement_forward();
-                break;
-            }
-
-            case ss_suspicion_setup:
-            {
-                setup_timer_action(STATE_SUSPICION_EXIT_USEC, sa_suspicion_exit);
-                setup_timer_action(
-                    get_random_number(
-                        STATE_SUSPICION_PEEK_MIN_USEC,
-                        STATE_SUSPICION_PEEK_MAX_USEC),
-                    sa_suspicion_timeout);
-
-                arm_movement_stop();
-                break;
-            }
+    return get_random_number(min_num, max_num);
+}
 
-            case ss_suspicion_step1:
-            {
-                setup_timer_action(
-                    get_random_number(
-                        STATE_SUSPICION_PEEK_OPEN_MIN_USEC,
-                        STATE_SUSPICION_PEEK_OPEN_MAX_USEC),
-                    sa_suspicion_timeout);
+static const box_ops_t          box_ops_gpio =
+    {
+        .arm_movement           = box_ops_arm_movement,
+        .arm_movement_speed     = box_ops_arm_movement_speed,
+        .read_swstates          = box_ops_read_swstates,
+        .sample_swstates        = box_ops_sample_swstates,
+        .setup_timer_action     = box_ops_setup_timer_action,
+        .next_state             = box_ops_next_state,
+        .random_number          = box_ops_random_number,
+    };
 
-                    arm_movement_forward();
-                break;
-            }
+void* statemachine_thread_entry(void* args)
+{
 
-            case ss_suspicion_step2:
-            {
-                setup_timer_action(
-                    get_random_number(
-                        STATE_SUSPICION_PEEK_LEN_MIN_USEC,
-                        STATE_SUSPICION_PEEK_LEN_MAX_USEC),
-                    sa_suspicion_timeout);
+    __unused(args);
 
-                    arm_movement_stop();
-                break;
-            }
+    statemachine_states_t current_state = ss_powerup;
+    statemachine_states_t left_state = ss_END;
+    bool finished = false;
+    statemachine_cid ss_cid;
 
-            case ss_suspicion_step3:
-            {
-                arm_movement_backward();
-                break;
-            }
+    statemachine_init(&ss_cid);
+    trace_set_source(trace_src_entry);
+    rtmode_enter(rt_role_dispatch);
 
-            case ss_slow_finger_setup:
-            {
-                setup_timer_action(STATE_SLOWFINGER_DUTYON_USEC, sa_slowfinger_timeout);
-                arm_movement_forward();
-                break;
-            }
 
-            case ss_slow_finger_step1:
-            {
-                setup_timer_action(STATE_SLOWFINGER_DUTYOFF_USEC, sa_slowfinger_timeout);
-                arm_movement_stop();
-                break;
-            }
+    while ( !finished )
+    {
+        statemachine_wait_state_change( &ss_cid, &current_state);
 
-            case ss_slow_finger_step2:
-            {
-                arm_movement_backward();
-                break;
-            }
+        print_stdout( STDPRINT_NAME "wakingup to handle state change; currentstate=%s \n", statemachine_get_statename( current_state ) );
 
-            case ss_before_shutdown:
-            {
-                arm_movement_stop();
-                statemachine_next_state(sa_shutdown_done, &current_state);
-                break;
-            }
+        box_entry_edge_nsec = __atomic_exchange_n(&box_input_edge_nsec, 0, __ATOMIC_ACQ_REL);
 
-            case ss_shutdown:
-            {
-                finished = true;
-                break;
-            }
+        //changes coalesce; only the state last entered is left
+        if (left_state != ss_END)
+        {
+            behaviour_dispatch_exit( box_dispatch, &box_ops_gpio, NULL, left_state, &finished );
+        }
 
-            default:
-            {
-                //unknown state (should never happen)
-                print_stderr( STDPRINT_NAME "unknown state entered; currentstate=%d\n", current_state );
+        //entry ops run on one definition even if a reload lands meanwhile
+        int epoch;
+        const behaviour_def_t* pdef = behaviour_slot_read_lock( box_behaviour, &epoch );
 
-                break;
-            }
+        if (pdef != NULL)
+        {
+            behaviour_def_enter_state( pdef, &box_ops_gpio, NULL, &current_state, &finished );
         }
+        else
+        {
+            behaviour_dispatch_enter( box_dispatch, &box_ops_gpio, NULL, &current_state, &finished );
+        }
+
+        behaviour_slot_read_unlock( box_behaviour, epoch );
+        left_state = current_state;
     }
 
 
@@ -505,40 +686,168 @@ void* statemachine_thread_entry(void* args)
 
 int wait_for_shutdown(statemachine_cid* pss_cid)
 {
-    statemachine_states_t current_state = ss_powerup;
-
-    while ( current_state != ss_shutdown )
-    {
-        statemachine_wait_state_change( pss_cid, &current_state);
-    }
-
-    return EOK;
+    //only the transition into ss_shutdown wakes us
+    return statemachine_wait_until(pss_cid, STATEMACHINE_STATE_BIT(ss_shutdown), 0, NULL);
 }
 
 int main(int c, char **v)
 {
     pthread_t pid;
+    pthread_t reload_pid;
     statemachine_cid ss_main_cid;
+    behaviour_def_t* pdef = NULL;
+    behaviour_def_t* pcandidate = NULL;
+    shadow_t* pshadow = NULL;
+    trace_writer_t* ptrace = NULL;
+    edgecap_writer_t* pcapture = NULL;
+    const char* playback_path = NULL;
+    bool rt_enabled = false;
+    int pwm_hz = ARM_MOVEMENT_PWM_HZ;
+    rtmode_config_t rt_config;
+    int opt;
+
+    rtmode_default_config(&rt_config);
+
+    while ((opt = getopt(c, v, "t:c:p:b:s:rRA:f:")) != -1)
+    {
+        switch (opt)
+        {
+            case 't':
+                //record every applied action for offline replay
+                if (trace_writer_open(&ptrace, optarg) != EOK)
+                {
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'c':
+                //record raw switch edges and motor writes
+                if (edgecap_writer_open(&pcapture, optarg) != EOK)
+                {
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'p':
+                //no hardware; switch edges come from a capture
+                playback_path = optarg;
+                break;
+            case 'b':
+                //loaded below; SIGUSR1 reloads it while running
+                box_behaviour_path = optarg;
+                break;
+            case 's':
+                //evaluate a candidate definition next to the live one and report where they differ
+                if (behaviour_def_load(&pcandidate, optarg) != EOK)
+                {
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'r':
+                //motor reactions straight from the edge handler
+                box_reflexes_enabled = true;
+                break;
+            case 'R':
+                //SCHED_FIFO per thread role, locked memory; falls back without privileges
+                rt_enabled = true;
+                break;
+            case 'A':
+                //cpus for the edge, timer, dispatch and logging threads
+                if (sscanf(optarg, "%d,%d,%d,%d",
+                        &rt_config.roles[rt_role_edge].cpu,
+                        &rt_config.roles[rt_role_timer].cpu,
+                        &rt_config.roles[rt_role_dispatch].cpu,
+                        &rt_config.roles[rt_role_logging].cpu) != rt_role_END)
+                {
+                    fprintf(stderr, "-A takes four cpus: edge,timer,dispatch,logging (-1 for any)\n");
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'f':
+                //pwm frequency for movements below full speed
+                pwm_hz = atoi(optarg);
+                if ((pwm_hz <= 0) || (pwm_hz > PWM_FREQ_MAX_HZ))
+                {
+                    fprintf(stderr, "-f takes 1 to %d hz\n", PWM_FREQ_MAX_HZ);
+                    return EXIT_FAILURE;
+                }
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-t tracefile] [-c capturefile] [-p capturefile] [-b behaviourfile] [-s candidatefile] [-r] [-R [-A cpus]] [-f pwmhz]\n", v[0]);
+                return EXIT_FAILURE;
+        }
+    }
+
+    if (box_behaviour_path != NULL)
+    {
+        //transitions and entry behaviour from a compiled definition
+        if (behaviour_def_load(&pdef, box_behaviour_path) != EOK)
+        {
+            return EXIT_FAILURE;
+        }
+    }
+    behaviour_slot_create(&box_behaviour, pdef);
+    behaviour_dispatch_create(&box_dispatch, STATE_HANDLER_BUDGET_USEC);
+    sem_init(&sem_reload, 0, 0);
 
     flag_exit = false;
     // Register signal and signal handler
     signal(SIGINT, signal_callback_handler);
     signal(SIGHUP, signal_callback_handler);
+    signal(SIGUSR1, signal_reload_handler);
+
+    arm_model_init(&box_arm_model, (uint64_t)ARM_MOVEMENT_FWD_OVERRUN_USEC * 1000);
+    latency_hist_init(&box_reflex_latency);
+    latency_hist_init(&box_entry_latency);
 
     init_rand();
     util_init();
     set_verbose_lvl(verblvl_moremore);
 
+    //before any thread of ours or wiringPi's starts
+    if (rt_enabled && (rtmode_start(&rt_config) != EOK))
+    {
+        fprintf(stderr, "rt mode: priority or cpu out of range\n");
+        return EXIT_FAILURE;
+    }
+
     statemachine_init(&ss_main_cid);
+    statemachine_subscribe(&ss_main_cid, 0, 0);
+    statemachine_set_trace(ptrace);
+    statemachine_set_behaviour(box_behaviour);
+    statemachine_set_input(box_input_swstates, NULL);
+    if (pcandidate != NULL)
+    {
+        shadow_start(&pshadow, pcandidate, NULL);
+        statemachine_set_shadow(pshadow);
+    }
+    trace_set_source(trace_src_control);
     init_box_swstate(&box_swstates);
-    init_gpio();
+    init_gpio((playback_path != NULL) ? &gpio_backend_sim : &gpio_backend_wiringpi);
+    gpio_set_capture(pcapture);
     init_pins();
+    if ((pwm_create(&box_pwm, FINGER_MTR_EN, pwm_hz, clocksrc_get_real()) != EOK)
+        || (actuator_create(&box_actuator, box_actuator_drive, NULL) != EOK))
+    {
+        fprintf(stderr, "motor control not started\n");
+        return EXIT_FAILURE;
+    }
     install_pin_isr();
 
-    arm_movement_stop();
+    if (playback_path != NULL)
+    {
+        gpio_sim_play_start(playback_path, clocksrc_get_real());
+        //a capture of the playback starts from the played start levels
+        gpio_set_capture(pcapture);
+    }
+
+    set_arm_movement(am_idle, 100);
 
     //kick off statemachine monitoring thread
-    pthread_create( &pid, NULL, statemachine_thread_entry, NULL );
+    create_box_thread(&pid, rt_role_dispatch, false, statemachine_thread_entry, NULL);
+
+    if (box_behaviour_path != NULL)
+    {
+        create_box_thread(&reload_pid, rt_role_logging, false, behaviour_reload_thread_entry, NULL);
+    }
 
     //all actions are conducted async to main thread
     //we just wait here until signaled to term
@@ -550,6 +859,66 @@ int main(int c, char **v)
     //wait here until shutdown cleanup complete
     wait_for_shutdown(&ss_main_cid);
 
+    statemachine_set_trace(NULL);
+    trace_writer_close(ptrace);
+
+    //entry behaviour may still be reading the definition until it sees ss_shutdown
+    pthread_join(pid, NULL);
+
+    if (box_behaviour_path != NULL)
+    {
+        sem_post(&sem_reload);
+        pthread_join(reload_pid, NULL);
+    }
+    statemachine_set_input(NULL, NULL);
+    statemachine_set_behaviour(NULL);
+
+    //edges keep coming until here: played ones until the player is joined,
+    //wiringPi ones for good (its handlers cannot be removed)
+    gpio_sim_play_join(true);
+    stop_box_reflexes(&box_swstates);
+    behaviour_slot_destroy(box_behaviour);
+
+    rtmode_report(stdout);
+    pwm_report(box_pwm, stdout);
+    actuator_report(box_actuator, stdout);
+    printf("input to motor command; reflex n=%llu p50=%lluus p99=%lluus max=%lluus; entry n=%llu p50=%lluus p99=%lluus max=%lluus\n",
+        (unsigned long long)box_reflex_latency.count,
+        (unsigned long long)(latency_hist_percentile(&box_reflex_latency, 50.0) / 1000),
+        (unsigned long long)(latency_hist_percentile(&box_reflex_latency, 99.0) / 1000),
+        (unsigned long long)(box_reflex_latency.max_nsec / 1000),
+        (unsigned long long)box_entry_latency.count,
+        (unsigned long long)(latency_hist_percentile(&box_entry_latency, 50.0) / 1000),
+        (unsigned long long)(latency_hist_percentile(&box_entry_latency, 99.0) / 1000),
+        (unsigned long long)(box_entry_latency.max_nsec / 1000));
+
+    arm_model_report(&box_arm_model, stdout);
+
+    printf("state handler timing:\n");
+    behaviour_dispatch_report(box_dispatch, stdout);
+    behaviour_dispatch_destroy(box_dispatch);
+
+    statemachine_set_shadow(NULL);
+    shadow_stop(pshadow);
+    behaviour_def_unload(pcandidate);
+    sem_destroy(&sem_reload);
+
+    //the actuator and the pwm write pins until destroyed, deadline commands included
+    actuator_destroy(box_actuator);
+    pwm_destroy(box_pwm);
+    gpio_set_capture(NULL);
+    edgecap_writer_close(pcapture);
+
+    gpio_write_stats_t write_stats;
+    gpio_get_write_stats(&write_stats);
+    printf("gpio writes; requested=%llu elided=%llu backend ops=%llu\n",
+        (unsigned long long)write_stats.requested,
+        (unsigned long long)write_stats.elided,
+        (unsigned long long)write_stats.backend_ops);
+
+    arm_model_destroy(&box_arm_model);
+    rtmode_stop();
+
     util_fini();
 
     printf("clean exit!\n");
@@ -0,0 +1,227 @@
+#include "pwm.h"
+#include "gpio.h"
+#include "rtmode.h"
+#include "util.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#define STDPRINT_NAME                       __FILE__ ":"
+
+struct pwm
+{
+    int                                     pin;
+    clocksrc_t*                             pclk;
+    pthread_t                               tid;
+    pthread_mutex_t                         mutex;          //guards everything below and every pin write
+    pthread_cond_t                          signal_active;
+    bool                                    running;
+    int                                     duty_percent;
+    uint64_t                                period_nsec;
+    pwm_stats_t                             stats;
+};
+
+/*
+ * Internal function telling whether the timing loop has anything to do
+ */
+static inline bool pwm_is_active_nolock( const pwm_t* ppwm )
+{
+    return ppwm->running && ( ppwm->duty_percent > 0 ) && ( ppwm->duty_percent < 100 );
+}
+
+/*
+ * Internal function writing one edge and recording how late it came
+ */
+static void pwm_write_edge_nolock( pwm_t* ppwm, int level, uint64_t deadline_nsec )
+{
+    gpio_write( ppwm->pin, level );
+
+    uint64_t now_nsec = clocksrc_now_nsec( ppwm->pclk );
+    latency_hist_record( &ppwm->stats.jitter, ( now_nsec > deadline_nsec ) ? now_nsec - deadline_nsec : 0 );
+}
+
+static void* pwm_thread_entry( void* args )
+{
+    pwm_t* ppwm = (pwm_t*)args;
+
+    rtmode_enter( rt_role_timer );
+
+    pthread_mutex_lock( &ppwm->mutex );
+    for (;;)
+    {
+        while ( ppwm->running && !pwm_is_active_nolock( ppwm ) )
+        {
+            pthread_cond_wait( &ppwm->signal_active, &ppwm->mutex );
+        }
+
+        if ( !ppwm->running )
+        {
+            break;
+        }
+
+        uint64_t start_nsec = clocksrc_now_nsec( ppwm->pclk );
+
+        //steady levels set meanwhile were written by the caller; stop touching the pin
+        while ( pwm_is_active_nolock( ppwm ) )
+        {
+            uint64_t period_nsec = ppwm->period_nsec;
+            uint64_t high_nsec = period_nsec * (uint64_t)ppwm->duty_percent / 100;
+
+            pwm_write_edge_nolock( ppwm, GPIO_HIGH, start_nsec );
+
+            pthread_mutex_unlock( &ppwm->mutex );
+            clocksrc_sleep_until( ppwm->pclk, start_nsec + high_nsec );
+            pthread_mutex_lock( &ppwm->mutex );
+
+            if ( !pwm_is_active_nolock( ppwm ) )
+            {
+                break;
+            }
+
+            pwm_write_edge_nolock( ppwm, GPIO_LOW, start_nsec + high_nsec );
+
+            pthread_mutex_unlock( &ppwm->mutex );
+            clocksrc_sleep_until( ppwm->pclk, start_nsec + period_nsec );
+            pthread_mutex_lock( &ppwm->mutex );
+
+            ppwm->stats.periods++;
+            start_nsec += period_nsec;
+
+            //a whole period lost (e.g. preempted) is skipped rather than caught up
+            uint64_t now_nsec = clocksrc_now_nsec( ppwm->pclk );
+            if ( now_nsec > start_nsec + period_nsec )
+            {
+                start_nsec = now_nsec;
+            }
+        }
+    }
+    pthread_mutex_unlock( &ppwm->mutex );
+
+    return NULL;
+}
+
+int pwm_create( pwm_t** ppwm, int pin, int freq_hz, clocksrc_t* pclk )
+{
+    pwm_t* pnew;
+    pthread_attr_t attr;
+    int ret;
+
+    return_if( ( freq_hz <= 0 ) || ( freq_hz > PWM_FREQ_MAX_HZ ), EINVAL );
+
+    pnew = calloc( 1, sizeof( pwm_t ) );
+    return_if( pnew == NULL, ENOMEM );
+
+    pnew->pin = pin;
+    pnew->pclk = pclk;
+    pnew->running = true;
+    pnew->duty_percent = 0;
+    pnew->period_nsec = 1000000000ULL / (uint64_t)freq_hz;
+    latency_hist_init( &pnew->stats.jitter );
+    pthread_mutex_init( &pnew->mutex, NULL );
+    pthread_cond_init( &pnew->signal_active, NULL );
+
+    gpio_write( pin, GPIO_LOW );
+
+    ret = rtmode_thread_attr_init( &attr, rt_role_timer );
+    if ( ret == EOK )
+    {
+        ret = pthread_create( &pnew->tid, &attr, pwm_thread_entry, pnew );
+        pthread_attr_destroy( &attr );
+    }
+
+    if ( ret != EOK )
+    {
+        pthread_cond_destroy( &pnew->signal_active );
+        pthread_mutex_destroy( &pnew->mutex );
+        free( pnew );
+        return ret;
+    }
+
+    *ppwm = pnew;
+
+    return EOK;
+}
+
+int pwm_destroy( pwm_t* ppwm )
+{
+    return_if( ppwm == NULL, EOK );
+
+    pthread_mutex_lock( &ppwm->mutex );
+    ppwm->running = false;
+    ppwm->duty_percent = 0;
+    gpio_write( ppwm->pin, GPIO_LOW );
+    pthread_cond_signal( &ppwm->signal_active );
+    pthread_mutex_unlock( &ppwm->mutex );
+
+    //the loop notices within one edge
+    pthread_join( ppwm->tid, NULL );
+
+    pthread_cond_destroy( &ppwm->signal_active );
+    pthread_mutex_destroy( &ppwm->mutex );
+    free( ppwm );
+
+    return EOK;
+}
+
+int pwm_set_duty( pwm_t* ppwm, int duty_percent )
+{
+    return_if( ( duty_percent < 0 ) || ( duty_percent > 100 ), EINVAL );
+
+    pthread_mutex_lock( &ppwm->mutex );
+    ppwm->duty_percent = duty_percent;
+
+    if ( duty_percent == 0 )
+    {
+        gpio_write( ppwm->pin, GPIO_LOW );
+    }
+    else if ( duty_percent == 100 )
+    {
+        gpio_write( ppwm->pin, GPIO_HIGH );
+    }
+    else
+    {
+        pthread_cond_signal( &ppwm->signal_active );
+    }
+    pthread_mutex_unlock( &ppwm->mutex );
+
+    return EOK;
+}
+
+int pwm_set_frequency( pwm_t* ppwm, int freq_hz )
+{
+    return_if( ( freq_hz <= 0 ) || ( freq_hz > PWM_FREQ_MAX_HZ ), EINVAL );
+
+    pthread_mutex_lock( &ppwm->mutex );
+    ppwm->period_nsec = 1000000000ULL / (uint64_t)freq_hz;
+    pthread_mutex_unlock( &ppwm->mutex );
+
+    return EOK;
+}
+
+void pwm_get_stats( pwm_t* ppwm, pwm_stats_t* pstats )
+{
+    pthread_mutex_lock( &ppwm->mutex );
+    *pstats = ppwm->stats;
+    pthread_mutex_unlock( &ppwm->mutex );
+}
+
+void pwm_report( pwm_t* ppwm, FILE* pout )
+{
+    pwm_stats_t stats;
+    uint64_t period_nsec;
+
+    pthread_mutex_lock( &ppwm->mutex );
+    period_nsec = ppwm->period_nsec;
+    stats = ppwm->stats;
+    pthread_mutex_unlock( &ppwm->mutex );
+
+    fprintf( pout, "pwm; pin=%d freq=%lluhz periods=%llu jitter p50=%lluus p99=%lluus max=%lluus\n",
+        ppwm->pin,
+        (unsigned long long)( 1000000000ULL / period_nsec ),
+        (unsigned long long)stats.periods,
+        (unsigned long long)( latency_hist_percentile( &stats.jitter, 50.0 ) / 1000 ),
+        (unsigned long long)( latency_hist_percentile( &stats.jitter, 99.0 ) / 1000 ),
+        (unsigned long long)( stats.jitter.max_nsec / 1000 ) );
+}
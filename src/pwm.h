@@ -0,0 +1,79 @@
+#ifndef pwm_H_
+#define pwm_H_
+
+#include "clocksrc.h"
+#include "latency.h"
+
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * Software pwm on one gpio output
+ *
+ * A single thread runs the timing loop against absolute deadlines, so
+ * lateness of one edge does not shift the ones after it. Duty 0 and 100 are
+ * steady levels written right away by the caller; the thread then sleeps
+ * until a duty in between is set. Duty and frequency changes take effect at
+ * the next period.
+ *
+ * Jitter is how late each edge was written relative to its deadline.
+ */
+
+#define PWM_FREQ_MAX_HZ                     10000
+
+typedef struct
+{
+    uint64_t        periods;        //full periods generated
+    latency_hist_t  jitter;         //edge lateness
+} pwm_stats_t;
+
+typedef struct pwm pwm_t;
+
+/*
+ * Creates a generator for an output pin, holding it low
+ *
+ * ppwm         pointer to receive the generator
+ * pin          gpio output; set up by the caller
+ * freq_hz      1 to PWM_FREQ_MAX_HZ
+ * pclk         clock the timing loop sleeps on
+ *
+ * returns EOK on success; EINVAL for frequencies out of range; EErr type otherwise
+ */
+int pwm_create( pwm_t** ppwm, int pin, int freq_hz, clocksrc_t* pclk );
+
+/*
+ * Stops the generator, leaving the pin low
+ *
+ * returns EOK always
+ */
+int pwm_destroy( pwm_t* ppwm );
+
+/*
+ * Sets the share of each period the pin is high
+ *
+ * thread-safe: yes
+ *
+ * returns EOK on success; EINVAL for duties outside 0 to 100
+ */
+int pwm_set_duty( pwm_t* ppwm, int duty_percent );
+
+/*
+ * Sets the period length
+ *
+ * thread-safe: yes
+ *
+ * returns EOK on success; EINVAL for frequencies out of range
+ */
+int pwm_set_frequency( pwm_t* ppwm, int freq_hz );
+
+/*
+ * Retrieves generated periods and edge jitter
+ */
+void pwm_get_stats( pwm_t* ppwm, pwm_stats_t* pstats );
+
+/*
+ * Writes frequency, periods and jitter as one line
+ */
+void pwm_report( pwm_t* ppwm, FILE* pout );
+
+#endif
@@ -0,0 +1,274 @@
+#define _GNU_SOURCE     //cpu affinity
+
+#include "rtmode.h"
+#include "util.h"
+
+#include <alloca.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define STDPRINT_NAME                       __FILE__ ":"
+
+#define RTMODE_PRIO_EDGE                    80
+#define RTMODE_PRIO_TIMER                   70
+#define RTMODE_PRIO_DISPATCH                60
+#define RTMODE_PRIO_LOGGING                 20
+#define RTMODE_PREFAULT_BYTES               ( 64 * 1024 )
+#define RTMODE_PREFAULT_TIMER_BYTES         ( 16 * 1024 )   //a thread per timer; keep it short
+#define RTMODE_STACK_BYTES                  ( 256 * 1024 )
+#define RTMODE_STACK_TIMER_BYTES            ( 64 * 1024 )
+
+#ifndef MCL_ONFAULT
+#define MCL_ONFAULT                         4       //linux 4.4; older headers lack it
+#endif
+
+static const char*                          rtmode_role_names[ rt_role_END ] =
+    {
+        [ rt_role_edge ]        = "edge",
+        [ rt_role_timer ]       = "timer",
+        [ rt_role_dispatch ]    = "dispatch",
+        [ rt_role_logging ]     = "logging",
+    };
+
+static bool                                 rtmode_started;
+static bool                                 rtmode_locked;          //mlockall succeeded
+static bool                                 rtmode_fifo;            //SCHED_FIFO allowed
+static rtmode_config_t                      rtmode_config;
+static unsigned                             rtmode_entered[ rt_role_END ];
+static unsigned                             rtmode_failed[ rt_role_END ];
+static __thread int                         rtmode_thread_role = -1;
+
+/*
+ * Internal function touching a stack region so it is mapped (and locked) before it is needed
+ * kept out of line; the region is released on return but the pages stay
+ */
+static void __attribute__(( noinline )) rtmode_prefault_stack( size_t bytes )
+{
+    volatile char* pstack = alloca( bytes );
+    size_t page = (size_t)sysconf( _SC_PAGESIZE );
+    size_t i;
+
+    for ( i = 0; i < bytes; i += page )
+    {
+        pstack[ i ] = 0;
+    }
+}
+
+/*
+ * Internal function checking whether the calling thread may switch to SCHED_FIFO
+ * leaves the thread's scheduling as it was
+ */
+static bool rtmode_probe_fifo( void )
+{
+    struct sched_param param;
+    struct sched_param saved;
+    int policy;
+
+    pthread_getschedparam( pthread_self(), &policy, &saved );
+
+    param.sched_priority = sched_get_priority_min( SCHED_FIFO );
+    if ( pthread_setschedparam( pthread_self(), SCHED_FIFO, &param ) != EOK )
+    {
+        return false;
+    }
+
+    pthread_setschedparam( pthread_self(), policy, &saved );
+
+    return true;
+}
+
+void rtmode_default_config( rtmode_config_t* pconfig )
+{
+    static const int priorities[ rt_role_END ] =
+        {
+            [ rt_role_edge ]        = RTMODE_PRIO_EDGE,
+            [ rt_role_timer ]       = RTMODE_PRIO_TIMER,
+            [ rt_role_dispatch ]    = RTMODE_PRIO_DISPATCH,
+            [ rt_role_logging ]     = RTMODE_PRIO_LOGGING,
+        };
+    int role;
+
+    for ( role = 0; role < rt_role_END; role++ )
+    {
+        pconfig->roles[ role ].priority = priorities[ role ];
+        pconfig->roles[ role ].cpu = RTMODE_CPU_ANY;
+        pconfig->roles[ role ].prefault_bytes = RTMODE_PREFAULT_BYTES;
+        pconfig->roles[ role ].stack_bytes = RTMODE_STACK_BYTES;
+    }
+
+    pconfig->roles[ rt_role_timer ].prefault_bytes = RTMODE_PREFAULT_TIMER_BYTES;
+    pconfig->roles[ rt_role_timer ].stack_bytes = RTMODE_STACK_TIMER_BYTES;
+    pconfig->roles[ rt_role_logging ].prefault_bytes = 0;
+}
+
+int rtmode_start( const rtmode_config_t* pconfig )
+{
+    int prio_min = sched_get_priority_min( SCHED_FIFO );
+    int prio_max = sched_get_priority_max( SCHED_FIFO );
+    long cpus = sysconf( _SC_NPROCESSORS_CONF );
+    int role;
+
+    for ( role = 0; role < rt_role_END; role++ )
+    {
+        const rtmode_role_config_t* prole = &pconfig->roles[ role ];
+
+        return_if( ( prole->priority < prio_min ) || ( prole->priority > prio_max ), EINVAL );
+        return_if( ( prole->cpu != RTMODE_CPU_ANY ) && ( ( prole->cpu < 0 ) || ( prole->cpu >= cpus ) || ( prole->cpu >= CPU_SETSIZE ) ), EINVAL );
+        return_if( ( prole->stack_bytes < PTHREAD_STACK_MIN ) || ( prole->prefault_bytes >= prole->stack_bytes ), EINVAL );
+    }
+
+    rtmode_config = *pconfig;
+
+    //pages are locked as they are faulted in; locking whole new mappings up front
+    //would fault every thread stack in full inside pthread_create
+    //kernels before 4.4 reject MCL_ONFAULT and lock everything instead
+    rtmode_locked = ( mlockall( MCL_CURRENT | MCL_FUTURE | MCL_ONFAULT ) == EOK );
+    if ( !rtmode_locked && ( errno == EINVAL ) )
+    {
+        rtmode_locked = ( mlockall( MCL_CURRENT | MCL_FUTURE ) == EOK );
+    }
+    if ( !rtmode_locked )
+    {
+        print_stderr( STDPRINT_NAME "memory not locked; running without; errno=%d\n", errno );
+    }
+
+    rtmode_fifo = rtmode_probe_fifo();
+    if ( !rtmode_fifo )
+    {
+        print_stderr( STDPRINT_NAME "SCHED_FIFO not permitted; threads keep normal priority\n" );
+    }
+
+    memset( rtmode_entered, 0, sizeof( rtmode_entered ) );
+    memset( rtmode_failed, 0, sizeof( rtmode_failed ) );
+    __atomic_store_n( &rtmode_started, true, __ATOMIC_RELEASE );
+
+    return EOK;
+}
+
+int rtmode_stop( void )
+{
+    return_if_not( __atomic_load_n( &rtmode_started, __ATOMIC_ACQUIRE ), EOK );
+
+    __atomic_store_n( &rtmode_started, false, __ATOMIC_RELEASE );
+
+    if ( rtmode_locked )
+    {
+        munlockall();
+        rtmode_locked = false;
+    }
+
+    return EOK;
+}
+
+int rtmode_enter( rtmode_role_t role )
+{
+    const rtmode_role_config_t* prole;
+    int ret = EOK;
+
+    return_if( (unsigned)role >= rt_role_END, EINVAL );
+    return_if_not( __atomic_load_n( &rtmode_started, __ATOMIC_ACQUIRE ), EOK );
+
+    //isr threads announce themselves on every edge
+    return_if( rtmode_thread_role == (int)role, EOK );
+    rtmode_thread_role = (int)role;
+
+    prole = &rtmode_config.roles[ role ];
+
+    if ( prole->cpu != RTMODE_CPU_ANY )
+    {
+        cpu_set_t set;
+
+        CPU_ZERO( &set );
+        CPU_SET( prole->cpu, &set );
+        ret = pthread_setaffinity_np( pthread_self(), sizeof( set ), &set );
+    }
+
+    if ( rtmode_fifo )
+    {
+        struct sched_param param;
+        int ret_sched;
+
+        param.sched_priority = prole->priority;
+        ret_sched = pthread_setschedparam( pthread_self(), SCHED_FIFO, &param );
+        if ( ret == EOK )
+        {
+            ret = ret_sched;
+        }
+    }
+
+    if ( prole->prefault_bytes > 0 )
+    {
+        rtmode_prefault_stack( prole->prefault_bytes );
+    }
+
+    __atomic_add_fetch( ( ret == EOK ) ? &rtmode_entered[ role ] : &rtmode_failed[ role ], 1, __ATOMIC_RELAXED );
+
+    return ret;
+}
+
+int rtmode_thread_attr_init( pthread_attr_t* pattr, rtmode_role_t role )
+{
+    rtmode_config_t config;
+    int ret;
+
+    return_if( (unsigned)role >= rt_role_END, EINVAL );
+
+    if ( rtmode_active() )
+    {
+        config = rtmode_config;
+    }
+    else
+    {
+        rtmode_default_config( &config );
+    }
+
+    ret = pthread_attr_init( pattr );
+    return_if( ret != EOK, ret );
+
+    ret = pthread_attr_setstacksize( pattr, config.roles[ role ].stack_bytes );
+    if ( ret != EOK )
+    {
+        pthread_attr_destroy( pattr );
+    }
+
+    return ret;
+}
+
+bool rtmode_active( void )
+{
+    return __atomic_load_n( &rtmode_started, __ATOMIC_ACQUIRE );
+}
+
+void rtmode_report( FILE* pout )
+{
+    int role;
+
+    if ( !rtmode_active() )
+    {
+        fprintf( pout, "rt mode off\n" );
+        return;
+    }
+
+    fprintf( pout, "rt mode on; memory %s; SCHED_FIFO %s\n",
+        rtmode_locked ? "locked" : "not locked",
+        rtmode_fifo ? "applied" : "not permitted" );
+
+    for ( role = 0; role < rt_role_END; role++ )
+    {
+        const rtmode_role_config_t* prole = &rtmode_config.roles[ role ];
+
+        fprintf( pout, "  %-9s prio=%d cpu=%d prefault=%zu stack=%zu threads=%u failed=%u\n",
+            rtmode_role_names[ role ],
+            rtmode_fifo ? prole->priority : 0,
+            prole->cpu,
+            prole->prefault_bytes,
+            prole->stack_bytes,
+            __atomic_load_n( &rtmode_entered[ role ], __ATOMIC_RELAXED ),
+            __atomic_load_n( &rtmode_failed[ role ], __ATOMIC_RELAXED ) );
+    }
+}
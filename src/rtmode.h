@@ -0,0 +1,96 @@
+#ifndef rtmode_H_
+#define rtmode_H_
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+/*
+ * Optional real-time execution mode
+ *
+ * Every thread announces its role once it runs; with the mode started that
+ * moves it to SCHED_FIFO at the role priority, pins it to the role cpu and
+ * pre-faults its stack. Memory is locked at start as it is faulted in, so
+ * the pre-fault decides how much of each stack is locked up front.
+ *
+ * Box threads are created with the role stack size (rtmode_thread_attr_init)
+ * whether or not the mode is started, so a thread per timer stays cheap.
+ *
+ * Missing privileges are detected at start: without CAP_SYS_NICE (or an
+ * RLIMIT_RTPRIO) threads stay at normal priority, without CAP_IPC_LOCK (or
+ * RLIMIT_MEMLOCK) memory stays unlocked. Pinning and pre-faulting need no
+ * privileges and are applied regardless.
+ */
+
+#define RTMODE_CPU_ANY                      -1
+
+typedef enum
+{
+    rt_role_edge,           //switch edge handling; highest
+    rt_role_timer,          //state timers
+    rt_role_dispatch,       //state entry behaviour
+    rt_role_logging,        //background writers; lowest
+    rt_role_END,   //not valid; marks end of enum
+} rtmode_role_t;
+
+typedef struct
+{
+    int         priority;           //SCHED_FIFO priority
+    int         cpu;                //RTMODE_CPU_ANY leaves the thread unpinned
+    size_t      prefault_bytes;     //stack touched when the thread enters the role
+    size_t      stack_bytes;        //stack size of threads created for the role
+} rtmode_role_config_t;
+
+typedef struct
+{
+    rtmode_role_config_t    roles[ rt_role_END ];
+} rtmode_config_t;
+
+/*
+ * Fills a configuration with the default priorities, no pinning, stack pre-faulting and stack sizes
+ */
+void rtmode_default_config( rtmode_config_t* pconfig );
+
+/*
+ * Starts the mode: locks memory and probes for the privileges needed
+ * falls back silently per feature (reported through rtmode_report) when privileges are missing
+ *
+ * returns EOK on success, fallback included; EINVAL for priorities, cpus or stack sizes out of range
+ */
+int rtmode_start( const rtmode_config_t* pconfig );
+
+/*
+ * Stops the mode and unlocks memory; threads keep their scheduling
+ *
+ * returns EOK always
+ */
+int rtmode_stop( void );
+
+/*
+ * Applies a role to the calling thread; cheap to repeat for the same role
+ * does nothing unless the mode is started
+ *
+ * returns EOK on success; EErr type otherwise describing what could not be applied
+ */
+int rtmode_enter( rtmode_role_t role );
+
+/*
+ * Initializes a thread attribute with the stack size of role
+ * uses the started configuration, or the defaults while the mode is off
+ *
+ * returns EOK on success; EErr type otherwise; pattr must be destroyed by the caller on success
+ */
+int rtmode_thread_attr_init( pthread_attr_t* pattr, rtmode_role_t role );
+
+/*
+ * Whether the mode is started
+ */
+bool rtmode_active( void );
+
+/*
+ * Writes what the mode applies and how many threads entered each role
+ */
+void rtmode_report( FILE* pout );
+
+#endif
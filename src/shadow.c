@@ -0,0 +1,258 @@
+#include "shadow.h"
+#include "clocksrc.h"
+#include "util.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define STDPRINT_NAME                       __FILE__ ":"
+
+#define SHADOW_RING_SIZE                    4096    //power of two
+#define SHADOW_DRAIN_USEC                   5000
+
+typedef struct
+{
+    uint64_t                                seq;            //index + 1 once published
+    uint64_t                                ts_nsec;
+    int                                     ret;
+    uint8_t                                 source;
+    uint8_t                                 action;
+    uint8_t                                 from_state;
+    uint8_t                                 to_state;
+} shadow_slot_t;
+
+struct shadow
+{
+    const behaviour_def_t*                  pcandidate;
+    FILE*                                   preport;
+    pthread_t                               tid;
+    volatile bool                           running;
+    uint64_t                                start_nsec;
+    uint64_t                                head;           //next slot to claim
+    uint64_t                                tail;           //next slot to evaluate
+    uint64_t                                dropped;
+    uint64_t                                evaluated;
+    uint64_t                                divergences;
+    int                                     history_len;    //evaluator only
+    statemachine_actions_t                  history[ SHADOW_HISTORY_LEN ];
+    uint32_t                                pair_divergences[ ss_END ][ sa_END ];
+    shadow_slot_t                           ring[ SHADOW_RING_SIZE ];
+};
+
+/*
+ * Internal function writing one divergence with the actions leading up to it
+ * Note: evaluator thread only
+ */
+static void shadow_report( shadow_t* pshadow, const shadow_divergence_t* pdiv )
+{
+    int i;
+
+    fprintf( pshadow->preport, "diverged +%.6fs %-8s %-22s %s: live -> %s%s candidate -> %s%s after:",
+        (double)( pdiv->ts_nsec - pshadow->start_nsec ) / 1e9,
+        trace_get_sourcename( pdiv->source ),
+        statemachine_get_actionname( pdiv->action ),
+        statemachine_get_statename( pdiv->from_state ),
+        statemachine_get_statename( pdiv->live_state ),
+        ( pdiv->live_ret == EOK ) ? "" : " (rejected)",
+        statemachine_get_statename( pdiv->candidate_state ),
+        ( pdiv->candidate_ret == EOK ) ? "" : " (rejected)" );
+
+    for ( i = 0; i < pshadow->history_len; i++ )
+    {
+        fprintf( pshadow->preport, " %s", statemachine_get_actionname( pshadow->history[ i ] ) );
+    }
+    fprintf( pshadow->preport, "\n" );
+}
+
+/*
+ * Internal function evaluating all published slots
+ * Note: evaluator thread only (or after it has been joined)
+ */
+static void shadow_drain( shadow_t* pshadow )
+{
+    uint64_t tail = pshadow->tail;
+
+    for (;;)
+    {
+        shadow_slot_t* pslot = &pshadow->ring[ tail & ( SHADOW_RING_SIZE - 1 ) ];
+        shadow_divergence_t div;
+
+        if ( __atomic_load_n( &pslot->seq, __ATOMIC_ACQUIRE ) != ( tail + 1 ) )
+        {
+            break;
+        }
+
+        div.ts_nsec = pslot->ts_nsec;
+        div.source = (trace_source_t)pslot->source;
+        div.action = (statemachine_actions_t)pslot->action;
+        div.from_state = (statemachine_states_t)pslot->from_state;
+        div.live_state = (statemachine_states_t)pslot->to_state;
+        div.live_ret = pslot->ret;
+
+        tail++;
+        __atomic_store_n( &pshadow->tail, tail, __ATOMIC_RELEASE );
+
+        div.candidate_ret = ( pshadow->pcandidate != NULL )
+            ? behaviour_def_transition( pshadow->pcandidate, div.from_state, div.action, &div.candidate_state )
+            : statemachine_transition( div.from_state, div.action, &div.candidate_state );
+
+        if ( ( div.candidate_state != div.live_state ) || ( ( div.candidate_ret == EOK ) != ( div.live_ret == EOK ) ) )
+        {
+            shadow_report( pshadow, &div );
+            __atomic_add_fetch( &pshadow->divergences, 1, __ATOMIC_RELAXED );
+
+            if ( ( div.from_state < ss_END ) && ( div.action < sa_END ) )
+            {
+                pshadow->pair_divergences[ div.from_state ][ div.action ]++;
+            }
+        }
+
+        __atomic_add_fetch( &pshadow->evaluated, 1, __ATOMIC_RELAXED );
+
+        //keep the last few actions as context for the next report
+        if ( pshadow->history_len == SHADOW_HISTORY_LEN )
+        {
+            memmove( &pshadow->history[ 0 ], &pshadow->history[ 1 ], ( SHADOW_HISTORY_LEN - 1 ) * sizeof( pshadow->history[ 0 ] ) );
+            pshadow->history_len--;
+        }
+        pshadow->history[ pshadow->history_len++ ] = div.action;
+    }
+
+    fflush( pshadow->preport );
+}
+
+static void* shadow_evaluator_entry( void* args )
+{
+    shadow_t* pshadow = (shadow_t*)args;
+
+    while ( pshadow->running )
+    {
+        shadow_drain( pshadow );
+        clocksrc_sleep_usec( clocksrc_get_real(), SHADOW_DRAIN_USEC );
+    }
+
+    return NULL;
+}
+
+int shadow_start( shadow_t** ppshadow, const behaviour_def_t* pcandidate, const char* report_path )
+{
+    shadow_t* pshadow = calloc( 1, sizeof( shadow_t ) );
+    int ret;
+
+    return_if( pshadow == NULL, ENOMEM );
+
+    pshadow->preport = stderr;
+    if ( report_path != NULL )
+    {
+        pshadow->preport = fopen( report_path, "w" );
+        if ( pshadow->preport == NULL )
+        {
+            ret = errno;
+            print_stderr( STDPRINT_NAME "failed to create shadow report; path=%s err=%d\n", report_path, ret );
+            free( pshadow );
+            return ret;
+        }
+    }
+
+    pshadow->pcandidate = pcandidate;
+    pshadow->start_nsec = get_monotonic_nsec();
+    pshadow->running = true;
+
+    ret = pthread_create( &pshadow->tid, NULL, shadow_evaluator_entry, pshadow );
+    if ( ret != EOK )
+    {
+        if ( pshadow->preport != stderr )
+        {
+            fclose( pshadow->preport );
+        }
+        free( pshadow );
+        return ret;
+    }
+
+    *ppshadow = pshadow;
+
+    return EOK;
+}
+
+int shadow_stop( shadow_t* pshadow )
+{
+    int state;
+    int action;
+
+    return_if( pshadow == NULL, EOK );
+
+    pshadow->running = false;
+    pthread_join( pshadow->tid, NULL );
+
+    shadow_drain( pshadow );
+
+    fprintf( pshadow->preport, "shadow summary; evaluated=%llu divergences=%llu dropped=%llu\n",
+        (unsigned long long)pshadow->evaluated,
+        (unsigned long long)pshadow->divergences,
+        (unsigned long long)pshadow->dropped );
+
+    for ( state = 0; state < ss_END; state++ )
+    {
+        for ( action = 0; action < sa_END; action++ )
+        {
+            if ( pshadow->pair_divergences[ state ][ action ] > 0 )
+            {
+                fprintf( pshadow->preport, "  %-22s %-22s %u\n",
+                    statemachine_get_statename( state ),
+                    statemachine_get_actionname( action ),
+                    pshadow->pair_divergences[ state ][ action ] );
+            }
+        }
+    }
+
+    if ( pshadow->preport != stderr )
+    {
+        fclose( pshadow->preport );
+    }
+    else
+    {
+        fflush( stderr );
+    }
+    free( pshadow );
+
+    return EOK;
+}
+
+int shadow_push( shadow_t* pshadow, statemachine_actions_t action, statemachine_states_t from_state, statemachine_states_t to_state, int ret )
+{
+    uint64_t now_nsec = get_monotonic_nsec();
+    uint64_t idx = __atomic_load_n( &pshadow->head, __ATOMIC_RELAXED );
+
+    //claim a slot unless that would lap the evaluator
+    do
+    {
+        if ( ( idx - __atomic_load_n( &pshadow->tail, __ATOMIC_ACQUIRE ) ) >= SHADOW_RING_SIZE )
+        {
+            __atomic_add_fetch( &pshadow->dropped, 1, __ATOMIC_RELAXED );
+            return ENOBUFS;
+        }
+    } while ( !__atomic_compare_exchange_n( &pshadow->head, &idx, idx + 1, true, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED ) );
+
+    shadow_slot_t* pslot = &pshadow->ring[ idx & ( SHADOW_RING_SIZE - 1 ) ];
+
+    pslot->ts_nsec = now_nsec;
+    pslot->ret = ret;
+    pslot->source = (uint8_t)trace_get_source();
+    pslot->action = (uint8_t)action;
+    pslot->from_state = (uint8_t)from_state;
+    pslot->to_state = (uint8_t)to_state;
+
+    __atomic_store_n( &pslot->seq, idx + 1, __ATOMIC_RELEASE );
+
+    return EOK;
+}
+
+void shadow_get_stats( shadow_t* pshadow, shadow_stats_t* pstats )
+{
+    pstats->evaluated = __atomic_load_n( &pshadow->evaluated, __ATOMIC_RELAXED );
+    pstats->divergences = __atomic_load_n( &pshadow->divergences, __ATOMIC_RELAXED );
+    pstats->dropped = __atomic_load_n( &pshadow->dropped, __ATOMIC_RELAXED );
+}
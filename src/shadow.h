@@ -0,0 +1,79 @@
+#ifndef shadow_H_
+#define shadow_H_
+
+#include "statemachine.h"
+#include "behaviour_def.h"
+#include "trace.h"
+
+#include <stdint.h>
+
+/*
+ * Shadow evaluation of a candidate transition table
+ *
+ * Every action a statemachine instance applies is pushed, with the live
+ * outcome, into an in-memory ring. A background thread evaluates the same
+ * action from the same live state against the candidate and reports every
+ * disagreement together with the actions that led up to it. The candidate
+ * always starts from the live state, so one divergence does not cascade.
+ *
+ * The live path pays one slot claim; when the ring is full the action is
+ * counted as dropped instead of waiting.
+ */
+
+#define SHADOW_HISTORY_LEN                  4       //preceding actions reported with a divergence
+
+typedef struct
+{
+    uint64_t                ts_nsec;
+    trace_source_t          source;
+    statemachine_actions_t  action;
+    statemachine_states_t   from_state;
+    statemachine_states_t   live_state;
+    int                     live_ret;
+    statemachine_states_t   candidate_state;
+    int                     candidate_ret;
+} shadow_divergence_t;
+
+typedef struct
+{
+    uint64_t        evaluated;
+    uint64_t        divergences;
+    uint64_t        dropped;
+} shadow_stats_t;
+
+typedef struct shadow shadow_t;
+
+/*
+ * Starts shadow evaluation
+ *
+ * ppshadow     pointer to receive the shadow
+ * pcandidate   candidate definition; NULL evaluates against the builtin table
+ *              owned by the caller and must outlive the shadow
+ * report_path  file receiving divergence reports; NULL reports to stderr
+ *
+ * returns EOK on success; EErr type otherwise describing the failure
+ */
+int shadow_start( shadow_t** ppshadow, const behaviour_def_t* pcandidate, const char* report_path );
+
+/*
+ * Evaluates what is still queued, writes the summary and stops the shadow
+ *
+ * returns EOK always
+ */
+int shadow_stop( shadow_t* pshadow );
+
+/*
+ * Queues one applied action; timestamp and source are taken from the calling thread
+ *
+ * thread-safe: yes; never blocks
+ *
+ * returns EOK on success; ENOBUFS when the ring is full (counted as dropped)
+ */
+int shadow_push( shadow_t* pshadow, statemachine_actions_t action, statemachine_states_t from_state, statemachine_states_t to_state, int ret );
+
+/*
+ * Retrieves counters; evaluated and divergences lag pushes by up to one drain period
+ */
+void shadow_get_stats( shadow_t* pshadow, shadow_stats_t* pstats );
+
+#endif
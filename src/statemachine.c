@@ -1,4 +1,7 @@
 #include "statemachine.h"
+#include "behaviour_def.h"
+#include "shadow.h"
+#include "trace.h"
 #include "util.h"
 
 #include <errno.h>
@@ -7,25 +10,107 @@
 #include <stdbool.h>
 #include <stdlib.h>
 #include <sys/queue.h>
-#include <assert.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
 
 #define STDPRINT_NAME                       __FILE__ ":"
-#define statemachine_CLIENT_MAXCOUNT        10              //some reasonable size to assert on
+#define statemachine_CLIENT_CHUNK_SIZE      64              //slots per chunk; chunks never move once published
+#define statemachine_CLIENT_CHUNKS          64              //up to 4096 clients per instance
+#define statemachine_OBSERVER_THREADS       2
+#define statemachine_OBSERVER_QUEUE_SIZE    256             //per observer thread
 
-typedef struct ss_client_entry
+typedef struct
 {
-    SLIST_ENTRY(ss_client_entry)            entries;
-    statemachine_cid*                       pcid;
-} ss_client_entry_t;
+    statemachine_cid*                       pcid;           //NULL when free; published with release
+    int                                     next_free;      //guarded by sscid_mutex
+} ss_client_slot_t;
 
-typedef SLIST_HEAD(, ss_client_entry)       sscids_head_t;
+struct statemachine_observer
+{
+    SLIST_ENTRY(statemachine_observer)      entries;
+    statemachine_observer_fn                callback;
+    void*                                   ctx;
+    int                                     flags;
+    int                                     worker;         //observer thread keeping async events in order
+    int                                     pending;        //queued async events; guarded by observer_pool_mutex
+    uint64_t                                dropped;
+};
+
+typedef SLIST_HEAD(, statemachine_observer) ssobservers_head_t;
+
+typedef struct
+{
+    statemachine_observer_t*                pobserver;
+    statemachine_event_t                    event;
+} ss_observer_call_t;
 
-static statemachine_states_t                state = ss_shutdown;
-static pthread_mutex_t                      statemachine_mutex = PTHREAD_MUTEX_INITIALIZER;
-static pthread_cond_t                       signal_state_haschanged = PTHREAD_COND_INITIALIZER;
-static sscids_head_t                        sscids_head;
-static int                                  sscid_count = 0;
-static int                                  sscid_uniqueid = 0;
+typedef struct
+{
+    struct statemachine*                    psm;
+    pthread_t                               tid;
+    pthread_cond_t                          signal_work;
+    unsigned                                head;
+    unsigned                                count;
+    ss_observer_call_t                      calls[ statemachine_OBSERVER_QUEUE_SIZE ];
+} ss_observer_worker_t;
+
+struct statemachine
+{
+    statemachine_states_t                   state;
+    pthread_mutex_t                         statemachine_mutex;
+    pthread_mutex_t                         sscid_mutex;    //registration only; never taken by a transition
+    ss_client_slot_t*                       sscid_chunks[ statemachine_CLIENT_CHUNKS ];
+    int                                     sscid_slots;    //slots in published chunks
+    int                                     sscid_free;     //first free slot; -1 when none
+    int                                     sscid_count;
+    int                                     sscid_action_subscribers;   //clients with a non-empty action mask
+    int                                     sscid_uniqueid;
+    trace_writer_t*                         ptrace;         //optional action recorder
+    behaviour_slot_t*                       pbehaviour;     //hot swappable transition table; NULL uses the builtin
+    shadow_t*                               pshadow;        //optional candidate table evaluated off the hot path
+    statemachine_input_fn                   input;          //optional switch levels for guards
+    void*                                   input_ctx;
+    uint64_t                                event_seq;
+    pthread_rwlock_t                        observers_lock; //held shared while notifying, never with statemachine_mutex
+    ssobservers_head_t                      observers_head;
+    int                                     observer_count;
+    int                                     observer_async_count;
+    int                                     observer_next_worker;
+    pthread_mutex_t                         observer_pool_mutex;
+    pthread_cond_t                          signal_observer_idle;
+    bool                                    observer_pool_running;
+    ss_observer_worker_t*                   pobserver_workers;  //started with the first async observer
+};
+
+//default instance backing the non-reentrant api
+static statemachine_t                       statemachine_default =
+    {
+        .state                      = ss_shutdown,
+        .statemachine_mutex         = PTHREAD_MUTEX_INITIALIZER,
+        .sscid_mutex                = PTHREAD_MUTEX_INITIALIZER,
+        .sscid_chunks               = { NULL },
+        .sscid_slots                = 0,
+        .sscid_free                 = -1,
+        .sscid_count                = 0,
+        .sscid_action_subscribers   = 0,
+        .sscid_uniqueid             = 0,
+        .ptrace                     = NULL,
+        .pbehaviour                 = NULL,
+        .pshadow                    = NULL,
+        .input                      = NULL,
+        .input_ctx                  = NULL,
+        .event_seq                  = 0,
+        .observers_lock             = PTHREAD_RWLOCK_INITIALIZER,
+        .observers_head             = SLIST_HEAD_INITIALIZER( statemachine_default.observers_head ),
+        .observer_count             = 0,
+        .observer_async_count       = 0,
+        .observer_next_worker       = 0,
+        .observer_pool_mutex        = PTHREAD_MUTEX_INITIALIZER,
+        .signal_observer_idle       = PTHREAD_COND_INITIALIZER,
+        .observer_pool_running      = false,
+        .pobserver_workers          = NULL,
+    };
 
 static const char*          statemachine_state_names[] =
     {
@@ -68,106 +153,235 @@ static const char*          statemachine_action_names[] =
         "sa_slowfinger_timeout",
     };
 
-int statemachine_init( statemachine_cid* pcid )
+int statemachine_create( statemachine_t** ppsm )
 {
-    //do following:
-    //lock the machine
-    //allocate a new client entry for tracking
-    //set the client id
-    //inc the client id for next time
-    //inc the list counter
-    //unlock the machine
+    statemachine_t* psm = calloc( 1, sizeof( statemachine_t ) );
 
-    int ret = EAGAIN;   //assume failure
+    if ( psm == NULL )
+    {
+        return errno;
+    }
 
-    pthread_mutex_lock( &statemachine_mutex );
+    psm->state = ss_shutdown;
+    pthread_mutex_init( &psm->statemachine_mutex, NULL );
+    pthread_mutex_init( &psm->sscid_mutex, NULL );
+    psm->sscid_slots = 0;
+    psm->sscid_free = -1;
+    psm->sscid_count = 0;
+    psm->sscid_action_subscribers = 0;
+    psm->sscid_uniqueid = 0;
+    psm->ptrace = NULL;
+    psm->pbehaviour = NULL;
+    psm->pshadow = NULL;
+    psm->input = NULL;
+    psm->input_ctx = NULL;
+    psm->event_seq = 0;
+    pthread_rwlock_init( &psm->observers_lock, NULL );
+    SLIST_INIT( &psm->observers_head );
+    psm->observer_count = 0;
+    psm->observer_async_count = 0;
+    psm->observer_next_worker = 0;
+    pthread_mutex_init( &psm->observer_pool_mutex, NULL );
+    pthread_cond_init( &psm->signal_observer_idle, NULL );
+    psm->observer_pool_running = false;
+    psm->pobserver_workers = NULL;
+
+    *ppsm = psm;
 
-    ss_client_entry_t* pcid_entry;
+    return EOK;
+}
 
-    assert( sscid_count < statemachine_CLIENT_MAXCOUNT );
+int statemachine_destroy( statemachine_t* psm )
+{
+    return_if( psm == NULL, EINVAL );
+    return_if( psm == &statemachine_default, EINVAL );
+
+    pthread_mutex_lock( &psm->sscid_mutex );
+    bool has_clients = ( psm->sscid_count > 0 );
+    pthread_mutex_unlock( &psm->sscid_mutex );
+
+    pthread_rwlock_rdlock( &psm->observers_lock );
+    bool has_observers = ( psm->observer_count > 0 );
+    pthread_rwlock_unlock( &psm->observers_lock );
+
+    //clients and observers must go before the instance does
+    return_if( has_clients || has_observers, EBUSY );
 
-    if ( sscid_count <= 0 )
+    pthread_cond_destroy( &psm->signal_observer_idle );
+    pthread_mutex_destroy( &psm->observer_pool_mutex );
+    pthread_rwlock_destroy( &psm->observers_lock );
+    pthread_mutex_destroy( &psm->sscid_mutex );
+    pthread_mutex_destroy( &psm->statemachine_mutex );
+
+    int chunk;
+    for ( chunk = 0; chunk < statemachine_CLIENT_CHUNKS; chunk++ )
     {
-        //we init for first use
-        state = ss_powerup;
-        SLIST_INIT(&sscids_head);
+        free( psm->sscid_chunks[ chunk ] );
     }
+    free( psm );
+
+    return EOK;
+}
+
+statemachine_t* statemachine_get_default( void )
+{
+    return &statemachine_default;
+}
 
-    pcid_entry = malloc( sizeof( ss_client_entry_t ) );
+/*
+ * Internal function to resolve a client slot
+ * slots below sscid_slots stay valid until the instance is destroyed
+ */
+static inline ss_client_slot_t* statemachine_client_slot( statemachine_t* psm, int slot )
+{
+    ss_client_slot_t* pchunk = __atomic_load_n( &psm->sscid_chunks[ slot / statemachine_CLIENT_CHUNK_SIZE ], __ATOMIC_ACQUIRE );
 
-    if ( pcid_entry != NULL )
+    return &pchunk[ slot % statemachine_CLIENT_CHUNK_SIZE ];
+}
+
+/*
+ * Internal function to add a chunk of free slots
+ * existing chunks are left in place so concurrent notification never sees them move
+ *
+ * Note: Callers should hold sscid_mutex lock
+ */
+static int statemachine_client_grow_nolock( statemachine_t* psm )
+{
+    int chunk = psm->sscid_slots / statemachine_CLIENT_CHUNK_SIZE;
+    int i;
+
+    return_if( chunk >= statemachine_CLIENT_CHUNKS, ENOSPC );
+
+    ss_client_slot_t* pchunk = calloc( statemachine_CLIENT_CHUNK_SIZE, sizeof( ss_client_slot_t ) );
+    return_if( pchunk == NULL, ENOMEM );
+
+    for ( i = 0; i < statemachine_CLIENT_CHUNK_SIZE; i++ )
     {
-        pcid_entry->pcid = pcid;
+        pchunk[ i ].next_free = ( i + 1 < statemachine_CLIENT_CHUNK_SIZE ) ? psm->sscid_slots + i + 1 : psm->sscid_free;
+    }
+    psm->sscid_free = psm->sscid_slots;
 
-        //init the client entry
-        pcid->id = sscid_uniqueid;         //uniquely id this client
-        pcid->state_haschanged = true;      //arrange for this client to immediate return on next waitfor
+    //chunk first, then the bound that lets notification reach it
+    __atomic_store_n( &psm->sscid_chunks[ chunk ], pchunk, __ATOMIC_RELEASE );
+    __atomic_store_n( &psm->sscid_slots, psm->sscid_slots + statemachine_CLIENT_CHUNK_SIZE, __ATOMIC_RELEASE );
 
-        //track the client
-        SLIST_INSERT_HEAD( &sscids_head, pcid_entry, entries );
+    return EOK;
+}
 
-        sscid_uniqueid++;
-        sscid_count++;
+int statemachine_init_r( statemachine_t* psm, statemachine_cid* pcid )
+{
+    //do following:
+    //lock the registry
+    //take a free slot, adding a chunk if none is left
+    //set the client id, subscription and wakeup signal
+    //inc the client id for next time
+    //inc the client counter
+    //publish the client in its slot
+    //unlock the registry
 
-        ret = EOK;
+    int ret = EOK;
+
+    pthread_mutex_lock( &psm->sscid_mutex );
+
+    if ( psm->sscid_free < 0 )
+    {
+        ret = statemachine_client_grow_nolock( psm );
     }
-    else
+
+    if ( ret == EOK )
     {
-        //entry malloc failed
-        ret = errno;
+        if ( psm->sscid_count <= 0 )
+        {
+            //we init for first use
+            pthread_mutex_lock( &psm->statemachine_mutex );
+            psm->state = ss_powerup;
+            pthread_mutex_unlock( &psm->statemachine_mutex );
+        }
+
+        ss_client_slot_t* pslot = statemachine_client_slot( psm, psm->sscid_free );
+
+        //init the client entry
+        pcid->id = psm->sscid_uniqueid;    //uniquely id this client
+        pcid->slot = psm->sscid_free;
+        pcid->state_haschanged = true;      //arrange for this client to immediate return on next waitfor
+        pcid->wait_cancelled = false;
+        pcid->state_mask = STATEMACHINE_MASK_ALL;
+        pcid->action_mask = 0;
+        pcid->wait_mask = 0;
+        pcid->event_fd = -1;
+
+        //deadlines are monotonic
+        pthread_condattr_t cond_attr;
+        pthread_condattr_init( &cond_attr );
+        pthread_condattr_setclock( &cond_attr, CLOCK_MONOTONIC );
+        pthread_cond_init( &pcid->signal_haschanged, &cond_attr );
+        pthread_condattr_destroy( &cond_attr );
+
+        psm->sscid_free = pslot->next_free;
+        psm->sscid_uniqueid++;
+        psm->sscid_count++;
+
+        //track the client
+        __atomic_store_n( &pslot->pcid, pcid, __ATOMIC_RELEASE );
     }
 
-    pthread_mutex_unlock( &statemachine_mutex );
+    pthread_mutex_unlock( &psm->sscid_mutex );
 
 
     return ret;
 }
 
-int statemachine_fini( statemachine_cid* pcid )
+int statemachine_fini_r( statemachine_t* psm, statemachine_cid* pcid )
 {
     //do following:
-    //lock the machine
-    //decr list counter
-    //find matching entry and remove it (dellocate the client tracking entry)
-    //unlock the machine
+    //lock the registry
+    //unpublish the client's slot
+    //wait out notification in flight by passing through the machine lock
+    //decr client counter
+    //return the slot to the free list
+    //unlock the registry
 
     int ret = EAGAIN;   //assume failure;
-    bool found_client = false;
 
-    pthread_mutex_lock( &statemachine_mutex );
+    pthread_mutex_lock( &psm->sscid_mutex );
 
-    //find matching entry and remove it
-    ss_client_entry_t* ssce;
-    ss_client_entry_t* ssce_next;
+    ss_client_slot_t* pslot = ( ( pcid->slot >= 0 ) && ( pcid->slot < psm->sscid_slots ) ) ? statemachine_client_slot( psm, pcid->slot ) : NULL;
 
-    SLIST_FOREACH_SAFE(ssce, &sscids_head, entries, ssce_next)
+    if ( ( pslot != NULL ) && ( pslot->pcid == pcid ) )
     {
-        if ( ssce->pcid->id == pcid->id )
+        __atomic_store_n( &pslot->pcid, NULL, __ATOMIC_RELEASE );
+
+        //notification only touches clients under the machine lock,
+        //so once we hold it nobody can still be signalling this one
+        pthread_mutex_lock( &psm->statemachine_mutex );
+
+        psm->sscid_action_subscribers -= ( pcid->action_mask != 0 );
+
+        //is statemachine now terminated?
+        if ( --psm->sscid_count <= 0 )
         {
-            SLIST_REMOVE( &sscids_head, ssce, ss_client_entry, entries);
-            free(ssce);
-            found_client = true;
-            sscid_count--;
-            break;
+            //has no effect and no one is listening,
+            //but this makes things tidy
+            psm->state = ss_shutdown;
         }
-    }
 
-    //did we remove successfully?
-    if ( found_client )
-    {
-        ret = EOK;
-    }
+        pthread_mutex_unlock( &psm->statemachine_mutex );
 
-    //is statemachine now terminated?
-    //we check this after removal to ensure the client cids were actually valid and removed
-    if ( sscid_count <= 0 )
-    {
-        //has no effect and no one is listening,
-        //but this makes things tidy
-        state = ss_shutdown;
+        pthread_cond_destroy( &pcid->signal_haschanged );
+        if ( pcid->event_fd >= 0 )
+        {
+            close( pcid->event_fd );
+            pcid->event_fd = -1;
+        }
+
+        pslot->next_free = psm->sscid_free;
+        psm->sscid_free = pcid->slot;
+        pcid->slot = -1;
+
+        ret = EOK;
     }
 
-    pthread_mutex_unlock( &statemachine_mutex );
+    pthread_mutex_unlock( &psm->sscid_mutex );
 
     return ret;
 }
@@ -176,57 +390,254 @@ int statemachine_fini( statemachine_cid* pcid )
  * Internal function to retrieve current statemachine state
  * note: no statemachien lock is acquired
  */
-static inline statemachine_states_t statemachine_get_current_state_nolock()
+static inline statemachine_states_t statemachine_get_current_state_nolock( statemachine_t* psm )
 {
-    return state;
+    return psm->state;
 }
 
 /*
  * Internal function to handle setting
  * specific client for statechange and notify
  *
+ * Note: Callers should hold statemachine_mutex lock
+ *
  * pcid     pointer to client id struct for notification
  *
  */
 static int statemachine_set_state_change_forclient_nolock( statemachine_cid* pcid )
 {
     //set specific clients state change and notify
+    //the event fd is only written on the first change since the client last looked
+    if ( ( pcid->event_fd >= 0 ) && !pcid->state_haschanged )
+    {
+        uint64_t one = 1;
+        ssize_t written = write( pcid->event_fd, &one, sizeof( one ) );
+        __unused( written );
+    }
+
     pcid->state_haschanged = true;
-    return pthread_cond_broadcast( &signal_state_haschanged );
+    return pthread_cond_signal( &pcid->signal_haschanged );
+}
+
+/*
+ * Internal function to consume a clients pending statechange
+ * the event fd stops being readable along with it
+ *
+ * Note: Callers should hold statemachine_mutex lock
+ */
+static void statemachine_clear_state_change_forclient_nolock( statemachine_cid* pcid )
+{
+    if ( ( pcid->event_fd >= 0 ) && pcid->state_haschanged )
+    {
+        uint64_t count;
+        ssize_t got = read( pcid->event_fd, &count, sizeof( count ) );
+        __unused( got );
+    }
+
+    pcid->state_haschanged = false;
+    pcid->wait_cancelled = false;
 }
 
 /*
  * Internal function to handle setting
- * all clients for statechange and notify
+ * subscribed clients for statechange and notify
+ * clients not subscribed to the new state nor the action are not woken
  *
  * Note: Callers should hold statemachine_mutex lock
  *
  */
-static int statemachine_set_state_change_nolock( statemachine_states_t new_state )
+static int statemachine_set_state_change_nolock( statemachine_t* psm, statemachine_states_t new_state, statemachine_actions_t action, bool changed )
 {
-    //set all clients state change and notify
-    ss_client_entry_t* ssce;
-    SLIST_FOREACH( ssce, &sscids_head, entries )
+    uint32_t state_bit = changed ? STATEMACHINE_STATE_BIT( new_state ) : 0;
+    uint32_t action_bit = STATEMACHINE_ACTION_BIT( action );
+    int slots = __atomic_load_n( &psm->sscid_slots, __ATOMIC_ACQUIRE );
+    int slot;
+
+    psm->state = new_state;
+
+    //registration may run concurrently; it never moves a slot
+    for ( slot = 0; slot < slots; slot++ )
     {
-        ssce->pcid->state_haschanged = true;
+        statemachine_cid* pcid = __atomic_load_n( &statemachine_client_slot( psm, slot )->pcid, __ATOMIC_ACQUIRE );
+
+        if ( pcid == NULL )
+        {
+            continue;
+        }
+
+        if ( ( pcid->state_mask & state_bit ) || ( pcid->action_mask & action_bit ) )
+        {
+            statemachine_set_state_change_forclient_nolock( pcid );
+        }
+        else if ( pcid->wait_mask & state_bit )
+        {
+            //statemachine_wait_until only; the client did not subscribe to it
+            pthread_cond_signal( &pcid->signal_haschanged );
+        }
     }
 
-    state = new_state;
-    return pthread_cond_broadcast( &signal_state_haschanged );
+    return EOK;
 }
 
-int statemachine_next_state(statemachine_actions_t action, statemachine_states_t* pnew_state)
+static void* statemachine_observer_thread_entry( void* args )
 {
-    //do following:
-    //lock the machine
-    //stimulate statemachine with action
-    //notify all clients of state change
-    //unlock the machine
+    ss_observer_worker_t* pworker = (ss_observer_worker_t*)args;
+    statemachine_t* psm = pworker->psm;
 
-    int ret = EAGAIN;       //assume failure
-    pthread_mutex_lock( &statemachine_mutex );
+    pthread_mutex_lock( &psm->observer_pool_mutex );
+    for (;;)
+    {
+        while ( ( pworker->count == 0 ) && psm->observer_pool_running )
+        {
+            pthread_cond_wait( &pworker->signal_work, &psm->observer_pool_mutex );
+        }
 
-    statemachine_states_t current_state = statemachine_get_current_state_nolock();
+        if ( pworker->count == 0 )
+        {
+            break;
+        }
+
+        ss_observer_call_t call = pworker->calls[ pworker->head ];
+        pworker->head = ( pworker->head + 1 ) % statemachine_OBSERVER_QUEUE_SIZE;
+        pworker->count--;
+        pthread_mutex_unlock( &psm->observer_pool_mutex );
+
+        call.pobserver->callback( call.pobserver->ctx, &call.event );
+
+        pthread_mutex_lock( &psm->observer_pool_mutex );
+        call.pobserver->pending--;
+        pthread_cond_broadcast( &psm->signal_observer_idle );
+    }
+    pthread_mutex_unlock( &psm->observer_pool_mutex );
+
+    return NULL;
+}
+
+/*
+ * Internal function starting the observer threads
+ * Note: callers should hold observers_lock exclusively
+ */
+static int statemachine_observer_pool_start_nolock( statemachine_t* psm )
+{
+    int i;
+    int ret;
+
+    psm->pobserver_workers = calloc( statemachine_OBSERVER_THREADS, sizeof( ss_observer_worker_t ) );
+    return_if( psm->pobserver_workers == NULL, ENOMEM );
+
+    psm->observer_pool_running = true;
+
+    for ( i = 0; i < statemachine_OBSERVER_THREADS; i++ )
+    {
+        ss_observer_worker_t* pworker = &psm->pobserver_workers[ i ];
+
+        pworker->psm = psm;
+        pthread_cond_init( &pworker->signal_work, NULL );
+
+        ret = pthread_create( &pworker->tid, NULL, statemachine_observer_thread_entry, pworker );
+        if ( ret != EOK )
+        {
+            //stop the ones already running
+            pthread_mutex_lock( &psm->observer_pool_mutex );
+            psm->observer_pool_running = false;
+            pthread_mutex_unlock( &psm->observer_pool_mutex );
+
+            while ( i-- > 0 )
+            {
+                pthread_cond_signal( &psm->pobserver_workers[ i ].signal_work );
+                pthread_join( psm->pobserver_workers[ i ].tid, NULL );
+                pthread_cond_destroy( &psm->pobserver_workers[ i ].signal_work );
+            }
+            pthread_cond_destroy( &pworker->signal_work );
+            free( psm->pobserver_workers );
+            psm->pobserver_workers = NULL;
+
+            return ret;
+        }
+    }
+
+    return EOK;
+}
+
+/*
+ * Internal function stopping idle observer threads
+ * Note: callers should hold observers_lock exclusively
+ */
+static void statemachine_observer_pool_stop_nolock( statemachine_t* psm )
+{
+    int i;
+
+    pthread_mutex_lock( &psm->observer_pool_mutex );
+    psm->observer_pool_running = false;
+    for ( i = 0; i < statemachine_OBSERVER_THREADS; i++ )
+    {
+        pthread_cond_signal( &psm->pobserver_workers[ i ].signal_work );
+    }
+    pthread_mutex_unlock( &psm->observer_pool_mutex );
+
+    for ( i = 0; i < statemachine_OBSERVER_THREADS; i++ )
+    {
+        pthread_join( psm->pobserver_workers[ i ].tid, NULL );
+        pthread_cond_destroy( &psm->pobserver_workers[ i ].signal_work );
+    }
+
+    free( psm->pobserver_workers );
+    psm->pobserver_workers = NULL;
+}
+
+/*
+ * Internal function handing an event to the observers
+ * Note: callers must not hold statemachine_mutex
+ */
+static void statemachine_notify_observers( statemachine_t* psm, statemachine_event_t* pevent )
+{
+    statemachine_observer_t* pobserver;
+
+    pevent->ts_nsec = get_monotonic_nsec();
+
+    pthread_rwlock_rdlock( &psm->observers_lock );
+
+    SLIST_FOREACH( pobserver, &psm->observers_head, entries )
+    {
+        if ( ( pevent->from_state == pevent->to_state ) && !( pobserver->flags & STATEMACHINE_OBSERVE_ALL ) )
+        {
+            continue;
+        }
+
+        if ( pobserver->flags & STATEMACHINE_OBSERVE_ASYNC )
+        {
+            ss_observer_worker_t* pworker = &psm->pobserver_workers[ pobserver->worker ];
+
+            pthread_mutex_lock( &psm->observer_pool_mutex );
+            if ( pworker->count < statemachine_OBSERVER_QUEUE_SIZE )
+            {
+                ss_observer_call_t* pcall = &pworker->calls[ ( pworker->head + pworker->count ) % statemachine_OBSERVER_QUEUE_SIZE ];
+
+                pcall->pobserver = pobserver;
+                pcall->event = *pevent;
+                pworker->count++;
+                pobserver->pending++;
+                pthread_cond_signal( &pworker->signal_work );
+            }
+            else
+            {
+                //never hold up the producer for a slow observer
+                pobserver->dropped++;
+            }
+            pthread_mutex_unlock( &psm->observer_pool_mutex );
+        }
+        else
+        {
+            pobserver->callback( pobserver->ctx, pevent );
+        }
+    }
+
+    pthread_rwlock_unlock( &psm->observers_lock );
+}
+
+int statemachine_transition( statemachine_states_t current_state, statemachine_actions_t action, statemachine_states_t* pnext_state )
+{
+    int ret = EOK;
     statemachine_states_t next_state = current_state;     //assume no state change
 
     switch ( current_state )
@@ -254,7 +665,6 @@ int statemachine_next_state(statemachine_actions_t action, statemachine_states_t
 
                 default:
                     //unknown action (should never happen)
-                    print_stderr( STDPRINT_NAME "unknown action specified; action=%s currentstate=%s\n", statemachine_get_actionname( action ), statemachine_get_statename( current_state ) );
                     ret = EINVAL;
 
                     break;
@@ -288,7 +698,6 @@ int statemachine_next_state(statemachine_actions_t action, statemachine_states_t
 
                 default:
                     //unknown action (should never happen)
-                    print_stderr( STDPRINT_NAME "unknown action specified; action=%s currentstate=%s\n", statemachine_get_actionname( action ), statemachine_get_statename( current_state ) );
                     ret = EINVAL;
 
                     break;
@@ -320,7 +729,6 @@ int statemachine_next_state(statemachine_actions_t action, statemachine_states_t
 
                 default:
                     //unknown action (should never happen)
-                    print_stderr( STDPRINT_NAME "unknown action specified; action=%s currentstate=%s\n", statemachine_get_actionname( action ), statemachine_get_statename( current_state ) );
                     ret = EINVAL;
 
                     break;
@@ -354,7 +762,6 @@ int statemachine_next_state(statemachine_actions_t action, statemachine_states_t
 
                 default:
                     //unknown action (should never happen)
-                    print_stderr( STDPRINT_NAME "unknown action specified; action=%s currentstate=%s\n", statemachine_get_actionname( action ), statemachine_get_statename( current_state ) );
                     ret = EINVAL;
 
                     break;
@@ -386,7 +793,6 @@ int statemachine_next_state(statemachine_actions_t action, statemachine_states_t
 
                 default:
                     //unknown action (should never happen)
-                    print_stderr( STDPRINT_NAME "unknown action specified; action=%s currentstate=%s\n", statemachine_get_actionname( action ), statemachine_get_statename( current_state ) );
                     ret = EINVAL;
 
                     break;
@@ -419,7 +825,6 @@ int statemachine_next_state(statemachine_actions_t action, statemachine_states_t
 
                 default:
                     //unknown action (should never happen)
-                    print_stderr( STDPRINT_NAME "unknown action specified; action=%s currentstate=%s\n", statemachine_get_actionname( action ), statemachine_get_statename( current_state ) );
                     ret = EINVAL;
 
                     break;
@@ -454,7 +859,6 @@ int statemachine_next_state(statemachine_actions_t action, statemachine_states_t
 
                 default:
                     //unknown action (should never happen)
-                    print_stderr( STDPRINT_NAME "unknown action specified; action=%s currentstate=%s\n", statemachine_get_actionname( action ), statemachine_get_statename( current_state ) );
                     ret = EINVAL;
 
                     break;
@@ -487,7 +891,6 @@ int statemachine_next_state(statemachine_actions_t action, statemachine_states_t
 
                 default:
                     //unknown action (should never happen)
-                    print_stderr( STDPRINT_NAME "unknown action specified; action=%s currentstate=%s\n", statemachine_get_actionname( action ), statemachine_get_statename( current_state ) );
                     ret = EINVAL;
 
                     break;
@@ -519,7 +922,6 @@ int statemachine_next_state(statemachine_actions_t action, statemachine_states_t
 
                 default:
                     //unknown action (should never happen)
-                    print_stderr( STDPRINT_NAME "unknown action specified; action=%s currentstate=%s\n", statemachine_get_actionname( action ), statemachine_get_statename( current_state ) );
                     ret = EINVAL;
 
                     break;
@@ -551,7 +953,6 @@ int statemachine_next_state(statemachine_actions_t action, statemachine_states_t
 
                 default:
                     //unknown action (should never happen)
-                    print_stderr( STDPRINT_NAME "unknown action specified; action=%s currentstate=%s\n", statemachine_get_actionname( action ), statemachine_get_statename( current_state ) );
                     ret = EINVAL;
 
                     break;
@@ -580,7 +981,6 @@ int statemachine_next_state(statemachine_actions_t action, statemachine_states_t
 
                 default:
                     //unknown action (should never happen)
-                    print_stderr( STDPRINT_NAME "unknown action specified; action=%s currentstate=%s\n", statemachine_get_actionname( action ), statemachine_get_statename( current_state ) );
                     ret = EINVAL;
 
                     break;
@@ -614,7 +1014,6 @@ int statemachine_next_state(statemachine_actions_t action, statemachine_states_t
 
                 default:
                     //unknown action (should never happen)
-                    print_stderr( STDPRINT_NAME "unknown action specified; action=%s currentstate=%s\n", statemachine_get_actionname( action ), statemachine_get_statename( current_state ) );
                     ret = EINVAL;
 
                     break;
@@ -648,7 +1047,6 @@ int statemachine_next_state(statemachine_actions_t action, statemachine_states_t
 
                 default:
                     //unknown action (should never happen)
-                    print_stderr( STDPRINT_NAME "unknown action specified; action=%s currentstate=%s\n", statemachine_get_actionname( action ), statemachine_get_statename( current_state ) );
                     ret = EINVAL;
 
                     break;
@@ -682,7 +1080,6 @@ int statemachine_next_state(statemachine_actions_t action, statemachine_states_t
 
                 default:
                     //unknown action (should never happen)
-                    print_stderr( STDPRINT_NAME "unknown action specified; action=%s currentstate=%s\n", statemachine_get_actionname( action ), statemachine_get_statename( current_state ) );
                     ret = EINVAL;
 
                     break;
@@ -716,7 +1113,6 @@ int statemachine_next_state(statemachine_actions_t action, statemachine_states_t
 
                 default:
                     //unknown action (should never happen)
-                    print_stderr( STDPRINT_NAME "unknown action specified; action=%s currentstate=%s\n", statemachine_get_actionname( action ), statemachine_get_statename( current_state ) );
                     ret = EINVAL;
 
                     break;
@@ -747,7 +1143,6 @@ int statemachine_next_state(statemachine_actions_t action, statemachine_states_t
 
                 default:
                     //unknown action (should never happen)
-                    print_stderr( STDPRINT_NAME "unknown action specified; action=%s currentstate=%s\n", statemachine_get_actionname( action ), statemachine_get_statename( current_state ) );
                     ret = EINVAL;
 
                     break;
@@ -778,7 +1173,6 @@ int statemachine_next_state(statemachine_actions_t action, statemachine_states_t
 
                 default:
                     //unknown action (should never happen)
-                    print_stderr( STDPRINT_NAME "unknown action specified; action=%s currentstate=%s\n", statemachine_get_actionname( action ), statemachine_get_statename( current_state ) );
                     ret = EINVAL;
 
                     break;
@@ -809,7 +1203,6 @@ int statemachine_next_state(statemachine_actions_t action, statemachine_states_t
 
                 default:
                     //unknown action (should never happen)
-                    print_stderr( STDPRINT_NAME "unknown action specified; action=%s currentstate=%s\n", statemachine_get_actionname( action ), statemachine_get_statename( current_state ) );
                     ret = EINVAL;
 
                     break;
@@ -836,7 +1229,6 @@ int statemachine_next_state(statemachine_actions_t action, statemachine_states_t
 
                 default:
                     //unknown action (should never happen)
-                    print_stderr( STDPRINT_NAME "unknown action specified; action=%s currentstate=%s\n", statemachine_get_actionname( action ), statemachine_get_statename( current_state ) );
                     ret = EINVAL;
 
                     break;
@@ -862,7 +1254,6 @@ int statemachine_next_state(statemachine_actions_t action, statemachine_states_t
 
                 default:
                     //unknown action (should never happen)
-                    print_stderr( STDPRINT_NAME "unknown action specified; action=%s currentstate=%s\n", statemachine_get_actionname( action ), statemachine_get_statename( current_state ) );
                     ret = EINVAL;
 
                     break;
@@ -875,14 +1266,161 @@ int statemachine_next_state(statemachine_actions_t action, statemachine_states_t
         default:
         {
             //unknown current state (should never happen)
-            print_stderr( STDPRINT_NAME "unknown current state specified; action=%s currentstate=%s\n", statemachine_get_actionname( action ), statemachine_get_statename( current_state ) );
             ret = EINVAL;
 
             break;
         }
     }
 
-    print_stdout( STDPRINT_NAME "state change details; action=%s currentstate=%s nextstate=%s\n", statemachine_get_actionname( action ), statemachine_get_statename( current_state ), statemachine_get_statename( next_state ) );
+    *pnext_state = next_state;
+
+    return ret;
+}
+
+/*
+ * Internal function evaluating the transition table in use
+ *
+ * pbuiltin     receives true when the builtin table (and so its guards) applied
+ *
+ * Note: Callers should hold statemachine_mutex lock
+ */
+static int statemachine_lookup_nolock( statemachine_t* psm, statemachine_states_t current_state, statemachine_actions_t action, statemachine_states_t* pnext_state, bool* pbuiltin )
+{
+    int ret;
+
+    *pbuiltin = true;
+
+    if ( psm->pbehaviour != NULL )
+    {
+        //a reload swapping the table meanwhile does not wait for us nor we for it;
+        //this transition completes on the version it started with
+        int epoch;
+        const behaviour_def_t* pdef = behaviour_slot_read_lock( psm->pbehaviour, &epoch );
+
+        *pbuiltin = ( pdef == NULL );
+        ret = ( pdef != NULL )
+            ? behaviour_def_transition( pdef, current_state, action, pnext_state )
+            : statemachine_transition( current_state, action, pnext_state );
+
+        behaviour_slot_read_unlock( psm->pbehaviour, epoch );
+    }
+    else
+    {
+        ret = statemachine_transition( current_state, action, pnext_state );
+    }
+
+    if ( ret == EINVAL )
+    {
+        if ( current_state >= ss_END )
+        {
+            //unknown current state (should never happen)
+            print_stderr( STDPRINT_NAME "unknown current state specified; action=%s currentstate=%s\n", statemachine_get_actionname( action ), statemachine_get_statename( current_state ) );
+        }
+        else
+        {
+            //unknown action (should never happen)
+            print_stderr( STDPRINT_NAME "unknown action specified; action=%s currentstate=%s\n", statemachine_get_actionname( action ), statemachine_get_statename( current_state ) );
+        }
+    }
+
+    return ret;
+}
+
+/*
+ * Internal function handing one applied step to the recorder and the shadow
+ *
+ * Note: Callers should hold statemachine_mutex lock
+ */
+static void statemachine_record_nolock( statemachine_t* psm, statemachine_actions_t action, statemachine_states_t from_state, statemachine_states_t to_state, int ret )
+{
+    //recorded even when the table rejects the pair; replay must see the same inputs
+    if ( psm->ptrace != NULL )
+    {
+        trace_writer_record( psm->ptrace, action, from_state, to_state );
+    }
+
+    //the candidate is evaluated on the shadow's own thread
+    if ( psm->pshadow != NULL )
+    {
+        shadow_push( psm->pshadow, action, from_state, to_state, ret );
+    }
+}
+
+bool statemachine_guard( statemachine_states_t entered_state, bool int_switch1, bool ext_switch1, statemachine_actions_t* paction )
+{
+    //states whose entry does nothing but move the arm home
+    static const bool guard_arm_home[ ss_END ] =
+        {
+            [ ss_reseting ]             = true,
+            [ ss_reseting_retry ]       = true,
+            [ ss_suspicion_step3 ]      = true,
+            [ ss_slow_finger_step2 ]    = true,
+        };
+
+    return_if( ( (unsigned)entered_state >= ss_END ) || !guard_arm_home[ entered_state ], false );
+
+    //the arm is already home: resolve like the entry behaviour would, without entering
+    return_if( !int_switch1, false );
+
+    *paction = ext_switch1 ? sa_arm_alarm : sa_arm_off;
+
+    return true;
+}
+
+int statemachine_next_state_r( statemachine_t* psm, statemachine_actions_t action, statemachine_states_t* pnew_state )
+{
+    //do following:
+    //lock the machine
+    //stimulate statemachine with action
+    //resolve the guard of the state entered against the current inputs
+    //notify all clients of state change once
+    //unlock the machine
+    //log and notify observers
+
+    int ret = EAGAIN;       //assume failure
+    statemachine_event_t events[ 2 ];
+    int event_count = 0;
+    bool builtin;
+
+    pthread_mutex_lock( &psm->statemachine_mutex );
+
+    statemachine_states_t current_state = statemachine_get_current_state_nolock( psm );
+    statemachine_states_t next_state;
+
+    ret = statemachine_lookup_nolock( psm, current_state, action, &next_state, &builtin );
+    statemachine_record_nolock( psm, action, current_state, next_state, ret );
+
+    events[ event_count ].action = action;
+    events[ event_count ].from_state = current_state;
+    events[ event_count ].to_state = next_state;
+    events[ event_count ].ret = ret;
+    event_count++;
+
+    //compiled definitions carry their own entry ops; guards follow the builtin ones
+    if ( ( ret == EOK ) && builtin && ( next_state != current_state ) && ( psm->input != NULL ) )
+    {
+        bool int_switch1;
+        bool ext_switch1;
+        statemachine_actions_t guard_action;
+
+        if ( ( psm->input( psm->input_ctx, &int_switch1, &ext_switch1 ) == EOK )
+                && statemachine_guard( next_state, int_switch1, ext_switch1, &guard_action ) )
+        {
+            statemachine_states_t guarded_state;
+
+            //replay sees the guard as the action it stands for
+            ret = statemachine_lookup_nolock( psm, next_state, guard_action, &guarded_state, &builtin );
+            statemachine_record_nolock( psm, guard_action, next_state, guarded_state, ret );
+
+            events[ event_count ].action = guard_action;
+            events[ event_count ].from_state = next_state;
+            events[ event_count ].to_state = guarded_state;
+            events[ event_count ].ret = ret;
+            event_count++;
+
+            next_state = guarded_state;
+        }
+    }
 
     //pass new state to caller
     if (pnew_state != NULL)
@@ -890,19 +1428,43 @@ int statemachine_next_state(statemachine_actions_t action, statemachine_states_t
         *pnew_state = next_state;
     }
 
-    //notify all clients only if state changes occurred
-    if ( current_state != next_state )
+    //notify subscribed clients only if state changes occurred or someone listens for actions
+    if ( ( current_state != next_state ) || ( psm->sscid_action_subscribers > 0 ) )
+    {
+        statemachine_set_state_change_nolock( psm, next_state, action, ( current_state != next_state ) );
+    }
+
+    int i;
+    for ( i = 0; i < event_count; i++ )
     {
-        statemachine_set_state_change_nolock( next_state );
+        events[ i ].seq = ++psm->event_seq;
     }
 
-    pthread_mutex_unlock( &statemachine_mutex );
+    pthread_mutex_unlock( &psm->statemachine_mutex );
+
+    //everything below runs outside the critical section
+    for ( i = 0; i < event_count; i++ )
+    {
+        print_stdout( STDPRINT_NAME "state change details; action=%s currentstate=%s nextstate=%s%s\n",
+            statemachine_get_actionname( events[ i ].action ),
+            statemachine_get_statename( events[ i ].from_state ),
+            statemachine_get_statename( events[ i ].to_state ),
+            ( i > 0 ) ? " (guard)" : "" );
+    }
+
+    if ( __atomic_load_n( &psm->observer_count, __ATOMIC_ACQUIRE ) > 0 )
+    {
+        for ( i = 0; i < event_count; i++ )
+        {
+            statemachine_notify_observers( psm, &events[ i ] );
+        }
+    }
 
     return ret;
 
 }
 
-int statemachine_wait_state_change( statemachine_cid* pcid, statemachine_states_t* pnew_state )
+int statemachine_wait_state_change_r( statemachine_t* psm, statemachine_cid* pcid, statemachine_states_t* pnew_state )
 {
     //do following:
     //lock the machien
@@ -912,44 +1474,375 @@ int statemachine_wait_state_change( statemachine_cid* pcid, statemachine_states_
     //read state for returning
     //unlock the machine
 
-    pthread_mutex_lock( &statemachine_mutex );
+    pthread_mutex_lock( &psm->statemachine_mutex );
 
     //block until state changed
     //we check if this clients last statechange was notified
     //if not, we continue to block
     while (!pcid->state_haschanged)
     {
-        pthread_cond_wait( &signal_state_haschanged, &statemachine_mutex );
+        pthread_cond_wait( &pcid->signal_haschanged, &psm->statemachine_mutex );
     }
 
-    pcid->state_haschanged = false;
+    statemachine_clear_state_change_forclient_nolock( pcid );
 
     //read state
-    *pnew_state = statemachine_get_current_state_nolock();
+    *pnew_state = statemachine_get_current_state_nolock( psm );
 
-    pthread_mutex_unlock( &statemachine_mutex );
+    pthread_mutex_unlock( &psm->statemachine_mutex );
 
     return EOK;
 }
 
-int statemachine_cancel_waitfor( statemachine_cid* pcid )
+int statemachine_get_event_fd_r( statemachine_t* psm, statemachine_cid* pcid, int* pfd )
 {
-    return statemachine_set_state_change_forclient_nolock( pcid );
+    int ret = EOK;
+
+    pthread_mutex_lock( &psm->statemachine_mutex );
+
+    if ( pcid->event_fd < 0 )
+    {
+        pcid->event_fd = eventfd( 0, EFD_NONBLOCK | EFD_CLOEXEC );
+        if ( pcid->event_fd < 0 )
+        {
+            ret = errno;
+        }
+        else if ( pcid->state_haschanged )
+        {
+            //a change already pending must show too
+            uint64_t one = 1;
+            ssize_t written = write( pcid->event_fd, &one, sizeof( one ) );
+            __unused( written );
+        }
+    }
+
+    *pfd = pcid->event_fd;
+
+    pthread_mutex_unlock( &psm->statemachine_mutex );
+
+    return ret;
 }
 
-statemachine_states_t statemachine_get_current_state()
+int statemachine_try_state_change_r( statemachine_t* psm, statemachine_cid* pcid, statemachine_states_t* pnew_state )
+{
+    int ret = EAGAIN;
+
+    pthread_mutex_lock( &psm->statemachine_mutex );
+
+    if ( pcid->state_haschanged )
+    {
+        statemachine_clear_state_change_forclient_nolock( pcid );
+        ret = EOK;
+    }
+
+    *pnew_state = statemachine_get_current_state_nolock( psm );
+
+    pthread_mutex_unlock( &psm->statemachine_mutex );
+
+    return ret;
+}
+
+int statemachine_subscribe_r( statemachine_t* psm, statemachine_cid* pcid, uint32_t state_mask, uint32_t action_mask )
+{
+    pthread_mutex_lock( &psm->statemachine_mutex );
+
+    psm->sscid_action_subscribers += ( action_mask != 0 ) - ( pcid->action_mask != 0 );
+    pcid->state_mask = state_mask;
+    pcid->action_mask = action_mask;
+
+    pthread_mutex_unlock( &psm->statemachine_mutex );
+
+    return EOK;
+}
+
+int statemachine_wait_until_r( statemachine_t* psm, statemachine_cid* pcid, uint32_t state_mask, uint64_t deadline_nsec, statemachine_states_t* pnew_state )
+{
+    //do following:
+    //lock the machine
+    //block until the state is in the mask, the deadline passes or the wait is cancelled
+    //  transitions into the mask wake us even if not subscribed to them
+    //read state for returning
+    //unlock the machine
+
+    int ret = EOK;
+    struct timespec deadline;
+
+    deadline.tv_sec = deadline_nsec / 1000000000ULL;
+    deadline.tv_nsec = deadline_nsec % 1000000000ULL;
+
+    pthread_mutex_lock( &psm->statemachine_mutex );
+
+    pcid->wait_mask = state_mask;
+
+    while ( !( state_mask & STATEMACHINE_STATE_BIT( psm->state ) ) )
+    {
+        if ( pcid->wait_cancelled )
+        {
+            pcid->wait_cancelled = false;
+            ret = ECANCELED;
+            break;
+        }
+
+        if ( deadline_nsec == 0 )
+        {
+            pthread_cond_wait( &pcid->signal_haschanged, &psm->statemachine_mutex );
+        }
+        else if ( pthread_cond_timedwait( &pcid->signal_haschanged, &psm->statemachine_mutex, &deadline ) == ETIMEDOUT )
+        {
+            ret = ( state_mask & STATEMACHINE_STATE_BIT( psm->state ) ) ? EOK : ETIMEDOUT;
+            break;
+        }
+    }
+
+    pcid->wait_mask = 0;
+
+    if ( pnew_state != NULL )
+    {
+        *pnew_state = psm->state;
+    }
+
+    pthread_mutex_unlock( &psm->statemachine_mutex );
+
+    return ret;
+}
+
+int statemachine_cancel_waitfor_r( statemachine_t* psm, statemachine_cid* pcid )
+{
+    pthread_mutex_lock( &psm->statemachine_mutex );
+
+    pcid->wait_cancelled = true;
+    int ret = statemachine_set_state_change_forclient_nolock( pcid );
+
+    pthread_mutex_unlock( &psm->statemachine_mutex );
+
+    return ret;
+}
+
+statemachine_states_t statemachine_get_current_state_r( statemachine_t* psm )
 {
     statemachine_states_t ret_state;
 
-    pthread_mutex_lock( &statemachine_mutex );
+    pthread_mutex_lock( &psm->statemachine_mutex );
 
-    ret_state = state;
+    ret_state = psm->state;
 
-    pthread_mutex_unlock( &statemachine_mutex );
+    pthread_mutex_unlock( &psm->statemachine_mutex );
 
     return ret_state;
 }
 
+int statemachine_init( statemachine_cid* pcid )
+{
+    return statemachine_init_r( &statemachine_default, pcid );
+}
+
+int statemachine_fini( statemachine_cid* pcid )
+{
+    return statemachine_fini_r( &statemachine_default, pcid );
+}
+
+int statemachine_next_state(statemachine_actions_t action, statemachine_states_t* pnew_state)
+{
+    return statemachine_next_state_r( &statemachine_default, action, pnew_state );
+}
+
+int statemachine_wait_state_change( statemachine_cid* pcid, statemachine_states_t* pnew_state )
+{
+    return statemachine_wait_state_change_r( &statemachine_default, pcid, pnew_state );
+}
+
+int statemachine_get_event_fd( statemachine_cid* pcid, int* pfd )
+{
+    return statemachine_get_event_fd_r( &statemachine_default, pcid, pfd );
+}
+
+int statemachine_try_state_change( statemachine_cid* pcid, statemachine_states_t* pnew_state )
+{
+    return statemachine_try_state_change_r( &statemachine_default, pcid, pnew_state );
+}
+
+int statemachine_subscribe( statemachine_cid* pcid, uint32_t state_mask, uint32_t action_mask )
+{
+    return statemachine_subscribe_r( &statemachine_default, pcid, state_mask, action_mask );
+}
+
+int statemachine_wait_until( statemachine_cid* pcid, uint32_t state_mask, uint64_t deadline_nsec, statemachine_states_t* pnew_state )
+{
+    return statemachine_wait_until_r( &statemachine_default, pcid, state_mask, deadline_nsec, pnew_state );
+}
+
+int statemachine_cancel_waitfor( statemachine_cid* pcid )
+{
+    return statemachine_cancel_waitfor_r( &statemachine_default, pcid );
+}
+
+statemachine_states_t statemachine_get_current_state()
+{
+    return statemachine_get_current_state_r( &statemachine_default );
+}
+
+int statemachine_set_trace( struct trace_writer* ptrace )
+{
+    return statemachine_set_trace_r( &statemachine_default, ptrace );
+}
+
+int statemachine_set_trace_r( statemachine_t* psm, struct trace_writer* ptrace )
+{
+    pthread_mutex_lock( &psm->statemachine_mutex );
+    psm->ptrace = ptrace;
+    pthread_mutex_unlock( &psm->statemachine_mutex );
+
+    return EOK;
+}
+
+int statemachine_set_behaviour( struct behaviour_slot* pslot )
+{
+    return statemachine_set_behaviour_r( &statemachine_default, pslot );
+}
+
+int statemachine_set_behaviour_r( statemachine_t* psm, struct behaviour_slot* pslot )
+{
+    pthread_mutex_lock( &psm->statemachine_mutex );
+    psm->pbehaviour = pslot;
+    pthread_mutex_unlock( &psm->statemachine_mutex );
+
+    return EOK;
+}
+
+int statemachine_set_shadow( struct shadow* pshadow )
+{
+    return statemachine_set_shadow_r( &statemachine_default, pshadow );
+}
+
+int statemachine_set_shadow_r( statemachine_t* psm, struct shadow* pshadow )
+{
+    pthread_mutex_lock( &psm->statemachine_mutex );
+    psm->pshadow = pshadow;
+    pthread_mutex_unlock( &psm->statemachine_mutex );
+
+    return EOK;
+}
+
+int statemachine_set_input( statemachine_input_fn input, void* ctx )
+{
+    return statemachine_set_input_r( &statemachine_default, input, ctx );
+}
+
+int statemachine_set_input_r( statemachine_t* psm, statemachine_input_fn input, void* ctx )
+{
+    pthread_mutex_lock( &psm->statemachine_mutex );
+    psm->input = input;
+    psm->input_ctx = ctx;
+    pthread_mutex_unlock( &psm->statemachine_mutex );
+
+    return EOK;
+}
+
+int statemachine_observe( statemachine_observer_fn callback, void* ctx, int flags, statemachine_observer_t** ppobserver )
+{
+    return statemachine_observe_r( &statemachine_default, callback, ctx, flags, ppobserver );
+}
+
+int statemachine_observe_r( statemachine_t* psm, statemachine_observer_fn callback, void* ctx, int flags, statemachine_observer_t** ppobserver )
+{
+    //do following:
+    //allocate the observer
+    //lock the observers
+    //start the observer threads with the first async observer
+    //publish the observer
+    //unlock the observers
+
+    int ret = EOK;
+    statemachine_observer_t* pobserver = calloc( 1, sizeof( statemachine_observer_t ) );
+
+    return_if( pobserver == NULL, ENOMEM );
+
+    pobserver->callback = callback;
+    pobserver->ctx = ctx;
+    pobserver->flags = flags;
+
+    pthread_rwlock_wrlock( &psm->observers_lock );
+
+    if ( flags & STATEMACHINE_OBSERVE_ASYNC )
+    {
+        if ( psm->observer_async_count == 0 )
+        {
+            ret = statemachine_observer_pool_start_nolock( psm );
+        }
+
+        if ( ret == EOK )
+        {
+            pobserver->worker = psm->observer_next_worker++ % statemachine_OBSERVER_THREADS;
+            psm->observer_async_count++;
+        }
+    }
+
+    if ( ret == EOK )
+    {
+        SLIST_INSERT_HEAD( &psm->observers_head, pobserver, entries );
+        __atomic_store_n( &psm->observer_count, psm->observer_count + 1, __ATOMIC_RELEASE );
+        *ppobserver = pobserver;
+    }
+
+    pthread_rwlock_unlock( &psm->observers_lock );
+
+    if ( ret != EOK )
+    {
+        free( pobserver );
+    }
+
+    return ret;
+}
+
+int statemachine_unobserve( statemachine_observer_t* pobserver )
+{
+    return statemachine_unobserve_r( &statemachine_default, pobserver );
+}
+
+int statemachine_unobserve_r( statemachine_t* psm, statemachine_observer_t* pobserver )
+{
+    //do following:
+    //unpublish the observer; no producer can reach it once we hold the lock
+    //wait for its queued async events to run
+    //stop the observer threads with the last async observer
+    //free the observer
+
+    return_if( pobserver == NULL, EOK );
+
+    pthread_rwlock_wrlock( &psm->observers_lock );
+    SLIST_REMOVE( &psm->observers_head, pobserver, statemachine_observer, entries );
+    __atomic_store_n( &psm->observer_count, psm->observer_count - 1, __ATOMIC_RELEASE );
+    pthread_rwlock_unlock( &psm->observers_lock );
+
+    if ( pobserver->flags & STATEMACHINE_OBSERVE_ASYNC )
+    {
+        //not under observers_lock; the callbacks may apply actions themselves
+        pthread_mutex_lock( &psm->observer_pool_mutex );
+        while ( pobserver->pending > 0 )
+        {
+            pthread_cond_wait( &psm->signal_observer_idle, &psm->observer_pool_mutex );
+        }
+        pthread_mutex_unlock( &psm->observer_pool_mutex );
+
+        if ( pobserver->dropped > 0 )
+        {
+            print_stderr( STDPRINT_NAME "observer queue overflowed; dropped=%llu\n", (unsigned long long)pobserver->dropped );
+        }
+
+        pthread_rwlock_wrlock( &psm->observers_lock );
+        if ( --psm->observer_async_count == 0 )
+        {
+            //no async observer left, so the threads are idle
+            statemachine_observer_pool_stop_nolock( psm );
+        }
+        pthread_rwlock_unlock( &psm->observers_lock );
+    }
+
+    free( pobserver );
+
+    return EOK;
+}
+
 const char* statemachine_get_statename( statemachine_states_t value )
 {
     if ( value < ss_END )
@@ -1,7 +1,9 @@
 #ifndef statemachine_H_
 #define statemachine_H_
 
+#include <pthread.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 typedef enum
 {
@@ -46,12 +48,29 @@ typedef enum
     sa_END,   //not valid; marks end of enum
 } statemachine_actions_t;
 
+#define STATEMACHINE_STATE_BIT( state )     ( 1u << (state) )
+#define STATEMACHINE_ACTION_BIT( action )   ( 1u << (action) )
+#define STATEMACHINE_MASK_ALL               0xFFFFFFFFu
+
 typedef struct
 {
     int             id;
+    int             slot;               //registry handle; -1 once fini'd
     volatile bool   state_haschanged;
+    volatile bool   wait_cancelled;
+    uint32_t        state_mask;         //entering one of these states wakes the client; see statemachine_subscribe
+    uint32_t        action_mask;        //applying one of these actions wakes the client, changed state or not
+    uint32_t        wait_mask;          //states statemachine_wait_until is blocked on
+    int             event_fd;           //readable on state change once requested; -1 otherwise
+    pthread_cond_t  signal_haschanged;  //only this client waits on it
 } statemachine_cid;
 
+/*
+ * Opaque statemachine instance handle
+ * each instance owns its own state, lock and clients
+ */
+typedef struct statemachine statemachine_t;
+
 /*
  * Inits threadman state
  *
@@ -98,7 +117,62 @@ int statemachine_wait_state_change( statemachine_cid* pcid, statemachine_states_
 
 
 /*
- * Cancels all blocked callers to statemachine_wait_state_change
+ * Retrieves a file descriptor that becomes readable whenever the client would be woken
+ * lets a client sit in its own poll/epoll loop instead of blocking a thread in
+ * statemachine_wait_state_change; consume changes with statemachine_try_state_change
+ *
+ * thread-safe: yes
+ *
+ * pcid             pointer to a state client identifier struct
+ * pfd              receives the descriptor (an eventfd); owned by the client and closed by statemachine_fini
+ *
+ * returns EOK on success; EErr type from eventfd otherwise
+ */
+int statemachine_get_event_fd( statemachine_cid* pcid, int* pfd );
+
+/*
+ * Consumes a pending state change without blocking; drains the event fd
+ *
+ * thread-safe: yes
+ *
+ * pcid             pointer to a state client identifier struct
+ * pnew_state       pointer receiving the current state
+ *
+ * returns EOK if a change was pending; EAGAIN otherwise
+ */
+int statemachine_try_state_change( statemachine_cid* pcid, statemachine_states_t* pnew_state );
+
+/*
+ * Narrows which transitions wake a client; clients start subscribed to every state and no action
+ *
+ * thread-safe: yes
+ *
+ * pcid             pointer to a state client identifier struct
+ * state_mask       STATEMACHINE_STATE_BIT of each state whose entry wakes the client
+ * action_mask      STATEMACHINE_ACTION_BIT of each action whose application wakes the client
+ *
+ * returns EOK always
+ */
+int statemachine_subscribe( statemachine_cid* pcid, uint32_t state_mask, uint32_t action_mask );
+
+/*
+ * Waits until the machine is in one of the given states
+ * only transitions into those states wake the caller, whatever its subscription
+ *
+ * thread-safe: yes
+ *
+ * pcid             pointer to a state client identifier struct
+ * state_mask       STATEMACHINE_STATE_BIT of each state to wait for
+ * deadline_nsec    give up at this get_monotonic_nsec time; 0 waits forever
+ * pnew_state       pointer receiving the state reached, or the current state on timeout/cancel; may be NULL
+ *
+ * returns EOK once in one of the states (at once if already);
+ *         ETIMEDOUT if the deadline passed; ECANCELED if statemachine_cancel_waitfor was called
+ */
+int statemachine_wait_until( statemachine_cid* pcid, uint32_t state_mask, uint64_t deadline_nsec, statemachine_states_t* pnew_state );
+
+/*
+ * Cancels all blocked callers to statemachine_wait_state_change and statemachine_wait_until
  *
  * thread-safe: yes
  **
@@ -114,6 +188,186 @@ int statemachine_cancel_waitfor( statemachine_cid* pcid );
  */
 statemachine_states_t statemachine_get_current_state();
 
+struct trace_writer;
+
+/*
+ * Attaches an action recorder; every applied action is appended to it
+ * see trace.h
+ *
+ * ptrace       writer to record into; NULL detaches
+ *
+ * returns EOK always
+ */
+int statemachine_set_trace( struct trace_writer* ptrace );
+
+struct behaviour_slot;
+
+/*
+ * Takes transitions from a hot swappable definition slot instead of the builtin table
+ * see behaviour_def.h; definitions published to the slot later apply from the next action
+ *
+ * pslot        slot to use; NULL restores the builtin table
+ *
+ * returns EOK always
+ */
+int statemachine_set_behaviour( struct behaviour_slot* pslot );
+
+struct shadow;
+
+/*
+ * Feeds every applied action to a shadow evaluating a candidate table
+ * see shadow.h
+ *
+ * pshadow      shadow to feed; NULL detaches
+ *
+ * returns EOK always
+ */
+int statemachine_set_shadow( struct shadow* pshadow );
+
+/*
+ * Switch levels the guards are evaluated against
+ * called with the machine locked; must not block nor call back into the machine
+ *
+ * returns EOK with both levels filled in; anything else skips the guards
+ */
+typedef int (*statemachine_input_fn)( void* ctx, bool* pint_switch1, bool* pext_switch1 );
+
+/*
+ * Lets the machine resolve guarded states in the same step that enters them
+ * see statemachine_guard; only the builtin table has guards
+ *
+ * input        level source; NULL disables guards
+ * ctx          passed back untouched
+ *
+ * returns EOK always
+ */
+int statemachine_set_input( statemachine_input_fn input, void* ctx );
+
+/*
+ * Resolves the guard of a state just entered against the switch levels
+ * states whose entry behaviour only moves the arm home continue at once when it already is;
+ * the machine then applies the returned action too, records both steps and notifies once
+ *
+ * thread-safe: yes (pure)
+ *
+ * returns true with the action to apply; false when the state has no guard or it does not hold
+ */
+bool statemachine_guard( statemachine_states_t entered_state, bool int_switch1, bool ext_switch1, statemachine_actions_t* paction );
+
+/*
+ * One applied action as seen by observers
+ */
+typedef struct
+{
+    uint64_t                seq;            //per instance; orders events from concurrent producers
+    uint64_t                ts_nsec;        //monotonic
+    statemachine_actions_t  action;
+    statemachine_states_t   from_state;
+    statemachine_states_t   to_state;
+    int                     ret;            //result of the transition; EINVAL when rejected
+} statemachine_event_t;
+
+/*
+ * Transition observer
+ * called after the state lock is released; the event is only valid for the call
+ */
+typedef void (*statemachine_observer_fn)( void* ctx, const statemachine_event_t* pevent );
+
+typedef struct statemachine_observer statemachine_observer_t;
+
+#define STATEMACHINE_OBSERVE_ASYNC          0x01    //call on the instance's observer threads instead of the producer
+#define STATEMACHINE_OBSERVE_ALL            0x02    //also call for actions that leave the state unchanged
+
+/*
+ * Subscribes a callback to the transitions of the default instance
+ *
+ * Inline observers run on the thread that applied the action and must not
+ * observe or unobserve. Async observers are called one event at a time on
+ * one of a few observer threads; events are dropped rather than block the
+ * producer when their queue is full. Either way, events from concurrent
+ * producers may arrive out of order; seq gives the order they were applied.
+ *
+ * callback     function to call
+ * ctx          passed back untouched
+ * flags        STATEMACHINE_OBSERVE_ flags
+ * ppobserver   pointer to receive the handle for statemachine_unobserve
+ *
+ * thread-safe: yes
+ *
+ * returns EOK on success; EErr type otherwise
+ */
+int statemachine_observe( statemachine_observer_fn callback, void* ctx, int flags, statemachine_observer_t** ppobserver );
+
+/*
+ * Unsubscribes an observer; once it returns the callback is no longer running nor queued
+ *
+ * thread-safe: yes; not from within an observer
+ *
+ * returns EOK always
+ */
+int statemachine_unobserve( statemachine_observer_t* pobserver );
+
+/*
+ * Evaluates the transition table without touching any statemachine instance
+ *
+ * thread-safe: yes (pure)
+ *
+ * current_state    state to transition from
+ * action           action to apply
+ * pnext_state      receives the next state (current_state when no transition)
+ *
+ * returns EOK on success; EINVAL for unknown state/action pairs
+ */
+int statemachine_transition( statemachine_states_t current_state, statemachine_actions_t action, statemachine_states_t* pnext_state );
+
+/*
+ * Reentrant api
+ *
+ * Each of the calls above operates on a process-wide default instance
+ * and is a thin wrapper over the matching _r call below.
+ * Independent instances share no locks and may be driven from any thread.
+ */
+
+/*
+ * Creates a new statemachine instance
+ *
+ * ppsm     pointer to receive the new instance handle
+ *
+ * returns EOK on success; EErr type otherwise describing the failure
+ */
+int statemachine_create( statemachine_t** ppsm );
+
+/*
+ * Destroys a statemachine instance created with statemachine_create
+ *
+ * psm      instance handle; all clients must already be fini'd
+ *
+ * returns EOK on success; EBUSY if clients or observers remain; EINVAL for the default instance
+ */
+int statemachine_destroy( statemachine_t* psm );
+
+/*
+ * Retrieves the default instance used by the non-reentrant api
+ */
+statemachine_t* statemachine_get_default( void );
+
+int statemachine_init_r( statemachine_t* psm, statemachine_cid* pcid );
+int statemachine_fini_r( statemachine_t* psm, statemachine_cid* pcid );
+int statemachine_next_state_r( statemachine_t* psm, statemachine_actions_t action, statemachine_states_t* pnew_state );
+int statemachine_wait_state_change_r( statemachine_t* psm, statemachine_cid* pcid, statemachine_states_t* pnew_state );
+int statemachine_get_event_fd_r( statemachine_t* psm, statemachine_cid* pcid, int* pfd );
+int statemachine_try_state_change_r( statemachine_t* psm, statemachine_cid* pcid, statemachine_states_t* pnew_state );
+int statemachine_subscribe_r( statemachine_t* psm, statemachine_cid* pcid, uint32_t state_mask, uint32_t action_mask );
+int statemachine_wait_until_r( statemachine_t* psm, statemachine_cid* pcid, uint32_t state_mask, uint64_t deadline_nsec, statemachine_states_t* pnew_state );
+int statemachine_cancel_waitfor_r( statemachine_t* psm, statemachine_cid* pcid );
+statemachine_states_t statemachine_get_current_state_r( statemachine_t* psm );
+int statemachine_set_trace_r( statemachine_t* psm, struct trace_writer* ptrace );
+int statemachine_set_behaviour_r( statemachine_t* psm, struct behaviour_slot* pslot );
+int statemachine_set_shadow_r( statemachine_t* psm, struct shadow* pshadow );
+int statemachine_set_input_r( statemachine_t* psm, statemachine_input_fn input, void* ctx );
+int statemachine_observe_r( statemachine_t* psm, statemachine_observer_fn callback, void* ctx, int flags, statemachine_observer_t** ppobserver );
+int statemachine_unobserve_r( statemachine_t* psm, statemachine_observer_t* pobserver );
+
 /*
  * Converts state enum to string literal
  *
@@ -0,0 +1,242 @@
+#include "statemachine_batch.h"
+#include "util.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined( __SSSE3__ )
+#  include <tmmintrin.h>
+#  define SM_BATCH_KERNEL_SSSE3
+#elif defined( __ARM_NEON__ ) || defined( __ARM_NEON )
+#  include <arm_neon.h>
+#  define SM_BATCH_KERNEL_NEON
+#endif
+
+#define SM_BATCH_ROW_SIZE                   32              //states per table row; one 32 byte shuffle/vtbl
+
+//the vector kernels look states up with a single 32 entry shuffle
+typedef char sm_batch_states_fit_row[ ( ss_END <= SM_BATCH_ROW_SIZE ) ? 1 : -1 ];
+
+//next state indexed by [action][current state]; the extra row for SM_BATCH_ACTION_NONE is identity
+static uint8_t                              sm_batch_table[ sa_END + 1 ][ SM_BATCH_ROW_SIZE ] __attribute__(( aligned( 16 ) ));
+static pthread_once_t                       sm_batch_table_once = PTHREAD_ONCE_INIT;
+
+/*
+ * Internal function flattening statemachine_transition into the lookup table
+ * built from the switch itself so the two can never disagree
+ */
+static void statemachine_batch_table_build( void )
+{
+    int action;
+    int state;
+
+    for ( action = 0; action <= sa_END; action++ )
+    {
+        for ( state = 0; state < SM_BATCH_ROW_SIZE; state++ )
+        {
+            statemachine_states_t next_state = (statemachine_states_t)state;
+
+            if ( ( action < sa_END ) && ( state < ss_END ) )
+            {
+                statemachine_transition( (statemachine_states_t)state, (statemachine_actions_t)action, &next_state );
+            }
+
+            sm_batch_table[ action ][ state ] = (uint8_t)next_state;
+        }
+    }
+}
+
+int statemachine_batch_init( statemachine_batch_t* pbatch, int count )
+{
+    return_if( count < 0, EINVAL );
+
+    pthread_once( &sm_batch_table_once, statemachine_batch_table_build );
+
+    int capacity = ( count + SM_BATCH_LANES - 1 ) & ~( SM_BATCH_LANES - 1 );
+    void* pstates = NULL;
+    void* pactions = NULL;
+
+    if ( capacity == 0 )
+    {
+        capacity = SM_BATCH_LANES;
+    }
+
+    if ( ( posix_memalign( &pstates, 64, capacity ) != 0 )
+            || ( posix_memalign( &pactions, 64, capacity ) != 0 ) )
+    {
+        free( pstates );
+        return ENOMEM;
+    }
+
+    pbatch->count = count;
+    pbatch->capacity = capacity;
+    pbatch->states = pstates;
+    pbatch->actions = pactions;
+
+    memset( pbatch->states, ss_powerup, capacity );
+    memset( pbatch->actions, SM_BATCH_ACTION_NONE, capacity );
+
+    return EOK;
+}
+
+void statemachine_batch_fini( statemachine_batch_t* pbatch )
+{
+    free( pbatch->states );
+    free( pbatch->actions );
+    pbatch->states = NULL;
+    pbatch->actions = NULL;
+    pbatch->count = 0;
+    pbatch->capacity = 0;
+}
+
+int statemachine_batch_step_scalar( statemachine_batch_t* pbatch )
+{
+    uint8_t* restrict pstates = pbatch->states;
+    uint8_t* restrict pactions = pbatch->actions;
+    int changed = 0;
+    int i;
+
+    for ( i = 0; i < pbatch->count; i++ )
+    {
+        uint8_t action = pactions[ i ];
+        uint8_t state = pstates[ i ];
+        uint8_t next_state = state;
+
+        //out of range actions are left alone, same as the vector kernels
+        if ( action < SM_BATCH_ACTION_NONE )
+        {
+            next_state = sm_batch_table[ action ][ state ];
+        }
+
+        changed += ( next_state != state );
+        pstates[ i ] = next_state;
+        pactions[ i ] = SM_BATCH_ACTION_NONE;
+    }
+
+    return changed;
+}
+
+#if defined( SM_BATCH_KERNEL_SSSE3 )
+
+/*
+ * Internal ssse3 kernel; 16 boxes per step
+ * each action row is looked up as two 16 byte pshufb halves and blended in where the box action matches
+ */
+static int statemachine_batch_step_vector( statemachine_batch_t* pbatch )
+{
+    const __m128i ones = _mm_set1_epi8( (char)0xFF );
+    const __m128i row_half = _mm_set1_epi8( 16 );
+    const __m128i row_last = _mm_set1_epi8( 15 );
+    const __m128i none = _mm_set1_epi8( (char)SM_BATCH_ACTION_NONE );
+    int changed = 0;
+    int i;
+    int action;
+
+    for ( i = 0; i < pbatch->capacity; i += SM_BATCH_LANES )
+    {
+        __m128i actions = _mm_load_si128( (const __m128i*)&pbatch->actions[ i ] );
+
+        //skip quiet chunks entirely; sparse activity is the common fleet case
+        if ( _mm_movemask_epi8( _mm_cmpeq_epi8( actions, none ) ) == 0xFFFF )
+        {
+            continue;
+        }
+
+        __m128i states = _mm_load_si128( (const __m128i*)&pbatch->states[ i ] );
+        __m128i in_hi = _mm_cmpgt_epi8( states, row_last );
+        __m128i idx_lo = _mm_or_si128( states, in_hi );                     //bit7 set zeroes the lane
+        __m128i idx_hi = _mm_or_si128( _mm_sub_epi8( states, row_half ), _mm_andnot_si128( in_hi, ones ) );
+        __m128i next_states = states;
+
+        for ( action = 0; action < sa_END; action++ )
+        {
+            const __m128i* prow = (const __m128i*)sm_batch_table[ action ];
+            __m128i mask = _mm_cmpeq_epi8( actions, _mm_set1_epi8( (char)action ) );
+            __m128i looked_up = _mm_or_si128(
+                _mm_shuffle_epi8( _mm_load_si128( prow ), idx_lo ),
+                _mm_shuffle_epi8( _mm_load_si128( prow + 1 ), idx_hi ) );
+
+            next_states = _mm_or_si128( _mm_and_si128( mask, looked_up ), _mm_andnot_si128( mask, next_states ) );
+        }
+
+        changed += __builtin_popcount( ~_mm_movemask_epi8( _mm_cmpeq_epi8( next_states, states ) ) & 0xFFFF );
+
+        _mm_store_si128( (__m128i*)&pbatch->states[ i ], next_states );
+        _mm_store_si128( (__m128i*)&pbatch->actions[ i ], none );
+    }
+
+    return changed;
+}
+
+#elif defined( SM_BATCH_KERNEL_NEON )
+
+/*
+ * Internal neon kernel; 8 boxes per vtbl4 lookup
+ * each action row is a 32 byte vtbl4 table blended in where the box action matches
+ */
+static int statemachine_batch_step_vector( statemachine_batch_t* pbatch )
+{
+    uint8x8x4_t rows[ sa_END ];
+    const uint8x8_t none = vdup_n_u8( SM_BATCH_ACTION_NONE );
+    int changed = 0;
+    int i;
+    int half;
+    int action;
+
+    for ( action = 0; action < sa_END; action++ )
+    {
+        rows[ action ].val[ 0 ] = vld1_u8( &sm_batch_table[ action ][ 0 ] );
+        rows[ action ].val[ 1 ] = vld1_u8( &sm_batch_table[ action ][ 8 ] );
+        rows[ action ].val[ 2 ] = vld1_u8( &sm_batch_table[ action ][ 16 ] );
+        rows[ action ].val[ 3 ] = vld1_u8( &sm_batch_table[ action ][ 24 ] );
+    }
+
+    for ( i = 0; i < pbatch->capacity; i += SM_BATCH_LANES )
+    {
+        for ( half = 0; half < SM_BATCH_LANES; half += 8 )
+        {
+            uint8x8_t actions = vld1_u8( &pbatch->actions[ i + half ] );
+            uint8x8_t states = vld1_u8( &pbatch->states[ i + half ] );
+            uint8x8_t next_states = states;
+
+            for ( action = 0; action < sa_END; action++ )
+            {
+                uint8x8_t mask = vceq_u8( actions, vdup_n_u8( (uint8_t)action ) );
+                next_states = vbsl_u8( mask, vtbl4_u8( rows[ action ], states ), next_states );
+            }
+
+            //one per changed lane, then horizontal add
+            uint8x8_t diff = vshr_n_u8( vmvn_u8( vceq_u8( next_states, states ) ), 7 );
+            changed += (int)vget_lane_u64( vpaddl_u32( vpaddl_u16( vpaddl_u8( diff ) ) ), 0 );
+
+            vst1_u8( &pbatch->states[ i + half ], next_states );
+            vst1_u8( &pbatch->actions[ i + half ], none );
+        }
+    }
+
+    return changed;
+}
+
+#endif
+
+int statemachine_batch_step( statemachine_batch_t* pbatch )
+{
+#if defined( SM_BATCH_KERNEL_SSSE3 ) || defined( SM_BATCH_KERNEL_NEON )
+    return statemachine_batch_step_vector( pbatch );
+#else
+    return statemachine_batch_step_scalar( pbatch );
+#endif
+}
+
+const char* statemachine_batch_kernel_name( void )
+{
+#if defined( SM_BATCH_KERNEL_SSSE3 )
+    return "ssse3";
+#elif defined( SM_BATCH_KERNEL_NEON )
+    return "neon";
+#else
+    return "scalar";
+#endif
+}
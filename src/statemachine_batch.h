@@ -0,0 +1,58 @@
+#ifndef statemachine_batch_H_
+#define statemachine_batch_H_
+
+#include "statemachine.h"
+
+#include <stdint.h>
+
+#define SM_BATCH_ACTION_NONE                ((uint8_t)sa_END)   //no pending action for the box
+#define SM_BATCH_LANES                      16                  //boxes per vector step; capacity is padded to this
+
+/*
+ * Struct-of-arrays state for many boxes advanced in lockstep
+ *
+ * states[i]    current state of box i
+ * actions[i]   pending action of box i; SM_BATCH_ACTION_NONE when idle
+ *
+ * both arrays are SM_BATCH_LANES aligned and padded; callers may write them directly
+ * states must hold valid statemachine_states_t values
+ */
+typedef struct
+{
+    int                 count;
+    int                 capacity;
+    uint8_t*            states;
+    uint8_t*            actions;
+} statemachine_batch_t;
+
+/*
+ * Allocates batch arrays; every box starts in ss_powerup with no pending action
+ *
+ * returns EOK on success; EErr type otherwise describing the failure
+ */
+int statemachine_batch_init( statemachine_batch_t* pbatch, int count );
+
+/*
+ * Releases batch arrays
+ */
+void statemachine_batch_fini( statemachine_batch_t* pbatch );
+
+/*
+ * Applies every pending action and clears it
+ * uses the best vector kernel available for the build target
+ *
+ * returns number of boxes that changed state
+ */
+int statemachine_batch_step( statemachine_batch_t* pbatch );
+
+/*
+ * Same as statemachine_batch_step, always using the scalar table lookup
+ */
+int statemachine_batch_step_scalar( statemachine_batch_t* pbatch );
+
+/*
+ * Names the vector kernel selected at build time ("ssse3", "neon" or "scalar")
+ */
+const char* statemachine_batch_kernel_name( void );
+
+#endif
@@ -0,0 +1,465 @@
+#include "trace.h"
+#include "util.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define STDPRINT_NAME                       __FILE__ ":"
+
+#define TRACE_RECORD_SIZE                   8
+#define TRACE_BUFFER_RECORDS                4096    //handed to the writer thread when full
+#define TRACE_BUFFERS                       4       //one filling, the rest queued for write
+#define TRACE_DELTA_MAX_USEC                0xFFFFFFFFu
+
+struct trace_writer
+{
+    int                                     fd;
+    pthread_t                               tid;
+    pthread_mutex_t                         mutex;          //guards everything below
+    pthread_cond_t                          signal_full;
+    bool                                    running;
+    uint64_t                                last_nsec;      //time base of the previous record
+    int                                     fill;           //buffer being filled; the queued ones precede it
+    int                                     fill_count;     //records in the fill buffer
+    int                                     full_count;     //buffers queued for the writer thread
+    uint64_t                                dropped;        //records lost to a writer that fell behind
+    int                                     write_err;      //first failed write
+    uint8_t                                 buffers[ TRACE_BUFFERS ][ TRACE_BUFFER_RECORDS * TRACE_RECORD_SIZE ];
+};
+
+struct trace_reader
+{
+    int                                     fd;
+    const uint8_t*                          pmap;
+    size_t                                  map_size;
+    const uint8_t*                          pnext;
+    const uint8_t*                          pend;
+    uint64_t                                ts_nsec;
+};
+
+static __thread trace_source_t              trace_source_current = trace_src_unknown;
+
+static const char*          trace_source_names[] =
+    {
+        "unknown",
+        "input",
+        "timer",
+        "entry",
+        "control",
+        "gap",
+    };
+
+/*
+ * Internal function writing a whole buffer, retrying short writes
+ */
+static int trace_write_all( int fd, const uint8_t* pbuf, size_t size )
+{
+    while ( size > 0 )
+    {
+        ssize_t written = write( fd, pbuf, size );
+
+        if ( written < 0 )
+        {
+            if ( errno == EINTR )
+            {
+                continue;
+            }
+            return errno;
+        }
+
+        pbuf += written;
+        size -= written;
+    }
+
+    return EOK;
+}
+
+/*
+ * Internal function queuing the full fill buffer for the writer thread
+ * Note: callers hold the writer mutex
+ *
+ * returns false if every other buffer is still queued
+ */
+static bool trace_writer_handoff_nolock( trace_writer_t* ptrace )
+{
+    return_if( ptrace->full_count == ( TRACE_BUFFERS - 1 ), false );
+
+    ptrace->full_count++;
+    ptrace->fill = ( ptrace->fill + 1 ) % TRACE_BUFFERS;
+    ptrace->fill_count = 0;
+    pthread_cond_signal( &ptrace->signal_full );
+
+    return true;
+}
+
+/*
+ * Writes queued buffers oldest first; the file is never written under the
+ * mutex, so a slow card stalls this thread and not the statemachine
+ */
+static void* trace_writer_entry( void* args )
+{
+    trace_writer_t* ptrace = (trace_writer_t*)args;
+
+    pthread_mutex_lock( &ptrace->mutex );
+    for (;;)
+    {
+        while ( ptrace->running && ( ptrace->full_count == 0 ) )
+        {
+            pthread_cond_wait( &ptrace->signal_full, &ptrace->mutex );
+        }
+
+        if ( ptrace->full_count == 0 )
+        {
+            break;
+        }
+
+        //stays queued (and so untouched by producers) until written
+        int oldest = ( ptrace->fill + TRACE_BUFFERS - ptrace->full_count ) % TRACE_BUFFERS;
+
+        pthread_mutex_unlock( &ptrace->mutex );
+        int ret = trace_write_all( ptrace->fd, ptrace->buffers[ oldest ], (size_t)TRACE_BUFFER_RECORDS * TRACE_RECORD_SIZE );
+        pthread_mutex_lock( &ptrace->mutex );
+
+        if ( ( ret != EOK ) && ( ptrace->write_err == EOK ) )
+        {
+            ptrace->write_err = ret;
+        }
+
+        ptrace->full_count--;
+    }
+    pthread_mutex_unlock( &ptrace->mutex );
+
+    return NULL;
+}
+
+/*
+ * Internal function appending one record
+ * Note: callers hold the writer mutex
+ *
+ * returns EOK on success; ENOBUFS if the record was dropped
+ */
+static int trace_writer_put_nolock( trace_writer_t* ptrace, uint32_t delta_usec, uint8_t source, uint8_t action, uint8_t from_state, uint8_t to_state )
+{
+    //an earlier handoff found the writer thread behind; retry before dropping
+    if ( ( ptrace->fill_count == TRACE_BUFFER_RECORDS ) && !trace_writer_handoff_nolock( ptrace ) )
+    {
+        ptrace->dropped++;
+        return ENOBUFS;
+    }
+
+    uint8_t* prec = &ptrace->buffers[ ptrace->fill ][ ptrace->fill_count * TRACE_RECORD_SIZE ];
+
+    prec[ 0 ] = (uint8_t)( delta_usec );
+    prec[ 1 ] = (uint8_t)( delta_usec >> 8 );
+    prec[ 2 ] = (uint8_t)( delta_usec >> 16 );
+    prec[ 3 ] = (uint8_t)( delta_usec >> 24 );
+    prec[ 4 ] = source;
+    prec[ 5 ] = action;
+    prec[ 6 ] = from_state;
+    prec[ 7 ] = to_state;
+
+    if ( ++ptrace->fill_count == TRACE_BUFFER_RECORDS )
+    {
+        trace_writer_handoff_nolock( ptrace );
+    }
+
+    return EOK;
+}
+
+int trace_writer_open( trace_writer_t** pptrace, const char* path )
+{
+    trace_writer_t* ptrace = calloc( 1, sizeof( trace_writer_t ) );
+    trace_file_header_t header;
+    int ret;
+
+    return_if( ptrace == NULL, ENOMEM );
+
+    ptrace->fd = open( path, O_WRONLY | O_CREAT | O_TRUNC, 0644 );
+    if ( ptrace->fd < 0 )
+    {
+        ret = errno;
+        print_stderr( STDPRINT_NAME "failed to create trace; path=%s err=%d\n", path, ret );
+        free( ptrace );
+        return ret;
+    }
+
+    pthread_mutex_init( &ptrace->mutex, NULL );
+    pthread_cond_init( &ptrace->signal_full, NULL );
+    ptrace->last_nsec = get_monotonic_nsec();
+
+    memset( &header, 0, sizeof( header ) );
+    header.magic = TRACE_FILE_MAGIC;
+    header.version = TRACE_FILE_VERSION;
+    header.record_size = TRACE_RECORD_SIZE;
+    header.start_nsec = ptrace->last_nsec;
+
+    ret = trace_write_all( ptrace->fd, (const uint8_t*)&header, sizeof( header ) );
+    if ( ret == EOK )
+    {
+        ptrace->running = true;
+        ret = pthread_create( &ptrace->tid, NULL, trace_writer_entry, ptrace );
+    }
+
+    if ( ret != EOK )
+    {
+        pthread_cond_destroy( &ptrace->signal_full );
+        pthread_mutex_destroy( &ptrace->mutex );
+        close( ptrace->fd );
+        free( ptrace );
+        return ret;
+    }
+
+    *pptrace = ptrace;
+
+    return EOK;
+}
+
+int trace_writer_close( trace_writer_t* ptrace )
+{
+    return_if( ptrace == NULL, EOK );
+
+    //the thread writes out what is queued before it exits
+    pthread_mutex_lock( &ptrace->mutex );
+    ptrace->running = false;
+    pthread_cond_signal( &ptrace->signal_full );
+    pthread_mutex_unlock( &ptrace->mutex );
+
+    pthread_join( ptrace->tid, NULL );
+
+    int ret = trace_write_all( ptrace->fd, ptrace->buffers[ ptrace->fill ], (size_t)ptrace->fill_count * TRACE_RECORD_SIZE );
+
+    if ( ret == EOK )
+    {
+        ret = ptrace->write_err;
+    }
+
+    if ( ptrace->dropped > 0 )
+    {
+        print_stderr( STDPRINT_NAME "trace writer fell behind; dropped=%llu\n", (unsigned long long)ptrace->dropped );
+    }
+
+    close( ptrace->fd );
+    pthread_cond_destroy( &ptrace->signal_full );
+    pthread_mutex_destroy( &ptrace->mutex );
+    free( ptrace );
+
+    return ret;
+}
+
+int trace_writer_record( trace_writer_t* ptrace, statemachine_actions_t action, statemachine_states_t from_state, statemachine_states_t to_state )
+{
+    uint64_t now_nsec = get_monotonic_nsec();
+    int ret = EOK;
+
+    pthread_mutex_lock( &ptrace->mutex );
+
+    //racing callers may stamp slightly out of order; never go back in time
+    uint64_t delta_usec = ( now_nsec > ptrace->last_nsec ) ? ( now_nsec - ptrace->last_nsec ) / 1000 : 0;
+
+    //a dropped record leaves the time base alone, so the next one carries its delta
+    while ( ( delta_usec > TRACE_DELTA_MAX_USEC ) && ( ret == EOK ) )
+    {
+        ret = trace_writer_put_nolock( ptrace, TRACE_DELTA_MAX_USEC, trace_src_gap, 0, 0, 0 );
+        if ( ret == EOK )
+        {
+            delta_usec -= TRACE_DELTA_MAX_USEC;
+            ptrace->last_nsec += (uint64_t)TRACE_DELTA_MAX_USEC * 1000;
+        }
+    }
+
+    if ( ret == EOK )
+    {
+        ret = trace_writer_put_nolock( ptrace, (uint32_t)delta_usec, (uint8_t)trace_source_current, (uint8_t)action, (uint8_t)from_state, (uint8_t)to_state );
+    }
+
+    if ( ret == EOK )
+    {
+        ptrace->last_nsec += delta_usec * 1000;
+    }
+
+    pthread_mutex_unlock( &ptrace->mutex );
+
+    return ret;
+}
+
+void trace_set_source( trace_source_t source )
+{
+    trace_source_current = source;
+}
+
+trace_source_t trace_get_source( void )
+{
+    return trace_source_current;
+}
+
+int trace_reader_open( trace_reader_t** pptrace, const char* path )
+{
+    trace_reader_t* ptrace = calloc( 1, sizeof( trace_reader_t ) );
+    const trace_file_header_t* pheader;
+    struct stat st;
+    int ret;
+
+    return_if( ptrace == NULL, ENOMEM );
+
+    ptrace->fd = open( path, O_RDONLY );
+    if ( ptrace->fd < 0 )
+    {
+        ret = errno;
+        free( ptrace );
+        return ret;
+    }
+
+    if ( ( fstat( ptrace->fd, &st ) != 0 ) || ( (size_t)st.st_size < sizeof( trace_file_header_t ) ) )
+    {
+        close( ptrace->fd );
+        free( ptrace );
+        return EILSEQ;
+    }
+
+    ptrace->map_size = (size_t)st.st_size;
+    ptrace->pmap = mmap( NULL, ptrace->map_size, PROT_READ, MAP_PRIVATE, ptrace->fd, 0 );
+    if ( ptrace->pmap == MAP_FAILED )
+    {
+        ret = errno;
+        close( ptrace->fd );
+        free( ptrace );
+        return ret;
+    }
+
+    //one forward pass; let the kernel read ahead and drop pages behind us
+    madvise( (void*)ptrace->pmap, ptrace->map_size, MADV_SEQUENTIAL );
+
+    pheader = (const trace_file_header_t*)ptrace->pmap;
+    if ( ( pheader->magic != TRACE_FILE_MAGIC ) || ( pheader->version != TRACE_FILE_VERSION ) || ( pheader->record_size != TRACE_RECORD_SIZE ) )
+    {
+        trace_reader_close( ptrace );
+        return EILSEQ;
+    }
+
+    ptrace->ts_nsec = pheader->start_nsec;
+    ptrace->pnext = ptrace->pmap + sizeof( trace_file_header_t );
+    //a torn last record (writer killed mid flush) is ignored
+    ptrace->pend = ptrace->pnext + ( ( ptrace->map_size - sizeof( trace_file_header_t ) ) / TRACE_RECORD_SIZE ) * TRACE_RECORD_SIZE;
+
+    *pptrace = ptrace;
+
+    return EOK;
+}
+
+int trace_reader_close( trace_reader_t* ptrace )
+{
+    return_if( ptrace == NULL, EOK );
+
+    munmap( (void*)ptrace->pmap, ptrace->map_size );
+    close( ptrace->fd );
+    free( ptrace );
+
+    return EOK;
+}
+
+int trace_reader_next( trace_reader_t* ptrace, trace_event_t* pevent )
+{
+    while ( ptrace->pnext < ptrace->pend )
+    {
+        const uint8_t* prec = ptrace->pnext;
+        uint32_t delta_usec = (uint32_t)prec[ 0 ] | ( (uint32_t)prec[ 1 ] << 8 ) | ( (uint32_t)prec[ 2 ] << 16 ) | ( (uint32_t)prec[ 3 ] << 24 );
+
+        ptrace->pnext += TRACE_RECORD_SIZE;
+        ptrace->ts_nsec += (uint64_t)delta_usec * 1000;
+
+        if ( prec[ 4 ] == trace_src_gap )
+        {
+            continue;
+        }
+
+        return_if( ( prec[ 4 ] >= trace_src_END ) || ( prec[ 5 ] >= sa_END ) || ( prec[ 6 ] >= ss_END ) || ( prec[ 7 ] >= ss_END ), EILSEQ );
+
+        pevent->ts_nsec = ptrace->ts_nsec;
+        pevent->source = (trace_source_t)prec[ 4 ];
+        pevent->action = (statemachine_actions_t)prec[ 5 ];
+        pevent->from_state = (statemachine_states_t)prec[ 6 ];
+        pevent->to_state = (statemachine_states_t)prec[ 7 ];
+
+        return EOK;
+    }
+
+    return ENOENT;
+}
+
+int trace_reader_next_batch( trace_reader_t* ptrace, uint64_t end_index, trace_event_t* pevents, int max_events, int* pcount )
+{
+    const uint8_t* pfirst = ptrace->pmap + sizeof( trace_file_header_t );
+    const uint8_t* pend = ( end_index < trace_reader_record_count( ptrace ) ) ? ( pfirst + ( end_index * TRACE_RECORD_SIZE ) ) : ptrace->pend;
+    const uint8_t* prec = ptrace->pnext;
+    uint64_t ts_nsec = ptrace->ts_nsec;
+    int count = 0;
+    int ret = EOK;
+
+    //same decode as trace_reader_next, kept in one loop so the compiler can keep state in registers
+    while ( ( prec < pend ) && ( count < max_events ) )
+    {
+        uint32_t delta_usec = (uint32_t)prec[ 0 ] | ( (uint32_t)prec[ 1 ] << 8 ) | ( (uint32_t)prec[ 2 ] << 16 ) | ( (uint32_t)prec[ 3 ] << 24 );
+
+        ts_nsec += (uint64_t)delta_usec * 1000;
+
+        if ( prec[ 4 ] != trace_src_gap )
+        {
+            if ( ( prec[ 4 ] >= trace_src_END ) || ( prec[ 5 ] >= sa_END ) || ( prec[ 6 ] >= ss_END ) || ( prec[ 7 ] >= ss_END ) )
+            {
+                ret = EILSEQ;
+                break;
+            }
+
+            pevents[ count ].ts_nsec = ts_nsec;
+            pevents[ count ].source = (trace_source_t)prec[ 4 ];
+            pevents[ count ].action = (statemachine_actions_t)prec[ 5 ];
+            pevents[ count ].from_state = (statemachine_states_t)prec[ 6 ];
+            pevents[ count ].to_state = (statemachine_states_t)prec[ 7 ];
+            count++;
+        }
+
+        prec += TRACE_RECORD_SIZE;
+    }
+
+    ptrace->pnext = prec;
+    ptrace->ts_nsec = ts_nsec;
+    *pcount = count;
+
+    return_if( ret != EOK, ret );
+
+    return ( ( count == 0 ) && ( prec >= pend ) ) ? ENOENT : EOK;
+}
+
+uint64_t trace_reader_record_count( trace_reader_t* ptrace )
+{
+    return (uint64_t)( ptrace->pend - ( ptrace->pmap + sizeof( trace_file_header_t ) ) ) / TRACE_RECORD_SIZE;
+}
+
+int trace_reader_seek( trace_reader_t* ptrace, uint64_t record_index )
+{
+    const uint8_t* pfirst = ptrace->pmap + sizeof( trace_file_header_t );
+
+    return_if( record_index > trace_reader_record_count( ptrace ), EINVAL );
+
+    ptrace->pnext = pfirst + ( record_index * TRACE_RECORD_SIZE );
+    ptrace->ts_nsec = 0;
+
+    return EOK;
+}
+
+uint64_t trace_reader_tell( trace_reader_t* ptrace )
+{
+    return (uint64_t)( ptrace->pnext - ( ptrace->pmap + sizeof( trace_file_header_t ) ) ) / TRACE_RECORD_SIZE;
+}
+
+const char* trace_get_sourcename( trace_source_t source )
+{
+    return ( source < NUM_OF( trace_source_names ) ) ? trace_source_names[ source ] : "unknown";
+}
@@ -0,0 +1,151 @@
+#ifndef trace_H_
+#define trace_H_
+
+#include "statemachine.h"
+
+#include <stdint.h>
+
+/*
+ * Action traces
+ *
+ * Every action fed to a statemachine instance with a trace attached is
+ * appended to a compact binary file as (timestamp, source, action, from, to).
+ *
+ * file layout (little endian)
+ *  header      trace_file_header_t
+ *  records     8 bytes each: delta_usec u32, source u8, action u8, from u8, to u8
+ *
+ * delta_usec is relative to the previous record; gaps that do not fit are
+ * split with trace_src_gap records that carry time only.
+ *
+ * Recording only fills memory buffers, as callers hold the statemachine
+ * lock; full buffers go to a writer thread. If the file falls behind by all
+ * spare buffers, records are dropped (and counted) rather than stalling.
+ */
+
+#define TRACE_FILE_MAGIC                    0x52544255  //"UBTR"
+#define TRACE_FILE_VERSION                  1
+
+typedef enum
+{
+    trace_src_unknown,
+    trace_src_input,        //switch edge handler
+    trace_src_timer,        //expired state timer
+    trace_src_entry,        //state entry behaviour
+    trace_src_control,      //process control e.g. shutdown
+    trace_src_gap,          //time only; no action
+    trace_src_END,   //not valid; marks end of enum
+} trace_source_t;
+
+typedef struct
+{
+    uint32_t        magic;
+    uint16_t        version;
+    uint16_t        record_size;
+    uint64_t        start_nsec;         //monotonic time of the first record's base
+} trace_file_header_t;
+
+typedef struct
+{
+    uint64_t                ts_nsec;    //monotonic; usec resolution
+    trace_source_t          source;
+    statemachine_actions_t  action;
+    statemachine_states_t   from_state;
+    statemachine_states_t   to_state;
+} trace_event_t;
+
+typedef struct trace_writer trace_writer_t;
+typedef struct trace_reader trace_reader_t;
+
+/*
+ * Creates a trace file and a writer for it
+ *
+ * pptrace      pointer to receive the writer
+ * path         file to create or truncate
+ *
+ * returns EOK on success; EErr type otherwise describing the failure
+ */
+int trace_writer_open( trace_writer_t** pptrace, const char* path );
+
+/*
+ * Writes out everything buffered, stops the writer thread and closes the file
+ *
+ * returns EOK on success; EErr type of the first failed write otherwise
+ */
+int trace_writer_close( trace_writer_t* ptrace );
+
+/*
+ * Appends one action; timestamp and source are taken from the calling thread
+ * never touches the file
+ *
+ * thread-safe: yes
+ *
+ * returns EOK on success; ENOBUFS if the writer thread fell behind and the action was dropped
+ */
+int trace_writer_record( trace_writer_t* ptrace, statemachine_actions_t action, statemachine_states_t from_state, statemachine_states_t to_state );
+
+/*
+ * Sets the source tagged on actions recorded from the calling thread
+ */
+void trace_set_source( trace_source_t source );
+
+/*
+ * Retrieves the source set by the calling thread
+ */
+trace_source_t trace_get_source( void );
+
+/*
+ * Maps a trace file for sequential reading
+ *
+ * returns EOK on success; EILSEQ for a foreign or damaged header; EErr type otherwise
+ */
+int trace_reader_open( trace_reader_t** pptrace, const char* path );
+
+/*
+ * Unmaps and closes a reader
+ *
+ * returns EOK always
+ */
+int trace_reader_close( trace_reader_t* ptrace );
+
+/*
+ * Retrieves the next action; gap records are folded into timestamps
+ *
+ * returns EOK on success; ENOENT at end of trace; EILSEQ on a damaged record
+ */
+int trace_reader_next( trace_reader_t* ptrace, trace_event_t* pevent );
+
+/*
+ * Retrieves up to max_events actions in one call, stopping at record end_index
+ * cheaper per action than trace_reader_next for bulk scans
+ *
+ * pcount       receives the number of actions stored
+ *
+ * returns EOK on success; ENOENT when no record before end_index is left; EILSEQ on a damaged record
+ */
+int trace_reader_next_batch( trace_reader_t* ptrace, uint64_t end_index, trace_event_t* pevents, int max_events, int* pcount );
+
+/*
+ * Number of records in the file (including gap records)
+ */
+uint64_t trace_reader_record_count( trace_reader_t* ptrace );
+
+/*
+ * Moves the reader to a record index; records are fixed size so this is O(1)
+ * timestamps read after a seek are relative to the seek point (base 0)
+ *
+ * returns EOK on success; EINVAL past the end
+ */
+int trace_reader_seek( trace_reader_t* ptrace, uint64_t record_index );
+
+/*
+ * Index of the record the next call to trace_reader_next starts at
+ */
+uint64_t trace_reader_tell( trace_reader_t* ptrace );
+
+/*
+ * Converts source enum to string literal
+ */
+const char* trace_get_sourcename( trace_source_t source );
+
+#endif
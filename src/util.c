@@ -7,6 +7,7 @@
 #include <stdbool.h>
 #include <errno.h>
 #include <sys/types.h>
+#include <time.h>
 
 #define STDPRINT_NAME                       __FILE__ ":"
 #define PRINT_BUF_MAXSIZE                   1024
@@ -33,6 +34,15 @@ void set_verbose_lvl(debug_lvl_t __verbose_lvl)
     verbose_lvl = __verbose_lvl;
 }
 
+uint64_t get_monotonic_nsec( void )
+{
+    struct timespec ts;
+
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+
+    return ( (uint64_t)ts.tv_sec * 1000000000ULL ) + (uint64_t)ts.tv_nsec;
+}
+
 int printlvl_stdout(debug_lvl_t lvl, const char *__format, ...)
 {
     if (verbose_lvl >= lvl)
@@ -55,6 +55,11 @@ debug_lvl_t get_verbose_lvl( void );
  */
 void set_verbose_lvl(debug_lvl_t verbose_lvl);
 
+/*
+ * Get monotonic time in nanoseconds
+ */
+uint64_t get_monotonic_nsec( void );
+
 /*
  * Print to message with specified verbosity level
  */
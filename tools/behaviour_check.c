@@ -0,0 +1,1051 @@
+/*
+ * Behaviour model checker
+ *
+ * Explores every reachable configuration of one box under every ordering
+ * of the events that race on real hardware:
+ *  - the entry behaviour running (after one or more state changes coalesced)
+ *  - any pending timer firing (timers are never cancelled)
+ *  - the user flipping the toggle switch on or off
+ *  - the arm moving one step while the motor runs (home -> mid -> toggle)
+ *  - shutdown, with -s
+ *
+ * With the builtin table, states guarded by statemachine_guard are resolved
+ * in the step entering them, as the live machine does.
+ *
+ * A configuration is (state, entry pending, motor, arm position, toggle
+ * level, sampled switch levels, pending timers per action); durations do not
+ * matter as all orderings are explored. Pending timers per action are capped
+ * at -t; arming one more is reported.
+ *
+ * The search is a level synchronous BFS: each level is split across workers
+ * and idle workers steal chunks from the others' share. Visited
+ * configurations live in a lock-free open addressing set that also keeps
+ * the parent of each, so every finding comes with one of its shortest event
+ * sequences.
+ *
+ * Reported: unreachable and absorbing states, states that cannot get back
+ * to ss_idle, motor commands into an end stop, the arm stalling on a toggle
+ * already off, timers firing and moving a state that never arms them, and
+ * (with -v) actions the table ignores.
+ *
+ * build (from repo root):
+ *   gcc -std=gnu99 -O2 -Isrc tools/behaviour_check.c src/behaviour_def.c src/behaviour.c src/statemachine.c \
+ *       src/shadow.c src/clocksrc.c src/trace.c src/util.c -o behaviour_check -lpthread -lrt
+ *
+ * usage: behaviour_check [-j threads] [-d max_depth] [-t max_timers] [-m log2_slots] [-s] [-v] [definitionfile]
+ */
+#include "behaviour_def.h"
+#include "util.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define CHECK_STEAL_CHUNK                   64
+#define CHECK_TIMER_BITS                    2
+#define CHECK_PATH_MAX                      4096
+
+typedef enum
+{
+    arm_home,
+    arm_mid,
+    arm_toggle,
+} check_arm_pos_t;
+
+typedef enum
+{
+    ev_root,
+    ev_entry,
+    ev_timer,               //arg: action
+    ev_flip_on,
+    ev_flip_off,
+    ev_arm_step,
+    ev_shutdown,
+} check_event_kind_t;
+
+#define CHECK_EVENT( kind, arg )            ( (uint8_t)( ( (kind) << 4 ) | (arg) ) )
+#define CHECK_EVENT_KIND( ev )              ( (check_event_kind_t)( (ev) >> 4 ) )
+#define CHECK_EVENT_ARG( ev )               ( (ev) & 0x0F )
+
+typedef enum
+{
+    finding_motor_into_stop,    //arg: movement
+    finding_arm_stall,          //arg: unused
+    finding_stale_timer,        //arg: action
+    finding_timer_overflow,     //arg: action
+    finding_ignored,            //arg: action
+    finding_END,
+} check_finding_kind_t;
+
+typedef struct
+{
+    statemachine_states_t   state;
+    bool                    entry_pending;
+    bool                    finished;
+    arm_movement_state_t    motor;
+    check_arm_pos_t         pos;
+    bool                    ext;
+    bool                    sampled_int;
+    bool                    sampled_ext;
+    int                     timers[ sa_END ];
+} check_config_t;
+
+typedef struct
+{
+    uint64_t                key;        //packed config + 1; 0 marks a free slot
+    uint64_t                parent;     //packed parent + 1; 0 for roots
+    uint8_t                 event;
+} check_slot_t;
+
+typedef struct
+{
+    bool                    found;
+    int                     depth;
+    uint64_t                parent;
+    uint8_t                 event;
+} check_finding_t;
+
+typedef struct
+{
+    uint64_t*               pitems;
+    size_t                  count;
+    size_t                  capacity;
+} check_queue_t;
+
+typedef struct check check_t;
+
+typedef struct
+{
+    check_t*                pcheck;
+    int                     id;
+    pthread_t               tid;
+    check_queue_t           next;
+    uint64_t                expanded;
+    uint64_t                stolen;
+} check_worker_t;
+
+struct check
+{
+    const behaviour_def_t*  pdef;       //NULL checks the builtin behaviour
+    int                     max_timers;
+    bool                    with_shutdown;
+    uint32_t                armers[ sa_END ];       //states whose entry arms each timer action
+    check_slot_t*           pslots;
+    uint64_t                slot_mask;
+    bool                    overflow;
+    int                     worker_count;
+    check_worker_t*         pworkers;
+    pthread_barrier_t       barrier;
+    bool                    done;
+    int                     depth;
+    check_queue_t           frontier;
+    size_t*                 pseg_cursor;
+    size_t*                 pseg_end;
+    bool                    reached[ ss_END ];
+    bool                    edges[ ss_END ][ ss_END ];
+    pthread_mutex_t         findings_mutex;
+    check_finding_t         findings[ finding_END ][ ss_END ][ sa_END ];
+};
+
+typedef struct
+{
+    check_worker_t*         pworker;
+    check_config_t*         pconfig;
+    uint64_t                parent;
+    uint8_t                 event;
+} check_box_t;
+
+static const char*          check_finding_names[] =
+    {
+        "motor into end stop",
+        "arm stalls on toggle already off",
+        "stale timer moves state",
+        "pending timers over bound",
+        "ignored action",
+    };
+
+static const char*          check_movement_names[] = { "idle", "fwd", "bwd" };
+static const char*          check_pos_names[] = { "home", "mid", "toggle" };
+
+static uint64_t check_pack( const check_config_t* pc )
+{
+    uint64_t packed = (uint64_t)pc->state
+        | ( (uint64_t)pc->entry_pending << 5 )
+        | ( (uint64_t)pc->finished << 6 )
+        | ( (uint64_t)pc->motor << 7 )
+        | ( (uint64_t)pc->pos << 9 )
+        | ( (uint64_t)pc->ext << 11 )
+        | ( (uint64_t)pc->sampled_int << 12 )
+        | ( (uint64_t)pc->sampled_ext << 13 );
+    int action;
+
+    for ( action = 0; action < sa_END; action++ )
+    {
+        packed |= (uint64_t)pc->timers[ action ] << ( 14 + action * CHECK_TIMER_BITS );
+    }
+
+    return packed;
+}
+
+static void check_unpack( uint64_t packed, check_config_t* pc )
+{
+    int action;
+
+    pc->state = (statemachine_states_t)( packed & 0x1F );
+    pc->entry_pending = ( packed >> 5 ) & 1;
+    pc->finished = ( packed >> 6 ) & 1;
+    pc->motor = (arm_movement_state_t)( ( packed >> 7 ) & 3 );
+    pc->pos = (check_arm_pos_t)( ( packed >> 9 ) & 3 );
+    pc->ext = ( packed >> 11 ) & 1;
+    pc->sampled_int = ( packed >> 12 ) & 1;
+    pc->sampled_ext = ( packed >> 13 ) & 1;
+
+    for ( action = 0; action < sa_END; action++ )
+    {
+        pc->timers[ action ] = (int)( ( packed >> ( 14 + action * CHECK_TIMER_BITS ) ) & ( ( 1 << CHECK_TIMER_BITS ) - 1 ) );
+    }
+}
+
+static uint64_t check_hash( uint64_t key )
+{
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    key *= 0xc4ceb9fe1a85ec53ULL;
+    key ^= key >> 33;
+
+    return key;
+}
+
+/*
+ * Inserts a configuration; lock-free
+ *
+ * returns true if the configuration had not been seen before
+ */
+static bool check_visit( check_t* pcheck, uint64_t config, uint64_t parent, uint8_t event )
+{
+    uint64_t key = config + 1;
+    uint64_t idx = check_hash( key ) & pcheck->slot_mask;
+    uint64_t probe;
+
+    for ( probe = 0; probe <= pcheck->slot_mask; probe++ )
+    {
+        check_slot_t* pslot = &pcheck->pslots[ idx ];
+        uint64_t current = __atomic_load_n( &pslot->key, __ATOMIC_ACQUIRE );
+
+        if ( current == 0 )
+        {
+            if ( __atomic_compare_exchange_n( &pslot->key, &current, key, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE ) )
+            {
+                //only read back after the search has joined
+                pslot->parent = parent;
+                pslot->event = event;
+                return true;
+            }
+        }
+
+        if ( current == key )
+        {
+            return false;
+        }
+
+        idx = ( idx + 1 ) & pcheck->slot_mask;
+    }
+
+    pcheck->overflow = true;
+
+    return false;
+}
+
+static const check_slot_t* check_lookup( const check_t* pcheck, uint64_t config )
+{
+    uint64_t key = config + 1;
+    uint64_t idx = check_hash( key ) & pcheck->slot_mask;
+
+    while ( pcheck->pslots[ idx ].key != 0 )
+    {
+        if ( pcheck->pslots[ idx ].key == key )
+        {
+            return &pcheck->pslots[ idx ];
+        }
+        idx = ( idx + 1 ) & pcheck->slot_mask;
+    }
+
+    return NULL;
+}
+
+static void check_queue_push( check_queue_t* pqueue, uint64_t item )
+{
+    if ( pqueue->count == pqueue->capacity )
+    {
+        pqueue->capacity = ( pqueue->capacity > 0 ) ? pqueue->capacity * 2 : 4096;
+        pqueue->pitems = realloc( pqueue->pitems, pqueue->capacity * sizeof( uint64_t ) );
+        if ( pqueue->pitems == NULL )
+        {
+            fprintf( stderr, "out of memory\n" );
+            exit( ENOMEM );
+        }
+    }
+
+    pqueue->pitems[ pqueue->count++ ] = item;
+}
+
+/*
+ * Records the first (so shallowest) occurrence of a finding
+ */
+static void check_report( check_box_t* pbox, check_finding_kind_t kind, statemachine_states_t state, int arg )
+{
+    check_t* pcheck = pbox->pworker->pcheck;
+    check_finding_t* pfinding = &pcheck->findings[ kind ][ state ][ arg ];
+
+    if ( __atomic_load_n( &pfinding->found, __ATOMIC_ACQUIRE ) )
+    {
+        return;
+    }
+
+    pthread_mutex_lock( &pcheck->findings_mutex );
+    if ( !pfinding->found )
+    {
+        pfinding->depth = pcheck->depth + 1;
+        pfinding->parent = pbox->parent;
+        pfinding->event = pbox->event;
+        __atomic_store_n( &pfinding->found, true, __ATOMIC_RELEASE );
+    }
+    pthread_mutex_unlock( &pcheck->findings_mutex );
+}
+
+/*
+ * Applies an action the way statemachine_next_state does
+ */
+static int check_apply( check_box_t* pbox, statemachine_actions_t action )
+{
+    check_t* pcheck = pbox->pworker->pcheck;
+    check_config_t* pc = pbox->pconfig;
+    statemachine_states_t next_state;
+    int ret;
+
+    ret = ( pcheck->pdef != NULL )
+        ? behaviour_def_transition( pcheck->pdef, pc->state, action, &next_state )
+        : statemachine_transition( pc->state, action, &next_state );
+
+    if ( ( ret != EOK ) && ( next_state == pc->state ) )
+    {
+        check_report( pbox, finding_ignored, pc->state, action );
+    }
+
+    if ( next_state != pc->state )
+    {
+        statemachine_actions_t guard_action;
+
+        //the live machine resolves guarded states in the same step (see statemachine_guard)
+        if ( ( ret == EOK ) && ( pcheck->pdef == NULL ) && statemachine_guard( next_state, pc->sampled_int, pc->sampled_ext, &guard_action ) )
+        {
+            statemachine_states_t guarded_state;
+
+            __atomic_store_n( &pcheck->reached[ next_state ], true, __ATOMIC_RELAXED );
+            __atomic_store_n( &pcheck->edges[ pc->state ][ next_state ], true, __ATOMIC_RELAXED );
+
+            ret = statemachine_transition( next_state, guard_action, &guarded_state );
+            pc->state = next_state;
+            next_state = guarded_state;
+        }
+    }
+
+    if ( next_state != pc->state )
+    {
+        __atomic_store_n( &pcheck->reached[ next_state ], true, __ATOMIC_RELAXED );
+        if ( CHECK_EVENT_KIND( pbox->event ) != ev_shutdown )
+        {
+            __atomic_store_n( &pcheck->edges[ pc->state ][ next_state ], true, __ATOMIC_RELAXED );
+        }
+
+        pc->state = next_state;
+        pc->entry_pending = true;
+    }
+
+    return ret;
+}
+
+/*
+ * Samples the switches like the edge handler; acts only on a change
+ */
+static void check_sample( check_box_t* pbox )
+{
+    check_config_t* pc = pbox->pconfig;
+    bool int_switch1 = ( pc->pos == arm_home );
+
+    if ( ( int_switch1 != pc->sampled_int ) || ( pc->ext != pc->sampled_ext ) )
+    {
+        pc->sampled_int = int_switch1;
+        pc->sampled_ext = pc->ext;
+        check_apply( pbox, behaviour_swstate_action( pc->sampled_int, pc->sampled_ext ) );
+    }
+}
+
+static int check_ops_arm_movement( void* ctx, arm_movement_state_t movement )
+{
+    check_box_t* pbox = ctx;
+    check_config_t* pc = pbox->pconfig;
+
+    if ( ( ( movement == am_fwd ) && ( pc->pos == arm_toggle ) && !pc->ext )
+            || ( ( movement == am_bwd ) && ( pc->pos == arm_home ) ) )
+    {
+        check_report( pbox, finding_motor_into_stop, pc->state, movement );
+    }
+
+    pc->motor = movement;
+
+    return EOK;
+}
+
+static int check_ops_read_swstates( void* ctx, bool* pint_switch1, bool* pext_switch1 )
+{
+    check_box_t* pbox = ctx;
+
+    //entry behaviour sees the last sampled levels, not the pins
+    *pint_switch1 = pbox->pconfig->sampled_int;
+    *pext_switch1 = pbox->pconfig->sampled_ext;
+
+    return EOK;
+}
+
+static int check_ops_sample_swstates( void* ctx )
+{
+    check_sample( ctx );
+    return EOK;
+}
+
+static int check_ops_setup_timer_action( void* ctx, int usec, statemachine_actions_t action )
+{
+    check_box_t* pbox = ctx;
+    check_config_t* pc = pbox->pconfig;
+
+    __unused( usec );
+
+    if ( pc->timers[ action ] == pbox->pworker->pcheck->max_timers )
+    {
+        check_report( pbox, finding_timer_overflow, pc->state, action );
+        return EOK;
+    }
+
+    pc->timers[ action ]++;
+
+    return EOK;
+}
+
+static int check_ops_next_state( void* ctx, statemachine_actions_t action, statemachine_states_t* pnew_state )
+{
+    check_box_t* pbox = ctx;
+    int ret = check_apply( pbox, action );
+
+    if ( pnew_state != NULL )
+    {
+        *pnew_state = pbox->pconfig->state;
+    }
+
+    return ret;
+}
+
+static int check_ops_random_number( void* ctx, int min_num, int max_num )
+{
+    __unused( ctx );
+    __unused( max_num );
+
+    //durations do not matter; every ordering is explored anyway
+    return min_num;
+}
+
+static const box_ops_t      check_ops =
+    {
+        .arm_movement           = check_ops_arm_movement,
+        .read_swstates          = check_ops_read_swstates,
+        .sample_swstates        = check_ops_sample_swstates,
+        .setup_timer_action     = check_ops_setup_timer_action,
+        .next_state             = check_ops_next_state,
+        .random_number          = check_ops_random_number,
+    };
+
+static void check_enter( const check_t* pcheck, check_box_t* pbox )
+{
+    statemachine_states_t state = pbox->pconfig->state;
+    bool finished = false;
+
+    if ( pcheck->pdef != NULL )
+    {
+        behaviour_def_enter_state( pcheck->pdef, &check_ops, pbox, &state, &finished );
+    }
+    else
+    {
+        behaviour_enter_state( &check_ops, pbox, &state, &finished );
+    }
+
+    pbox->pconfig->finished |= finished;
+}
+
+static void check_emit( check_worker_t* pworker, check_box_t* pbox )
+{
+    uint64_t child = check_pack( pbox->pconfig );
+
+    if ( check_visit( pworker->pcheck, child, pbox->parent, pbox->event ) )
+    {
+        check_queue_push( &pworker->next, child );
+    }
+}
+
+/*
+ * Generates every successor of one configuration
+ */
+static void check_expand( check_worker_t* pworker, uint64_t packed )
+{
+    check_t* pcheck = pworker->pcheck;
+    check_config_t from;
+    check_config_t to;
+    check_box_t box;
+    int action;
+
+    check_unpack( packed, &from );
+
+    box.pworker = pworker;
+    box.pconfig = &to;
+    box.parent = packed + 1;
+
+    //entry behaviour thread wakes; it only sees the latest state
+    if ( from.entry_pending && !from.finished )
+    {
+        to = from;
+        to.entry_pending = false;
+        box.event = CHECK_EVENT( ev_entry, 0 );
+        check_enter( pcheck, &box );
+        check_emit( pworker, &box );
+    }
+
+    for ( action = 0; action < sa_END; action++ )
+    {
+        if ( from.timers[ action ] > 0 )
+        {
+            to = from;
+            to.timers[ action ]--;
+            box.event = CHECK_EVENT( ev_timer, action );
+
+            statemachine_states_t fired_in = to.state;
+            int ret = check_apply( &box, action );
+
+            if ( ( ret == EOK ) && ( to.state != fired_in ) && !( pcheck->armers[ action ] & ( 1u << fired_in ) ) )
+            {
+                check_report( &box, finding_stale_timer, fired_in, action );
+            }
+            check_emit( pworker, &box );
+        }
+    }
+
+    //the arm blocks the toggle while pushing it
+    if ( !from.ext && ( from.pos != arm_toggle ) )
+    {
+        to = from;
+        to.ext = true;
+        box.event = CHECK_EVENT( ev_flip_on, 0 );
+        check_sample( &box );
+        check_emit( pworker, &box );
+    }
+
+    if ( from.ext )
+    {
+        to = from;
+        to.ext = false;
+        box.event = CHECK_EVENT( ev_flip_off, 0 );
+        check_sample( &box );
+        check_emit( pworker, &box );
+    }
+
+    if ( ( ( from.motor == am_fwd ) && ( from.pos != arm_toggle ) ) || ( ( from.motor == am_bwd ) && ( from.pos != arm_home ) ) )
+    {
+        to = from;
+        box.event = CHECK_EVENT( ev_arm_step, 0 );
+
+        if ( from.motor == am_fwd )
+        {
+            to.pos = ( from.pos == arm_home ) ? arm_mid : arm_toggle;
+            if ( to.pos == arm_toggle )
+            {
+                if ( to.ext )
+                {
+                    to.ext = false;
+                }
+                else
+                {
+                    check_report( &box, finding_arm_stall, from.state, 0 );
+                }
+            }
+        }
+        else
+        {
+            to.pos = ( from.pos == arm_toggle ) ? arm_mid : arm_home;
+        }
+
+        check_sample( &box );
+        check_emit( pworker, &box );
+    }
+
+    if ( pcheck->with_shutdown && ( from.state != ss_before_shutdown ) && ( from.state != ss_shutdown ) )
+    {
+        to = from;
+        box.event = CHECK_EVENT( ev_shutdown, 0 );
+        check_apply( &box, sa_shutdown );
+        check_emit( pworker, &box );
+    }
+
+    pworker->expanded++;
+}
+
+/*
+ * Takes the next chunk of the current level: own share first, then others'
+ */
+static bool check_take( check_worker_t* pworker, size_t* pbegin, size_t* pend )
+{
+    check_t* pcheck = pworker->pcheck;
+    int i;
+
+    for ( i = 0; i < pcheck->worker_count; i++ )
+    {
+        int victim = ( pworker->id + i ) % pcheck->worker_count;
+        size_t begin = __atomic_fetch_add( &pcheck->pseg_cursor[ victim ], CHECK_STEAL_CHUNK, __ATOMIC_RELAXED );
+
+        if ( begin < pcheck->pseg_end[ victim ] )
+        {
+            *pbegin = begin;
+            *pend = ( begin + CHECK_STEAL_CHUNK < pcheck->pseg_end[ victim ] ) ? begin + CHECK_STEAL_CHUNK : pcheck->pseg_end[ victim ];
+            pworker->stolen += ( i > 0 );
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static void* check_worker_entry( void* args )
+{
+    check_worker_t* pworker = (check_worker_t*)args;
+    check_t* pcheck = pworker->pcheck;
+    size_t begin;
+    size_t end;
+
+    for (;;)
+    {
+        pthread_barrier_wait( &pcheck->barrier );
+        if ( pcheck->done )
+        {
+            break;
+        }
+
+        while ( check_take( pworker, &begin, &end ) )
+        {
+            for ( ; begin < end; begin++ )
+            {
+                check_expand( pworker, pcheck->frontier.pitems[ begin ] );
+            }
+        }
+
+        pthread_barrier_wait( &pcheck->barrier );
+    }
+
+    return NULL;
+}
+
+/*
+ * Finds the timer actions each state's entry arms, for any sampled switch levels
+ */
+static void check_find_armers( check_t* pcheck, check_worker_t* pworker )
+{
+    int state;
+    int levels;
+    int action;
+
+    for ( state = 0; state < ss_END; state++ )
+    {
+        for ( levels = 0; levels < 4; levels++ )
+        {
+            check_config_t config;
+            check_box_t box;
+
+            memset( &config, 0, sizeof( config ) );
+            config.state = state;
+            config.sampled_int = ( levels & 1 );
+            config.sampled_ext = ( levels & 2 );
+            config.pos = config.sampled_int ? arm_home : arm_mid;
+            config.ext = config.sampled_ext;
+
+            box.pworker = pworker;
+            box.pconfig = &config;
+            box.parent = 0;
+            box.event = CHECK_EVENT( ev_root, 0 );
+
+            check_enter( pcheck, &box );
+
+            for ( action = 0; action < sa_END; action++ )
+            {
+                if ( config.timers[ action ] > 0 )
+                {
+                    pcheck->armers[ action ] |= 1u << state;
+                }
+            }
+        }
+    }
+
+    //the probing above is not part of the search
+    memset( pcheck->findings, 0, sizeof( pcheck->findings ) );
+    memset( pcheck->reached, 0, sizeof( pcheck->reached ) );
+    memset( pcheck->edges, 0, sizeof( pcheck->edges ) );
+}
+
+static void check_print_config( const check_config_t* pc )
+{
+    int action;
+
+    printf( "%s motor=%s arm=%s toggle=%s%s",
+        statemachine_get_statename( pc->state ),
+        check_movement_names[ pc->motor ],
+        check_pos_names[ pc->pos ],
+        pc->ext ? "on" : "off",
+        pc->entry_pending ? " entry-pending" : "" );
+
+    for ( action = 0; action < sa_END; action++ )
+    {
+        if ( pc->timers[ action ] > 0 )
+        {
+            printf( " %s*%d", statemachine_get_actionname( action ), pc->timers[ action ] );
+        }
+    }
+}
+
+static void check_print_event( uint8_t event )
+{
+    switch ( CHECK_EVENT_KIND( event ) )
+    {
+        case ev_root:       printf( "start" ); break;
+        case ev_entry:      printf( "entry runs" ); break;
+        case ev_timer:      printf( "timer %s fires", statemachine_get_actionname( CHECK_EVENT_ARG( event ) ) ); break;
+        case ev_flip_on:    printf( "user flips toggle on" ); break;
+        case ev_flip_off:   printf( "user flips toggle off" ); break;
+        case ev_arm_step:   printf( "arm moves" ); break;
+        case ev_shutdown:   printf( "shutdown requested" ); break;
+    }
+}
+
+/*
+ * Prints the event sequence from a root to the finding
+ */
+static void check_print_path( const check_t* pcheck, const check_finding_t* pfinding )
+{
+    static uint64_t path[ CHECK_PATH_MAX ];
+    static uint8_t events[ CHECK_PATH_MAX ];
+    check_config_t config;
+    uint64_t current = pfinding->parent;
+    int count = 0;
+
+    while ( ( current != 0 ) && ( count < CHECK_PATH_MAX ) )
+    {
+        const check_slot_t* pslot = check_lookup( pcheck, current - 1 );
+
+        path[ count ] = current - 1;
+        events[ count ] = ( pslot != NULL ) ? pslot->event : CHECK_EVENT( ev_root, 0 );
+        count++;
+        current = ( pslot != NULL ) ? pslot->parent : 0;
+    }
+
+    while ( count-- > 0 )
+    {
+        check_unpack( path[ count ], &config );
+        printf( "    " );
+        check_print_event( events[ count ] );
+        printf( " -> " );
+        check_print_config( &config );
+        printf( "\n" );
+    }
+
+    printf( "    then " );
+    check_print_event( pfinding->event );
+    printf( "\n" );
+}
+
+/*
+ * Reports states the search never reached, states with no way out and states with no way back to idle
+ */
+static void check_print_states( const check_t* pcheck )
+{
+    bool back_to_idle[ ss_END ];
+    bool changed = true;
+    int from;
+    int to;
+
+    printf( "unreachable states:" );
+    for ( from = 0; from < ss_END; from++ )
+    {
+        if ( !pcheck->reached[ from ] )
+        {
+            printf( " %s", statemachine_get_statename( from ) );
+        }
+    }
+
+    printf( "\nabsorbing states:" );
+    for ( from = 0; from < ss_END; from++ )
+    {
+        bool leaves = false;
+
+        for ( to = 0; to < ss_END; to++ )
+        {
+            leaves |= pcheck->edges[ from ][ to ];
+        }
+        if ( pcheck->reached[ from ] && !leaves )
+        {
+            printf( " %s", statemachine_get_statename( from ) );
+        }
+    }
+
+    //fixed point over the observed state graph
+    memset( back_to_idle, 0, sizeof( back_to_idle ) );
+    back_to_idle[ ss_idle ] = true;
+    while ( changed )
+    {
+        changed = false;
+        for ( from = 0; from < ss_END; from++ )
+        {
+            for ( to = 0; ( to < ss_END ) && !back_to_idle[ from ]; to++ )
+            {
+                if ( pcheck->edges[ from ][ to ] && back_to_idle[ to ] )
+                {
+                    back_to_idle[ from ] = true;
+                    changed = true;
+                }
+            }
+        }
+    }
+
+    printf( "\nno way back to ss_idle:" );
+    for ( from = 0; from < ss_END; from++ )
+    {
+        if ( pcheck->reached[ from ] && !back_to_idle[ from ] )
+        {
+            printf( " %s", statemachine_get_statename( from ) );
+        }
+    }
+    printf( "\n" );
+}
+
+/*
+ * Prints findings; returns the number of findings that count as failures
+ */
+static int check_print_findings( const check_t* pcheck, bool verbose )
+{
+    int failures = 0;
+    int kind;
+    int state;
+    int arg;
+
+    for ( kind = 0; kind < finding_END; kind++ )
+    {
+        if ( ( kind == finding_ignored ) && !verbose )
+        {
+            continue;
+        }
+
+        for ( state = 0; state < ss_END; state++ )
+        {
+            for ( arg = 0; arg < sa_END; arg++ )
+            {
+                const check_finding_t* pfinding = &pcheck->findings[ kind ][ state ][ arg ];
+
+                if ( !pfinding->found )
+                {
+                    continue;
+                }
+
+                printf( "%s: %s %s (depth %d)\n",
+                    check_finding_names[ kind ],
+                    statemachine_get_statename( state ),
+                    ( kind == finding_motor_into_stop ) ? check_movement_names[ arg ]
+                        : ( kind == finding_arm_stall ) ? "" : statemachine_get_actionname( arg ),
+                    pfinding->depth );
+
+                if ( kind != finding_ignored )
+                {
+                    check_print_path( pcheck, pfinding );
+                }
+
+                failures += ( kind <= finding_stale_timer );
+            }
+        }
+    }
+
+    return failures;
+}
+
+int main( int argc, char** argv )
+{
+    check_t* pcheck;
+    behaviour_def_t* pdef = NULL;
+    int thread_count = (int)sysconf( _SC_NPROCESSORS_ONLN );
+    int max_depth = 0;
+    int log2_slots = 24;
+    bool verbose = false;
+    uint64_t configs = 0;
+    int opt;
+    int ret;
+    int i;
+
+    pcheck = calloc( 1, sizeof( check_t ) );
+    return_if( pcheck == NULL, ENOMEM );
+    pcheck->max_timers = 2;
+
+    while ( ( opt = getopt( argc, argv, "j:d:t:m:sv" ) ) != -1 )
+    {
+        switch ( opt )
+        {
+            case 'j': thread_count = atoi( optarg ); break;
+            case 'd': max_depth = atoi( optarg ); break;
+            case 't': pcheck->max_timers = atoi( optarg ); break;
+            case 'm': log2_slots = atoi( optarg ); break;
+            case 's': pcheck->with_shutdown = true; break;
+            case 'v': verbose = true; break;
+            default:
+                fprintf( stderr, "usage: %s [-j threads] [-d max_depth] [-t max_timers] [-m log2_slots] [-s] [-v] [definitionfile]\n", argv[ 0 ] );
+                return EINVAL;
+        }
+    }
+
+    if ( ( pcheck->max_timers < 1 ) || ( pcheck->max_timers >= ( 1 << CHECK_TIMER_BITS ) ) || ( log2_slots < 10 ) || ( log2_slots > 34 ) )
+    {
+        fprintf( stderr, "max_timers must be 1..%d and log2_slots 10..34\n", ( 1 << CHECK_TIMER_BITS ) - 1 );
+        return EINVAL;
+    }
+
+    if ( optind < argc )
+    {
+        ret = behaviour_def_load( &pdef, argv[ optind ] );
+        if ( ret != EOK )
+        {
+            fprintf( stderr, "cannot load %s: %s\n", argv[ optind ], strerror( ret ) );
+            return ret;
+        }
+    }
+
+    thread_count = ( thread_count > 0 ) ? thread_count : 1;
+
+    pcheck->pdef = pdef;
+    pcheck->slot_mask = ( 1ULL << log2_slots ) - 1;
+    pcheck->pslots = calloc( pcheck->slot_mask + 1, sizeof( check_slot_t ) );
+    pcheck->worker_count = thread_count;
+    pcheck->pworkers = calloc( thread_count, sizeof( check_worker_t ) );
+    pcheck->pseg_cursor = calloc( thread_count, sizeof( size_t ) );
+    pcheck->pseg_end = calloc( thread_count, sizeof( size_t ) );
+    return_if( ( pcheck->pslots == NULL ) || ( pcheck->pworkers == NULL ) || ( pcheck->pseg_cursor == NULL ) || ( pcheck->pseg_end == NULL ), ENOMEM );
+
+    pthread_mutex_init( &pcheck->findings_mutex, NULL );
+    pthread_barrier_init( &pcheck->barrier, NULL, thread_count + 1 );
+
+    for ( i = 0; i < thread_count; i++ )
+    {
+        pcheck->pworkers[ i ].pcheck = pcheck;
+        pcheck->pworkers[ i ].id = i;
+    }
+
+    check_find_armers( pcheck, &pcheck->pworkers[ 0 ] );
+
+    //the box powers up with the arm home, the toggle either way and nothing sampled yet
+    for ( i = 0; i < 2; i++ )
+    {
+        check_config_t root;
+
+        memset( &root, 0, sizeof( root ) );
+        root.state = ss_powerup;
+        root.entry_pending = true;
+        root.motor = am_idle;
+        root.pos = arm_home;
+        root.ext = ( i == 1 );
+
+        if ( check_visit( pcheck, check_pack( &root ), 0, CHECK_EVENT( ev_root, 0 ) ) )
+        {
+            check_queue_push( &pcheck->frontier, check_pack( &root ) );
+        }
+    }
+    pcheck->reached[ ss_powerup ] = true;
+
+    for ( i = 0; i < thread_count; i++ )
+    {
+        pthread_create( &pcheck->pworkers[ i ].tid, NULL, check_worker_entry, &pcheck->pworkers[ i ] );
+    }
+
+    uint64_t start_nsec = get_monotonic_nsec();
+
+    while ( ( pcheck->frontier.count > 0 ) && ( ( max_depth == 0 ) || ( pcheck->depth < max_depth ) ) && !pcheck->overflow )
+    {
+        size_t share = ( pcheck->frontier.count + thread_count - 1 ) / thread_count;
+
+        configs += pcheck->frontier.count;
+
+        for ( i = 0; i < thread_count; i++ )
+        {
+            size_t begin = (size_t)i * share;
+
+            pcheck->pseg_cursor[ i ] = ( begin < pcheck->frontier.count ) ? begin : pcheck->frontier.count;
+            pcheck->pseg_end[ i ] = ( begin + share < pcheck->frontier.count ) ? begin + share : pcheck->frontier.count;
+        }
+
+        //run one level
+        pthread_barrier_wait( &pcheck->barrier );
+        pthread_barrier_wait( &pcheck->barrier );
+
+        //the next level is whatever the workers discovered
+        pcheck->frontier.count = 0;
+        for ( i = 0; i < thread_count; i++ )
+        {
+            check_queue_t* pnext = &pcheck->pworkers[ i ].next;
+            size_t j;
+
+            for ( j = 0; j < pnext->count; j++ )
+            {
+                check_queue_push( &pcheck->frontier, pnext->pitems[ j ] );
+            }
+            pnext->count = 0;
+        }
+
+        pcheck->depth++;
+    }
+
+    pcheck->done = true;
+    pthread_barrier_wait( &pcheck->barrier );
+
+    uint64_t stolen = 0;
+    for ( i = 0; i < thread_count; i++ )
+    {
+        pthread_join( pcheck->pworkers[ i ].tid, NULL );
+        stolen += pcheck->pworkers[ i ].stolen;
+    }
+
+    double wall_sec = (double)( get_monotonic_nsec() - start_nsec ) / 1e9;
+
+    if ( pcheck->overflow )
+    {
+        fprintf( stderr, "visited set full; rerun with a larger -m\n" );
+    }
+
+    printf( "behaviour=%s configs=%llu depth=%d%s threads=%d stolen_chunks=%llu time=%.3fs rate=%.0f configs/s\n",
+        ( optind < argc ) ? argv[ optind ] : "builtin",
+        (unsigned long long)configs,
+        pcheck->depth,
+        ( pcheck->frontier.count > 0 ) ? " (bounded)" : "",
+        thread_count,
+        (unsigned long long)stolen,
+        wall_sec,
+        ( wall_sec > 0.0 ) ? (double)configs / wall_sec : 0.0 );
+
+    check_print_states( pcheck );
+    int failures = check_print_findings( pcheck, verbose );
+
+    behaviour_def_unload( pdef );
+
+    return pcheck->overflow ? ENOSPC : ( failures > 0 ) ? EXIT_FAILURE : EOK;
+}
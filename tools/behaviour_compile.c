@@ -0,0 +1,715 @@
+/*
+ * Behaviour compiler
+ *
+ * Compiles a text behaviour source into the binary definition loaded with
+ * `uselessbox -b <file>` (see src/behaviour_def.h). The output replaces the
+ * file by rename, so compiling over the definition of a running box and
+ * sending it SIGUSR1 swaps the behaviour live. Each state lists its
+ * transitions and the ops run when it is entered:
+ *
+ *   state ss_scare_setup
+ *       on sa_arm_reset sa_arm_off -> ss_scare_step1
+ *       reject sa_shutdown_done -> ss_shutdown
+ *       entry timer 3000000 sa_scare_exit
+ *       entry timer 1000000..12000000 sa_suspicion_timeout
+ *       entry skip_if_int_on 2
+ *       entry arm_home
+ *       entry skip 1
+ *       entry motor fwd
+ *
+ * Pairs not listed are rejected and stay in the current state. `reject`
+ * lists pairs that are rejected but still move (the builtin table has one).
+ * Entry ops: motor idle|fwd|bwd, arm_home, timer usec|min..max action,
+ * sample, next action, skip_if_int_on n, skip n, finish.
+ *
+ * With -d it prints the builtin transition table as source text; with -v it
+ * checks a compiled definition against the builtin table and entry behaviour
+ * for every state and switch level combination.
+ *
+ * build (from repo root):
+ *   gcc -std=gnu99 -O2 -Isrc tools/behaviour_compile.c src/behaviour_def.c src/behaviour.c src/statemachine.c \
+ *       src/shadow.c src/clocksrc.c src/trace.c src/util.c -o behaviour_compile -lpthread -lrt
+ *
+ * usage: behaviour_compile -o outfile sourcefile
+ *        behaviour_compile -d
+ *        behaviour_compile -v definitionfile
+ */
+#include "behaviour_def.h"
+#include "util.h"
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define COMPILE_LINE_MAX                    512
+#define COMPILE_STATE_OPS_MAX               32
+#define COMPILE_ALIGN( x )                  ( ( (x) + 3u ) & ~3u )
+#define VERIFY_LOG_MAX                      1024
+
+typedef struct
+{
+    uint8_t             transitions[ ss_END ][ sa_END ];
+    bool                listed[ ss_END ][ sa_END ];
+    bool                defined[ ss_END ];
+    behaviour_def_op_t  ops[ ss_END ][ COMPILE_STATE_OPS_MAX ];
+    int                 op_count[ ss_END ];
+} compile_source_t;
+
+typedef struct
+{
+    bool                int_switch1;
+    bool                ext_switch1;
+    size_t              len;
+    char                log[ VERIFY_LOG_MAX ];
+} verify_box_t;
+
+static const char*      compile_path;
+static int              compile_lineno;
+
+static void compile_error( const char* format, ... )
+{
+    va_list args;
+
+    fprintf( stderr, "%s:%d: ", compile_path, compile_lineno );
+    va_start( args, format );
+    vfprintf( stderr, format, args );
+    va_end( args );
+    fprintf( stderr, "\n" );
+}
+
+static int compile_find_state( const char* name )
+{
+    int state;
+
+    for ( state = 0; state < ss_END; state++ )
+    {
+        return_if( strcmp( name, statemachine_get_statename( state ) ) == 0, state );
+    }
+
+    return -1;
+}
+
+static int compile_find_action( const char* name )
+{
+    int action;
+
+    for ( action = 0; action < sa_END; action++ )
+    {
+        return_if( strcmp( name, statemachine_get_actionname( action ) ) == 0, action );
+    }
+
+    return -1;
+}
+
+/*
+ * Parses "on|reject action... -> state"
+ */
+static int compile_transition( compile_source_t* psrc, int state, bool reject, char** ptokens, int count )
+{
+    int arrow;
+    int next;
+    int i;
+
+    for ( arrow = 0; ( arrow < count ) && ( strcmp( ptokens[ arrow ], "->" ) != 0 ); arrow++ )
+    {
+    }
+
+    if ( ( arrow == 0 ) || ( arrow != count - 2 ) )
+    {
+        compile_error( "expected: %s action... -> state", reject ? "reject" : "on" );
+        return EINVAL;
+    }
+
+    next = compile_find_state( ptokens[ count - 1 ] );
+    if ( next < 0 )
+    {
+        compile_error( "unknown state %s", ptokens[ count - 1 ] );
+        return EINVAL;
+    }
+
+    for ( i = 0; i < arrow; i++ )
+    {
+        int action = compile_find_action( ptokens[ i ] );
+
+        if ( action < 0 )
+        {
+            compile_error( "unknown action %s", ptokens[ i ] );
+            return EINVAL;
+        }
+        if ( psrc->listed[ state ][ action ] )
+        {
+            compile_error( "%s already listed for %s", ptokens[ i ], statemachine_get_statename( state ) );
+            return EINVAL;
+        }
+
+        psrc->listed[ state ][ action ] = true;
+        psrc->transitions[ state ][ action ] = (uint8_t)next | ( reject ? BEHAVIOUR_DEF_REJECT : 0 );
+    }
+
+    return EOK;
+}
+
+/*
+ * Parses "entry op args..."
+ */
+static int compile_entry( compile_source_t* psrc, int state, char** ptokens, int count )
+{
+    behaviour_def_op_t op;
+    int opcode;
+    int action;
+    char* pend;
+
+    if ( count == 0 )
+    {
+        compile_error( "expected: entry op args..." );
+        return EINVAL;
+    }
+
+    for ( opcode = 0; ( opcode < bop_END ) && ( strcmp( ptokens[ 0 ], behaviour_def_get_opname( opcode ) ) != 0 ); opcode++ )
+    {
+    }
+
+    if ( opcode == bop_END )
+    {
+        compile_error( "unknown op %s", ptokens[ 0 ] );
+        return EINVAL;
+    }
+
+    if ( psrc->op_count[ state ] == COMPILE_STATE_OPS_MAX )
+    {
+        compile_error( "more than %d entry ops", COMPILE_STATE_OPS_MAX );
+        return EINVAL;
+    }
+
+    memset( &op, 0, sizeof( op ) );
+    op.opcode = (uint8_t)opcode;
+
+    switch ( opcode )
+    {
+        case bop_motor:
+        {
+            static const char* movements[] = { "idle", "fwd", "bwd" };
+
+            for ( op.arg = 0; ( count == 2 ) && ( op.arg < NUM_OF( movements ) ); op.arg++ )
+            {
+                if ( strcmp( ptokens[ 1 ], movements[ op.arg ] ) == 0 )
+                {
+                    break;
+                }
+            }
+            if ( ( count != 2 ) || ( op.arg == NUM_OF( movements ) ) )
+            {
+                compile_error( "expected: motor idle|fwd|bwd" );
+                return EINVAL;
+            }
+            break;
+        }
+
+        case bop_timer:
+        {
+            unsigned long min_usec;
+            unsigned long max_usec;
+
+            if ( count != 3 )
+            {
+                compile_error( "expected: timer usec|min..max action" );
+                return EINVAL;
+            }
+
+            min_usec = strtoul( ptokens[ 1 ], &pend, 10 );
+            max_usec = min_usec;
+            if ( strncmp( pend, "..", 2 ) == 0 )
+            {
+                max_usec = strtoul( pend + 2, &pend, 10 );
+            }
+            if ( ( *pend != '\0' ) || ( min_usec > max_usec ) || ( max_usec > INT32_MAX ) )
+            {
+                compile_error( "bad timer duration %s", ptokens[ 1 ] );
+                return EINVAL;
+            }
+
+            action = compile_find_action( ptokens[ 2 ] );
+            if ( action < 0 )
+            {
+                compile_error( "unknown action %s", ptokens[ 2 ] );
+                return EINVAL;
+            }
+
+            op.arg = (uint8_t)action;
+            op.min_usec = (uint32_t)min_usec;
+            op.max_usec = (uint32_t)max_usec;
+            break;
+        }
+
+        case bop_next_state:
+        {
+            action = ( count == 2 ) ? compile_find_action( ptokens[ 1 ] ) : -1;
+            if ( action < 0 )
+            {
+                compile_error( "expected: next action" );
+                return EINVAL;
+            }
+            op.arg = (uint8_t)action;
+            break;
+        }
+
+        case bop_skip_if_int_on:
+        case bop_skip:
+        {
+            long skip = ( count == 2 ) ? strtol( ptokens[ 1 ], &pend, 10 ) : -1;
+
+            if ( ( count != 2 ) || ( *pend != '\0' ) || ( skip < 0 ) || ( skip > COMPILE_STATE_OPS_MAX ) )
+            {
+                compile_error( "expected: %s count", ptokens[ 0 ] );
+                return EINVAL;
+            }
+            op.arg = (uint8_t)skip;
+            break;
+        }
+
+        default:
+        {
+            if ( count != 1 )
+            {
+                compile_error( "%s takes no arguments", ptokens[ 0 ] );
+                return EINVAL;
+            }
+            break;
+        }
+    }
+
+    psrc->ops[ state ][ psrc->op_count[ state ]++ ] = op;
+
+    return EOK;
+}
+
+static int compile_parse( compile_source_t* psrc, const char* path )
+{
+    char line[ COMPILE_LINE_MAX ];
+    char* ptokens[ COMPILE_LINE_MAX / 2 + 1 ];
+    int state = -1;
+    int ret = EOK;
+    int i;
+    int j;
+    FILE* pfile;
+
+    pfile = fopen( path, "r" );
+    return_if( pfile == NULL, errno );
+
+    memset( psrc, 0, sizeof( *psrc ) );
+    compile_path = path;
+    compile_lineno = 0;
+
+    //unlisted pairs are rejected and stay put
+    for ( i = 0; i < ss_END; i++ )
+    {
+        for ( j = 0; j < sa_END; j++ )
+        {
+            psrc->transitions[ i ][ j ] = (uint8_t)i | BEHAVIOUR_DEF_REJECT;
+        }
+    }
+
+    while ( ( ret == EOK ) && ( fgets( line, sizeof( line ), pfile ) != NULL ) )
+    {
+        char* psave = NULL;
+        char* pcomment = strchr( line, '#' );
+        int count = 0;
+
+        compile_lineno++;
+
+        if ( pcomment != NULL )
+        {
+            *pcomment = '\0';
+        }
+
+        for ( ptokens[ 0 ] = strtok_r( line, " \t\r\n", &psave ); ptokens[ count ] != NULL; ptokens[ count ] = strtok_r( NULL, " \t\r\n", &psave ) )
+        {
+            count++;
+        }
+
+        if ( count == 0 )
+        {
+            continue;
+        }
+
+        if ( strcmp( ptokens[ 0 ], "state" ) == 0 )
+        {
+            state = ( count == 2 ) ? compile_find_state( ptokens[ 1 ] ) : -1;
+            if ( state < 0 )
+            {
+                compile_error( "expected: state name" );
+                ret = EINVAL;
+            }
+            else if ( psrc->defined[ state ] )
+            {
+                compile_error( "%s defined twice", ptokens[ 1 ] );
+                ret = EINVAL;
+            }
+            else
+            {
+                psrc->defined[ state ] = true;
+            }
+        }
+        else if ( state < 0 )
+        {
+            compile_error( "%s outside of a state block", ptokens[ 0 ] );
+            ret = EINVAL;
+        }
+        else if ( ( strcmp( ptokens[ 0 ], "on" ) == 0 ) || ( strcmp( ptokens[ 0 ], "reject" ) == 0 ) )
+        {
+            ret = compile_transition( psrc, state, ( ptokens[ 0 ][ 0 ] == 'r' ), &ptokens[ 1 ], count - 1 );
+        }
+        else if ( strcmp( ptokens[ 0 ], "entry" ) == 0 )
+        {
+            ret = compile_entry( psrc, state, &ptokens[ 1 ], count - 1 );
+        }
+        else
+        {
+            compile_error( "unknown keyword %s", ptokens[ 0 ] );
+            ret = EINVAL;
+        }
+    }
+
+    fclose( pfile );
+
+    return ret;
+}
+
+/*
+ * Lays out the compiled definition and checks it with the loader's own validation
+ */
+static int compile_write( const compile_source_t* psrc, const char* out_path )
+{
+    behaviour_def_header_t header;
+    behaviour_def_t* pdef;
+    uint8_t* pbuf;
+    uint32_t op_count = 0;
+    int state;
+    int ret;
+
+    for ( state = 0; state < ss_END; state++ )
+    {
+        op_count += (uint32_t)psrc->op_count[ state ];
+    }
+
+    memset( &header, 0, sizeof( header ) );
+    header.magic = BEHAVIOUR_DEF_MAGIC;
+    header.version = BEHAVIOUR_DEF_VERSION;
+    header.state_count = ss_END;
+    header.action_count = sa_END;
+    header.transitions_offset = sizeof( header );
+    header.entries_offset = COMPILE_ALIGN( header.transitions_offset + sizeof( psrc->transitions ) );
+    header.ops_offset = COMPILE_ALIGN( header.entries_offset + ss_END * sizeof( behaviour_def_entry_t ) );
+    header.op_count = op_count;
+    header.file_size = header.ops_offset + op_count * sizeof( behaviour_def_op_t );
+
+    pbuf = calloc( 1, header.file_size );
+    return_if( pbuf == NULL, ENOMEM );
+
+    memcpy( pbuf, &header, sizeof( header ) );
+    memcpy( pbuf + header.transitions_offset, psrc->transitions, sizeof( psrc->transitions ) );
+
+    behaviour_def_entry_t* pentries = (behaviour_def_entry_t*)( pbuf + header.entries_offset );
+    behaviour_def_op_t* pops = (behaviour_def_op_t*)( pbuf + header.ops_offset );
+
+    op_count = 0;
+    for ( state = 0; state < ss_END; state++ )
+    {
+        pentries[ state ].first_op = (uint16_t)op_count;
+        pentries[ state ].op_count = (uint16_t)psrc->op_count[ state ];
+        memcpy( &pops[ op_count ], psrc->ops[ state ], psrc->op_count[ state ] * sizeof( behaviour_def_op_t ) );
+        op_count += (uint32_t)psrc->op_count[ state ];
+    }
+
+    ret = behaviour_def_from_buffer( &pdef, pbuf, header.file_size );
+    if ( ret != EOK )
+    {
+        fprintf( stderr, "%s: compiled definition fails validation (skip past the end of an entry list?)\n", compile_path );
+        free( pbuf );
+        return ret;
+    }
+    behaviour_def_unload( pdef );
+
+    //a running box maps the definition it loaded; never rewrite that file in place
+    char tmp_path[ COMPILE_LINE_MAX ];
+    snprintf( tmp_path, sizeof( tmp_path ), "%s.tmp", out_path );
+
+    FILE* pfile = fopen( tmp_path, "wb" );
+    if ( pfile == NULL )
+    {
+        ret = errno;
+    }
+    else
+    {
+        ret = ( fwrite( pbuf, header.file_size, 1, pfile ) == 1 ) ? EOK : EIO;
+        ret = ( fclose( pfile ) == 0 ) ? ret : errno;
+        ret = ( ( ret == EOK ) && ( rename( tmp_path, out_path ) != 0 ) ) ? errno : ret;
+        if ( ret != EOK )
+        {
+            unlink( tmp_path );
+        }
+    }
+
+    if ( ret != EOK )
+    {
+        fprintf( stderr, "cannot write %s: %s\n", out_path, strerror( ret ) );
+    }
+    else
+    {
+        printf( "%s: %u bytes, %u entry ops\n", out_path, header.file_size, header.op_count );
+    }
+
+    free( pbuf );
+
+    return ret;
+}
+
+/*
+ * Prints the builtin transition table as source text
+ */
+static void compile_dump_builtin( void )
+{
+    int state;
+    int action;
+    int other;
+
+    for ( state = 0; state < ss_END; state++ )
+    {
+        statemachine_states_t next_states[ sa_END ];
+        int rets[ sa_END ];
+        bool printed[ sa_END ];
+
+        for ( action = 0; action < sa_END; action++ )
+        {
+            rets[ action ] = statemachine_transition( state, action, &next_states[ action ] );
+            //rejected pairs that stay put are the default
+            printed[ action ] = ( rets[ action ] != EOK ) && ( next_states[ action ] == (statemachine_states_t)state );
+        }
+
+        printf( "state %s\n", statemachine_get_statename( state ) );
+
+        //group actions sharing an outcome onto one line
+        for ( action = 0; action < sa_END; action++ )
+        {
+            if ( printed[ action ] )
+            {
+                continue;
+            }
+
+            printf( "    %s", ( rets[ action ] == EOK ) ? "on" : "reject" );
+            for ( other = action; other < sa_END; other++ )
+            {
+                if ( !printed[ other ] && ( rets[ other ] == rets[ action ] ) && ( next_states[ other ] == next_states[ action ] ) )
+                {
+                    printf( " %s", statemachine_get_actionname( other ) );
+                    printed[ other ] = true;
+                }
+            }
+            printf( " -> %s\n", statemachine_get_statename( next_states[ action ] ) );
+        }
+
+        printf( "\n" );
+    }
+}
+
+static void verify_log( verify_box_t* pbox, const char* format, ... )
+{
+    va_list args;
+
+    if ( pbox->len >= sizeof( pbox->log ) )
+    {
+        return;
+    }
+
+    va_start( args, format );
+    int len = vsnprintf( pbox->log + pbox->len, sizeof( pbox->log ) - pbox->len, format, args );
+    va_end( args );
+
+    pbox->len += ( len > 0 ) ? (size_t)len : 0;
+}
+
+static int verify_arm_movement( void* ctx, arm_movement_state_t movement )
+{
+    verify_log( ctx, " motor:%d", movement );
+    return EOK;
+}
+
+static int verify_read_swstates( void* ctx, bool* pint_switch1, bool* pext_switch1 )
+{
+    verify_box_t* pbox = ctx;
+
+    *pint_switch1 = pbox->int_switch1;
+    *pext_switch1 = pbox->ext_switch1;
+
+    return EOK;
+}
+
+static int verify_sample_swstates( void* ctx )
+{
+    verify_log( ctx, " sample" );
+    return EOK;
+}
+
+static int verify_setup_timer_action( void* ctx, int usec, statemachine_actions_t action )
+{
+    verify_log( ctx, " timer:%d:%s", usec, statemachine_get_actionname( action ) );
+    return EOK;
+}
+
+static int verify_next_state( void* ctx, statemachine_actions_t action, statemachine_states_t* pnew_state )
+{
+    verify_log( ctx, " next:%s%s", statemachine_get_actionname( action ), ( pnew_state != NULL ) ? ":out" : "" );
+    return EOK;
+}
+
+static int verify_random_number( void* ctx, int min_num, int max_num )
+{
+    verify_log( ctx, " random:%d..%d", min_num, max_num );
+    return min_num;
+}
+
+static const box_ops_t      verify_ops =
+    {
+        .arm_movement           = verify_arm_movement,
+        .read_swstates          = verify_read_swstates,
+        .sample_swstates        = verify_sample_swstates,
+        .setup_timer_action     = verify_setup_timer_action,
+        .next_state             = verify_next_state,
+        .random_number          = verify_random_number,
+    };
+
+/*
+ * Compares a compiled definition with the builtin table and entry behaviour
+ */
+static int compile_verify( const char* path )
+{
+    behaviour_def_t* pdef;
+    long mismatches = 0;
+    int state;
+    int action;
+    int levels;
+    int ret;
+
+    ret = behaviour_def_load( &pdef, path );
+    if ( ret != EOK )
+    {
+        fprintf( stderr, "cannot load %s: %s\n", path, strerror( ret ) );
+        return ret;
+    }
+
+    for ( state = 0; state < ss_END; state++ )
+    {
+        for ( action = 0; action < sa_END; action++ )
+        {
+            statemachine_states_t builtin_next;
+            statemachine_states_t def_next;
+            int builtin_ret = statemachine_transition( state, action, &builtin_next );
+            int def_ret = behaviour_def_transition( pdef, state, action, &def_next );
+
+            if ( ( builtin_ret != def_ret ) || ( builtin_next != def_next ) )
+            {
+                printf( "transition %s %s: builtin %s (%d) definition %s (%d)\n",
+                    statemachine_get_statename( state ),
+                    statemachine_get_actionname( action ),
+                    statemachine_get_statename( builtin_next ), builtin_ret,
+                    statemachine_get_statename( def_next ), def_ret );
+                mismatches++;
+            }
+        }
+
+        for ( levels = 0; levels < 4; levels++ )
+        {
+            verify_box_t builtin_box;
+            verify_box_t def_box;
+            statemachine_states_t builtin_state = state;
+            statemachine_states_t def_state = state;
+            bool builtin_finished = false;
+            bool def_finished = false;
+
+            memset( &builtin_box, 0, sizeof( builtin_box ) );
+            builtin_box.int_switch1 = ( levels & 1 );
+            builtin_box.ext_switch1 = ( levels & 2 );
+            def_box = builtin_box;
+
+            behaviour_enter_state( &verify_ops, &builtin_box, &builtin_state, &builtin_finished );
+            behaviour_def_enter_state( pdef, &verify_ops, &def_box, &def_state, &def_finished );
+
+            if ( ( strcmp( builtin_box.log, def_box.log ) != 0 ) || ( builtin_finished != def_finished ) )
+            {
+                printf( "entry %s int=%d ext=%d:\n  builtin   %s%s\n  definition%s%s\n",
+                    statemachine_get_statename( state ),
+                    builtin_box.int_switch1, builtin_box.ext_switch1,
+                    builtin_box.log, builtin_finished ? " finish" : "",
+                    def_box.log, def_finished ? " finish" : "" );
+                mismatches++;
+            }
+        }
+    }
+
+    printf( "%s: %ld mismatches against the builtin behaviour\n", path, mismatches );
+
+    behaviour_def_unload( pdef );
+
+    return ( mismatches > 0 ) ? EXIT_FAILURE : EOK;
+}
+
+int main( int argc, char** argv )
+{
+    compile_source_t* psrc;
+    const char* out_path = NULL;
+    const char* verify_path = NULL;
+    bool dump = false;
+    int opt;
+    int ret;
+
+    while ( ( opt = getopt( argc, argv, "o:dv:" ) ) != -1 )
+    {
+        switch ( opt )
+        {
+            case 'o': out_path = optarg; break;
+            case 'd': dump = true; break;
+            case 'v': verify_path = optarg; break;
+            default:
+                fprintf( stderr, "usage: %s -o outfile sourcefile | -d | -v definitionfile\n", argv[ 0 ] );
+                return EINVAL;
+        }
+    }
+
+    if ( dump )
+    {
+        compile_dump_builtin();
+        return EOK;
+    }
+
+    if ( verify_path != NULL )
+    {
+        return compile_verify( verify_path );
+    }
+
+    if ( ( out_path == NULL ) || ( optind >= argc ) )
+    {
+        fprintf( stderr, "usage: %s -o outfile sourcefile | -d | -v definitionfile\n", argv[ 0 ] );
+        return EINVAL;
+    }
+
+    psrc = malloc( sizeof( compile_source_t ) );
+    return_if( psrc == NULL, ENOMEM );
+
+    ret = compile_parse( psrc, argv[ optind ] );
+    if ( ret == EOK )
+    {
+        ret = compile_write( psrc, out_path );
+    }
+    else if ( ret != EINVAL )
+    {
+        fprintf( stderr, "cannot read %s: %s\n", argv[ optind ], strerror( ret ) );
+    }
+
+    free( psrc );
+
+    return ret;
+}
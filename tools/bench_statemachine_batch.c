@@ -0,0 +1,188 @@
+/*
+ * Benchmark: per-box cost of the batch transition kernels against
+ * calling statemachine_next_state in a loop
+ *
+ * build (from repo root):
+ *   gcc -std=gnu99 -O2 -march=native -Isrc tools/bench_statemachine_batch.c \
+ *       src/statemachine_batch.c src/statemachine.c src/behaviour_def.c src/behaviour.c src/shadow.c \
+ *       src/clocksrc.c src/trace.c src/util.c -o bench_statemachine_batch -lpthread -lrt
+ *
+ * usage: bench_statemachine_batch [box_count] [rounds] [active_percent]
+ */
+#include "statemachine.h"
+#include "statemachine_batch.h"
+#include "util.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+static uint32_t             bench_seed = 12345;
+
+static uint32_t bench_rand( void )
+{
+    //xorshift32; cheap and reproducible
+    bench_seed ^= bench_seed << 13;
+    bench_seed ^= bench_seed >> 17;
+    bench_seed ^= bench_seed << 5;
+    return bench_seed;
+}
+
+/*
+ * Fills per-round pending actions; active_percent of boxes get an action each round
+ */
+static void bench_fill_actions( uint8_t* pactions, int count, int rounds, int active_percent )
+{
+    int i;
+
+    for ( i = 0; i < count * rounds; i++ )
+    {
+        pactions[ i ] = ( (int)( bench_rand() % 100 ) < active_percent )
+            ? (uint8_t)( bench_rand() % sa_END )
+            : SM_BATCH_ACTION_NONE;
+    }
+}
+
+static void bench_report( const char* name, uint64_t nsec, uint64_t box_steps, uint64_t changed )
+{
+    printf( "%-28s %10.3f ms  %8.3f ns/box  changed=%llu\n",
+        name,
+        (double)nsec / 1e6,
+        (double)nsec / (double)box_steps,
+        (unsigned long long)changed );
+}
+
+int main( int argc, char** argv )
+{
+    int count = ( argc > 1 ) ? atoi( argv[ 1 ] ) : 100000;
+    int rounds = ( argc > 2 ) ? atoi( argv[ 2 ] ) : 200;
+    int active_percent = ( argc > 3 ) ? atoi( argv[ 3 ] ) : 100;
+    statemachine_batch_t batch;
+    uint64_t start;
+    uint64_t changed;
+    int round;
+    int i;
+
+    if ( ( count <= 0 ) || ( rounds <= 0 ) )
+    {
+        fprintf( stderr, "usage: %s [box_count] [rounds] [active_percent]\n", argv[ 0 ] );
+        return EINVAL;
+    }
+
+    uint64_t box_steps = (uint64_t)count * (uint64_t)rounds;
+    uint8_t* pround_actions = malloc( (size_t)box_steps );
+    uint8_t* preference = malloc( (size_t)count );
+
+    if ( ( pround_actions == NULL ) || ( preference == NULL ) || ( statemachine_batch_init( &batch, count ) != EOK ) )
+    {
+        fprintf( stderr, "allocation failed\n" );
+        return ENOMEM;
+    }
+
+    bench_fill_actions( pround_actions, count, rounds, active_percent );
+
+    printf( "boxes=%d rounds=%d active=%d%% kernel=%s\n", count, rounds, active_percent, statemachine_batch_kernel_name() );
+
+    //reference: one locked statemachine instance per box
+    {
+        statemachine_t** ppsm = calloc( count, sizeof( statemachine_t* ) );
+        statemachine_cid* pcids = calloc( count, sizeof( statemachine_cid ) );
+
+        for ( i = 0; i < count; i++ )
+        {
+            statemachine_create( &ppsm[ i ] );
+            statemachine_init_r( ppsm[ i ], &pcids[ i ] );
+        }
+
+        changed = 0;
+        start = get_monotonic_nsec();
+        for ( round = 0; round < rounds; round++ )
+        {
+            const uint8_t* pactions = &pround_actions[ (size_t)round * count ];
+
+            for ( i = 0; i < count; i++ )
+            {
+                if ( pactions[ i ] != SM_BATCH_ACTION_NONE )
+                {
+                    statemachine_states_t old_state = statemachine_get_current_state_r( ppsm[ i ] );
+                    statemachine_states_t new_state;
+
+                    statemachine_next_state_r( ppsm[ i ], (statemachine_actions_t)pactions[ i ], &new_state );
+                    changed += ( new_state != old_state );
+                }
+            }
+        }
+        bench_report( "statemachine_next_state", get_monotonic_nsec() - start, box_steps, changed );
+
+        for ( i = 0; i < count; i++ )
+        {
+            statemachine_fini_r( ppsm[ i ], &pcids[ i ] );
+            statemachine_destroy( ppsm[ i ] );
+        }
+        free( pcids );
+        free( ppsm );
+    }
+
+    //pure switch, per box
+    memset( preference, ss_powerup, count );
+    changed = 0;
+    start = get_monotonic_nsec();
+    for ( round = 0; round < rounds; round++ )
+    {
+        const uint8_t* pactions = &pround_actions[ (size_t)round * count ];
+
+        for ( i = 0; i < count; i++ )
+        {
+            if ( pactions[ i ] != SM_BATCH_ACTION_NONE )
+            {
+                statemachine_states_t new_state;
+
+                statemachine_transition( (statemachine_states_t)preference[ i ], (statemachine_actions_t)pactions[ i ], &new_state );
+                changed += ( new_state != preference[ i ] );
+                preference[ i ] = (uint8_t)new_state;
+            }
+        }
+    }
+    bench_report( "statemachine_transition", get_monotonic_nsec() - start, box_steps, changed );
+
+    //batch kernels; action copy-in is part of the cost
+    memset( batch.states, ss_powerup, batch.capacity );
+    changed = 0;
+    start = get_monotonic_nsec();
+    for ( round = 0; round < rounds; round++ )
+    {
+        memcpy( batch.actions, &pround_actions[ (size_t)round * count ], count );
+        changed += statemachine_batch_step_scalar( &batch );
+    }
+    bench_report( "statemachine_batch (scalar)", get_monotonic_nsec() - start, box_steps, changed );
+
+    if ( memcmp( batch.states, preference, count ) != 0 )
+    {
+        fprintf( stderr, "scalar batch diverged from statemachine_transition\n" );
+        return EINVAL;
+    }
+
+    memset( batch.states, ss_powerup, batch.capacity );
+    changed = 0;
+    start = get_monotonic_nsec();
+    for ( round = 0; round < rounds; round++ )
+    {
+        memcpy( batch.actions, &pround_actions[ (size_t)round * count ], count );
+        changed += statemachine_batch_step( &batch );
+    }
+    bench_report( "statemachine_batch (vector)", get_monotonic_nsec() - start, box_steps, changed );
+
+    if ( memcmp( batch.states, preference, count ) != 0 )
+    {
+        fprintf( stderr, "vector batch diverged from statemachine_transition\n" );
+        return EINVAL;
+    }
+
+    statemachine_batch_fini( &batch );
+    free( preference );
+    free( pround_actions );
+
+    return EOK;
+}
@@ -0,0 +1,268 @@
+/*
+ * Edge capture statistics
+ *
+ * Summarises a capture taken with `uselessbox -c <file>`: switch bounce
+ * per input pin (bursts of edges closer than the window, and how long they
+ * take to settle) and arm travel timing from the motor enable write to the
+ * first edge on each switch. Use the settle percentiles to tune debounce.
+ *
+ * With -b it instead measures the per-event capture cost. Events are
+ * recorded in batches the ring holds, with the encoder draining in between,
+ * so the figure is the cost of an accepted event and not of a drop.
+ *
+ * build (from repo root):
+ *   gcc -std=gnu99 -O2 -Isrc tools/edgecap_stats.c src/edgecap.c src/clocksrc.c src/latency.c src/util.c \
+ *       -o edgecap_stats -lpthread -lrt
+ *
+ * usage: edgecap_stats [-w window_usec] [-e en_pin] [-i int_pin] [-x ext_pin] capturefile
+ *        edgecap_stats -b events
+ */
+#include "edgecap.h"
+#include "latency.h"
+#include "util.h"
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define STATS_PIN_MAX                       ( EDGECAP_PIN_MAX + 1 )
+#define STATS_BENCH_BATCH                   4096    //well inside the 16384 slot ring
+#define STATS_BENCH_DRAIN_USEC              20000   //a few encoder drain periods
+
+typedef struct
+{
+    uint64_t            edges;
+    uint64_t            writes;
+    uint64_t            bursts;
+    uint64_t            bouncy_bursts;
+    uint64_t            burst_first_nsec;
+    uint64_t            last_nsec;
+    int                 burst_edges;
+    latency_hist_t      settle;                 //first to last edge of bouncy bursts
+} stats_pin_t;
+
+static void stats_print_hist( const char* name, const latency_hist_t* phist )
+{
+    if ( phist->count == 0 )
+    {
+        printf( "  %-18s none\n", name );
+        return;
+    }
+
+    printf( "  %-18s n=%llu p50=%.3fms p99=%.3fms p99.9=%.3fms max=%.3fms\n",
+        name,
+        (unsigned long long)phist->count,
+        latency_hist_percentile( phist, 50.0 ) / 1e6,
+        latency_hist_percentile( phist, 99.0 ) / 1e6,
+        latency_hist_percentile( phist, 99.9 ) / 1e6,
+        phist->max_nsec / 1e6 );
+}
+
+static void stats_close_burst( stats_pin_t* ppin )
+{
+    if ( ppin->burst_edges > 1 )
+    {
+        ppin->bouncy_bursts++;
+        latency_hist_record( &ppin->settle, ppin->last_nsec - ppin->burst_first_nsec );
+    }
+}
+
+/*
+ * Measures capture cost per accepted event with the encoder running
+ * only the record calls are timed; the encoder drains between batches
+ */
+static int stats_bench( long events )
+{
+    edgecap_writer_t* pcap;
+    char path[] = "/tmp/edgecap_bench_XXXXXX";
+    int fd = mkstemp( path );
+    uint64_t nsec = 0;
+    uint64_t accepted = 0;
+    long i = 0;
+
+    return_if( fd < 0, errno );
+    close( fd );
+
+    int ret = edgecap_writer_open( &pcap, path );
+    return_if( ret != EOK, ret );
+
+    while ( i < events )
+    {
+        long batch_end = ( ( events - i ) > STATS_BENCH_BATCH ) ? ( i + STATS_BENCH_BATCH ) : events;
+        uint64_t start = get_monotonic_nsec();
+
+        for ( ; i < batch_end; i++ )
+        {
+            if ( edgecap_record( pcap, ( i & 1 ) ? edgecap_output : edgecap_input, (int)( i & 7 ), (int)( i & 1 ) ) == EOK )
+            {
+                accepted++;
+            }
+        }
+        nsec += get_monotonic_nsec() - start;
+
+        usleep( STATS_BENCH_DRAIN_USEC );
+    }
+
+    uint64_t dropped = edgecap_writer_dropped( pcap );
+
+    edgecap_writer_close( pcap );
+    unlink( path );
+
+    printf( "events=%ld accepted=%llu dropped=%llu %.1f ns/accepted event\n",
+        events,
+        (unsigned long long)accepted,
+        (unsigned long long)dropped,
+        ( accepted > 0 ) ? (double)nsec / (double)accepted : 0.0 );
+
+    return EOK;
+}
+
+int main( int argc, char** argv )
+{
+    edgecap_reader_t* pcap;
+    edgecap_event_t event;
+    stats_pin_t* ppins;
+    latency_hist_t leave_home;
+    latency_hist_t reach_toggle;
+    uint64_t window_nsec = 5000000;
+    uint64_t en_nsec = 0;
+    bool en_waiting_int = false;
+    bool en_waiting_ext = false;
+    int en_pin = 0;
+    int int_pin = 3;
+    int ext_pin = 4;
+    long bench_events = 0;
+    int opt;
+    int ret;
+    int i;
+
+    while ( ( opt = getopt( argc, argv, "w:e:i:x:b:" ) ) != -1 )
+    {
+        switch ( opt )
+        {
+            case 'w': window_nsec = (uint64_t)atol( optarg ) * 1000; break;
+            case 'e': en_pin = atoi( optarg ); break;
+            case 'i': int_pin = atoi( optarg ); break;
+            case 'x': ext_pin = atoi( optarg ); break;
+            case 'b': bench_events = atol( optarg ); break;
+            default:
+                fprintf( stderr, "usage: %s [-w window_usec] [-e en_pin] [-i int_pin] [-x ext_pin] capturefile | -b events\n", argv[ 0 ] );
+                return EINVAL;
+        }
+    }
+
+    if ( bench_events > 0 )
+    {
+        return stats_bench( bench_events );
+    }
+
+    if ( optind >= argc )
+    {
+        fprintf( stderr, "usage: %s [-w window_usec] [-e en_pin] [-i int_pin] [-x ext_pin] capturefile | -b events\n", argv[ 0 ] );
+        return EINVAL;
+    }
+
+    ret = edgecap_reader_open( &pcap, argv[ optind ] );
+    if ( ret != EOK )
+    {
+        fprintf( stderr, "cannot open capture %s: %s\n", argv[ optind ], strerror( ret ) );
+        return ret;
+    }
+
+    ppins = calloc( STATS_PIN_MAX, sizeof( stats_pin_t ) );
+    return_if( ppins == NULL, ENOMEM );
+
+    for ( i = 0; i < STATS_PIN_MAX; i++ )
+    {
+        latency_hist_init( &ppins[ i ].settle );
+    }
+    latency_hist_init( &leave_home );
+    latency_hist_init( &reach_toggle );
+
+    uint64_t first_nsec = edgecap_reader_start_nsec( pcap );
+    uint64_t last_nsec = first_nsec;
+
+    while ( ( ret = edgecap_reader_next( pcap, &event ) ) == EOK )
+    {
+        stats_pin_t* ppin = &ppins[ event.pin ];
+
+        last_nsec = event.ts_nsec;
+
+        if ( event.kind == edgecap_output )
+        {
+            ppin->writes++;
+
+            //arm starts travelling when the motor gets enabled
+            if ( ( event.pin == en_pin ) && event.level )
+            {
+                en_nsec = event.ts_nsec;
+                en_waiting_int = true;
+                en_waiting_ext = true;
+            }
+            continue;
+        }
+
+        ppin->edges++;
+
+        if ( ( ppin->edges == 1 ) || ( ( event.ts_nsec - ppin->last_nsec ) > window_nsec ) )
+        {
+            stats_close_burst( ppin );
+            ppin->bursts++;
+            ppin->burst_first_nsec = event.ts_nsec;
+            ppin->burst_edges = 0;
+        }
+        ppin->burst_edges++;
+        ppin->last_nsec = event.ts_nsec;
+
+        if ( en_waiting_int && ( event.pin == int_pin ) )
+        {
+            latency_hist_record( &leave_home, event.ts_nsec - en_nsec );
+            en_waiting_int = false;
+        }
+        if ( en_waiting_ext && ( event.pin == ext_pin ) )
+        {
+            latency_hist_record( &reach_toggle, event.ts_nsec - en_nsec );
+            en_waiting_ext = false;
+        }
+    }
+
+    if ( ret == EILSEQ )
+    {
+        fprintf( stderr, "damaged record; stats cover the capture up to it\n" );
+    }
+
+    printf( "span=%.3fs window=%.3fms\n", (double)( last_nsec - first_nsec ) / 1e9, (double)window_nsec / 1e6 );
+
+    for ( i = 0; i < STATS_PIN_MAX; i++ )
+    {
+        stats_pin_t* ppin = &ppins[ i ];
+
+        if ( ppin->writes > 0 )
+        {
+            printf( "pin %d output writes=%llu\n", i, (unsigned long long)ppin->writes );
+        }
+
+        if ( ppin->edges > 0 )
+        {
+            stats_close_burst( ppin );
+            printf( "pin %d input edges=%llu bursts=%llu bouncy=%llu\n",
+                i,
+                (unsigned long long)ppin->edges,
+                (unsigned long long)ppin->bursts,
+                (unsigned long long)ppin->bouncy_bursts );
+            stats_print_hist( "settle", &ppin->settle );
+        }
+    }
+
+    printf( "arm travel from motor enable (pin %d)\n", en_pin );
+    stats_print_hist( "first int edge", &leave_home );
+    stats_print_hist( "first ext edge", &reach_toggle );
+
+    free( ppins );
+    edgecap_reader_close( pcap );
+
+    return ( ret == EILSEQ ) ? EILSEQ : EOK;
+}
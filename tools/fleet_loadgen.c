@@ -0,0 +1,481 @@
+/*
+ * Fleet load generator
+ *
+ * Drives many simulated boxes on the fleet runtime with modelled people
+ * flipping the switch, using the real transition table and the STATE_*
+ * timings from behaviour.h. Arm travel is simulated so the toggle is
+ * flipped back and the lid switch opens/closes as on a real box. Each
+ * scenario prints its state mix: how often every state was entered.
+ *
+ * With -v the fleet runs on a virtual clock and jumps between deadlines,
+ * so long scenarios finish far faster than real time. A virtual run with
+ * one worker is exactly reproducible; compare the printed digest.
+ *
+ * build (from repo root):
+ *   gcc -std=gnu99 -O2 -Isrc tools/fleet_loadgen.c src/fleet.c src/behaviour.c src/behaviour_def.c src/clocksrc.c \
+ *       src/statemachine.c src/shadow.c src/trace.c src/latency.c src/util.c -o fleet_loadgen -lpthread -lrt
+ *
+ * usage: fleet_loadgen [-w workers[,workers...]] [-b boxes] [-d seconds] [-s scenario] [-v]
+ *        scenario: patient | impatient | peeker | hammer | mixed | all
+ *
+ * A list of worker counts (e.g. -w 1,2,4) reruns every scenario with each,
+ * which shows how throughput and the wall time of a virtual run scale with
+ * cores.
+ */
+#include "fleet.h"
+#include "behaviour.h"
+#include "latency.h"
+#include "clocksrc.h"
+#include "util.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define LG_ARM_TRAVEL_USEC                  400000  //home <-> toggle at full speed
+#define LG_ARM_LEAVE_HOME_USEC              30000   //lid switch opens this long after moving off home
+#define LG_THINK_MIN_USEC                   500000  //idle box until someone flips it again
+#define LG_THINK_MAX_USEC                   3000000
+#define LG_REACT_MIN_USEC                   150000  //person reacting to the box moving
+#define LG_REACT_MAX_USEC                   400000
+#define LG_HAMMER_USEC                      100000  //sustained flipping period
+#define LG_SWEEP_MAX                        16      //worker counts in one -w list
+
+typedef enum
+{
+    lg_human_patient,       //flips once the box settles idle
+    lg_human_impatient,     //also re-flips while the arm goes home (ss_reseting) and while scaring (ss_scare_step*)
+    lg_human_peeker,        //also re-flips while the arm goes home and flips when the lid peeks (ss_suspicion_step1)
+    lg_human_hammer,        //flips every LG_HAMMER_USEC regardless of state
+    lg_human_END,
+} lg_human_t;
+
+typedef enum
+{
+    lg_ev_arm_left_home,
+    lg_ev_arm_at_toggle,
+    lg_ev_arm_home,
+    lg_ev_human_flip,
+    lg_ev_human_hammer,
+    lg_ev_human_prod,
+} lg_event_t;
+
+typedef struct
+{
+    pthread_mutex_t         mutex;
+    lg_human_t              human;
+    double                  arm_pos;        //0.0 home .. 1.0 at toggle
+    arm_movement_state_t    arm_movement;
+    uint64_t                arm_since_nsec;
+    int                     arm_generation; //stale arm events are dropped
+    int                     state_generation;   //stale prods are dropped
+    unsigned int            seed;
+    fleet_box_t*            pbox;
+    uint64_t                entered[ ss_END ];
+} lg_box_t;
+
+static const char*          lg_human_names[] =
+    {
+        "patient",
+        "impatient",
+        "peeker",
+        "hammer",
+    };
+
+#define LG_EVENT_ARG( _ev, _gen )           ( (int)(_ev) | ( (_gen) << 4 ) )
+#define LG_EVENT_EV( _arg )                 ( (lg_event_t)( (_arg) & 0xF ) )
+#define LG_EVENT_GEN( _arg )                ( (_arg) >> 4 )
+
+static int lg_random_usec( lg_box_t* plg, int min_usec, int max_usec )
+{
+    return min_usec + ( rand_r( &plg->seed ) % ( max_usec - min_usec + 1 ) );
+}
+
+static void lg_on_timer( fleet_box_t* pbox, void* user, int arg );
+
+/*
+ * Flips the external switch on if it is off
+ * Note: plg->mutex held
+ */
+static void lg_flip_on_nolock( lg_box_t* plg )
+{
+    bool int_switch1;
+    bool ext_switch1;
+
+    fleet_box_get_swstates( plg->pbox, &int_switch1, &ext_switch1 );
+    if ( ext_switch1 )
+    {
+        return;
+    }
+
+    fleet_box_set_swstates( plg->pbox, int_switch1, true );
+
+    //a finger moving out (or resting on the toggle) knocks it off again when it gets there
+    if ( plg->arm_movement == am_fwd )
+    {
+        double travelled = (double)( fleet_box_now_nsec( plg->pbox ) - plg->arm_since_nsec ) / ( LG_ARM_TRAVEL_USEC * 1000.0 );
+        double pos = ( plg->arm_pos + travelled > 1.0 ) ? 1.0 : plg->arm_pos + travelled;
+
+        fleet_box_setup_timer_callback( plg->pbox, (int)( ( 1.0 - pos ) * LG_ARM_TRAVEL_USEC ), lg_on_timer, LG_EVENT_ARG( lg_ev_arm_at_toggle, plg->arm_generation ) );
+    }
+}
+
+static void lg_on_timer( fleet_box_t* pbox, void* user, int arg )
+{
+    lg_box_t* plg = (lg_box_t*)user;
+    lg_event_t ev = LG_EVENT_EV( arg );
+    bool int_switch1;
+    bool ext_switch1;
+
+    pthread_mutex_lock( &plg->mutex );
+
+    if ( ( ev <= lg_ev_arm_home ) && ( LG_EVENT_GEN( arg ) != plg->arm_generation ) )
+    {
+        //arm changed direction since this was armed
+        pthread_mutex_unlock( &plg->mutex );
+        return;
+    }
+
+    fleet_box_get_swstates( pbox, &int_switch1, &ext_switch1 );
+
+    switch ( ev )
+    {
+        case lg_ev_arm_left_home:
+            fleet_box_set_swstates( pbox, false, ext_switch1 );
+            break;
+
+        case lg_ev_arm_at_toggle:
+            //finger knocks the toggle off; with the toggle already off it just stalls
+            plg->arm_pos = 1.0;
+            fleet_box_set_swstates( pbox, false, false );
+            break;
+
+        case lg_ev_arm_home:
+            plg->arm_pos = 0.0;
+            fleet_box_set_swstates( pbox, true, ext_switch1 );
+            break;
+
+        case lg_ev_human_flip:
+            lg_flip_on_nolock( plg );
+            break;
+
+        case lg_ev_human_hammer:
+            lg_flip_on_nolock( plg );
+            fleet_box_setup_timer_callback( pbox, LG_HAMMER_USEC, lg_on_timer, LG_EVENT_ARG( lg_ev_human_hammer, 0 ) );
+            break;
+
+        case lg_ev_human_prod:
+            //the box sat in one state all along (e.g. offence with the toggle already off)
+            if ( LG_EVENT_GEN( arg ) == plg->state_generation )
+            {
+                lg_flip_on_nolock( plg );
+            }
+            break;
+    }
+
+    pthread_mutex_unlock( &plg->mutex );
+}
+
+static void lg_on_arm_movement( fleet_box_t* pbox, void* user, arm_movement_state_t movement )
+{
+    lg_box_t* plg = (lg_box_t*)user;
+    uint64_t now_nsec = fleet_box_now_nsec( pbox );
+
+    pthread_mutex_lock( &plg->mutex );
+
+    //integrate arm position over the previous movement
+    double travelled = (double)( now_nsec - plg->arm_since_nsec ) / ( LG_ARM_TRAVEL_USEC * 1000.0 );
+
+    if ( plg->arm_movement == am_fwd )
+    {
+        plg->arm_pos += travelled;
+    }
+    else if ( plg->arm_movement == am_bwd )
+    {
+        plg->arm_pos -= travelled;
+    }
+
+    plg->arm_pos = ( plg->arm_pos < 0.0 ) ? 0.0 : ( plg->arm_pos > 1.0 ) ? 1.0 : plg->arm_pos;
+    plg->arm_movement = movement;
+    plg->arm_since_nsec = now_nsec;
+    plg->arm_generation = ( plg->arm_generation + 1 ) & 0x7FFFFFF;
+
+    int gen = plg->arm_generation;
+
+    if ( movement == am_fwd )
+    {
+        if ( plg->arm_pos <= 0.0 )
+        {
+            fleet_box_setup_timer_callback( pbox, LG_ARM_LEAVE_HOME_USEC, lg_on_timer, LG_EVENT_ARG( lg_ev_arm_left_home, gen ) );
+        }
+        fleet_box_setup_timer_callback( pbox, (int)( ( 1.0 - plg->arm_pos ) * LG_ARM_TRAVEL_USEC ), lg_on_timer, LG_EVENT_ARG( lg_ev_arm_at_toggle, gen ) );
+    }
+    else if ( ( movement == am_bwd ) && ( plg->arm_pos > 0.0 ) )
+    {
+        fleet_box_setup_timer_callback( pbox, (int)( plg->arm_pos * LG_ARM_TRAVEL_USEC ), lg_on_timer, LG_EVENT_ARG( lg_ev_arm_home, gen ) );
+    }
+
+    pthread_mutex_unlock( &plg->mutex );
+}
+
+static void lg_on_transition( fleet_box_t* pbox, void* user, statemachine_states_t from_state, statemachine_states_t to_state )
+{
+    lg_box_t* plg = (lg_box_t*)user;
+    int delay_usec = -1;
+    int prod_usec = -1;
+
+    __unused( from_state );
+
+    pthread_mutex_lock( &plg->mutex );
+
+    plg->entered[ to_state ]++;
+    plg->state_generation = ( plg->state_generation + 1 ) & 0x7FFFFFF;
+
+    int gen = plg->state_generation;
+
+    //flipping back on before the arm is home is what leads into the scare and suspicion states
+    switch ( plg->human )
+    {
+        case lg_human_impatient:
+            if ( ( to_state == ss_reseting ) || ( to_state == ss_scare_step1 ) || ( to_state == ss_scare_step2 ) || ( to_state == ss_scare_step3 ) )
+            {
+                delay_usec = lg_random_usec( plg, LG_REACT_MIN_USEC, LG_REACT_MAX_USEC );
+            }
+            break;
+
+        case lg_human_peeker:
+            if ( ( to_state == ss_reseting ) || ( to_state == ss_suspicion_step1 ) )
+            {
+                delay_usec = lg_random_usec( plg, LG_REACT_MIN_USEC, LG_REACT_MAX_USEC );
+            }
+            break;
+
+        default:
+            break;
+    }
+
+    if ( ( to_state == ss_idle ) && ( plg->human != lg_human_hammer ) )
+    {
+        delay_usec = lg_random_usec( plg, LG_THINK_MIN_USEC, LG_THINK_MAX_USEC );
+    }
+    else if ( plg->human != lg_human_hammer )
+    {
+        //some states only move on with a new flip; a box standing still gets one
+        prod_usec = lg_random_usec( plg, LG_THINK_MIN_USEC, LG_THINK_MAX_USEC );
+    }
+
+    pthread_mutex_unlock( &plg->mutex );
+
+    if ( delay_usec >= 0 )
+    {
+        fleet_box_setup_timer_callback( pbox, delay_usec, lg_on_timer, LG_EVENT_ARG( lg_ev_human_flip, 0 ) );
+    }
+
+    if ( prod_usec >= 0 )
+    {
+        fleet_box_setup_timer_callback( pbox, prod_usec, lg_on_timer, LG_EVENT_ARG( lg_ev_human_prod, gen ) );
+    }
+}
+
+static const fleet_box_hooks_t              lg_hooks =
+    {
+        .on_arm_movement        = lg_on_arm_movement,
+        .on_transition          = lg_on_transition,
+    };
+
+/*
+ * Runs one scenario; human < 0 mixes all models across the fleet
+ */
+static int lg_run_scenario( const char* name, int human, int worker_count, int box_count, int seconds, bool is_virtual )
+{
+    fleet_t* pfleet;
+    fleet_stats_t stats;
+    clocksrc_t* pclk = clocksrc_get_real();
+    uint64_t digest = 1469598103934665603ULL;
+    lg_box_t* plgs = calloc( box_count, sizeof( lg_box_t ) );
+    int ret;
+    int i;
+
+    return_if( plgs == NULL, ENOMEM );
+
+    if ( is_virtual )
+    {
+        clocksrc_create_virtual( &pclk, 0, 0 );
+    }
+
+    ret = fleet_create( &pfleet, worker_count, box_count );
+    if ( ret != EOK )
+    {
+        clocksrc_destroy( pclk );
+        free( plgs );
+        return ret;
+    }
+
+    fleet_set_clock( pfleet, pclk );
+
+    for ( i = 0; i < box_count; i++ )
+    {
+        fleet_box_t* pbox;
+
+        pthread_mutex_init( &plgs[ i ].mutex, NULL );
+        plgs[ i ].human = ( human < 0 ) ? (lg_human_t)( i % lg_human_END ) : (lg_human_t)human;
+        plgs[ i ].arm_movement = am_idle;
+        plgs[ i ].arm_since_nsec = clocksrc_now_nsec( pclk );
+        plgs[ i ].seed = (unsigned int)( i * 2654435761u ) + 1;
+
+        fleet_add_box( pfleet, &lg_hooks, &plgs[ i ], &pbox );
+        plgs[ i ].pbox = pbox;
+
+        if ( plgs[ i ].human == lg_human_hammer )
+        {
+            fleet_box_setup_timer_callback( pbox, lg_random_usec( &plgs[ i ], 0, LG_HAMMER_USEC ), lg_on_timer, LG_EVENT_ARG( lg_ev_human_hammer, 0 ) );
+        }
+    }
+
+    uint64_t wall_start_nsec = get_monotonic_nsec();
+
+    fleet_run_until( pfleet, clocksrc_now_nsec( pclk ) + ( (uint64_t)seconds * 1000000000ULL ) );
+    fleet_get_stats( pfleet, &stats );
+
+    double wall_sec = (double)( get_monotonic_nsec() - wall_start_nsec ) / 1e9;
+
+    //fnv-1a over final box states; identical across reproducible runs
+    for ( i = 0; i < box_count; i++ )
+    {
+        digest = ( digest ^ (uint64_t)fleet_box_get_state( plgs[ i ].pbox ) ) * 1099511628211ULL;
+    }
+    digest = ( digest ^ stats.transitions ) * 1099511628211ULL;
+
+    uint64_t entered[ ss_END ] = { 0 };
+    int state;
+
+    for ( i = 0; i < box_count; i++ )
+    {
+        for ( state = 0; state < ss_END; state++ )
+        {
+            entered[ state ] += plgs[ i ].entered[ state ];
+        }
+    }
+
+    const latency_hist_t* plat = &stats.reaction_latency;
+
+    printf( "scenario=%s workers=%d boxes=%d duration=%ds clock=%s wall=%.3fs speedup=%.1fx digest=%016llx\n",
+        name, worker_count, box_count, seconds, is_virtual ? "virtual" : "real",
+        wall_sec, seconds / wall_sec, (unsigned long long)digest );
+    printf( "  throughput   actions=%.0f/s transitions=%.0f/s\n",
+        (double)stats.actions / seconds, (double)stats.transitions / seconds );
+    printf( "  queues       runqueue_depth_max=%d steals=%llu actions_dropped=%llu\n",
+        stats.runqueue_depth_max, (unsigned long long)stats.steals, (unsigned long long)stats.actions_dropped );
+    printf( "  timers       armed=%.0f/s fired=%.0f/s pending_max=%d\n",
+        (double)stats.timers_armed / seconds, (double)stats.timers_fired / seconds, stats.timers_pending_max );
+    printf( "  latency_us   p50=%.1f p90=%.1f p99=%.1f p99.9=%.1f max=%.1f\n",
+        latency_hist_percentile( plat, 50.0 ) / 1e3,
+        latency_hist_percentile( plat, 90.0 ) / 1e3,
+        latency_hist_percentile( plat, 99.0 ) / 1e3,
+        latency_hist_percentile( plat, 99.9 ) / 1e3,
+        plat->max_nsec / 1e3 );
+
+    //state mix: entries per state over the run
+    printf( "  states      " );
+    for ( state = 0; state < ss_END; state++ )
+    {
+        if ( entered[ state ] > 0 )
+        {
+            printf( " %s=%llu", statemachine_get_statename( (statemachine_states_t)state ) + 3, (unsigned long long)entered[ state ] );
+        }
+    }
+    printf( "\n" );
+
+    fleet_destroy( pfleet );
+    clocksrc_destroy( pclk );
+
+    for ( i = 0; i < box_count; i++ )
+    {
+        pthread_mutex_destroy( &plgs[ i ].mutex );
+    }
+    free( plgs );
+
+    return EOK;
+}
+
+/*
+ * Parses a comma separated list of worker counts
+ *
+ * returns number of counts parsed; 0 if any is not positive or there are too many
+ */
+static int lg_parse_workers( char* plist, int* pcounts )
+{
+    char* psave = NULL;
+    char* ptok;
+    int n = 0;
+
+    for ( ptok = strtok_r( plist, ",", &psave ); ptok != NULL; ptok = strtok_r( NULL, ",", &psave ) )
+    {
+        if ( ( n == LG_SWEEP_MAX ) || ( atoi( ptok ) <= 0 ) )
+        {
+            return 0;
+        }
+        pcounts[ n++ ] = atoi( ptok );
+    }
+
+    return n;
+}
+
+int main( int argc, char** argv )
+{
+    int worker_counts[ LG_SWEEP_MAX ] = { (int)sysconf( _SC_NPROCESSORS_ONLN ) };
+    int sweep_count = 1;
+    int box_count = 1000;
+    int seconds = 10;
+    const char* scenario = "all";
+    bool is_virtual = false;
+    int opt;
+    int w;
+    int i;
+
+    while ( ( opt = getopt( argc, argv, "w:b:d:s:v" ) ) != -1 )
+    {
+        switch ( opt )
+        {
+            case 'w': sweep_count = lg_parse_workers( optarg, worker_counts ); break;
+            case 'b': box_count = atoi( optarg ); break;
+            case 'd': seconds = atoi( optarg ); break;
+            case 's': scenario = optarg; break;
+            case 'v': is_virtual = true; break;
+            default:
+                fprintf( stderr, "usage: %s [-w workers[,workers...]] [-b boxes] [-d seconds] [-s patient|impatient|peeker|hammer|mixed|all] [-v]\n", argv[ 0 ] );
+                return EINVAL;
+        }
+    }
+
+    if ( ( sweep_count <= 0 ) || ( worker_counts[ 0 ] <= 0 ) || ( box_count <= 0 ) || ( seconds <= 0 ) )
+    {
+        fprintf( stderr, "workers, boxes and seconds must be positive; at most %d worker counts\n", LG_SWEEP_MAX );
+        return EINVAL;
+    }
+
+    for ( i = 0; i < lg_human_END; i++ )
+    {
+        if ( ( strcmp( scenario, "all" ) == 0 ) || ( strcmp( scenario, lg_human_names[ i ] ) == 0 ) )
+        {
+            for ( w = 0; w < sweep_count; w++ )
+            {
+                lg_run_scenario( lg_human_names[ i ], i, worker_counts[ w ], box_count, seconds, is_virtual );
+            }
+        }
+    }
+
+    if ( ( strcmp( scenario, "all" ) == 0 ) || ( strcmp( scenario, "mixed" ) == 0 ) )
+    {
+        for ( w = 0; w < sweep_count; w++ )
+        {
+            lg_run_scenario( "mixed", -1, worker_counts[ w ], box_count, seconds, is_virtual );
+        }
+    }
+
+    return EOK;
+}
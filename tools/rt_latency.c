@@ -0,0 +1,170 @@
+/*
+ * Measures worst-case wakeup latency per thread role, without and then with
+ * the real-time mode, optionally under cpu load
+ *
+ * One thread per role sleeps to absolute deadlines on CLOCK_MONOTONIC and
+ * records how late it woke up; the box reacts to edges and timers the same
+ * way, so this bounds its reaction latency on the machine at hand.
+ *
+ * build (from repo root):
+ *   gcc -std=gnu99 -O2 -Isrc tools/rt_latency.c src/rtmode.c src/latency.c src/util.c \
+ *       -o rt_latency -lpthread -lrt
+ *
+ * usage: rt_latency [seconds_per_run] [interval_usec] [load_threads] [cpu]
+ */
+#include "rtmode.h"
+#include "latency.h"
+#include "util.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#define RT_LATENCY_LOAD_BYTES               ( 4 * 1024 * 1024 )
+
+typedef struct
+{
+    rtmode_role_t       role;
+    uint64_t            interval_nsec;
+    uint64_t            end_nsec;
+    latency_hist_t      hist;
+    pthread_t           tid;
+} rt_latency_probe_t;
+
+static volatile bool                        rt_latency_loading;
+static const char*                          rt_latency_role_names[ rt_role_END ] = { "edge", "timer", "dispatch", "logging" };
+
+static void* rt_latency_probe_entry( void* args )
+{
+    rt_latency_probe_t* pprobe = (rt_latency_probe_t*)args;
+    struct timespec ts;
+    uint64_t deadline_nsec;
+
+    rtmode_enter( pprobe->role );
+
+    deadline_nsec = get_monotonic_nsec() + pprobe->interval_nsec;
+    while ( deadline_nsec < pprobe->end_nsec )
+    {
+        ts.tv_sec = (time_t)( deadline_nsec / 1000000000ULL );
+        ts.tv_nsec = (long)( deadline_nsec % 1000000000ULL );
+        while ( clock_nanosleep( CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL ) == EINTR )
+        {
+        }
+
+        latency_hist_record( &pprobe->hist, get_monotonic_nsec() - deadline_nsec );
+        deadline_nsec += pprobe->interval_nsec;
+    }
+
+    return NULL;
+}
+
+/*
+ * Keeps a cpu busy and the caches and page tables churning
+ */
+static void* rt_latency_load_entry( void* args )
+{
+    char* pbuf = malloc( RT_LATENCY_LOAD_BYTES );
+    size_t i = 0;
+
+    __unused( args );
+
+    while ( rt_latency_loading && ( pbuf != NULL ) )
+    {
+        pbuf[ i ] = (char)i;
+        i = ( i + 4093 ) % RT_LATENCY_LOAD_BYTES;
+    }
+
+    free( pbuf );
+
+    return NULL;
+}
+
+static void rt_latency_run( const char* name, int seconds, uint64_t interval_nsec, int load_threads )
+{
+    rt_latency_probe_t probes[ rt_role_END ];
+    pthread_t* pload = calloc( load_threads > 0 ? load_threads : 1, sizeof( pthread_t ) );
+    uint64_t end_nsec = get_monotonic_nsec() + (uint64_t)seconds * 1000000000ULL;
+    int i;
+
+    rt_latency_loading = true;
+    for ( i = 0; i < load_threads; i++ )
+    {
+        pthread_create( &pload[ i ], NULL, rt_latency_load_entry, NULL );
+    }
+
+    for ( i = 0; i < rt_role_END; i++ )
+    {
+        probes[ i ].role = (rtmode_role_t)i;
+        probes[ i ].interval_nsec = interval_nsec;
+        probes[ i ].end_nsec = end_nsec;
+        latency_hist_init( &probes[ i ].hist );
+        pthread_create( &probes[ i ].tid, NULL, rt_latency_probe_entry, &probes[ i ] );
+    }
+
+    for ( i = 0; i < rt_role_END; i++ )
+    {
+        pthread_join( probes[ i ].tid, NULL );
+    }
+
+    rt_latency_loading = false;
+    for ( i = 0; i < load_threads; i++ )
+    {
+        pthread_join( pload[ i ], NULL );
+    }
+    free( pload );
+
+    for ( i = 0; i < rt_role_END; i++ )
+    {
+        printf( "%-4s %-9s n=%-8llu p50=%6lluus p99=%6lluus max=%6lluus\n",
+            name,
+            rt_latency_role_names[ i ],
+            (unsigned long long)probes[ i ].hist.count,
+            (unsigned long long)( latency_hist_percentile( &probes[ i ].hist, 50.0 ) / 1000 ),
+            (unsigned long long)( latency_hist_percentile( &probes[ i ].hist, 99.0 ) / 1000 ),
+            (unsigned long long)( probes[ i ].hist.max_nsec / 1000 ) );
+    }
+}
+
+int main( int argc, char** argv )
+{
+    int seconds = ( argc > 1 ) ? atoi( argv[ 1 ] ) : 5;
+    int interval_usec = ( argc > 2 ) ? atoi( argv[ 2 ] ) : 1000;
+    int load_threads = ( argc > 3 ) ? atoi( argv[ 3 ] ) : (int)sysconf( _SC_NPROCESSORS_ONLN );
+    int cpu = ( argc > 4 ) ? atoi( argv[ 4 ] ) : RTMODE_CPU_ANY;
+    rtmode_config_t config;
+    int role;
+    int ret;
+
+    if ( ( seconds <= 0 ) || ( interval_usec <= 0 ) || ( load_threads < 0 ) )
+    {
+        fprintf( stderr, "usage: %s [seconds_per_run] [interval_usec] [load_threads] [cpu]\n", argv[ 0 ] );
+        return EINVAL;
+    }
+
+    printf( "seconds=%d interval=%dus load_threads=%d cpu=%d\n", seconds, interval_usec, load_threads, cpu );
+
+    rt_latency_run( "off", seconds, (uint64_t)interval_usec * 1000, load_threads );
+
+    rtmode_default_config( &config );
+    for ( role = 0; role < rt_role_END; role++ )
+    {
+        config.roles[ role ].cpu = cpu;
+    }
+
+    ret = rtmode_start( &config );
+    if ( ret != EOK )
+    {
+        fprintf( stderr, "rt mode not started; cpu out of range\n" );
+        return ret;
+    }
+
+    rt_latency_run( "on", seconds, (uint64_t)interval_usec * 1000, load_threads );
+    rtmode_report( stdout );
+    rtmode_stop();
+
+    return EOK;
+}
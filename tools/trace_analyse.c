@@ -0,0 +1,568 @@
+/*
+ * Parallel trace analyser
+ *
+ * Maps any number of action traces (uselessbox -t) and edge captures
+ * (uselessbox -c) and reports, merged over all files:
+ *  - dwell time distribution per state
+ *  - scare and suspicion cycle durations (setup entered -> family left)
+ *  - reset retry rate (ss_reseting_retry entries per ss_reseting entry)
+ *  - bounce bursts and settle times per input pin
+ *
+ * Action traces have fixed size records, so each is cut into chunks that
+ * threads take independently. Time within a chunk is relative, which is all
+ * durations need. A chunk owns the dwells and cycles that start inside it
+ * and reads past its end only until those close, so chunk results merge
+ * without double counting. Edge captures are varint streams that cannot be
+ * entered mid-way; they are spread across threads per file.
+ *
+ * build (from repo root):
+ *   gcc -std=gnu99 -O2 -Isrc tools/trace_analyse.c src/trace.c src/edgecap.c src/clocksrc.c \
+ *       src/statemachine.c src/behaviour_def.c src/behaviour.c src/shadow.c src/latency.c src/util.c \
+ *       -o trace_analyse -lpthread -lrt
+ *
+ * usage: trace_analyse [-j threads] [-w bounce_window_usec] file...
+ */
+#include "statemachine.h"
+#include "trace.h"
+#include "edgecap.h"
+#include "latency.h"
+#include "util.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define ANALYSE_CHUNK_MIN_RECORDS           ( 1 << 20 )     //8MB; smaller chunks cost more in overrun than they gain
+#define ANALYSE_PIN_COUNT                   ( EDGECAP_PIN_MAX + 1 )
+#define ANALYSE_BATCH_EVENTS                256
+
+typedef enum
+{
+    analyse_cycle_scare,
+    analyse_cycle_suspicion,
+    analyse_cycle_END,
+} analyse_cycle_t;
+
+typedef enum
+{
+    analyse_file_trace,
+    analyse_file_edgecap,
+} analyse_file_kind_t;
+
+typedef struct
+{
+    const char*             path;
+    analyse_file_kind_t     kind;
+    uint64_t                begin;          //trace record range; unused for captures
+    uint64_t                end;
+} analyse_item_t;
+
+typedef struct
+{
+    uint64_t                edges;
+    uint64_t                bursts;
+    uint64_t                bouncy_bursts;
+    latency_hist_t          settle;
+} analyse_pin_t;
+
+typedef struct
+{
+    uint64_t                actions;
+    uint64_t                transitions;
+    uint64_t                sources[ trace_src_END ];
+    uint64_t                resets;
+    uint64_t                retries;
+    uint64_t                bytes;
+    latency_hist_t          dwell[ ss_END ];
+    latency_hist_t          cycles[ analyse_cycle_END ];
+    analyse_pin_t           pins[ ANALYSE_PIN_COUNT ];
+} analyse_result_t;
+
+typedef struct
+{
+    analyse_item_t*         pitems;
+    int                     item_count;
+    int                     next_item;      //claimed atomically
+    uint64_t                window_nsec;
+} analyse_job_t;
+
+typedef struct
+{
+    pthread_t               tid;
+    analyse_job_t*          pjob;
+    analyse_result_t        result;
+} analyse_worker_t;
+
+static const statemachine_states_t          analyse_cycle_setup[ analyse_cycle_END ] =
+    {
+        ss_scare_setup,
+        ss_suspicion_setup,
+    };
+
+static const char*                          analyse_cycle_names[ analyse_cycle_END ] =
+    {
+        "scare",
+        "suspicion",
+    };
+
+static bool analyse_in_cycle( analyse_cycle_t cycle, statemachine_states_t state )
+{
+    switch ( cycle )
+    {
+        case analyse_cycle_scare:
+            return ( state >= ss_scare_setup ) && ( state <= ss_scare_step3 );
+        case analyse_cycle_suspicion:
+            return ( state >= ss_suspicion_setup ) && ( state <= ss_suspicion_step3 );
+        default:
+            return false;
+    }
+}
+
+static void analyse_result_init( analyse_result_t* presult )
+{
+    int i;
+
+    memset( presult, 0, sizeof( analyse_result_t ) );
+
+    for ( i = 0; i < ss_END; i++ )
+    {
+        latency_hist_init( &presult->dwell[ i ] );
+    }
+    for ( i = 0; i < analyse_cycle_END; i++ )
+    {
+        latency_hist_init( &presult->cycles[ i ] );
+    }
+    for ( i = 0; i < ANALYSE_PIN_COUNT; i++ )
+    {
+        latency_hist_init( &presult->pins[ i ].settle );
+    }
+}
+
+static void analyse_result_merge( analyse_result_t* pdst, const analyse_result_t* psrc )
+{
+    int i;
+
+    pdst->actions += psrc->actions;
+    pdst->transitions += psrc->transitions;
+    pdst->resets += psrc->resets;
+    pdst->retries += psrc->retries;
+    pdst->bytes += psrc->bytes;
+
+    for ( i = 0; i < trace_src_END; i++ )
+    {
+        pdst->sources[ i ] += psrc->sources[ i ];
+    }
+    for ( i = 0; i < ss_END; i++ )
+    {
+        latency_hist_merge( &pdst->dwell[ i ], &psrc->dwell[ i ] );
+    }
+    for ( i = 0; i < analyse_cycle_END; i++ )
+    {
+        latency_hist_merge( &pdst->cycles[ i ], &psrc->cycles[ i ] );
+    }
+    for ( i = 0; i < ANALYSE_PIN_COUNT; i++ )
+    {
+        pdst->pins[ i ].edges += psrc->pins[ i ].edges;
+        pdst->pins[ i ].bursts += psrc->pins[ i ].bursts;
+        pdst->pins[ i ].bouncy_bursts += psrc->pins[ i ].bouncy_bursts;
+        latency_hist_merge( &pdst->pins[ i ].settle, &psrc->pins[ i ].settle );
+    }
+}
+
+typedef struct
+{
+    bool                    dwell_open;
+    uint64_t                dwell_start_nsec;
+    bool                    cycle_open[ analyse_cycle_END ];
+    uint64_t                cycle_start_nsec[ analyse_cycle_END ];
+} analyse_chunk_t;
+
+static inline bool analyse_chunk_has_open( const analyse_chunk_t* pchunk )
+{
+    return pchunk->dwell_open || pchunk->cycle_open[ analyse_cycle_scare ] || pchunk->cycle_open[ analyse_cycle_suspicion ];
+}
+
+static inline void analyse_trace_event( analyse_chunk_t* pchunk, const trace_event_t* pevent, bool in_range, analyse_result_t* presult )
+{
+    int cycle;
+
+    if ( in_range )
+    {
+        presult->actions++;
+        presult->sources[ pevent->source ]++;
+    }
+
+    if ( pevent->from_state == pevent->to_state )
+    {
+        return;
+    }
+
+    //close what was open, whether this record is ours or overrun
+    if ( pchunk->dwell_open )
+    {
+        latency_hist_record( &presult->dwell[ pevent->from_state ], pevent->ts_nsec - pchunk->dwell_start_nsec );
+        pchunk->dwell_open = false;
+    }
+
+    for ( cycle = 0; cycle < analyse_cycle_END; cycle++ )
+    {
+        if ( pchunk->cycle_open[ cycle ] && !analyse_in_cycle( cycle, pevent->to_state ) )
+        {
+            latency_hist_record( &presult->cycles[ cycle ], pevent->ts_nsec - pchunk->cycle_start_nsec[ cycle ] );
+            pchunk->cycle_open[ cycle ] = false;
+        }
+    }
+
+    if ( !in_range )
+    {
+        return;
+    }
+
+    //open only what starts inside the chunk
+    presult->transitions++;
+    presult->resets += ( pevent->to_state == ss_reseting );
+    presult->retries += ( pevent->to_state == ss_reseting_retry );
+
+    pchunk->dwell_open = true;
+    pchunk->dwell_start_nsec = pevent->ts_nsec;
+
+    for ( cycle = 0; cycle < analyse_cycle_END; cycle++ )
+    {
+        if ( !pchunk->cycle_open[ cycle ] && ( pevent->to_state == analyse_cycle_setup[ cycle ] ) )
+        {
+            pchunk->cycle_open[ cycle ] = true;
+            pchunk->cycle_start_nsec[ cycle ] = pevent->ts_nsec;
+        }
+    }
+}
+
+/*
+ * Analyses one chunk of an action trace
+ */
+static int analyse_trace_chunk( const analyse_item_t* pitem, analyse_result_t* presult )
+{
+    trace_reader_t* ptrace;
+    trace_event_t events[ ANALYSE_BATCH_EVENTS ];
+    analyse_chunk_t chunk;
+    int count;
+    int ret;
+    int i;
+
+    ret = trace_reader_open( &ptrace, pitem->path );
+    return_if( ret != EOK, ret );
+
+    trace_reader_seek( ptrace, pitem->begin );
+    memset( &chunk, 0, sizeof( chunk ) );
+
+    //own records in batches
+    while ( ( ret = trace_reader_next_batch( ptrace, pitem->end, events, ANALYSE_BATCH_EVENTS, &count ) ) == EOK )
+    {
+        for ( i = 0; i < count; i++ )
+        {
+            analyse_trace_event( &chunk, &events[ i ], true, presult );
+        }
+    }
+
+    //overrun one record at a time until what we opened has closed
+    while ( ( ret == ENOENT ) && analyse_chunk_has_open( &chunk ) )
+    {
+        ret = trace_reader_next( ptrace, &events[ 0 ] );
+        if ( ret == EOK )
+        {
+            analyse_trace_event( &chunk, &events[ 0 ], false, presult );
+            ret = ENOENT;
+        }
+        else
+        {
+            break;
+        }
+    }
+
+    presult->bytes += ( pitem->end - pitem->begin ) * 8;
+
+    trace_reader_close( ptrace );
+
+    return ( ret == EILSEQ ) ? EILSEQ : EOK;
+}
+
+/*
+ * Analyses bounce in a whole edge capture
+ */
+static int analyse_edgecap( const analyse_item_t* pitem, uint64_t window_nsec, analyse_result_t* presult )
+{
+    edgecap_reader_t* pcap;
+    edgecap_event_t event;
+    uint64_t burst_first_nsec[ ANALYSE_PIN_COUNT ];
+    uint64_t last_nsec[ ANALYSE_PIN_COUNT ];
+    int burst_edges[ ANALYSE_PIN_COUNT ];
+    struct stat st;
+    int ret;
+    int i;
+
+    ret = edgecap_reader_open( &pcap, pitem->path );
+    return_if( ret != EOK, ret );
+
+    memset( burst_edges, 0, sizeof( burst_edges ) );
+
+    while ( ( ret = edgecap_reader_next( pcap, &event ) ) == EOK )
+    {
+        analyse_pin_t* ppin = &presult->pins[ event.pin ];
+
+        if ( event.kind != edgecap_input )
+        {
+            continue;
+        }
+
+        if ( ( burst_edges[ event.pin ] == 0 ) || ( ( event.ts_nsec - last_nsec[ event.pin ] ) > window_nsec ) )
+        {
+            if ( burst_edges[ event.pin ] > 1 )
+            {
+                ppin->bouncy_bursts++;
+                latency_hist_record( &ppin->settle, last_nsec[ event.pin ] - burst_first_nsec[ event.pin ] );
+            }
+            ppin->bursts++;
+            burst_first_nsec[ event.pin ] = event.ts_nsec;
+            burst_edges[ event.pin ] = 0;
+        }
+
+        burst_edges[ event.pin ]++;
+        last_nsec[ event.pin ] = event.ts_nsec;
+        ppin->edges++;
+    }
+
+    for ( i = 0; i < ANALYSE_PIN_COUNT; i++ )
+    {
+        if ( burst_edges[ i ] > 1 )
+        {
+            presult->pins[ i ].bouncy_bursts++;
+            latency_hist_record( &presult->pins[ i ].settle, last_nsec[ i ] - burst_first_nsec[ i ] );
+        }
+    }
+
+    if ( stat( pitem->path, &st ) == 0 )
+    {
+        presult->bytes += (uint64_t)st.st_size;
+    }
+
+    edgecap_reader_close( pcap );
+
+    return ( ret == EILSEQ ) ? EILSEQ : EOK;
+}
+
+static int analyse_add_item( analyse_job_t* pjob, int* pitem_size, const char* path, analyse_file_kind_t kind, uint64_t begin, uint64_t end )
+{
+    if ( pjob->item_count == *pitem_size )
+    {
+        int new_size = ( *pitem_size > 0 ) ? ( *pitem_size * 2 ) : 64;
+        analyse_item_t* pnew = realloc( pjob->pitems, new_size * sizeof( analyse_item_t ) );
+
+        return_if( pnew == NULL, ENOMEM );
+
+        pjob->pitems = pnew;
+        *pitem_size = new_size;
+    }
+
+    pjob->pitems[ pjob->item_count ].path = path;
+    pjob->pitems[ pjob->item_count ].kind = kind;
+    pjob->pitems[ pjob->item_count ].begin = begin;
+    pjob->pitems[ pjob->item_count ].end = end;
+    pjob->item_count++;
+
+    return EOK;
+}
+
+static void* analyse_worker_entry( void* args )
+{
+    analyse_worker_t* pworker = (analyse_worker_t*)args;
+    analyse_job_t* pjob = pworker->pjob;
+    int index;
+
+    while ( ( index = __atomic_fetch_add( &pjob->next_item, 1, __ATOMIC_RELAXED ) ) < pjob->item_count )
+    {
+        analyse_item_t* pitem = &pjob->pitems[ index ];
+        int ret = ( pitem->kind == analyse_file_trace )
+            ? analyse_trace_chunk( pitem, &pworker->result )
+            : analyse_edgecap( pitem, pjob->window_nsec, &pworker->result );
+
+        if ( ret != EOK )
+        {
+            fprintf( stderr, "%s: %s\n", pitem->path, strerror( ret ) );
+        }
+    }
+
+    return NULL;
+}
+
+static void analyse_print_hist( const char* name, const latency_hist_t* phist )
+{
+    printf( "  %-22s n=%-9llu mean=%10.3fms p50=%10.3fms p99=%10.3fms max=%10.3fms\n",
+        name,
+        (unsigned long long)phist->count,
+        latency_hist_mean( phist ) / 1e6,
+        latency_hist_percentile( phist, 50.0 ) / 1e6,
+        latency_hist_percentile( phist, 99.0 ) / 1e6,
+        phist->max_nsec / 1e6 );
+}
+
+static void analyse_report( const analyse_result_t* presult )
+{
+    int i;
+
+    printf( "actions=%llu transitions=%llu\n", (unsigned long long)presult->actions, (unsigned long long)presult->transitions );
+
+    printf( "sources:" );
+    for ( i = 0; i < trace_src_END; i++ )
+    {
+        if ( presult->sources[ i ] > 0 )
+        {
+            printf( " %s=%llu", trace_get_sourcename( (trace_source_t)i ), (unsigned long long)presult->sources[ i ] );
+        }
+    }
+    printf( "\n" );
+
+    printf( "dwell per state\n" );
+    for ( i = 0; i < ss_END; i++ )
+    {
+        if ( presult->dwell[ i ].count > 0 )
+        {
+            analyse_print_hist( statemachine_get_statename( (statemachine_states_t)i ), &presult->dwell[ i ] );
+        }
+    }
+
+    printf( "cycles\n" );
+    for ( i = 0; i < analyse_cycle_END; i++ )
+    {
+        analyse_print_hist( analyse_cycle_names[ i ], &presult->cycles[ i ] );
+    }
+
+    printf( "retries resets=%llu retries=%llu rate=%.3f\n",
+        (unsigned long long)presult->resets,
+        (unsigned long long)presult->retries,
+        ( presult->resets > 0 ) ? (double)presult->retries / (double)presult->resets : 0.0 );
+
+    for ( i = 0; i < ANALYSE_PIN_COUNT; i++ )
+    {
+        const analyse_pin_t* ppin = &presult->pins[ i ];
+
+        if ( ppin->edges > 0 )
+        {
+            char name[ 32 ];
+
+            snprintf( name, sizeof( name ), "pin %d settle", i );
+            printf( "pin %d edges=%llu bursts=%llu bouncy=%llu\n",
+                i, (unsigned long long)ppin->edges, (unsigned long long)ppin->bursts, (unsigned long long)ppin->bouncy_bursts );
+            analyse_print_hist( name, &ppin->settle );
+        }
+    }
+}
+
+int main( int argc, char** argv )
+{
+    analyse_job_t job;
+    analyse_worker_t* pworkers;
+    analyse_result_t* ptotal;
+    int thread_count = (int)sysconf( _SC_NPROCESSORS_ONLN );
+    int item_size = 0;
+    int opt;
+    int i;
+
+    memset( &job, 0, sizeof( job ) );
+    job.window_nsec = 5000000;
+
+    while ( ( opt = getopt( argc, argv, "j:w:" ) ) != -1 )
+    {
+        switch ( opt )
+        {
+            case 'j': thread_count = atoi( optarg ); break;
+            case 'w': job.window_nsec = (uint64_t)atol( optarg ) * 1000; break;
+            default:
+                fprintf( stderr, "usage: %s [-j threads] [-w bounce_window_usec] file...\n", argv[ 0 ] );
+                return EINVAL;
+        }
+    }
+
+    if ( ( optind >= argc ) || ( thread_count <= 0 ) )
+    {
+        fprintf( stderr, "usage: %s [-j threads] [-w bounce_window_usec] file...\n", argv[ 0 ] );
+        return EINVAL;
+    }
+
+    //do following:
+    //cut traces into chunks and queue captures whole
+    //let the threads claim items until none are left
+    //merge per thread results and report
+
+    for ( i = optind; i < argc; i++ )
+    {
+        trace_reader_t* ptrace;
+        edgecap_reader_t* pcap;
+        uint64_t records;
+        uint64_t chunk;
+        uint64_t begin;
+
+        if ( trace_reader_open( &ptrace, argv[ i ] ) == EOK )
+        {
+            records = trace_reader_record_count( ptrace );
+            trace_reader_close( ptrace );
+
+            chunk = ( records + thread_count - 1 ) / thread_count;
+            chunk = ( chunk < ANALYSE_CHUNK_MIN_RECORDS ) ? ANALYSE_CHUNK_MIN_RECORDS : chunk;
+
+            for ( begin = 0; begin < records; begin += chunk )
+            {
+                return_if( analyse_add_item( &job, &item_size, argv[ i ], analyse_file_trace, begin, ( ( begin + chunk ) < records ) ? ( begin + chunk ) : records ) != EOK, ENOMEM );
+            }
+        }
+        else if ( edgecap_reader_open( &pcap, argv[ i ] ) == EOK )
+        {
+            edgecap_reader_close( pcap );
+
+            return_if( analyse_add_item( &job, &item_size, argv[ i ], analyse_file_edgecap, 0, 0 ) != EOK, ENOMEM );
+        }
+        else
+        {
+            fprintf( stderr, "%s: neither an action trace nor an edge capture\n", argv[ i ] );
+        }
+    }
+
+    pworkers = calloc( thread_count, sizeof( analyse_worker_t ) );
+    ptotal = malloc( sizeof( analyse_result_t ) );
+    return_if( ( pworkers == NULL ) || ( ptotal == NULL ), ENOMEM );
+
+    uint64_t start_nsec = get_monotonic_nsec();
+
+    for ( i = 0; i < thread_count; i++ )
+    {
+        pworkers[ i ].pjob = &job;
+        analyse_result_init( &pworkers[ i ].result );
+        pthread_create( &pworkers[ i ].tid, NULL, analyse_worker_entry, &pworkers[ i ] );
+    }
+
+    analyse_result_init( ptotal );
+    for ( i = 0; i < thread_count; i++ )
+    {
+        pthread_join( pworkers[ i ].tid, NULL );
+        analyse_result_merge( ptotal, &pworkers[ i ].result );
+    }
+
+    double wall_sec = (double)( get_monotonic_nsec() - start_nsec ) / 1e9;
+
+    analyse_report( ptotal );
+    printf( "threads=%d items=%d bytes=%llu wall=%.3fs rate=%.2fGB/s\n",
+        thread_count,
+        job.item_count,
+        (unsigned long long)ptotal->bytes,
+        wall_sec,
+        ( wall_sec > 0.0 ) ? (double)ptotal->bytes / wall_sec / 1e9 : 0.0 );
+
+    free( ptotal );
+    free( pworkers );
+    free( job.pitems );
+
+    return EOK;
+}
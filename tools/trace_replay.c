@@ -0,0 +1,175 @@
+/*
+ * Trace replay
+ *
+ * Streams an action trace recorded with `uselessbox -t <file>` through the
+ * transition table this tool is linked against and reports the resulting
+ * state sequence and every divergence from what the box recorded. To try a
+ * modified table, pass its compiled definition with -b (see
+ * tools/behaviour_compile.c) or build against the modified statemachine.c.
+ *
+ * By default the replay follows its own states, so the first divergence
+ * carries forward like it would on a box running the new table. With -r the
+ * replay resyncs to the recorded state after each action and so counts every
+ * individual disagreement instead.
+ *
+ * build (from repo root):
+ *   gcc -std=gnu99 -O2 -Isrc tools/trace_replay.c src/trace.c src/statemachine.c src/behaviour_def.c \
+ *       src/behaviour.c src/shadow.c src/clocksrc.c src/util.c -o trace_replay -lpthread -lrt
+ *
+ * usage: trace_replay [-v] [-r] [-m max_reported] [-b behaviourfile] tracefile
+ */
+#include "statemachine.h"
+#include "behaviour_def.h"
+#include "trace.h"
+#include "util.h"
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+typedef struct
+{
+    uint64_t        actions;
+    uint64_t        transitions;
+    uint64_t        divergences;
+    uint64_t        first_nsec;
+    uint64_t        last_nsec;
+} replay_stats_t;
+
+static void replay_print_event( const char* tag, uint64_t offset_nsec, const trace_event_t* pevent, statemachine_states_t from_state, statemachine_states_t to_state )
+{
+    printf( "%-9s +%12.6fs %-8s %-22s %s -> %s",
+        tag,
+        (double)offset_nsec / 1e9,
+        trace_get_sourcename( pevent->source ),
+        statemachine_get_actionname( pevent->action ),
+        statemachine_get_statename( from_state ),
+        statemachine_get_statename( to_state ) );
+}
+
+int main( int argc, char** argv )
+{
+    trace_reader_t* ptrace;
+    behaviour_def_t* pdef = NULL;
+    trace_event_t event;
+    replay_stats_t stats;
+    statemachine_states_t state = ss_END;
+    bool verbose = false;
+    bool resync = false;
+    long max_reported = 20;
+    int opt;
+    int ret;
+
+    while ( ( opt = getopt( argc, argv, "vrm:b:" ) ) != -1 )
+    {
+        switch ( opt )
+        {
+            case 'v': verbose = true; break;
+            case 'r': resync = true; break;
+            case 'm': max_reported = atol( optarg ); break;
+            case 'b':
+                ret = behaviour_def_load( &pdef, optarg );
+                if ( ret != EOK )
+                {
+                    fprintf( stderr, "cannot load behaviour %s: %s\n", optarg, strerror( ret ) );
+                    return ret;
+                }
+                break;
+            default:
+                fprintf( stderr, "usage: %s [-v] [-r] [-m max_reported] [-b behaviourfile] tracefile\n", argv[ 0 ] );
+                return EINVAL;
+        }
+    }
+
+    if ( optind >= argc )
+    {
+        fprintf( stderr, "usage: %s [-v] [-r] [-m max_reported] [-b behaviourfile] tracefile\n", argv[ 0 ] );
+        return EINVAL;
+    }
+
+    ret = trace_reader_open( &ptrace, argv[ optind ] );
+    if ( ret != EOK )
+    {
+        fprintf( stderr, "cannot open trace %s: %s\n", argv[ optind ], strerror( ret ) );
+        return ret;
+    }
+
+    memset( &stats, 0, sizeof( stats ) );
+
+    uint64_t wall_start_nsec = get_monotonic_nsec();
+
+    while ( ( ret = trace_reader_next( ptrace, &event ) ) == EOK )
+    {
+        statemachine_states_t next_state;
+
+        if ( stats.actions == 0 )
+        {
+            //the recording may start mid-run; pick up where the box was
+            state = event.from_state;
+            stats.first_nsec = event.ts_nsec;
+        }
+
+        if ( resync )
+        {
+            state = event.from_state;
+        }
+
+        if ( pdef != NULL )
+        {
+            behaviour_def_transition( pdef, state, event.action, &next_state );
+        }
+        else
+        {
+            statemachine_transition( state, event.action, &next_state );
+        }
+
+        uint64_t offset_nsec = event.ts_nsec - stats.first_nsec;
+        bool diverged = ( state != event.from_state ) || ( next_state != event.to_state );
+
+        if ( diverged )
+        {
+            stats.divergences++;
+            if ( ( max_reported < 0 ) || ( stats.divergences <= (uint64_t)max_reported ) )
+            {
+                replay_print_event( "diverged", offset_nsec, &event, state, next_state );
+                printf( "  (recorded %s -> %s)\n", statemachine_get_statename( event.from_state ), statemachine_get_statename( event.to_state ) );
+            }
+        }
+        else if ( verbose && ( next_state != state ) )
+        {
+            replay_print_event( "state", offset_nsec, &event, state, next_state );
+            printf( "\n" );
+        }
+
+        stats.transitions += ( next_state != state );
+        stats.actions++;
+        stats.last_nsec = event.ts_nsec;
+        state = next_state;
+    }
+
+    double wall_sec = (double)( get_monotonic_nsec() - wall_start_nsec ) / 1e9;
+
+    if ( ret == EILSEQ )
+    {
+        fprintf( stderr, "damaged record after %llu actions\n", (unsigned long long)stats.actions );
+    }
+
+    printf( "records=%llu actions=%llu transitions=%llu divergences=%llu final=%s\n",
+        (unsigned long long)trace_reader_record_count( ptrace ),
+        (unsigned long long)stats.actions,
+        (unsigned long long)stats.transitions,
+        (unsigned long long)stats.divergences,
+        ( stats.actions > 0 ) ? statemachine_get_statename( state ) : "none" );
+    printf( "span=%.3fs replay=%.3fs rate=%.0f actions/s\n",
+        (double)( stats.last_nsec - stats.first_nsec ) / 1e9,
+        wall_sec,
+        ( wall_sec > 0.0 ) ? (double)stats.actions / wall_sec : 0.0 );
+
+    trace_reader_close( ptrace );
+    behaviour_def_unload( pdef );
+
+    return ( ret == EILSEQ ) ? EILSEQ : ( stats.divergences > 0 ) ? EXIT_FAILURE : EOK;
+}